@@ -0,0 +1,281 @@
+// 用户信息的多级读缓存：进程内LRU -> Redis -> Mysql
+//  1. 只缓存对外展示的用户信息(不含密码)，需要修改用户信息时必须直接从数据库读取
+//  2. 用户信息修改后调用invalidate删除两级缓存；其他实例的本地缓存依靠较短的过期时间收敛
+//  3. 缓存未命中时通过singleflight合并同一时刻的相同回源请求，防止缓存击穿
+//  4. 回源读主库：其他实例修改后从库可能还是旧数据，回填到Redis会在整个过期时间内生效
+//  5. 每个用户在Redis中有一个版本号 user_info_ver:<用户ID>，invalidate时先递增版本号再删除缓存；
+//     回源前记录版本号，回填时在lua脚本中比较，版本号变化说明回源期间数据被修改过，放弃回填，
+//     避免在invalidate之前开始的数据库读取把旧数据写回缓存
+#pragma once
+#include <sw/redis++/redis++.h>
+#include <atomic>
+#include <iterator>
+#include <unordered_set>
+#include "lru_cache.hpp"
+#include "singleflight.hpp"
+#include "mysql_user.hpp"
+#include "logger.hpp"
+
+namespace lbk
+{
+    class UserCache
+    {
+    public:
+        using ptr = std::shared_ptr<UserCache>;
+        UserCache(const UserTable::ptr &user_table,
+                  const std::shared_ptr<sw::redis::Redis> &redis_client,
+                  size_t local_capacity = 10000,
+                  const std::chrono::milliseconds &local_ttl = std::chrono::milliseconds(5000),
+                  const std::chrono::seconds &redis_ttl = std::chrono::seconds(3600))
+            : _user_table(user_table), _redis_client(redis_client),
+              _local(local_capacity, local_ttl), _redis_ttl(redis_ttl)
+        {
+        }
+        std::shared_ptr<User> select_by_id(const std::string &uid)
+        {
+            User user;
+            // 1. 进程内缓存
+            if (_local.get(uid, user))
+                return std::make_shared<User>(user);
+            // 2. Redis缓存
+            try
+            {
+                auto val = _redis_client->get(_key(uid));
+                if (val && _decode(*val, user))
+                {
+                    _local.put(uid, user);
+                    return std::make_shared<User>(user);
+                }
+            }
+            catch (const std::exception &e)
+            {
+                LOG_WARN("从Redis获取用户缓存失败 {}:{}", uid, e.what());
+            }
+            // 3. 回源数据库，相同用户的并发回源只执行一次
+            auto res = _single_flight.run(uid, [this, &uid]()
+                                          { return _load({uid}); });
+            if (res.empty())
+                return std::shared_ptr<User>();
+            return std::make_shared<User>(res[0]);
+        }
+        // 返回的用户信息不重复，id_list中重复的用户ID只查询一次
+        std::vector<User> select_multi_users(const std::vector<std::string> &id_list)
+        {
+            std::vector<User> res;
+            // 1. 进程内缓存
+            std::vector<std::string> miss;
+            std::unordered_set<std::string> seen;
+            for (auto &uid : id_list)
+            {
+                if (seen.insert(uid).second == false)
+                    continue;
+                User user;
+                if (_local.get(uid, user))
+                    res.push_back(user);
+                else
+                    miss.push_back(uid);
+            }
+            if (miss.empty())
+                return res;
+            // 2. Redis缓存，一次MGET取回所有未命中的用户
+            std::vector<std::string> db_miss;
+            try
+            {
+                std::vector<std::string> keys;
+                for (auto &uid : miss)
+                    keys.push_back(_key(uid));
+                std::vector<sw::redis::OptionalString> vals;
+                _redis_client->mget(keys.begin(), keys.end(), std::back_inserter(vals));
+                for (size_t i = 0; i < miss.size(); i++)
+                {
+                    User user;
+                    if (i < vals.size() && vals[i] && _decode(*vals[i], user))
+                    {
+                        _local.put(miss[i], user);
+                        res.push_back(user);
+                    }
+                    else
+                        db_miss.push_back(miss[i]);
+                }
+            }
+            catch (const std::exception &e)
+            {
+                LOG_WARN("从Redis批量获取用户缓存失败:{}", e.what());
+                db_miss = miss;
+            }
+            if (db_miss.empty())
+                return res;
+            // 3. 回源数据库，以排序后的用户ID集合作为合并请求的key
+            auto users = _single_flight.run(flight_key(db_miss), [this, &db_miss]()
+                                            { return _load(db_miss); });
+            res.insert(res.end(), users.begin(), users.end());
+            return res;
+        }
+        // 用户信息发生变化后调用，必须在数据库修改完成之后调用：递增版本号并删除缓存
+        void invalidate(const std::string &uid)
+        {
+            _epoch.fetch_add(1);
+            _local.remove(uid);
+            try
+            {
+                auto pipe = _redis_client->pipeline(false);
+                pipe.incr(_ver_key(uid));
+                pipe.expire(_ver_key(uid), _redis_ttl);
+                pipe.del(_key(uid));
+                pipe.exec();
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("删除Redis用户缓存失败 {}:{}", uid, e.what());
+            }
+        }
+
+    private:
+        // 回源数据库并回填两级缓存：查询前记录版本号，回填时版本号未变化才写入
+        std::vector<User> _load(const std::vector<std::string> &uids)
+        {
+            uint64_t epoch = _epoch.load();
+            std::unordered_map<std::string, std::string> vers;
+            bool versioned = true;
+            try
+            {
+                std::vector<std::string> keys;
+                for (auto &uid : uids)
+                    keys.push_back(_ver_key(uid));
+                std::vector<sw::redis::OptionalString> vals;
+                _redis_client->mget(keys.begin(), keys.end(), std::back_inserter(vals));
+                for (size_t i = 0; i < uids.size(); i++)
+                    vers[uids[i]] = (i < vals.size() && vals[i]) ? *vals[i] : "";
+            }
+            catch (const std::exception &e)
+            {
+                LOG_WARN("获取用户缓存版本号失败，本次不回填Redis:{}", e.what());
+                versioned = false;
+            }
+            std::vector<User> users;
+            for (auto &user : _user_table->select_multi_users(uids, true))
+                users.push_back(_strip(user));
+            if (users.empty())
+                return users;
+            // Redis中的回填结果，不可用时只按进程内的失效计数判断是否回填本地缓存
+            std::vector<long long> filled(users.size(), 1);
+            if (versioned)
+                filled = _fill(users, vers);
+            for (size_t i = 0; i < users.size(); i++)
+            {
+                if (filled[i] == 1 && _epoch.load() == epoch)
+                    _local.put(users[i].user_id(), users[i]);
+            }
+            return users;
+        }
+        // 在一个lua脚本中逐个比较版本号并回填Redis，返回每个用户是否回填成功
+        std::vector<long long> _fill(const std::vector<User> &users,
+                                     std::unordered_map<std::string, std::string> &vers)
+        {
+            static const std::string script = R"(
+                local res = {}
+                for i = 1, #KEYS, 2 do
+                    local ver = redis.call('GET', KEYS[i + 1]) or ''
+                    if ver == ARGV[i + 1] then
+                        redis.call('SET', KEYS[i], ARGV[i + 2], 'EX', tonumber(ARGV[1]))
+                        res[#res + 1] = 1
+                    else
+                        res[#res + 1] = 0
+                    end
+                end
+                return res)";
+            std::vector<std::string> keys;
+            std::vector<std::string> args = {std::to_string(_redis_ttl.count())};
+            for (auto &user : users)
+            {
+                keys.push_back(_key(user.user_id()));
+                keys.push_back(_ver_key(user.user_id()));
+                args.push_back(vers[user.user_id()]);
+                args.push_back(_encode(user));
+            }
+            std::vector<long long> res;
+            try
+            {
+                _redis_client->eval(script, keys.begin(), keys.end(), args.begin(), args.end(), std::back_inserter(res));
+            }
+            catch (const std::exception &e)
+            {
+                LOG_WARN("回填Redis用户缓存失败:{}", e.what());
+                res.clear();
+            }
+            if (res.size() != users.size())
+                res.assign(users.size(), 0);
+            return res;
+        }
+        std::string _key(const std::string &uid)
+        {
+            return "user_info:" + uid;
+        }
+        std::string _ver_key(const std::string &uid)
+        {
+            return "user_info_ver:" + uid;
+        }
+        // 缓存中的用户信息不保留密码
+        User _strip(const User &user)
+        {
+            User ret;
+            ret.user_id(user.user_id());
+            ret.nickname(user.nickname());
+            ret.description(user.description());
+            ret.phone(user.phone());
+            ret.avatar_id(user.avatar_id());
+            return ret;
+        }
+        // 编码格式：每个字段为 "长度:内容"，依次为 用户ID/昵称/签名/手机号/头像ID
+        std::string _encode(const User &user)
+        {
+            std::string ret;
+            for (const std::string &field : {user.user_id(), user.nickname(), user.description(),
+                                             user.phone(), user.avatar_id()})
+            {
+                ret += std::to_string(field.size());
+                ret += ':';
+                ret += field;
+            }
+            return ret;
+        }
+        bool _decode(const std::string &str, User &user)
+        {
+            std::string fields[5];
+            size_t pos = 0;
+            for (int i = 0; i < 5; i++)
+            {
+                size_t sep = str.find(':', pos);
+                if (sep == std::string::npos)
+                    return false;
+                size_t len = 0;
+                try
+                {
+                    len = std::stoul(str.substr(pos, sep - pos));
+                }
+                catch (const std::exception &e)
+                {
+                    return false;
+                }
+                if (sep + 1 + len > str.size())
+                    return false;
+                fields[i] = str.substr(sep + 1, len);
+                pos = sep + 1 + len;
+            }
+            user.user_id(fields[0]);
+            user.nickname(fields[1]);
+            user.description(fields[2]);
+            user.phone(fields[3]);
+            user.avatar_id(fields[4]);
+            return true;
+        }
+
+    private:
+        UserTable::ptr _user_table;
+        std::shared_ptr<sw::redis::Redis> _redis_client;
+        LRUCache<std::string, User> _local;
+        std::chrono::seconds _redis_ttl;
+        std::atomic<uint64_t> _epoch{0}; // 本进程内invalidate的次数，回源期间发生变化则不回填本地缓存
+        SingleFlight<std::vector<User>> _single_flight;
+    };
+}
@@ -2,32 +2,34 @@
 #include "icsearch.hpp"
 #include "user.hxx"
 #include "message.hxx"
+#include "message_search.hpp"
 
 namespace lbk
 {
     class ESClientFactory
     {
     public:
-        static std::shared_ptr<elasticlient::Client> create(const std::vector<std::string> &host_list)
+        // 初始化失败时返回空指针，由各服务的建造者统一检查
+        static ESClient::ptr create(const std::vector<std::string> &host_list, int timeout_ms = 5000, int max_retry = 2)
         {
-            return std::make_shared<elasticlient::Client>(host_list);
+            auto client = std::make_shared<ESClient>(host_list, timeout_ms, max_retry);
+            if (client->init() == false)
+                return ESClient::ptr();
+            return client;
         }
     };
     class ESUser
     {
     public:
         using ptr = std::shared_ptr<ESUser>;
-        ESUser(const std::shared_ptr<elasticlient::Client> &es_client)
-            : _es_client(es_client) {}
+        // bulk不为空时用户数据经批量写入器异步写入，否则每次同步发送一个index请求
+        //  settings只在索引不存在、需要新建时使用
+        ESUser(const ESClient::ptr &es_client, const ESBulkWriter::ptr &bulk = ESBulkWriter::ptr(),
+               const ESIndexSettings &settings = ESIndexSettings())
+            : _es_client(es_client), _bulk(bulk), _settings(settings) {}
         bool createIndex()
         {
-            bool ret = ESIndex(_es_client, "user")
-                           .append("user_id", "keyword", "standard", true)
-                           .append("nickname")
-                           .append("phone", "keyword", "standard", true)
-                           .append("description", "text", "standard", false)
-                           .append("avatar_id", "keyword", "standard", false)
-                           .create();
+            bool ret = _index().create();
             if (ret == false)
             {
                 LOG_INFO("用户信息索引创建失败!");
@@ -36,16 +38,39 @@ namespace lbk
             LOG_INFO("用户信息索引创建成功!");
             return true;
         }
+        // 按当前映射重建索引，数据复制完成后切换别名
+        bool reindex()
+        {
+            return _index().reindex();
+        }
+        // version为数据库中用户行的版本号，作为ES文档的外部版本号，旧版本的写入不会覆盖新版本
         bool appendData(const std::string &uid, const std::string &phone, const std::string &nickname,
-                        const std::string &description, const std::string &avatar_id)
+                        const std::string &description, const std::string &avatar_id, int64_t version)
         {
+            if (_bulk)
+            {
+                JsonWriter doc;
+                doc.begin_object()
+                    .key("user_id").value(uid)
+                    .key("phone").value(phone)
+                    .key("nickname").value(nickname)
+                    .key("description").value(description)
+                    .key("avatar_id").value(avatar_id)
+                    .end_object();
+                if (_bulk->append("user", uid, doc.str(), version) == false)
+                {
+                    LOG_ERROR("用户数据加入批量写入队列失败!");
+                    return false;
+                }
+                return true;
+            }
             bool ret = ESInsert(_es_client, "user")
                            .append("user_id", uid)
                            .append("phone", phone)
                            .append("nickname", nickname)
                            .append("description", description)
                            .append("avatar_id", avatar_id)
-                           .insert(uid);
+                           .insert(uid, version);
             if (ret == false)
             {
                 LOG_ERROR("用户数据插入/更新失败!");
@@ -57,50 +82,78 @@ namespace lbk
         std::vector<User> search(const std::string &key, const std::vector<std::string> &uid_list)
         {
             std::vector<User> ret;
-            auto json_message = ESSearch(_es_client, "user")
-                                    .append_should_match("user_id.keyword", key)
-                                    .append_should_match("phone.keyword", key)
-                                    .append_should_match("nickname", key)
-                                    .append_must_not_terms("user_id.keyword", uid_list)
-                                    .search();
-            if (json_message.isArray() == false)
+            bool ok = ESSearch(_es_client, "user")
+                          .append_should_match("user_id.keyword", key)
+                          .append_should_match("phone.keyword", key)
+                          .append_should_match("nickname", key)
+                          .append_must_not_terms("user_id.keyword", uid_list)
+                          .search({"user_id", "phone", "nickname", "avatar_id", "description"},
+                                  [&ret](std::vector<std::string> &values)
+                                  {
+                                      User user;
+                                      user.user_id(values[0]);
+                                      user.phone(values[1]);
+                                      user.nickname(values[2]);
+                                      user.avatar_id(values[3]);
+                                      user.description(values[4]);
+                                      ret.push_back(user);
+                                  });
+            if (ok == false)
             {
-                LOG_DEBUG("检索结果不是数组类型！");
+                LOG_DEBUG("用户检索失败！");
                 return std::vector<User>();
             }
-            LOG_DEBUG("检索结果的条目数量为{}", json_message.size());
-            for (int i = 0; i < json_message.size(); i++)
-            {
-                User user;
-                user.user_id(json_message[i]["_source"]["user_id"].asString());
-                user.phone(json_message[i]["_source"]["phone"].asString());
-                user.nickname(json_message[i]["_source"]["nickname"].asString());
-                user.avatar_id(json_message[i]["_source"]["avatar_id"].asString());
-                user.description(json_message[i]["_source"]["description"].asString());
-                ret.push_back(user);
-            }
+            LOG_DEBUG("检索结果的条目数量为{}", ret.size());
             return ret;
         }
+        // 按用户ID顺序分页遍历所有用户，after为上一页最后一个用户ID(第一页为空)，用于构建本地检索索引
+        bool scan(const std::string &after, int size, std::vector<User> &users)
+        {
+            ESSearch search(_es_client, "user");
+            search.size(size).append_sort("user_id.keyword", "asc").source({"user_id", "phone", "nickname"});
+            if (!after.empty())
+                search.append_search_after(after);
+            return search.search({"user_id", "phone", "nickname"},
+                                 [&users](std::vector<std::string> &values)
+                                 {
+                                     User user;
+                                     user.user_id(values[0]);
+                                     user.phone(values[1]);
+                                     user.nickname(values[2]);
+                                     users.push_back(user);
+                                 });
+        }
 
     private:
-        std::shared_ptr<elasticlient::Client> _es_client;
+        ESIndex _index()
+        {
+            ESIndex index(_es_client, "user", "_doc", _settings);
+            index.append("user_id", "keyword", "standard", true)
+                .append("nickname")
+                .append("phone", "keyword", "standard", true)
+                .append("description", "text", "standard", false)
+                .append("avatar_id", "keyword", "standard", false);
+            return index;
+        }
+
+    private:
+        ESClient::ptr _es_client;
+        ESBulkWriter::ptr _bulk;
+        ESIndexSettings _settings;
     };
 
-    class ESMessage
+    class ESMessage : public MessageSearcher
     {
     public:
         using ptr = std::shared_ptr<ESMessage>;
-        ESMessage(const std::shared_ptr<elasticlient::Client> &es_client)
-            : _es_client(es_client) {}
-        bool createIndex()
+        // bulk不为空时消息数据经批量写入器异步写入，否则每次同步发送一个index请求
+        //  settings只在索引不存在、需要新建时使用
+        ESMessage(const ESClient::ptr &es_client, const ESBulkWriter::ptr &bulk = ESBulkWriter::ptr(),
+                  const ESIndexSettings &settings = ESIndexSettings())
+            : _es_client(es_client), _bulk(bulk), _settings(settings) {}
+        bool createIndex() override
         {
-            bool ret = ESIndex(_es_client, "message")
-                           .append("user_id", "keyword", "standard", false)
-                           .append("message_id", "keyword", "standard", false)
-                           .append("chat_session_id", "keyword", "standard", true)
-                           .append("create_time", "long", "standard", false)
-                           .append("content")
-                           .create();
+            bool ret = _index().create();
             if (ret == false)
             {
                 LOG_INFO("消息信息索引创建失败!");
@@ -109,16 +162,40 @@ namespace lbk
             LOG_INFO("消息信息索引创建成功!");
             return true;
         }
+        // 按当前映射重建索引，数据复制完成后切换别名
+        bool reindex()
+        {
+            return _index().reindex();
+        }
+        // 消息写入后不再修改，以消息的创建时间作为外部版本号，重复写入同一条消息时返回409被忽略
         bool appendData(const std::string &user_id, const std::string &message_id, const std::string &chat_session_id,
-                        const long create_time, const std::string &content)
+                        const long create_time, const std::string &content) override
         {
+            int64_t version = (int64_t)create_time * 1000000;
+            if (_bulk)
+            {
+                JsonWriter doc;
+                doc.begin_object()
+                    .key("user_id").value(user_id)
+                    .key("message_id").value(message_id)
+                    .key("chat_session_id").value(chat_session_id)
+                    .key("create_time").value((int64_t)create_time)
+                    .key("content").value(content)
+                    .end_object();
+                if (_bulk->append("message", message_id, doc.str(), version) == false)
+                {
+                    LOG_ERROR("消息数据加入批量写入队列失败!");
+                    return false;
+                }
+                return true;
+            }
             bool ret = ESInsert(_es_client, "message")
                            .append("user_id", user_id)
                            .append("message_id", message_id)
                            .append("chat_session_id", chat_session_id)
                            .append("create_time", create_time)
                            .append("content", content)
-                           .insert(message_id);
+                           .insert(message_id, version);
             if (ret == false)
             {
                 LOG_ERROR("消息数据插入/更新失败!");
@@ -128,36 +205,75 @@ namespace lbk
             return true;
         }
         std::vector<Message> search(const std::string &key, const std::string &ssid)
+        {
+            bool has_more;
+            return search(key, ssid, MessageSearchPage(), has_more);
+        }
+        // 分页检索：结果按(create_time, message_id)倒序，page中给出上一页最后一条的时间与ID时从其之后继续；
+        //  has_more表示之后是否还有结果
+        std::vector<Message> search(const std::string &key, const std::string &ssid,
+                                    const MessageSearchPage &page, bool &has_more) override
         {
             std::vector<Message> ret;
-            auto json_message = ESSearch(_es_client, "message")
-                                    .append_must_match("content", key)
-                                    .append_must_term("chat_session_id.keyword", ssid)
-                                    .search();
-            if (json_message.isArray() == false)
+            has_more = false;
+            ESSearch search(_es_client, "message");
+            search.append_must_match("content", key)
+                .append_must_term("chat_session_id.keyword", ssid)
+                .size(page.size + 1) // 多取一条用于判断是否还有下一页
+                .append_sort("create_time", "desc")
+                .append_sort("message_id.keyword", "desc", "keyword");
+            if (!page.after_id.empty())
+                search.append_search_after((int64_t)page.after_time).append_search_after(page.after_id);
+            // 高亮时不需要返回完整的消息正文
+            std::vector<std::string> fields = {"user_id", "message_id", "create_time", "chat_session_id"};
+            if (page.highlight)
             {
-                LOG_DEBUG("检索结果不是数组类型！");
-                return std::vector<Message>();
+                search.source(fields).highlight("content", page.fragment_size, page.fragments, page.pre_tag, page.post_tag);
+                fields.push_back("highlight.content");
             }
-            LOG_DEBUG("检索结果的条目数量为{}", json_message.size());
-            for (int i = 0; i < json_message.size(); i++)
+            else
             {
+                fields.push_back("content");
+                search.source(fields);
+            }
+            bool ok = search.search(fields, [&ret](std::vector<std::string> &values)
+                                    {
                 Message message;
-                message.user_id(json_message[i]["_source"]["user_id"].asString());
-                message.message_id(json_message[i]["_source"]["message_id"].asString());
-
-                boost::posix_time::ptime ctime(boost::posix_time::
-                                                   from_time_t(json_message[i]["_source"]["create_time"].asInt64()));
-                message.create_time(ctime);
-
-                message.session_id(json_message[i]["_source"]["chat_session_id"].asString());
-                message.content(json_message[i]["_source"]["content"].asString());
-                ret.push_back(message);
+                message.user_id(values[0]);
+                message.message_id(values[1]);
+                message.create_time(boost::posix_time::from_time_t(atol(values[2].c_str())));
+                message.session_id(values[3]);
+                message.content(values[4]);
+                ret.push_back(message); });
+            if (ok == false)
+            {
+                LOG_DEBUG("消息检索失败！");
+                return std::vector<Message>();
+            }
+            if (ret.size() > (size_t)page.size)
+            {
+                has_more = true;
+                ret.resize(page.size);
             }
+            LOG_DEBUG("检索结果的条目数量为{}", ret.size());
             return ret;
         }
 
     private:
-        std::shared_ptr<elasticlient::Client> _es_client;
+        ESIndex _index()
+        {
+            ESIndex index(_es_client, "message", "_doc", _settings);
+            index.append("user_id", "keyword", "standard", false)
+                .append("message_id", "keyword", "standard", false)
+                .append("chat_session_id", "keyword", "standard", true)
+                .append("create_time", "long", "standard", false)
+                .append("content");
+            return index;
+        }
+
+    private:
+        ESClient::ptr _es_client;
+        ESBulkWriter::ptr _bulk;
+        ESIndexSettings _settings;
     };
 }
\ No newline at end of file
@@ -1,23 +1,33 @@
 #pragma once
 #include <sw/redis++/redis++.h>
 #include <iostream>
+#include <vector>
+#include <unordered_map>
 
 namespace lbk
 {
     class RedisClientFactory
     {
     public:
+        // pool_size: 连接池大小，多个bthread并发访问redis时避免争抢同一条连接
         static std::shared_ptr<sw::redis::Redis> create(
-            const std::string &host, int port, int db, bool keep_alive)
+            const std::string &host, int port, int db, bool keep_alive, size_t pool_size = 1)
         {
             sw::redis::ConnectionOptions op;
             op.host = host;
             op.port = port;
             op.db = db;
             op.keep_alive = keep_alive;
-            return std::make_shared<sw::redis::Redis>(op);
+            sw::redis::ConnectionPoolOptions pop;
+            pop.size = pool_size == 0 ? 1 : pool_size;
+            return std::make_shared<sw::redis::Redis>(op, pop);
         }
     };
+    // 用户在线状态键，由网关写入，登录时据此判断用户是否已经在线
+    inline std::string presence_key(const std::string &uid)
+    {
+        return "presence:" + uid;
+    }
     class Session
     {
     public:
@@ -28,14 +38,61 @@ namespace lbk
         {
             _redis_client->set(ssid, uid);
         }
+        // 原子地创建登录会话：用户没有在任何网关上保持长连接(不存在在线状态)时写入会话信息
+        // 检查与写入在一个lua脚本中完成，只需一次往返，也避免了并发登录的竞态；
+        // 登录后没有建立长连接的会话不会阻止再次登录，到期后自动失效
+        // ttl为0表示不过期；返回false表示用户已经在线
+        bool create(const std::string &ssid, const std::string &uid,
+                    const std::chrono::seconds &ttl = std::chrono::seconds(0))
+        {
+            static const std::string script = R"(
+                if redis.call('EXISTS', KEYS[1]) == 1 then return 0 end
+                local ttl = tonumber(ARGV[2])
+                if ttl > 0 then
+                    redis.call('SET', KEYS[2], ARGV[1], 'EX', ttl)
+                else
+                    redis.call('SET', KEYS[2], ARGV[1])
+                end
+                return 1)";
+            std::vector<std::string> keys = {presence_key(uid), ssid};
+            std::vector<std::string> args = {uid, std::to_string(ttl.count())};
+            auto ret = _redis_client->eval<long long>(script, keys.begin(), keys.end(), args.begin(), args.end());
+            return ret == 1;
+        }
         void remove(const std::string &ssid)
         {
             _redis_client->del(ssid);
         }
+        // 批量续期会话的过期时间，由网关按心跳周期对仍保持长连接的会话调用，一次管道往返完成
+        void refresh(const std::vector<std::string> &ssids, const std::chrono::seconds &ttl)
+        {
+            if (ssids.empty() || ttl.count() <= 0)
+                return;
+            auto pipe = _redis_client->pipeline(false);
+            for (auto &ssid : ssids)
+                pipe.expire(ssid, ttl);
+            pipe.exec();
+        }
         sw::redis::OptionalString uid(const std::string &ssid)
         {
             return _redis_client->get(ssid);
         }
+        // 批量获取会话对应的用户ID，一次MGET完成；不存在的会话不会出现在结果中
+        std::unordered_map<std::string, std::string> uids(const std::vector<std::string> &ssids)
+        {
+            std::unordered_map<std::string, std::string> res;
+            if (ssids.empty())
+                return res;
+            std::vector<sw::redis::OptionalString> vals;
+            vals.reserve(ssids.size());
+            _redis_client->mget(ssids.begin(), ssids.end(), std::back_inserter(vals));
+            for (size_t i = 0; i < ssids.size() && i < vals.size(); ++i)
+            {
+                if (vals[i])
+                    res[ssids[i]] = *vals[i];
+            }
+            return res;
+        }
 
     private:
         std::shared_ptr<sw::redis::Redis> _redis_client;
@@ -61,9 +118,173 @@ namespace lbk
                 return true;
             return false;
         }
+        // 批量判断用户是否在线，一次MGET完成，返回结果与uids一一对应
+        std::vector<bool> exists_many(const std::vector<std::string> &uids)
+        {
+            std::vector<bool> res(uids.size(), false);
+            if (uids.empty())
+                return res;
+            std::vector<sw::redis::OptionalString> vals;
+            vals.reserve(uids.size());
+            _redis_client->mget(uids.begin(), uids.end(), std::back_inserter(vals));
+            for (size_t i = 0; i < uids.size() && i < vals.size(); ++i)
+            {
+                res[i] = static_cast<bool>(vals[i]);
+            }
+            return res;
+        }
+        // 批量删除登录标记，通过pipeline一次性发送
+        void remove_many(const std::vector<std::string> &uids)
+        {
+            if (uids.empty())
+                return;
+            auto pipe = _redis_client->pipeline(false);
+            for (auto &uid : uids)
+            {
+                pipe.del(uid);
+            }
+            pipe.exec();
+        }
+
+    private:
+        std::shared_ptr<sw::redis::Redis> _redis_client;
+    };
+
+    /////////////////////////////////////////////////////////////////在线状态
+    // 用户在线状态：
+    //   presence:<uid> -> 网关节点，带过期时间，由网关心跳续期；网关异常退出时状态会自动过期
+    //   Session::create据此拒绝在线期间的重复登录；在线状态与登录会话各自独立，下线不会删除会话
+    //   online_index:<n> 分片有序集合，member为uid、score为最近一次心跳的毫秒时间戳，
+    //   用于枚举在线用户以及清理过期成员，分片避免单个大key
+    class Presence
+    {
+    public:
+        using ptr = std::shared_ptr<Presence>;
+        Presence(const std::shared_ptr<sw::redis::Redis> &redis_client,
+                 const std::chrono::seconds &ttl = std::chrono::seconds(60),
+                 size_t shard_count = 16)
+            : _redis_client(redis_client), _ttl(ttl),
+              _shard_count(shard_count == 0 ? 1 : shard_count) {}
+        // 用户上线，node为用户长连接所在的网关节点
+        void online(const std::string &uid, const std::string &node = "")
+        {
+            auto pipe = _redis_client->pipeline(false);
+            pipe.set(presence_key(uid), node, _ttl);
+            pipe.zadd(index_key(uid), uid, now_ms());
+            pipe.exec();
+        }
+        // 批量心跳续期，网关周期性地对本节点上的所有连接调用
+        void heartbeat(const std::vector<std::string> &uids, const std::string &node = "")
+        {
+            if (uids.empty())
+                return;
+            double score = now_ms();
+            auto pipe = _redis_client->pipeline(false);
+            for (auto &uid : uids)
+            {
+                pipe.set(presence_key(uid), node, _ttl);
+                pipe.zadd(index_key(uid), uid, score);
+            }
+            pipe.exec();
+        }
+        // 用户下线：node不为空时只有在线状态仍指向该节点才删除，用户已经在其他网关重新上线时不受影响
+        void offline(const std::string &uid, const std::string &node = "")
+        {
+            static const std::string script = R"(
+                if ARGV[1] ~= '' and redis.call('GET', KEYS[1]) ~= ARGV[1] then return 0 end
+                redis.call('DEL', KEYS[1])
+                redis.call('ZREM', KEYS[2], ARGV[2])
+                return 1)";
+            std::vector<std::string> keys = {presence_key(uid), index_key(uid)};
+            std::vector<std::string> args = {node, uid};
+            _redis_client->eval<long long>(script, keys.begin(), keys.end(), args.begin(), args.end());
+        }
+        bool is_online(const std::string &uid)
+        {
+            return _redis_client->exists(presence_key(uid)) > 0;
+        }
+        // 批量查询：返回uids中在线的用户及其所在的网关节点，一次MGET完成
+        std::unordered_map<std::string, std::string> online_among(const std::vector<std::string> &uids)
+        {
+            std::unordered_map<std::string, std::string> res;
+            if (uids.empty())
+                return res;
+            std::vector<std::string> keys;
+            keys.reserve(uids.size());
+            for (auto &uid : uids)
+                keys.push_back(presence_key(uid));
+            std::vector<sw::redis::OptionalString> vals;
+            vals.reserve(uids.size());
+            _redis_client->mget(keys.begin(), keys.end(), std::back_inserter(vals));
+            for (size_t i = 0; i < uids.size() && i < vals.size(); ++i)
+            {
+                if (vals[i])
+                    res[uids[i]] = *vals[i];
+            }
+            return res;
+        }
+        // 枚举所有在线用户（最近一个ttl内有心跳）
+        std::vector<std::string> online_users()
+        {
+            std::vector<std::string> res;
+            auto min = now_ms() - std::chrono::duration_cast<std::chrono::milliseconds>(_ttl).count();
+            for (size_t i = 0; i < _shard_count; ++i)
+            {
+                _redis_client->zrangebyscore(shard_key(i), sw::redis::LeftBoundedInterval<double>(min, sw::redis::BoundType::OPEN),
+                                             std::back_inserter(res));
+            }
+            return res;
+        }
+        long long online_count()
+        {
+            long long count = 0;
+            auto min = now_ms() - std::chrono::duration_cast<std::chrono::milliseconds>(_ttl).count();
+            for (size_t i = 0; i < _shard_count; ++i)
+            {
+                count += _redis_client->zcount(shard_key(i), sw::redis::LeftBoundedInterval<double>(min, sw::redis::BoundType::OPEN));
+            }
+            return count;
+        }
+        // 清理索引中超过ttl未心跳的成员，返回清理数量；可由任意节点周期调用
+        long long sweep()
+        {
+            long long count = 0;
+            auto max = now_ms() - std::chrono::duration_cast<std::chrono::milliseconds>(_ttl).count();
+            for (size_t i = 0; i < _shard_count; ++i)
+            {
+                count += _redis_client->zremrangebyscore(shard_key(i), sw::redis::RightBoundedInterval<double>(max, sw::redis::BoundType::OPEN));
+            }
+            return count;
+        }
+        const std::chrono::seconds &ttl() const { return _ttl; }
+
+    private:
+        static double now_ms()
+        {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::system_clock::now().time_since_epoch())
+                .count();
+        }
+        std::string shard_key(size_t i) const
+        {
+            return "online_index:" + std::to_string(i);
+        }
+        std::string index_key(const std::string &uid) const
+        {
+            // 各节点需要算出相同的分片，使用FNV-1a而不是依赖实现的std::hash
+            uint64_t h = 14695981039346656037ULL;
+            for (unsigned char c : uid)
+            {
+                h ^= c;
+                h *= 1099511628211ULL;
+            }
+            return shard_key(h % _shard_count);
+        }
 
     private:
         std::shared_ptr<sw::redis::Redis> _redis_client;
+        std::chrono::seconds _ttl;
+        size_t _shard_count;
     };
 
     /////////////////////////////////////////////////////////////////验证码
@@ -0,0 +1,148 @@
+#pragma once
+#include <bthread/countdown_event.h>
+#include <bvar/bvar.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "logger.hpp"
+#include "trace.hpp"
+
+namespace lbk
+{
+    // 数据库异步执行结果：get()在bthread中调用时只挂起当前bthread，不会占住worker线程
+    //  结果类型需要可默认构造，执行过程中抛出异常时get()返回默认值(各Table接口本身也以空值表示失败)
+    template <typename T>
+    class DBFuture
+    {
+    public:
+        struct State
+        {
+            bthread::CountdownEvent event;
+            T value;
+        };
+        DBFuture() {}
+        DBFuture(const std::shared_ptr<State> &state) : _state(state) {}
+        bool valid() const { return _state != nullptr; }
+        T get()
+        {
+            _state->event.wait();
+            return std::move(_state->value);
+        }
+
+    private:
+        std::shared_ptr<State> _state;
+    };
+
+    // 数据库操作专用的线程池
+    //  libmysqlclient的调用都是阻塞的，直接在brpc处理函数中执行会占住bthread的worker线程，
+    //  慢查询期间同一worker上的其他请求都得不到调度(rpc_threads默认只有1个)；
+    //  把数据库操作投递到独立的线程中执行，处理函数可以先发起数据库查询，再去做其他Rpc调用，最后取结果。
+    //  ODB事务绑定在线程上，在固定的线程中执行也避免了bthread切换线程导致事务上下文错乱
+    //  任务队列有上限，队列满时在调用者线程中直接执行，以此形成反压而不是无限堆积
+    class DBExecutor
+    {
+    public:
+        using ptr = std::shared_ptr<DBExecutor>;
+        DBExecutor(size_t threads = 4, size_t max_pending = 1024, const std::string &name = "mysql_executor")
+            : _max_pending(max_pending), _running(true)
+        {
+            // 同一进程中有多个线程池时依次加上序号，避免监控项重名导致后创建的指标不可见
+            std::string prefix = name;
+            for (int i = 2; _queue_wait.expose(prefix + "_queue_wait") != 0; ++i)
+                prefix = name + "_" + std::to_string(i);
+            for (size_t i = 0; i < threads; ++i)
+                _threads.emplace_back(&DBExecutor::_worker, this);
+        }
+        ~DBExecutor()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _running = false;
+            }
+            _cond.notify_all();
+            for (auto &thread : _threads)
+                thread.join();
+        }
+        // 投递任意数据库操作
+        template <typename F>
+        DBFuture<std::invoke_result_t<F>> submit(F &&func)
+        {
+            using R = std::invoke_result_t<F>;
+            auto state = std::make_shared<typename DBFuture<R>::State>();
+            auto start = std::chrono::steady_clock::now();
+            // 投递者的追踪上下文带到数据库线程中，语句耗时记在发起请求的span之下
+            std::function<void()> task = [this, state, start, ctx = trace::capture(), func = std::forward<F>(func)]() mutable
+            {
+                _queue_wait << std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+                trace::ContextScope scope(ctx);
+                try
+                {
+                    state->value = func();
+                }
+                catch (const std::exception &e)
+                {
+                    LOG_ERROR("异步执行数据库操作失败：{}", e.what());
+                }
+                state->event.signal();
+            };
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (_running && _tasks.size() < _max_pending)
+                {
+                    _tasks.push_back(std::move(task));
+                    lock.unlock();
+                    _cond.notify_one();
+                    return DBFuture<R>(state);
+                }
+            }
+            LOG_WARN("数据库任务队列已满，在当前线程中同步执行！");
+            task();
+            return DBFuture<R>(state);
+        }
+        // 异步调用Table对象的接口，例如 async(member_table, &ChatSessionMemberTable::members, ssid)
+        //  参数按值保存到任务执行时；接口有重载时需要显式转换成对应的成员函数指针
+        template <typename Table, typename Method, typename... Args>
+        auto async(const std::shared_ptr<Table> &table, Method method, Args... args)
+            -> DBFuture<typename std::decay<decltype((table.get()->*method)(args...))>::type>
+        {
+            return submit([table, method, args...]() mutable
+                          { return (table.get()->*method)(args...); });
+        }
+
+    private:
+        void _worker()
+        {
+            while (true)
+            {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _cond.wait(lock, [this]()
+                               { return !_running || !_tasks.empty(); });
+                    // 退出前把已经投递的任务执行完，保证等待结果的调用者都能被唤醒
+                    if (_tasks.empty())
+                        return;
+                    task = std::move(_tasks.front());
+                    _tasks.pop_front();
+                }
+                task();
+            }
+        }
+
+    private:
+        size_t _max_pending;
+        bool _running;
+        std::mutex _mutex;
+        std::condition_variable _cond;
+        std::deque<std::function<void()>> _tasks;
+        std::vector<std::thread> _threads;
+        bvar::LatencyRecorder _queue_wait;
+    };
+}
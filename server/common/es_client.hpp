@@ -0,0 +1,214 @@
+#pragma once
+#include <brpc/channel.h>
+#include <brpc/controller.h>
+#include <bthread/countdown_event.h>
+#include <bvar/bvar.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "logger.hpp"
+#include "trace.hpp"
+
+namespace lbk
+{
+    // ES的HTTP响应，请求未能发出或没有收到响应时status_code为0，error为错误原因
+    struct ESResponse
+    {
+        int status_code = 0;
+        std::string text;
+        std::string error;
+    };
+
+    // ES异步请求结果：get()在bthread中调用时只挂起当前bthread，不会占住worker线程
+    class ESFuture
+    {
+    public:
+        struct State
+        {
+            bthread::CountdownEvent event;
+            ESResponse rsp;
+        };
+        ESFuture() {}
+        ESFuture(const std::shared_ptr<State> &state) : _state(state) {}
+        bool valid() const { return _state != nullptr; }
+        ESResponse get()
+        {
+            _state->event.wait();
+            return std::move(_state->rsp);
+        }
+
+    private:
+        std::shared_ptr<State> _state;
+    };
+
+    // 基于brpc HTTP/1.1信道的ES客户端，替代阻塞的elasticlient/cpr
+    //  1. 连接池方式(pooled)复用长连接，所有ES节点按轮询(rr)分摊请求
+    //  2. 连接失败的节点由brpc摘除并在后台做健康检查，恢复后重新加入轮询；失败的请求换节点重试max_retry次
+    //  3. 请求都是异步发出的，同步接口只是等待异步结果，在bthread中等待时不会阻塞worker线程
+    //  hosts格式与elasticlient相同，例如 http://127.0.0.1:9200/
+    class ESClient
+    {
+    public:
+        using ptr = std::shared_ptr<ESClient>;
+        enum class HTTPMethod
+        {
+            GET,
+            POST,
+            PUT,
+            DELETE,
+            HEAD
+        };
+        ESClient(const std::vector<std::string> &hosts, int timeout_ms = 5000, int max_retry = 2)
+            : _hosts(hosts), _timeout_ms(timeout_ms), _max_retry(max_retry) {}
+        bool init()
+        {
+            std::string naming = "list://";
+            bool ssl = false;
+            for (size_t i = 0; i < _hosts.size(); ++i)
+            {
+                std::string host = _hosts[i];
+                if (host.compare(0, 8, "https://") == 0)
+                {
+                    ssl = true;
+                    host = host.substr(8);
+                }
+                else if (host.compare(0, 7, "http://") == 0)
+                    host = host.substr(7);
+                host = host.substr(0, host.find('/'));
+                if (i > 0)
+                    naming += ",";
+                naming += host;
+            }
+            brpc::ChannelOptions options;
+            options.protocol = brpc::PROTOCOL_HTTP;
+            options.connection_type = "pooled";
+            options.timeout_ms = _timeout_ms;
+            options.max_retry = _max_retry;
+            if (ssl)
+                options.mutable_ssl_options();
+            if (_channel.Init(naming.c_str(), "rr", &options) != 0)
+            {
+                LOG_ERROR("初始化ES客户端信道失败：{}", naming);
+                return false;
+            }
+            _latency.expose("es_request");
+            _errors.expose("es_request_error");
+            return true;
+        }
+        // 发送任意请求，url为不带前导'/'的路径，例如 "_bulk"、"user/_doc/_search"
+        ESFuture performRequestAsync(HTTPMethod method, const std::string &url, const std::string &body)
+        {
+            auto state = std::make_shared<ESFuture::State>();
+            Call *call = new Call(this, state);
+            // 请求在回调中结束，先记下发起时所在的span，结束时作为其子span记录
+            call->ctx = trace::capture();
+            if (call->ctx.valid())
+                call->name = "es " + url.substr(0, url.find('?'));
+            brpc::Controller &cntl = call->cntl;
+            cntl.http_request().set_method(_method(method));
+            cntl.http_request().uri() = "/" + url;
+            if (!body.empty())
+            {
+                cntl.http_request().set_content_type("application/json");
+                cntl.request_attachment().append(body);
+            }
+            _channel.CallMethod(nullptr, &cntl, nullptr, nullptr, call);
+            return ESFuture(state);
+        }
+        ESResponse performRequest(HTTPMethod method, const std::string &url, const std::string &body)
+        {
+            return performRequestAsync(method, url, body).get();
+        }
+        // 与elasticlient::Client同名的便捷接口，id为空时由ES生成文档ID
+        //  version大于0时以外部版本号(external_gte)写入，已有更高版本时ES返回409
+        ESFuture indexAsync(const std::string &name, const std::string &type, const std::string &id, const std::string &body,
+                            int64_t version = 0)
+        {
+            if (id.empty())
+                return performRequestAsync(HTTPMethod::POST, name + "/" + type + "/", body);
+            std::string url = name + "/" + type + "/" + id;
+            if (version > 0)
+                url += "?version=" + std::to_string(version) + "&version_type=external_gte";
+            return performRequestAsync(HTTPMethod::PUT, url, body);
+        }
+        ESResponse index(const std::string &name, const std::string &type, const std::string &id, const std::string &body,
+                         int64_t version = 0)
+        {
+            return indexAsync(name, type, id, body, version).get();
+        }
+        ESFuture searchAsync(const std::string &name, const std::string &type, const std::string &body)
+        {
+            return performRequestAsync(HTTPMethod::POST, name + "/" + type + "/_search", body);
+        }
+        ESResponse search(const std::string &name, const std::string &type, const std::string &body)
+        {
+            return searchAsync(name, type, body).get();
+        }
+        ESFuture removeAsync(const std::string &name, const std::string &type, const std::string &id)
+        {
+            return performRequestAsync(HTTPMethod::DELETE, name + "/" + type + "/" + id, "");
+        }
+        ESResponse remove(const std::string &name, const std::string &type, const std::string &id)
+        {
+            return removeAsync(name, type, id).get();
+        }
+
+    private:
+        // 一次异步调用，brpc在收到响应或失败后回调Run
+        struct Call : public google::protobuf::Closure
+        {
+            Call(ESClient *client, const std::shared_ptr<ESFuture::State> &state)
+                : client(client), state(state), start(butil::gettimeofday_us()) {}
+            void Run() override
+            {
+                std::unique_ptr<Call> guard(this);
+                int64_t end = butil::gettimeofday_us();
+                client->_latency << end - start;
+                trace::record(ctx, name, "es", start, end, !cntl.Failed());
+                ESResponse &rsp = state->rsp;
+                // 非2xx的HTTP响应brpc也视为失败(EHTTP)，此时状态码与响应正文仍然有效
+                if (cntl.Failed() && cntl.ErrorCode() != brpc::EHTTP)
+                {
+                    client->_errors << 1;
+                    rsp.error = cntl.ErrorText();
+                }
+                else
+                {
+                    rsp.status_code = cntl.http_response().status_code();
+                    rsp.text = cntl.response_attachment().to_string();
+                }
+                state->event.signal();
+            }
+            ESClient *client;
+            std::shared_ptr<ESFuture::State> state;
+            int64_t start;
+            trace::Context ctx;
+            std::string name;
+            brpc::Controller cntl;
+        };
+        static brpc::HttpMethod _method(HTTPMethod method)
+        {
+            switch (method)
+            {
+            case HTTPMethod::GET:
+                return brpc::HTTP_METHOD_GET;
+            case HTTPMethod::PUT:
+                return brpc::HTTP_METHOD_PUT;
+            case HTTPMethod::DELETE:
+                return brpc::HTTP_METHOD_DELETE;
+            case HTTPMethod::HEAD:
+                return brpc::HTTP_METHOD_HEAD;
+            default:
+                return brpc::HTTP_METHOD_POST;
+            }
+        }
+
+    private:
+        std::vector<std::string> _hosts;
+        int _timeout_ms;
+        int _max_retry;
+        brpc::Channel _channel;
+        bvar::LatencyRecorder _latency;
+        bvar::Adder<int64_t> _errors;
+    };
+}
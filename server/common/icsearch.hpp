@@ -1,14 +1,24 @@
 #pragma once
-#include <elasticlient/client.h>
+#include "es_client.hpp"
 #include <json/json.h>
 #include <iostream>
 #include <memory>
 #include <sstream>
-#include <cpr/cpr.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 #include "logger.hpp"
 namespace lbk
 {
-    bool Serialize(const Json::Value &val, std::string &dst)
+    inline bool Serialize(const Json::Value &val, std::string &dst)
     {
         // 先定义Json::StreamWriter 工厂类 Json::StreamWriterBuilder
         Json::StreamWriterBuilder swb;
@@ -25,7 +35,7 @@ namespace lbk
         dst = ss.str();
         return true;
     }
-    bool UnSerialize(const std::string &src, Json::Value &val)
+    inline bool UnSerialize(const std::string &src, Json::Value &val)
     {
         Json::CharReaderBuilder crb;
         crb.settings_["emitUTF8"] = true;
@@ -39,104 +49,778 @@ namespace lbk
         }
         return true;
     }
+
+    // 直接拼接json文本的写入器，用于组织ES请求正文，省去构造Json::Value树再序列化的开销
+    //  输出为不带缩进的单行文本，非ASCII字符按UTF-8原样输出
+    //  用法：JsonWriter w; w.begin_object().key("size").value(10).end_object(); w.str();
+    class JsonWriter
+    {
+    public:
+        JsonWriter() : _after_key(false) {}
+        JsonWriter &begin_object()
+        {
+            _separate();
+            _buf += '{';
+            _first.push_back(true);
+            return *this;
+        }
+        JsonWriter &end_object()
+        {
+            _buf += '}';
+            _first.pop_back();
+            return *this;
+        }
+        JsonWriter &begin_array()
+        {
+            _separate();
+            _buf += '[';
+            _first.push_back(true);
+            return *this;
+        }
+        JsonWriter &end_array()
+        {
+            _buf += ']';
+            _first.pop_back();
+            return *this;
+        }
+        JsonWriter &key(const std::string &key)
+        {
+            _separate();
+            _escape(key);
+            _buf += ':';
+            _after_key = true;
+            return *this;
+        }
+        JsonWriter &value(const std::string &val)
+        {
+            _separate();
+            _escape(val);
+            return *this;
+        }
+        JsonWriter &value(const char *val) { return value(std::string(val)); }
+        JsonWriter &value(int val) { return value((int64_t)val); }
+        JsonWriter &value(int64_t val)
+        {
+            _separate();
+            _buf += std::to_string(val);
+            return *this;
+        }
+        JsonWriter &value(bool val)
+        {
+            _separate();
+            _buf += val ? "true" : "false";
+            return *this;
+        }
+        // 写入一段已经是合法json的文本
+        JsonWriter &raw(const std::string &json)
+        {
+            _separate();
+            _buf += json;
+            return *this;
+        }
+        const std::string &str() const { return _buf; }
+
+    private:
+        void _separate()
+        {
+            if (_after_key)
+            {
+                _after_key = false;
+                return;
+            }
+            if (_first.empty())
+                return;
+            if (_first.back() == false)
+                _buf += ',';
+            _first.back() = false;
+        }
+        void _escape(const std::string &val)
+        {
+            static const char *hex = "0123456789abcdef";
+            _buf += '"';
+            for (unsigned char c : val)
+            {
+                switch (c)
+                {
+                case '"':
+                    _buf += "\\\"";
+                    break;
+                case '\\':
+                    _buf += "\\\\";
+                    break;
+                case '\n':
+                    _buf += "\\n";
+                    break;
+                case '\r':
+                    _buf += "\\r";
+                    break;
+                case '\t':
+                    _buf += "\\t";
+                    break;
+                default:
+                    if (c < 0x20)
+                    {
+                        _buf += "\\u00";
+                        _buf += hex[c >> 4];
+                        _buf += hex[c & 0xf];
+                    }
+                    else
+                    {
+                        _buf += (char)c;
+                    }
+                }
+            }
+            _buf += '"';
+        }
+
+    private:
+        std::string _buf;
+        std::vector<bool> _first; // 每层对象/数组中是否还没有写入过元素
+        bool _after_key;
+    };
+
+    // 按需解析的json扫描器：顺序遍历json文本，调用者只解析关心的字段，其余的值直接跳过，不构造DOM
+    //  object/array的回调中必须恰好消费一个值(读取或skip)，回调返回false时停止解析并返回false
+    class JsonScanner
+    {
+    public:
+        JsonScanner(const char *begin, const char *end) : _p(begin), _end(end) {}
+        JsonScanner(const std::string &text) : JsonScanner(text.data(), text.data() + text.size()) {}
+        // 遍历对象的所有键，on_key(const std::string &key)
+        template <typename F>
+        bool object(F &&on_key)
+        {
+            if (!_consume('{'))
+                return false;
+            _ws();
+            if (_peek() == '}')
+            {
+                ++_p;
+                return true;
+            }
+            std::string key;
+            while (true)
+            {
+                key.clear();
+                if (!string(key) || !_consume(':') || !on_key(key))
+                    return false;
+                _ws();
+                char c = _peek();
+                ++_p;
+                if (c == '}')
+                    return true;
+                if (c != ',')
+                    return false;
+            }
+        }
+        // 遍历数组的所有元素，on_elem()
+        template <typename F>
+        bool array(F &&on_elem)
+        {
+            if (!_consume('['))
+                return false;
+            _ws();
+            if (_peek() == ']')
+            {
+                ++_p;
+                return true;
+            }
+            while (true)
+            {
+                if (!on_elem())
+                    return false;
+                _ws();
+                char c = _peek();
+                ++_p;
+                if (c == ']')
+                    return true;
+                if (c != ',')
+                    return false;
+            }
+        }
+        // 读取字符串值并还原转义字符，结果追加到out
+        bool string(std::string &out)
+        {
+            if (!_consume('"'))
+                return false;
+            while (_p < _end)
+            {
+                // 连续的普通字符整段拷贝
+                const char *q = _p;
+                while (q < _end && *q != '"' && *q != '\\')
+                    ++q;
+                out.append(_p, q);
+                _p = q;
+                if (_p >= _end)
+                    return false;
+                if (*_p++ == '"')
+                    return true;
+                if (!_unescape(out))
+                    return false;
+            }
+            return false;
+        }
+        // 读取标量值的文本：字符串返回还原后的内容，数值/布尔返回原文，null返回空串
+        bool scalar(std::string &out)
+        {
+            out.clear();
+            _ws();
+            if (_peek() == '"')
+                return string(out);
+            if (_peek() == '{' || _peek() == '[')
+                return skip();
+            const char *q = _p;
+            _literal();
+            if (q == _p)
+                return false;
+            if (!(_p - q == 4 && memcmp(q, "null", 4) == 0))
+                out.assign(q, _p);
+            return true;
+        }
+        // 当前解析位置，可配合skip截取某个值的原文
+        const char *position()
+        {
+            _ws();
+            return _p;
+        }
+        // 跳过一个任意类型的值
+        bool skip()
+        {
+            _ws();
+            char c = _peek();
+            if (c == '"')
+                return _skip_string();
+            if (c != '{' && c != '[')
+            {
+                const char *q = _p;
+                _literal();
+                return q != _p;
+            }
+            int depth = 0;
+            while (_p < _end)
+            {
+                c = *_p;
+                if (c == '"')
+                {
+                    if (!_skip_string())
+                        return false;
+                    continue;
+                }
+                ++_p;
+                if (c == '{' || c == '[')
+                    ++depth;
+                else if ((c == '}' || c == ']') && --depth == 0)
+                    return true;
+            }
+            return false;
+        }
+
+    private:
+        char _peek() const { return _p < _end ? *_p : '\0'; }
+        void _ws()
+        {
+            while (_p < _end && (*_p == ' ' || *_p == '\n' || *_p == '\r' || *_p == '\t'))
+                ++_p;
+        }
+        bool _consume(char c)
+        {
+            _ws();
+            if (_peek() != c)
+                return false;
+            ++_p;
+            return true;
+        }
+        void _literal()
+        {
+            while (_p < _end && *_p != ',' && *_p != '}' && *_p != ']' &&
+                   *_p != ' ' && *_p != '\n' && *_p != '\r' && *_p != '\t')
+                ++_p;
+        }
+        bool _skip_string()
+        {
+            ++_p;
+            while (_p < _end)
+            {
+                const char *q = (const char *)memchr(_p, '"', _end - _p);
+                if (q == nullptr)
+                    return false;
+                // 引号前连续反斜杠的个数为奇数时，该引号是被转义的
+                const char *b = q;
+                while (b > _p && *(b - 1) == '\\')
+                    --b;
+                _p = q + 1;
+                if ((q - b) % 2 == 0)
+                    return true;
+            }
+            return false;
+        }
+        bool _hex4(uint32_t &cp)
+        {
+            if (_end - _p < 4)
+                return false;
+            cp = 0;
+            for (int i = 0; i < 4; ++i)
+            {
+                char c = *_p++;
+                cp <<= 4;
+                if (c >= '0' && c <= '9')
+                    cp |= c - '0';
+                else if (c >= 'a' && c <= 'f')
+                    cp |= c - 'a' + 10;
+                else if (c >= 'A' && c <= 'F')
+                    cp |= c - 'A' + 10;
+                else
+                    return false;
+            }
+            return true;
+        }
+        bool _unescape(std::string &out)
+        {
+            if (_p >= _end)
+                return false;
+            char c = *_p++;
+            switch (c)
+            {
+            case '"':
+            case '\\':
+            case '/':
+                out += c;
+                return true;
+            case 'b':
+                out += '\b';
+                return true;
+            case 'f':
+                out += '\f';
+                return true;
+            case 'n':
+                out += '\n';
+                return true;
+            case 'r':
+                out += '\r';
+                return true;
+            case 't':
+                out += '\t';
+                return true;
+            case 'u':
+                break;
+            default:
+                return false;
+            }
+            uint32_t cp;
+            if (!_hex4(cp))
+                return false;
+            // UTF-16代理对：高位(0xD800~0xDBFF)后接低位(0xDC00~0xDFFF)，合并为一个码点
+            if (cp >= 0xD800 && cp <= 0xDBFF)
+            {
+                uint32_t low;
+                if (_end - _p < 6 || _p[0] != '\\' || _p[1] != 'u')
+                    return false;
+                _p += 2;
+                if (!_hex4(low) || low < 0xDC00 || low > 0xDFFF)
+                    return false;
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+            }
+            if (cp < 0x80)
+            {
+                out += (char)cp;
+            }
+            else if (cp < 0x800)
+            {
+                out += (char)(0xC0 | (cp >> 6));
+                out += (char)(0x80 | (cp & 0x3F));
+            }
+            else if (cp < 0x10000)
+            {
+                out += (char)(0xE0 | (cp >> 12));
+                out += (char)(0x80 | ((cp >> 6) & 0x3F));
+                out += (char)(0x80 | (cp & 0x3F));
+            }
+            else
+            {
+                out += (char)(0xF0 | (cp >> 18));
+                out += (char)(0x80 | ((cp >> 12) & 0x3F));
+                out += (char)(0x80 | ((cp >> 6) & 0x3F));
+                out += (char)(0x80 | (cp & 0x3F));
+            }
+            return true;
+        }
+
+    private:
+        const char *_p;
+        const char *_end;
+    };
+
+    // 索引创建时的设置，写入量大的索引可以调大refresh_interval以减少段刷新开销
+    struct ESIndexSettings
+    {
+        int shards = 1;
+        int replicas = 1;
+        std::string refresh_interval = "1s";
+    };
+
+    // 索引管理：name是对外使用的别名，实际的索引为 name_v1、name_v2 ...
+    //  1. create：别名(或旧版本直接创建的同名索引)已存在时只补充缺少的字段映射，不存在时按设置创建索引并绑定别名；
+    //     同一进程内检查过的索引会被记住，重复构造不再发请求
+    //  2. reindex：按当前的映射与设置创建新版本索引，复制数据后原子切换别名，切换后再补齐复制期间新写入的文档，
+    //     读写全程经别名进行，不需要停服；旧版本直接创建的同名索引在最后一次补齐到切换完成之间禁止写入，
+    //     期间的写入请求会失败而不是写进即将删除的旧索引。重建只应由一个进程执行一次(es_reindex_tool)
+    //  字段映射：keyword类型的字段同时带有 .keyword 子字段，与检索条件中的 xxx.keyword 保持一致
     class ESIndex
     {
     public:
-        ESIndex(std::shared_ptr<elasticlient::Client> &client,
-                const std::string &name, const std::string &type = "_doc") : _name(name), _type(type), _client(client)
-        {
-            Json::Value analysis;
-            Json::Value analyzer;
-            Json::Value ik;
-            Json::Value tokenizer;
-            tokenizer["tokenizer"] = "ik_max_word";
-            ik["ik"] = tokenizer;
-            analyzer["analyzer"] = ik;
-            analysis["analysis"] = analyzer;
-            _index["settings"] = analysis;
+        ESIndex(const ESClient::ptr &client,
+                const std::string &name, const std::string &type = "_doc",
+                const ESIndexSettings &settings = ESIndexSettings())
+            : _name(name), _type(type), _settings(settings), _client(client)
+        {
         }
         ESIndex &append(const std::string &key, const std::string &type = "text",
                         const std::string &analyzer = "ik_max_word", bool enabled = true)
         {
-            Json::Value fields;
-            fields["type"] = type;
-            fields["analyzer"] = analyzer;
+            JsonWriter field;
+            field.begin_object();
+            if (type == "keyword" || type == "text")
+            {
+                field.key("type").value("text").key("analyzer").value(type == "keyword" ? "standard" : analyzer);
+                if (type == "keyword")
+                    field.key("fields").begin_object().key("keyword").begin_object().key("type").value("keyword").end_object().end_object();
+            }
+            else
+                field.key("type").value(type);
             if (enabled == false)
-                fields["enabled"] = false;
-            _properties[key] = fields;
+                field.key("index").value(false);
+            field.end_object();
+            _properties.emplace_back(key, field.str());
             return *this;
         }
-        bool create(const std::string &index_id = "default_index_id")
+        bool create()
         {
-            Json::Value mappings;
-            mappings["dynamic"] = true;
-            mappings["properties"] = _properties;
-            _index["mappings"] = mappings;
-
-            std::string body;
-            bool ret = Serialize(_index, body);
-            if (ret == false)
+            if (_cached())
+                return true;
+            ESResponse rsp = _client->performRequest(ESClient::HTTPMethod::HEAD, _name, "");
+            if (rsp.status_code == 200)
+            {
+                if (!_update_mapping())
+                    return false;
+                // 旧版本以写入文档的方式"创建"索引，会留下一条ID为default_index_id的无用文档
+                _client->remove(_name, _type, "default_index_id");
+            }
+            else if (rsp.status_code == 404)
             {
-                LOG_ERROR("索引序列化失败！");
+                if (!_create(_name + "_v1", true))
+                    return false;
+            }
+            else
+            {
+                LOG_ERROR("检查ES索引{}失败，响应状态码异常：{} {}", _name, rsp.status_code, rsp.error);
                 return false;
             }
-            LOG_DEBUG("{}", body);
-
-            try
+            _cache();
+            return true;
+        }
+        bool reindex()
+        {
+            // {"message_v1":{"aliases":{"message":{}}}}，旧版本直接创建的同名索引没有别名
+            std::string current;
+            ESResponse rsp = _client->performRequest(ESClient::HTTPMethod::GET, "_alias/" + _name, "");
+            if (rsp.status_code == 200)
             {
-                auto rsp = _client->index(_name, _type, index_id, body);
-                if (rsp.status_code < 200 || rsp.status_code >= 300)
+                JsonScanner scanner(rsp.text);
+                scanner.object([&](const std::string &key)
+                               {
+                    if (current.empty())
+                        current = key;
+                    return scanner.skip(); });
+            }
+            bool legacy = current.empty();
+            if (legacy)
+            {
+                rsp = _client->performRequest(ESClient::HTTPMethod::HEAD, _name, "");
+                if (rsp.status_code != 200)
+                {
+                    LOG_INFO("ES索引{}不存在，直接创建", _name);
+                    return create();
+                }
+                current = _name;
+            }
+            std::string next = _name + "_v" + std::to_string(_version(current) + 1);
+            LOG_INFO("开始重建ES索引：{} -> {}", current, next);
+            if (!_create(next, false) || !_copy(current, next, false))
+                return false;
+            JsonWriter actions;
+            actions.begin_object().key("actions").begin_array();
+            if (legacy)
+            {
+                // 同名索引与别名不能共存：禁止写入旧索引后补齐一次，再在同一个原子操作中删除旧索引并添加别名，
+                //  补齐之后到删除之前不会再有写入落到旧索引中
+                if (!_block_write(current, true))
+                    return false;
+                if (!_copy(current, next, true))
                 {
-                    LOG_ERROR("创建ES索引{}失败，响应状态码异常：{}", _name, rsp.status_code);
+                    _block_write(current, false);
                     return false;
                 }
+                actions.begin_object().key("remove_index").begin_object().key("index").value(current).end_object().end_object();
             }
-            catch (const std::exception &e)
+            else
+                actions.begin_object().key("remove").begin_object().key("index").value(current).key("alias").value(_name).end_object().end_object();
+            actions.begin_object().key("add").begin_object().key("index").value(next).key("alias").value(_name).end_object().end_object();
+            actions.end_array().end_object();
+            rsp = _client->performRequest(ESClient::HTTPMethod::POST, "_aliases", actions.str());
+            if (rsp.status_code < 200 || rsp.status_code >= 300)
             {
-                LOG_ERROR("创建ES索引{}失败：{}", _name, e.what());
+                LOG_ERROR("切换ES索引别名{}失败，响应状态码异常：{} {}", _name, rsp.status_code, rsp.error);
+                if (legacy)
+                    _block_write(current, false);
                 return false;
             }
+            if (!legacy)
+            {
+                // 切换前写入旧索引的文档补到新索引中：按版本号只覆盖新索引中更旧的文档，
+                //  第一次复制之后在旧索引中更新过的文档会被补上，切换后直接写入新索引的文档不会被覆盖
+                if (!_copy(current, next, true))
+                    return false;
+                _client->performRequest(ESClient::HTTPMethod::DELETE, current, "");
+            }
+            _cache();
+            LOG_INFO("ES索引{}重建完成，当前索引为{}", _name, next);
             return true;
         }
 
     private:
-        std::shared_ptr<elasticlient::Client> _client;
+        bool _create(const std::string &index, bool alias)
+        {
+            JsonWriter body;
+            body.begin_object().key("settings").begin_object()
+                .key("number_of_shards").value(_settings.shards)
+                .key("number_of_replicas").value(_settings.replicas)
+                .key("refresh_interval").value(_settings.refresh_interval)
+                .key("analysis").begin_object().key("analyzer").begin_object()
+                .key("ik").begin_object().key("tokenizer").value("ik_max_word").end_object()
+                .end_object().end_object()
+                .end_object();
+            body.key("mappings").begin_object().key("dynamic").value(true);
+            _write_properties(body, _properties);
+            body.end_object();
+            if (alias)
+                body.key("aliases").begin_object().key(_name).begin_object().end_object().end_object();
+            body.end_object();
+            LOG_DEBUG("{}", body.str());
+            ESResponse rsp = _client->performRequest(ESClient::HTTPMethod::PUT, index, body.str());
+            if (rsp.status_code >= 200 && rsp.status_code < 300)
+                return true;
+            // 多个实例同时启动时，索引可能已被其他实例创建
+            if (alias && rsp.status_code == 400 && rsp.text.find("resource_already_exists_exception") != std::string::npos)
+                return true;
+            LOG_ERROR("创建ES索引{}失败，响应状态码异常：{} {}{}", index, rsp.status_code, rsp.text, rsp.error);
+            return false;
+        }
+        // 设置/解除索引的写入禁止(index.blocks.write)，禁止期间写入请求返回403
+        bool _block_write(const std::string &index, bool block)
+        {
+            JsonWriter body;
+            body.begin_object().key("index.blocks.write").value(block).end_object();
+            ESResponse rsp = _client->performRequest(ESClient::HTTPMethod::PUT, index + "/_settings", body.str());
+            if (rsp.status_code < 200 || rsp.status_code >= 300)
+            {
+                LOG_ERROR("{}ES索引{}的写入失败，响应状态码异常：{} {}{}", block ? "禁止" : "恢复", index, rsp.status_code, rsp.text, rsp.error);
+                return false;
+            }
+            return true;
+        }
+        // 对比已有索引的映射，只补充缺少的字段(已有字段的类型ES不允许修改，需要reindex)
+        bool _update_mapping()
+        {
+            ESResponse rsp = _client->performRequest(ESClient::HTTPMethod::GET, _name + "/_mapping", "");
+            if (rsp.status_code != 200)
+            {
+                LOG_ERROR("获取ES索引{}的映射失败，响应状态码异常：{} {}", _name, rsp.status_code, rsp.error);
+                return false;
+            }
+            // {"message_v1":{"mappings":{"properties":{"user_id":{..},..}}}}
+            std::vector<std::string> existing;
+            JsonScanner scanner(rsp.text);
+            std::function<bool(const std::string &)> on_mapping = [&](const std::string &key)
+            {
+                if (key == "properties")
+                    return scanner.object([&](const std::string &field)
+                                          {
+                        existing.push_back(field);
+                        return scanner.skip(); });
+                if (key == "mappings")
+                    return scanner.object(on_mapping);
+                return scanner.skip();
+            };
+            scanner.object([&](const std::string &)
+                           { return scanner.object(on_mapping); });
+            std::vector<std::pair<std::string, std::string>> missing;
+            for (auto &property : _properties)
+            {
+                if (std::find(existing.begin(), existing.end(), property.first) == existing.end())
+                    missing.push_back(property);
+            }
+            if (missing.empty())
+                return true;
+            JsonWriter body;
+            body.begin_object();
+            _write_properties(body, missing);
+            body.end_object();
+            rsp = _client->performRequest(ESClient::HTTPMethod::PUT, _name + "/_mapping", body.str());
+            if (rsp.status_code < 200 || rsp.status_code >= 300)
+            {
+                LOG_ERROR("更新ES索引{}的映射失败，响应状态码异常：{} {}{}", _name, rsp.status_code, rsp.text, rsp.error);
+                return false;
+            }
+            LOG_INFO("ES索引{}补充了{}个字段映射", _name, missing.size());
+            return true;
+        }
+        // 以后台任务方式复制数据并轮询到完成，避免大索引复制时请求超时
+        //  文档保留源索引中的版本号(version_type=external)，目标中已有同等或更新版本的文档不会被覆盖；
+        //  catch_up为true时是切换别名后的补齐，这类版本冲突是预期的，忽略即可
+        bool _copy(const std::string &from, const std::string &to, bool catch_up)
+        {
+            JsonWriter body;
+            body.begin_object();
+            if (catch_up)
+                body.key("conflicts").value("proceed");
+            body.key("source").begin_object().key("index").value(from).end_object();
+            body.key("dest").begin_object().key("index").value(to).key("version_type").value("external");
+            body.end_object().end_object();
+            ESResponse rsp = _client->performRequest(ESClient::HTTPMethod::POST, "_reindex?wait_for_completion=false", body.str());
+            std::string task;
+            if (rsp.status_code >= 200 && rsp.status_code < 300)
+            {
+                JsonScanner scanner(rsp.text);
+                scanner.object([&](const std::string &key)
+                               { return key == "task" ? scanner.scalar(task) : scanner.skip(); });
+            }
+            if (task.empty())
+            {
+                LOG_ERROR("复制ES索引{} -> {}失败，响应状态码异常：{} {}{}", from, to, rsp.status_code, rsp.text, rsp.error);
+                return false;
+            }
+            while (true)
+            {
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+                rsp = _client->performRequest(ESClient::HTTPMethod::GET, "_tasks/" + task, "");
+                if (rsp.status_code != 200)
+                {
+                    LOG_ERROR("查询ES复制任务{}失败，响应状态码异常：{} {}", task, rsp.status_code, rsp.error);
+                    return false;
+                }
+                // {"completed":true,"task":{..},"response":{"failures":[..]},"error":{..}}
+                std::string completed, error;
+                size_t failures = 0;
+                JsonScanner scanner(rsp.text);
+                scanner.object([&](const std::string &key)
+                               {
+                    if (key == "completed")
+                        return scanner.scalar(completed);
+                    if (key == "error")
+                    {
+                        const char *begin = scanner.position();
+                        if (!scanner.skip())
+                            return false;
+                        error.assign(begin, scanner.position());
+                        return true;
+                    }
+                    if (key == "response")
+                        return scanner.object([&](const std::string &field)
+                                              {
+                            if (field != "failures")
+                                return scanner.skip();
+                            return scanner.array([&]()
+                                                 { ++failures; return scanner.skip(); }); });
+                    return scanner.skip(); });
+                if (completed != "true")
+                    continue;
+                if (!error.empty() || failures > 0)
+                {
+                    LOG_ERROR("复制ES索引{} -> {}失败：{} 失败文档数{}", from, to, error, failures);
+                    return false;
+                }
+                return true;
+            }
+        }
+        static void _write_properties(JsonWriter &body, const std::vector<std::pair<std::string, std::string>> &properties)
+        {
+            body.key("properties").begin_object();
+            for (auto &property : properties)
+                body.key(property.first).raw(property.second);
+            body.end_object();
+        }
+        // name_v3 -> 3，没有版本后缀(旧版本的同名索引)为0
+        int _version(const std::string &index)
+        {
+            std::string prefix = _name + "_v";
+            if (index.compare(0, prefix.size(), prefix) != 0)
+                return 0;
+            return atoi(index.c_str() + prefix.size());
+        }
+        bool _cached()
+        {
+            std::unique_lock<std::mutex> lock(_cache_mutex());
+            return _cache_set().count(_name) > 0;
+        }
+        void _cache()
+        {
+            std::unique_lock<std::mutex> lock(_cache_mutex());
+            _cache_set().insert(_name);
+        }
+        static std::mutex &_cache_mutex()
+        {
+            static std::mutex mutex;
+            return mutex;
+        }
+        static std::unordered_set<std::string> &_cache_set()
+        {
+            static std::unordered_set<std::string> names;
+            return names;
+        }
+
+    private:
         std::string _name;
         std::string _type;
-        Json::Value _index;
-        Json::Value _properties;
+        ESIndexSettings _settings;
+        ESClient::ptr _client;
+        std::vector<std::pair<std::string, std::string>> _properties;
     };
 
     class ESInsert
     {
     public:
-        ESInsert(std::shared_ptr<elasticlient::Client> &client,
+        ESInsert(const ESClient::ptr &client,
                  const std::string &name, const std::string &type = "_doc") : _name(name), _type(type), _client(client)
         {
+            _item.begin_object();
         }
         template <typename T>
         ESInsert &append(const std::string &key, const T &val)
         {
-            _item[key] = val;
+            _item.key(key).value(val);
             return *this;
         }
-        bool insert(const std::string id = "")
+        // version为文档的外部版本号，由调用者从数据源(例如数据库行的版本列)取得，0表示不带版本写入；
+        //  带version_type=external_gte写入时，ES只接受不低于已有版本的写入，
+        //  先发出的旧内容在新内容之后才到达(例如失败重试)会被拒绝(409)，而不会覆盖新内容
+        bool insert(const std::string id = "", int64_t version = 0)
         {
-            std::string body;
-            bool ret = Serialize(_item, body);
-            if (ret == false)
-            {
-                LOG_ERROR("索引序列化失败！");
-                return false;
-            }
+            _item.end_object();
+            const std::string &body = _item.str();
             LOG_DEBUG("{}", body);
 
             try
             {
-                auto rsp = _client->index(_name, _type, id, body);
+                // 指定ID的文档带外部版本号写入，重建索引时复制的旧内容不会覆盖这里写入的新内容
+                auto rsp = _client->index(_name, _type, id, body, id.empty() ? 0 : version);
+                if (rsp.status_code == 409)
+                {
+                    LOG_DEBUG("数据{}已被更新的版本取代", id);
+                    return true;
+                }
                 if (rsp.status_code < 200 || rsp.status_code >= 300)
                 {
-                    LOG_ERROR("新增数据{}失败，响应状态码异常：{}", body, rsp.status_code);
+                    LOG_ERROR("新增数据{}失败，响应状态码异常：{} {}", body, rsp.status_code, rsp.error);
                     return false;
                 }
             }
@@ -149,16 +833,312 @@ namespace lbk
         }
 
     private:
-        std::shared_ptr<elasticlient::Client> _client;
+        ESClient::ptr _client;
         std::string _name;
         std::string _type;
-        Json::Value _item;
+        JsonWriter _item;
+    };
+
+    // 批量写入ES：文档先进入有界队列，后台线程按条数/字节数/时间间隔组织NDJSON格式的_bulk请求发送
+    //  1. 整个请求失败，或单条文档返回429/5xx时，该条文档重新入队，退避后重试，超过重试次数后丢弃；
+    //     其他错误(如字段类型冲突)重试也不会成功，直接丢弃并记录日志
+    //     带外部版本号写入的文档，重试的旧内容不会覆盖之后已写入的新内容(返回409，视为已被取代)；
+    //     版本号由调用者从数据源取得，不使用本机时钟，不同实例之间的时钟偏差不会让新内容被当作旧内容丢弃
+    //  2. 队列满时append最多阻塞block_ms，仍然满则返回false，调用者据此减缓写入速度(反压)
+    //  3. 写入后到可被检索之间最多有一个刷新周期的延迟
+    class ESBulkWriter
+    {
+    public:
+        using ptr = std::shared_ptr<ESBulkWriter>;
+        ESBulkWriter(const ESClient::ptr &client,
+                     size_t max_docs = 500, size_t max_bytes = 5 * 1024 * 1024, int flush_interval_ms = 1000,
+                     size_t capacity = 10000, int block_ms = 1000, int max_retries = 3)
+            : _client(client), _max_docs(max_docs), _max_bytes(max_bytes), _interval(flush_interval_ms),
+              _capacity(capacity), _block_ms(block_ms), _max_retries(max_retries),
+              _bytes(0), _inflight(0), _dropped(0), _flush(false), _running(true)
+        {
+            _thread = std::thread(&ESBulkWriter::_run, this);
+        }
+        ~ESBulkWriter() { stop(); }
+        // 新增/覆盖一条文档，队列已满且等待超时时返回false
+        bool append(const std::string &index, const std::string &id, const Json::Value &doc,
+                    int64_t version = 0, const std::string &type = "_doc")
+        {
+            return append(index, id, _compact(doc), version, type);
+        }
+        // source为单行的json文本，可由JsonWriter直接生成；version为0时不带外部版本号
+        bool append(const std::string &index, const std::string &id, const std::string &source,
+                    int64_t version = 0, const std::string &type = "_doc")
+        {
+            JsonWriter action;
+            action.begin_object().key("index").begin_object().key("_index").value(index);
+            if (type != "_doc")
+                action.key("_type").value(type);
+            if (!id.empty())
+                action.key("_id").value(id);
+            if (!id.empty() && version > 0)
+                action.key("version").value(version).key("version_type").value("external_gte");
+            action.end_object().end_object();
+            Item item;
+            item.action = action.str();
+            item.source = source;
+            item.retries = 0;
+
+            std::unique_lock<std::mutex> lock(_mutex);
+            bool ok = _not_full.wait_for(lock, std::chrono::milliseconds(_block_ms), [this]()
+                                         { return !_running || _queue.size() < _capacity; });
+            if (!ok || !_running)
+            {
+                LOG_WARN("ES批量写入队列已满({}条)，文档{}写入失败！", _queue.size(), id);
+                return false;
+            }
+            _bytes += item.size();
+            _queue.push_back(std::move(item));
+            if (_queue.size() >= _max_docs || _bytes >= _max_bytes)
+                _cond.notify_one();
+            return true;
+        }
+        // 当前排队与正在发送的文档数量
+        size_t pending()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            return _queue.size() + _inflight;
+        }
+        // 因重试耗尽或不可重试的错误而丢弃的文档数量
+        size_t dropped()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            return _dropped;
+        }
+        // 立即发送队列中的文档，并等待发送完成，超时返回false
+        bool flush(int timeout_ms)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _flush = true;
+            _cond.notify_one();
+            return _idle.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this]()
+                                  { return _queue.empty() && _inflight == 0; });
+        }
+        // 停止后台线程，退出前把队列中剩余的文档发送完
+        void stop()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (!_running)
+                    return;
+                _running = false;
+            }
+            _cond.notify_all();
+            _not_full.notify_all();
+            if (_thread.joinable())
+                _thread.join();
+        }
+
+    private:
+        struct Item
+        {
+            std::string action;
+            std::string source;
+            int retries;
+            size_t size() const { return action.size() + source.size() + 2; }
+        };
+        // _bulk请求要求每个json对象占一行，不能使用带缩进的序列化
+        static std::string _compact(const Json::Value &val)
+        {
+            Json::StreamWriterBuilder swb;
+            swb.settings_["emitUTF8"] = true;
+            swb.settings_["indentation"] = "";
+            return Json::writeString(swb, val);
+        }
+        void _run()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            int backoff_ms = 0;
+            while (true)
+            {
+                _cond.wait_for(lock, std::chrono::milliseconds(_interval), [this]()
+                               { return !_running || _flush || _queue.size() >= _max_docs || _bytes >= _max_bytes; });
+                _flush = false;
+                if (_queue.empty())
+                {
+                    _idle.notify_all();
+                    if (!_running)
+                        break;
+                    continue;
+                }
+                std::vector<Item> batch;
+                size_t bytes = 0;
+                while (!_queue.empty() && batch.size() < _max_docs && (batch.empty() || bytes + _queue.front().size() <= _max_bytes))
+                {
+                    bytes += _queue.front().size();
+                    batch.push_back(std::move(_queue.front()));
+                    _queue.pop_front();
+                }
+                _bytes -= bytes;
+                _inflight = batch.size();
+                lock.unlock();
+                _not_full.notify_all();
+
+                std::vector<Item> retry;
+                size_t dropped = _send(batch, retry);
+                // 有文档需要重试时逐次加倍退避，避免ES过载时持续施压
+                if (!retry.empty())
+                {
+                    backoff_ms = backoff_ms == 0 ? 100 : std::min(backoff_ms * 2, 5000);
+                    std::this_thread::sleep_for(std::chrono::milliseconds(backoff_ms));
+                }
+                else
+                {
+                    backoff_ms = 0;
+                }
+
+                lock.lock();
+                for (auto it = retry.rbegin(); it != retry.rend(); ++it)
+                {
+                    _bytes += it->size();
+                    _queue.push_front(std::move(*it));
+                }
+                _inflight = 0;
+                _dropped += dropped;
+                if (_queue.empty())
+                    _idle.notify_all();
+            }
+        }
+        // 发送一批文档，需要重试的放入retry，返回丢弃的数量
+        size_t _send(std::vector<Item> &batch, std::vector<Item> &retry)
+        {
+            std::string body;
+            for (auto &item : batch)
+            {
+                body += item.action;
+                body += '\n';
+                body += item.source;
+                body += '\n';
+            }
+            size_t dropped = 0;
+            std::vector<ItemResult> results;
+            try
+            {
+                auto rsp = _client->performRequest(ESClient::HTTPMethod::POST, "_bulk", body);
+                if (rsp.status_code < 200 || rsp.status_code >= 300)
+                    LOG_ERROR("ES批量写入{}条文档失败，响应状态码异常：{} {}", batch.size(), rsp.status_code, rsp.error);
+                else if (!_parse(rsp.text, results))
+                    LOG_ERROR("ES批量写入{}条文档的响应解析失败！", batch.size());
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("ES批量写入{}条文档失败：{}", batch.size(), e.what());
+            }
+            if (results.size() != batch.size())
+            {
+                for (auto &item : batch)
+                    dropped += _retry(item, retry);
+                return dropped;
+            }
+            for (size_t i = 0; i < results.size(); ++i)
+            {
+                int status = results[i].status;
+                if (status >= 200 && status < 300)
+                    continue;
+                // 版本冲突：同一文档更新的内容已经写入，这条旧内容不再需要
+                if (status == 409)
+                {
+                    LOG_DEBUG("ES批量写入文档{}已被更新的版本取代", results[i].id);
+                    continue;
+                }
+                if (status == 429 || status >= 500)
+                {
+                    dropped += _retry(batch[i], retry);
+                    continue;
+                }
+                LOG_ERROR("ES批量写入文档{}失败，不可重试：{}", results[i].id, results[i].error);
+                ++dropped;
+            }
+            return dropped;
+        }
+        struct ItemResult
+        {
+            int status = 0;
+            std::string id;
+            std::string error; // 错误原因，只在失败时有值
+        };
+        // 只提取响应中每条文档的状态码，成功的文档不解析其余字段
+        //  {"took":..,"errors":false,"items":[{"index":{"_id":"..","status":201,..}},..]}
+        static bool _parse(const std::string &text, std::vector<ItemResult> &results)
+        {
+            JsonScanner scanner(text);
+            std::string val;
+            // 单条文档的结果：{"_id":"..","status":201,"error":{..}}
+            auto on_field = [&](const std::string &field)
+            {
+                ItemResult &res = results.back();
+                if (field == "_id")
+                    return scanner.scalar(res.id);
+                if (field == "status")
+                {
+                    if (!scanner.scalar(val))
+                        return false;
+                    res.status = atoi(val.c_str());
+                    return true;
+                }
+                if (field == "error")
+                {
+                    const char *begin = scanner.position();
+                    if (!scanner.skip())
+                        return false;
+                    res.error.assign(begin, scanner.position());
+                    return true;
+                }
+                return scanner.skip();
+            };
+            // items的每个元素只有一个键，即操作类型index
+            auto on_item = [&]()
+            {
+                return scanner.object([&](const std::string &)
+                                      {
+                    results.emplace_back();
+                    return scanner.object(on_field); });
+            };
+            return scanner.object([&](const std::string &key)
+                                  { return key == "items" ? scanner.array(on_item) : scanner.skip(); });
+        }
+        size_t _retry(Item &item, std::vector<Item> &retry)
+        {
+            if (++item.retries > _max_retries)
+            {
+                LOG_ERROR("ES批量写入文档重试{}次仍失败，丢弃：{}", _max_retries, item.action);
+                return 1;
+            }
+            retry.push_back(std::move(item));
+            return 0;
+        }
+
+    private:
+        ESClient::ptr _client;
+        size_t _max_docs;
+        size_t _max_bytes;
+        int _interval;
+        size_t _capacity;
+        int _block_ms;
+        int _max_retries;
+
+        std::mutex _mutex;
+        std::condition_variable _cond;     // 通知后台线程发送
+        std::condition_variable _not_full; // 通知等待入队的调用者
+        std::condition_variable _idle;     // 通知flush的调用者
+        std::deque<Item> _queue;
+        size_t _bytes;
+        size_t _inflight;
+        size_t _dropped;
+        bool _flush;
+        bool _running;
+        std::thread _thread;
     };
 
     class ESRemove
     {
     public:
-        ESRemove(std::shared_ptr<elasticlient::Client> &client,
+        ESRemove(const ESClient::ptr &client,
                  const std::string &name, const std::string &type = "_doc")
             : _client(client), _name(name), _type(type)
         {
@@ -170,7 +1150,7 @@ namespace lbk
                 auto rsp = _client->remove(_name, _type, id);
                 if (rsp.status_code < 200 || rsp.status_code >= 300)
                 {
-                    LOG_ERROR("删除数据{}失败，响应状态码异常：{}", id, rsp.status_code);
+                    LOG_ERROR("删除数据{}失败，响应状态码异常：{} {}", id, rsp.status_code, rsp.error);
                     return false;
                 }
             }
@@ -183,7 +1163,7 @@ namespace lbk
         }
 
     private:
-        std::shared_ptr<elasticlient::Client> _client;
+        ESClient::ptr _client;
         std::string _name;
         std::string _type;
     };
@@ -191,104 +1171,228 @@ namespace lbk
     class ESSearch
     {
     public:
-        ESSearch(std::shared_ptr<elasticlient::Client> &client,
+        ESSearch(const ESClient::ptr &client,
                  const std::string &name, const std::string &type = "_doc")
             : _client(client), _name(name), _type(type)
         {
         }
         ESSearch &append_must_not_terms(const std::string &key, const std::vector<std::string> &vals)
         {
-            Json::Value fields;
+            JsonWriter terms;
+            terms.begin_object().key("terms").begin_object().key(key).begin_array();
             for (const auto &val : vals)
             {
-                fields[key].append(val);
+                terms.value(val);
             }
-            Json::Value terms;
-            terms["terms"] = fields;
-            _must_not.append(terms);
+            terms.end_array().end_object().end_object();
+            _must_not.push_back(terms.str());
             return *this;
         }
         ESSearch &append_must_term(const std::string &key, const std::string &val)
         {
-            Json::Value field;
-            field[key] = val;
-            Json::Value term;
-            term["term"] = field;
-            _must.append(term);
+            _must.push_back(_clause("term", key, val));
             return *this;
         }
         ESSearch &append_must_match(const std::string &key, const std::string &val)
         {
-            Json::Value field;
-            field[key] = val;
-            Json::Value match;
-            match["match"] = field;
-            _must.append(match);
+            _must.push_back(_clause("match", key, val));
             return *this;
         }
         ESSearch &append_should_match(const std::string &key, const std::string &val)
         {
-            Json::Value field;
-            field[key] = val;
-            Json::Value match;
-            match["match"] = field;
-            _should.append(match);
+            _should.push_back(_clause("match", key, val));
             return *this;
         }
-        Json::Value search()
-        {
-            Json::Value cond;
-            if (_must_not.empty() == false)
-                cond["must_not"] = _must_not;
-            if (_must.empty() == false)
-                cond["must"] = _must;
-            if (_should.empty() == false)
-                cond["should"] = _should;
-            Json::Value query;
-            query["bool"] = cond;
-            Json::Value root;
-            root["query"] = query;
-
-            std::string body;
-            bool ret = Serialize(root, body);
-            if (ret == false)
+        // 返回的最大条数，不设置时为ES默认的10条
+        ESSearch &size(int size)
+        {
+            _size = size;
+            return *this;
+        }
+        // 排序字段，按添加顺序依次比较；unmapped_type用于字段尚未出现在映射中时避免检索报错
+        ESSearch &append_sort(const std::string &key, const std::string &order = "desc",
+                              const std::string &unmapped_type = "")
+        {
+            JsonWriter sort;
+            sort.begin_object().key(key).begin_object().key("order").value(order);
+            if (!unmapped_type.empty())
+                sort.key("unmapped_type").value(unmapped_type);
+            sort.end_object().end_object();
+            _sort.push_back(sort.str());
+            return *this;
+        }
+        // search_after分页：依次给出上一页最后一条结果的各排序字段值，与append_sort一一对应
+        ESSearch &append_search_after(int64_t val)
+        {
+            _search_after.push_back(std::to_string(val));
+            return *this;
+        }
+        ESSearch &append_search_after(const std::string &val)
+        {
+            JsonWriter w;
+            w.value(val);
+            _search_after.push_back(w.str());
+            return *this;
+        }
+        // 只返回_source中的这些字段
+        ESSearch &source(const std::vector<std::string> &fields)
+        {
+            _source = fields;
+            return *this;
+        }
+        // 对字段启用高亮，命中结果中 "highlight.<字段名>" 为命中关键字附近的片段，多个片段以省略号连接
+        ESSearch &highlight(const std::string &key, int fragment_size = 100, int fragments = 3,
+                            const std::string &pre_tag = "<em>", const std::string &post_tag = "</em>")
+        {
+            JsonWriter field;
+            field.begin_object()
+                .key("fragment_size").value(fragment_size)
+                .key("number_of_fragments").value(fragments)
+                .key("pre_tags").begin_array().value(pre_tag).end_array()
+                .key("post_tags").begin_array().value(post_tag).end_array()
+                .end_object();
+            _highlight.emplace_back(key, field.str());
+            return *this;
+        }
+        // 执行检索，每条命中结果回调一次on_hit(std::vector<std::string> &values)
+        //  values与fields一一对应，为_source中对应字段的值(数值为其文本形式)，缺失的字段为空串；
+        //  fields中的 "highlight.<字段名>" 对应该字段的高亮片段；
+        //  响应正文按需扫描，只提取fields中列出的字段，不构造完整的DOM
+        template <typename F>
+        bool search(const std::vector<std::string> &fields, F &&on_hit)
+        {
+            JsonWriter body;
+            body.begin_object().key("query").begin_object().key("bool").begin_object();
+            _clauses(body, "must_not", _must_not);
+            _clauses(body, "must", _must);
+            _clauses(body, "should", _should);
+            body.end_object().end_object();
+            if (_size >= 0)
+                body.key("size").value(_size);
+            _clauses(body, "sort", _sort);
+            _clauses(body, "search_after", _search_after);
+            if (!_source.empty())
             {
-                LOG_ERROR("索引序列化失败！");
-                return Json::Value();
+                body.key("_source").begin_array();
+                for (auto &field : _source)
+                    body.value(field);
+                body.end_array();
             }
-            LOG_DEBUG("{}", body);
-            cpr::Response rsp;
+            if (!_highlight.empty())
+            {
+                body.key("highlight").begin_object().key("fields").begin_object();
+                for (auto &field : _highlight)
+                    body.key(field.first).raw(field.second);
+                body.end_object().end_object();
+            }
+            body.end_object();
+            LOG_DEBUG("{}", body.str());
+            ESResponse rsp;
             try
             {
-                rsp = _client->search(_name, _type, body);
+                rsp = _client->search(_name, _type, body.str());
                 if (rsp.status_code < 200 || rsp.status_code >= 300)
                 {
-                    LOG_ERROR("检索数据{}失败，响应状态码异常：{}", body, rsp.status_code);
-                    return Json::Value();
+                    LOG_ERROR("检索数据{}失败，响应状态码异常：{} - {}{}", body.str(), rsp.status_code, rsp.text, rsp.error);
+                    return false;
                 }
             }
             catch (const std::exception &e)
             {
-                LOG_ERROR("删除数据{}失败：{}", body, e.what());
-                return Json::Value();
+                LOG_ERROR("检索数据{}失败：{}", body.str(), e.what());
+                return false;
             }
-            LOG_DEBUG("检索响应正文：{}", rsp.text);
-            Json::Value json_rsp;
-            ret = UnSerialize(rsp.text, json_rsp);
+
+            // {"took":..,"hits":{"total":..,"hits":[{"_id":..,"_source":{..}},..]}}
+            JsonScanner scanner(rsp.text);
+            std::vector<std::string> values;
+            size_t count = 0;
+            auto on_source = [&](const std::string &key)
+            {
+                auto it = std::find(fields.begin(), fields.end(), key);
+                if (it == fields.end())
+                    return scanner.skip();
+                return scanner.scalar(values[it - fields.begin()]);
+            };
+            // "highlight":{"content":["片段1","片段2"]}
+            std::string fragment;
+            auto on_highlight = [&](const std::string &key)
+            {
+                auto it = std::find(fields.begin(), fields.end(), "highlight." + key);
+                if (it == fields.end())
+                    return scanner.skip();
+                std::string &val = values[it - fields.begin()];
+                return scanner.array([&]()
+                                     {
+                    fragment.clear();
+                    if (!scanner.string(fragment))
+                        return false;
+                    if (!val.empty())
+                        val += "…";
+                    val += fragment;
+                    return true; });
+            };
+            auto on_elem = [&]()
+            {
+                values.assign(fields.size(), std::string());
+                bool ret = scanner.object([&](const std::string &key)
+                                          {
+                    if (key == "_source")
+                        return scanner.object(on_source);
+                    if (key == "highlight")
+                        return scanner.object(on_highlight);
+                    return scanner.skip(); });
+                if (ret)
+                {
+                    on_hit(values);
+                    ++count;
+                }
+                return ret;
+            };
+            auto on_hits = [&](const std::string &key)
+            {
+                return key == "hits" ? scanner.array(on_elem) : scanner.skip();
+            };
+            bool ret = scanner.object([&](const std::string &key)
+                                      { return key == "hits" ? scanner.object(on_hits) : scanner.skip(); });
             if (ret == false)
             {
-                LOG_ERROR("检索数据 {} 结果反序列化失败", rsp.text);
-                return Json::Value();
+                LOG_ERROR("检索数据{}的结果解析失败，响应共{}字节", body.str(), rsp.text.size());
+                return false;
             }
-            return json_rsp["hits"]["hits"];
+            LOG_DEBUG("检索响应{}字节，命中{}条", rsp.text.size(), count);
+            return true;
+        }
+
+    private:
+        // {"term":{"key":"val"}} / {"match":{"key":"val"}}
+        static std::string _clause(const std::string &type, const std::string &key, const std::string &val)
+        {
+            JsonWriter clause;
+            clause.begin_object().key(type).begin_object().key(key).value(val).end_object().end_object();
+            return clause.str();
+        }
+        static void _clauses(JsonWriter &body, const std::string &name, const std::vector<std::string> &clauses)
+        {
+            if (clauses.empty())
+                return;
+            body.key(name).begin_array();
+            for (auto &clause : clauses)
+                body.raw(clause);
+            body.end_array();
         }
 
     private:
-        std::shared_ptr<elasticlient::Client> _client;
+        ESClient::ptr _client;
         std::string _name;
         std::string _type;
-        Json::Value _must_not;
-        Json::Value _must;
-        Json::Value _should;
+        std::vector<std::string> _must_not;
+        std::vector<std::string> _must;
+        std::vector<std::string> _should;
+        int _size = -1;
+        std::vector<std::string> _sort;
+        std::vector<std::string> _search_after;
+        std::vector<std::string> _source;
+        std::vector<std::pair<std::string, std::string>> _highlight; // 字段名 -> 高亮参数
     };
 }
@@ -2,53 +2,67 @@
 #include <iostream>
 #include <spdlog/spdlog.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
-#include <spdlog/sinks/basic_file_sink.h>
+#include <spdlog/sinks/rotating_file_sink.h>
 #include <spdlog/async.h>
 namespace lbk
 {
     std::shared_ptr<spdlog::logger> g_default_logger;
     // mode:运行模式，true为发布模式，false为调试模式
-    void init_logger(bool mode, const std::string &file, int32_t level)
+    //  日志以异步方式输出：业务线程只把日志写入有界环形队列，由后台线程格式化并写入输出端，
+    //  队列满时丢弃最旧的日志而不是阻塞业务线程；
+    //  发布模式下写入按大小滚动的文件，只在error及以上级别立即刷新，其余由后台每flush_interval_sec秒刷新一次
+    //  queue_size: 队列容量(条)；max_file_size/max_files: 单个日志文件的字节数上限与保留的文件个数
+    void init_logger(bool mode, const std::string &file, int32_t level,
+                     size_t queue_size = 8192, int flush_interval_sec = 1,
+                     size_t max_file_size = 100 * 1024 * 1024, size_t max_files = 10)
     {
+        spdlog::init_thread_pool(queue_size, 1);
         if (mode == false)
         {
             // 调试模式，创建标准输出日志器，输出等级为最低
-            g_default_logger = spdlog::stdout_color_mt("default_logger");
+            g_default_logger = spdlog::create_async_nb<spdlog::sinks::stdout_color_sink_mt>("default_logger");
             g_default_logger->set_level(spdlog::level::level_enum::trace);
             g_default_logger->flush_on(spdlog::level::level_enum::trace);
         }
         else
         {
-            // 发布模式，创建文件输出日志器
-            g_default_logger = spdlog::basic_logger_mt("default_logger", file);
+            // 发布模式，创建滚动文件日志器
+            g_default_logger = spdlog::create_async_nb<spdlog::sinks::rotating_file_sink_mt>("default_logger", file, max_file_size, max_files);
             g_default_logger->set_level((spdlog::level::level_enum)level);
-            g_default_logger->flush_on((spdlog::level::level_enum)level);
+            g_default_logger->flush_on(spdlog::level::level_enum::err);
+            spdlog::flush_every(std::chrono::seconds(flush_interval_sec));
         }
         g_default_logger->set_pattern("[%n][%H:%M:%S][%t][%-8l]%v");
     }
-#define LOG_TRACE(format, ...)                                                                       \
-    {                                                                                                \
-        g_default_logger->trace(std::string("[{}:{}]") + format, __FILE__, __LINE__, ##__VA_ARGS__); \
-    }
-#define LOG_DEBUG(format, ...)                                                                       \
-    {                                                                                                \
-        g_default_logger->debug(std::string("[{}:{}]") + format, __FILE__, __LINE__, ##__VA_ARGS__); \
-    }
-#define LOG_INFO(format, ...)                                                                       \
-    {                                                                                               \
-        g_default_logger->info(std::string("[{}:{}]") + format, __FILE__, __LINE__, ##__VA_ARGS__); \
-    }
-#define LOG_WARN(format, ...)                                                                       \
-    {                                                                                               \
-        g_default_logger->warn(std::string("[{}:{}]") + format, __FILE__, __LINE__, ##__VA_ARGS__); \
-    }
-#define LOG_ERROR(format, ...)                                                                       \
-    {                                                                                                \
-        g_default_logger->error(std::string("[{}:{}]") + format, __FILE__, __LINE__, ##__VA_ARGS__); \
-    }
-#define LOG_CRITICAL(format, ...)                                                                       \
-    {                                                                                                   \
-        g_default_logger->critical(std::string("[{}:{}]") + format, __FILE__, __LINE__, ##__VA_ARGS__); \
+    // 进程退出前调用：异步日志可能还在队列中，等待后台线程全部写出后再返回，
+    //  之后的日志不再输出，只用于abort/exit之前
+    inline void shutdown_logger()
+    {
+        if (g_default_logger)
+            g_default_logger->flush();
+        spdlog::shutdown();
     }
+    // 文件位置在编译期拼接到格式串前，低于输出等级时直接跳过，参数也不会被求值
+#define LOG_STRINGIFY_(x) #x
+#define LOG_STRINGIFY(x) LOG_STRINGIFY_(x)
+#define LOG_AT_LEVEL(lvl, format, ...)                                                                     \
+    do                                                                                                     \
+    {                                                                                                      \
+        if (g_default_logger->should_log(lvl))                                                             \
+            g_default_logger->log(lvl, "[" __FILE__ ":" LOG_STRINGIFY(__LINE__) "]" format, ##__VA_ARGS__); \
+    } while (0)
+#define LOG_TRACE(format, ...) LOG_AT_LEVEL(spdlog::level::trace, format, ##__VA_ARGS__)
+#define LOG_DEBUG(format, ...) LOG_AT_LEVEL(spdlog::level::debug, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...) LOG_AT_LEVEL(spdlog::level::info, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...) LOG_AT_LEVEL(spdlog::level::warn, format, ##__VA_ARGS__)
+#define LOG_ERROR(format, ...) LOG_AT_LEVEL(spdlog::level::err, format, ##__VA_ARGS__)
+#define LOG_CRITICAL(format, ...) LOG_AT_LEVEL(spdlog::level::critical, format, ##__VA_ARGS__)
+// 致命错误：输出后立即把队列中的日志写完，调用者随后abort/exit，保证导致退出的原因不会丢失
+#define LOG_FATAL(format, ...)                                             \
+    do                                                                     \
+    {                                                                      \
+        LOG_AT_LEVEL(spdlog::level::critical, format, ##__VA_ARGS__);      \
+        lbk::shutdown_logger();                                            \
+    } while (0)
 
 }
@@ -0,0 +1,102 @@
+// 进程内分片LRU缓存
+//  1. 按key的哈希值分片，每个分片独立加锁，降低多线程竞争
+//  2. 每个条目带有过期时间，用于限制多实例部署时本地缓存的数据陈旧时间
+#pragma once
+#include <list>
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+
+namespace lbk
+{
+    template <typename K, typename V, typename Hash = std::hash<K>>
+    class LRUCache
+    {
+    public:
+        using ptr = std::shared_ptr<LRUCache<K, V, Hash>>;
+        LRUCache(size_t capacity, const std::chrono::milliseconds &ttl, size_t shard_count = 16)
+            : _ttl(ttl), _shards(shard_count == 0 ? 1 : shard_count)
+        {
+            size_t per_shard = capacity / _shards.size();
+            for (auto &shard : _shards)
+                shard.capacity = per_shard == 0 ? 1 : per_shard;
+        }
+        // 获取缓存数据，不存在或已过期返回false
+        bool get(const K &key, V &val)
+        {
+            Shard &shard = _shard(key);
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            auto it = shard.index.find(key);
+            if (it == shard.index.end())
+                return false;
+            if (it->second->expire < std::chrono::steady_clock::now())
+            {
+                shard.items.erase(it->second);
+                shard.index.erase(it);
+                return false;
+            }
+            // 命中的条目移动到链表头部
+            shard.items.splice(shard.items.begin(), shard.items, it->second);
+            val = it->second->val;
+            return true;
+        }
+        // 新增/更新缓存数据，超出容量时淘汰最久未使用的条目
+        void put(const K &key, const V &val)
+        {
+            Shard &shard = _shard(key);
+            auto expire = std::chrono::steady_clock::now() + _ttl;
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            auto it = shard.index.find(key);
+            if (it != shard.index.end())
+            {
+                it->second->val = val;
+                it->second->expire = expire;
+                shard.items.splice(shard.items.begin(), shard.items, it->second);
+                return;
+            }
+            shard.items.push_front(Entry{key, val, expire});
+            shard.index[key] = shard.items.begin();
+            while (shard.items.size() > shard.capacity)
+            {
+                shard.index.erase(shard.items.back().key);
+                shard.items.pop_back();
+            }
+        }
+        void remove(const K &key)
+        {
+            Shard &shard = _shard(key);
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            auto it = shard.index.find(key);
+            if (it == shard.index.end())
+                return;
+            shard.items.erase(it->second);
+            shard.index.erase(it);
+        }
+
+    private:
+        struct Entry
+        {
+            K key;
+            V val;
+            std::chrono::steady_clock::time_point expire;
+        };
+        struct Shard
+        {
+            std::mutex mutex;
+            size_t capacity;
+            std::list<Entry> items; // 头部为最近使用
+            std::unordered_map<K, typename std::list<Entry>::iterator, Hash> index;
+        };
+        Shard &_shard(const K &key)
+        {
+            return _shards[Hash()(key) % _shards.size()];
+        }
+
+    private:
+        std::chrono::milliseconds _ttl;
+        std::vector<Shard> _shards;
+    };
+}
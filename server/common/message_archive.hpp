@@ -0,0 +1,844 @@
+#pragma once
+#include "mysql_message.hpp"
+#include "logger.hpp"
+#include <odb/mysql/connection.hxx>
+#include <zstd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace lbk
+{
+    // 冷消息归档文件格式(.marc)
+    //  [数据块0][数据块1]...[稀疏索引][文件尾]
+    //  数据块：同一会话内按时间连续的至多BLOCK_ROWS条消息，按列存储后整体zstd压缩
+    //    行数 | 时间列(相对块起始时间的增量) | 序号列(增量) | 类型列 | 发送者字典 + 字典下标列 |
+    //    消息ID列 | 内容列 | 文件ID列 | 文件名列 | 文件大小列
+    //  稀疏索引：每个数据块一项 - 会话ID | 起止时间 | 块偏移 | 压缩长度 | 原始长度 | 行数
+    //  文件尾：索引偏移(8) | 索引项数(4) | 版本(4) | 魔数(4)
+    //  读取时整个文件mmap映射，只常驻稀疏索引，按会话和时间定位到数据块后再解压
+    namespace archive_codec
+    {
+        static const uint32_t MAGIC = 0x4352414d; // "MARC"
+        static const uint32_t VERSION = 1;
+        static const size_t FOOTER_SIZE = 20;
+
+        inline void put_varint(std::string &out, uint64_t val)
+        {
+            while (val >= 0x80)
+            {
+                out.push_back((char)((val & 0x7f) | 0x80));
+                val >>= 7;
+            }
+            out.push_back((char)val);
+        }
+        inline void put_svarint(std::string &out, int64_t val)
+        {
+            put_varint(out, ((uint64_t)val << 1) ^ (uint64_t)(val >> 63));
+        }
+        inline void put_string(std::string &out, const std::string &val)
+        {
+            put_varint(out, val.size());
+            out.append(val);
+        }
+        template <typename T>
+        inline void put_fixed(std::string &out, T val)
+        {
+            out.append((const char *)&val, sizeof(T));
+        }
+
+        // 顺序读取缓冲区，越界时抛出异常，由调用者统一捕获
+        class Reader
+        {
+        public:
+            Reader(const char *data, size_t size) : _cur(data), _end(data + size) {}
+            uint64_t varint()
+            {
+                uint64_t val = 0;
+                for (int shift = 0; shift < 64; shift += 7)
+                {
+                    check(1);
+                    uint8_t byte = (uint8_t)*_cur++;
+                    val |= (uint64_t)(byte & 0x7f) << shift;
+                    if ((byte & 0x80) == 0)
+                        return val;
+                }
+                throw std::runtime_error("归档数据变长整数格式错误");
+            }
+            int64_t svarint()
+            {
+                uint64_t val = varint();
+                return (int64_t)(val >> 1) ^ -(int64_t)(val & 1);
+            }
+            std::string string()
+            {
+                size_t len = varint();
+                check(len);
+                std::string val(_cur, len);
+                _cur += len;
+                return val;
+            }
+            uint8_t byte()
+            {
+                check(1);
+                return (uint8_t)*_cur++;
+            }
+            template <typename T>
+            T fixed()
+            {
+                check(sizeof(T));
+                T val;
+                memcpy(&val, _cur, sizeof(T));
+                _cur += sizeof(T);
+                return val;
+            }
+
+        private:
+            void check(size_t len)
+            {
+                if ((size_t)(_end - _cur) < len)
+                    throw std::runtime_error("归档数据长度不足");
+            }
+
+        private:
+            const char *_cur;
+            const char *_end;
+        };
+    }
+
+    // 归档数据块的稀疏索引项
+    struct ArchiveBlockIndex
+    {
+        std::string session_id;
+        int64_t first_time;
+        int64_t last_time;
+        uint64_t offset;
+        uint32_t zsize;
+        uint32_t raw_size;
+        uint32_t rows;
+    };
+
+    // 归档文件写入：消息需按 会话 -> 时间 -> 序号 的顺序依次追加
+    class ArchiveWriter
+    {
+    public:
+        static const size_t BLOCK_ROWS = 1024; // 每个数据块最多的消息条数，决定稀疏索引的粒度
+        ArchiveWriter(const std::string &path, int level = 3)
+            : _path(path), _level(level), _offset(0), _rows(0), _fp(nullptr) {}
+        ~ArchiveWriter()
+        {
+            if (_fp)
+                fclose(_fp);
+        }
+        bool open()
+        {
+            _fp = fopen(_path.c_str(), "wb");
+            if (_fp == nullptr)
+            {
+                LOG_ERROR("打开归档文件{}失败：{}", _path, strerror(errno));
+                return false;
+            }
+            return true;
+        }
+        bool append(const Message &msg)
+        {
+            if (!_block.empty() && (_block.size() >= BLOCK_ROWS || _block.front().session_id() != msg.session_id()))
+            {
+                if (flush() == false)
+                    return false;
+            }
+            _block.push_back(msg);
+            ++_rows;
+            return true;
+        }
+        // 放弃写入：关闭并删除未完成的文件
+        void discard()
+        {
+            if (_fp)
+            {
+                fclose(_fp);
+                _fp = nullptr;
+            }
+            remove(_path.c_str());
+        }
+        // 写入剩余数据块、稀疏索引与文件尾，并落盘
+        bool finish()
+        {
+            if (flush() == false)
+                return false;
+            std::string index;
+            for (auto &idx : _index)
+            {
+                archive_codec::put_string(index, idx.session_id);
+                archive_codec::put_fixed<int64_t>(index, idx.first_time);
+                archive_codec::put_fixed<int64_t>(index, idx.last_time);
+                archive_codec::put_fixed<uint64_t>(index, idx.offset);
+                archive_codec::put_fixed<uint32_t>(index, idx.zsize);
+                archive_codec::put_fixed<uint32_t>(index, idx.raw_size);
+                archive_codec::put_fixed<uint32_t>(index, idx.rows);
+            }
+            archive_codec::put_fixed<uint64_t>(index, _offset);
+            archive_codec::put_fixed<uint32_t>(index, (uint32_t)_index.size());
+            archive_codec::put_fixed<uint32_t>(index, archive_codec::VERSION);
+            archive_codec::put_fixed<uint32_t>(index, archive_codec::MAGIC);
+            if (write(index) == false)
+                return false;
+            if (fflush(_fp) != 0 || fsync(fileno(_fp)) != 0)
+            {
+                LOG_ERROR("归档文件{}落盘失败：{}", _path, strerror(errno));
+                return false;
+            }
+            fclose(_fp);
+            _fp = nullptr;
+            return true;
+        }
+        size_t rows() const { return _rows; }
+
+    private:
+        bool write(const std::string &data)
+        {
+            if (fwrite(data.data(), 1, data.size(), _fp) != data.size())
+            {
+                LOG_ERROR("写入归档文件{}失败：{}", _path, strerror(errno));
+                return false;
+            }
+            return true;
+        }
+        // 将当前数据块按列编码后压缩写入
+        bool flush()
+        {
+            if (_block.empty())
+                return true;
+            using namespace archive_codec;
+            int64_t first_time = boost::posix_time::to_time_t(_block.front().create_time());
+            std::string raw;
+            put_varint(raw, _block.size());
+            int64_t prev_time = first_time;
+            for (auto &msg : _block)
+            {
+                int64_t t = boost::posix_time::to_time_t(msg.create_time());
+                put_svarint(raw, t - prev_time);
+                prev_time = t;
+            }
+            int64_t prev_seq = 0;
+            for (auto &msg : _block)
+            {
+                put_svarint(raw, (int64_t)msg.seq() - prev_seq);
+                prev_seq = msg.seq();
+            }
+            for (auto &msg : _block)
+                raw.push_back((char)msg.message_type());
+            // 一个会话内的发送者很少，字典编码后每条消息只需一个下标
+            std::vector<std::string> dict;
+            std::unordered_map<std::string, size_t> dict_index;
+            std::string refs;
+            for (auto &msg : _block)
+            {
+                auto it = dict_index.find(msg.user_id());
+                if (it == dict_index.end())
+                {
+                    it = dict_index.emplace(msg.user_id(), dict.size()).first;
+                    dict.push_back(msg.user_id());
+                }
+                put_varint(refs, it->second);
+            }
+            put_varint(raw, dict.size());
+            for (auto &uid : dict)
+                put_string(raw, uid);
+            raw.append(refs);
+            for (auto &msg : _block)
+                put_string(raw, msg.message_id());
+            for (auto &msg : _block)
+                put_string(raw, msg.content());
+            for (auto &msg : _block)
+                put_string(raw, msg.file_id());
+            for (auto &msg : _block)
+                put_string(raw, msg.file_name());
+            for (auto &msg : _block)
+                put_varint(raw, msg.file_size());
+
+            std::string zdata(ZSTD_compressBound(raw.size()), '\0');
+            size_t zsize = ZSTD_compress(&zdata[0], zdata.size(), raw.data(), raw.size(), _level);
+            if (ZSTD_isError(zsize))
+            {
+                LOG_ERROR("压缩归档数据块失败：{}", ZSTD_getErrorName(zsize));
+                return false;
+            }
+            zdata.resize(zsize);
+            if (write(zdata) == false)
+                return false;
+            ArchiveBlockIndex idx;
+            idx.session_id = _block.front().session_id();
+            idx.first_time = first_time;
+            idx.last_time = prev_time;
+            idx.offset = _offset;
+            idx.zsize = (uint32_t)zsize;
+            idx.raw_size = (uint32_t)raw.size();
+            idx.rows = (uint32_t)_block.size();
+            _index.push_back(idx);
+            _offset += zsize;
+            _block.clear();
+            return true;
+        }
+
+    private:
+        std::string _path;
+        int _level;
+        uint64_t _offset;
+        size_t _rows;
+        FILE *_fp;
+        std::vector<Message> _block;
+        std::vector<ArchiveBlockIndex> _index;
+    };
+
+    // 只读打开的归档文件：mmap映射整个文件，常驻内存的只有稀疏索引
+    class ArchiveFile
+    {
+    public:
+        using ptr = std::shared_ptr<ArchiveFile>;
+        ArchiveFile(const std::string &path) : _path(path), _fd(-1), _data(nullptr), _size(0) {}
+        ~ArchiveFile()
+        {
+            if (_data)
+                munmap(_data, _size);
+            if (_fd != -1)
+                close(_fd);
+        }
+        bool open()
+        {
+            _fd = ::open(_path.c_str(), O_RDONLY);
+            if (_fd == -1)
+            {
+                LOG_ERROR("打开归档文件{}失败：{}", _path, strerror(errno));
+                return false;
+            }
+            struct stat st;
+            if (fstat(_fd, &st) == -1 || (size_t)st.st_size < archive_codec::FOOTER_SIZE)
+            {
+                LOG_ERROR("归档文件{}大小异常！", _path);
+                return false;
+            }
+            _size = st.st_size;
+            void *data = mmap(nullptr, _size, PROT_READ, MAP_SHARED, _fd, 0);
+            if (data == MAP_FAILED)
+            {
+                LOG_ERROR("映射归档文件{}失败：{}", _path, strerror(errno));
+                return false;
+            }
+            _data = (char *)data;
+            try
+            {
+                archive_codec::Reader footer(_data + _size - archive_codec::FOOTER_SIZE, archive_codec::FOOTER_SIZE);
+                uint64_t index_offset = footer.fixed<uint64_t>();
+                uint32_t count = footer.fixed<uint32_t>();
+                uint32_t version = footer.fixed<uint32_t>();
+                uint32_t magic = footer.fixed<uint32_t>();
+                if (magic != archive_codec::MAGIC || version != archive_codec::VERSION ||
+                    index_offset > _size - archive_codec::FOOTER_SIZE)
+                {
+                    LOG_ERROR("归档文件{}格式错误！", _path);
+                    return false;
+                }
+                archive_codec::Reader reader(_data + index_offset, _size - archive_codec::FOOTER_SIZE - index_offset);
+                _index.reserve(count);
+                for (uint32_t i = 0; i < count; ++i)
+                {
+                    ArchiveBlockIndex idx;
+                    idx.session_id = reader.string();
+                    idx.first_time = reader.fixed<int64_t>();
+                    idx.last_time = reader.fixed<int64_t>();
+                    idx.offset = reader.fixed<uint64_t>();
+                    idx.zsize = reader.fixed<uint32_t>();
+                    idx.raw_size = reader.fixed<uint32_t>();
+                    idx.rows = reader.fixed<uint32_t>();
+                    if (idx.offset + idx.zsize > index_offset)
+                        throw std::runtime_error("数据块越界");
+                    _index.push_back(std::move(idx));
+                }
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("读取归档文件{}索引失败：{}", _path, e.what());
+                return false;
+            }
+            // 写入时按会话键排序，这里按会话ID和时间重新排序以便二分查找
+            std::sort(_index.begin(), _index.end(), [](const ArchiveBlockIndex &a, const ArchiveBlockIndex &b)
+                      { return a.session_id != b.session_id ? a.session_id < b.session_id : a.first_time < b.first_time; });
+            return true;
+        }
+        // 获取会话在[stime, etime]区间内的消息，只解压与区间有交集的数据块
+        bool range(const std::string &ssid, int64_t stime, int64_t etime, std::vector<Message> &res)
+        {
+            auto begin = std::lower_bound(_index.begin(), _index.end(), ssid, [](const ArchiveBlockIndex &idx, const std::string &key)
+                                          { return idx.session_id < key; });
+            for (auto it = begin; it != _index.end() && it->session_id == ssid; ++it)
+            {
+                if (it->first_time > etime)
+                    break;
+                if (it->last_time < stime)
+                    continue;
+                if (decode(*it, stime, etime, res) == false)
+                    return false;
+            }
+            return true;
+        }
+        // 按写入顺序解压全部数据块，每个数据块的消息交给fn处理，fn返回false时停止
+        bool scan(const std::function<bool(std::vector<Message> &)> &fn)
+        {
+            for (auto &idx : _index)
+            {
+                std::vector<Message> msgs;
+                if (decode(idx, idx.first_time, idx.last_time, msgs) == false)
+                    return false;
+                if (fn(msgs) == false)
+                    return false;
+            }
+            return true;
+        }
+        const std::string &path() const { return _path; }
+
+    private:
+        bool decode(const ArchiveBlockIndex &idx, int64_t stime, int64_t etime, std::vector<Message> &res)
+        {
+            std::string raw(idx.raw_size, '\0');
+            size_t n = ZSTD_decompress(&raw[0], raw.size(), _data + idx.offset, idx.zsize);
+            if (ZSTD_isError(n) || n != idx.raw_size)
+            {
+                LOG_ERROR("解压归档文件{}的数据块失败！", _path);
+                return false;
+            }
+            try
+            {
+                archive_codec::Reader reader(raw.data(), raw.size());
+                size_t rows = reader.varint();
+                std::vector<int64_t> times(rows);
+                std::vector<int64_t> seqs(rows);
+                std::vector<uint8_t> types(rows);
+                int64_t t = idx.first_time;
+                for (size_t i = 0; i < rows; ++i)
+                    times[i] = t += reader.svarint();
+                int64_t seq = 0;
+                for (size_t i = 0; i < rows; ++i)
+                    seqs[i] = seq += reader.svarint();
+                for (size_t i = 0; i < rows; ++i)
+                    types[i] = reader.byte();
+                std::vector<std::string> dict(reader.varint());
+                for (auto &uid : dict)
+                    uid = reader.string();
+                std::vector<size_t> refs(rows);
+                for (size_t i = 0; i < rows; ++i)
+                {
+                    refs[i] = reader.varint();
+                    if (refs[i] >= dict.size())
+                        throw std::runtime_error("发送者字典下标越界");
+                }
+                std::vector<Message> msgs;
+                msgs.reserve(rows);
+                for (size_t i = 0; i < rows; ++i)
+                {
+                    msgs.emplace_back(reader.string(), idx.session_id, dict[refs[i]], types[i],
+                                      boost::posix_time::from_time_t(times[i]));
+                    msgs.back().seq(seqs[i]);
+                }
+                for (size_t i = 0; i < rows; ++i)
+                {
+                    std::string content = reader.string();
+                    if (!content.empty())
+                        msgs[i].content(content);
+                }
+                for (size_t i = 0; i < rows; ++i)
+                {
+                    std::string file_id = reader.string();
+                    if (!file_id.empty())
+                        msgs[i].file_id(file_id);
+                }
+                for (size_t i = 0; i < rows; ++i)
+                {
+                    std::string file_name = reader.string();
+                    if (!file_name.empty())
+                        msgs[i].file_name(file_name);
+                }
+                for (size_t i = 0; i < rows; ++i)
+                {
+                    unsigned int file_size = reader.varint();
+                    if (file_size != 0)
+                        msgs[i].file_size(file_size);
+                }
+                for (size_t i = 0; i < rows; ++i)
+                {
+                    if (times[i] >= stime && times[i] <= etime)
+                        res.push_back(std::move(msgs[i]));
+                }
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("解析归档文件{}的数据块失败：{}", _path, e.what());
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        std::string _path;
+        int _fd;
+        char *_data;
+        size_t _size;
+        std::vector<ArchiveBlockIndex> _index;
+    };
+
+    // 归档目录管理：将消息表中某个时间区间的消息写成归档文件，并为历史消息查询提供读取接口
+    //  文件名为 [分库名_]<起始时间>_<结束时间>.marc，启动时加载目录下已有的全部归档文件，
+    //  之后由后台线程周期性扫描目录，加载离线归档工具新写入(或重新生成)的文件
+    //  归档后的消息从数据库中删除，只能从归档文件中读到，因此所有存储实例与归档工具必须使用同一个共享目录，
+    //  由verify校验：目录中的标记文件与数据库中登记的目录标识一致才允许使用
+    class MessageArchive
+    {
+    public:
+        using ptr = std::shared_ptr<MessageArchive>;
+        MessageArchive(const std::string &dir, int level = 3)
+            : _dir(dir), _level(level), _boundary(boost::posix_time::min_date_time), _running(false) {}
+        ~MessageArchive() { stop(); }
+        bool init()
+        {
+            boost::system::error_code ec;
+            boost::filesystem::create_directories(_dir, ec);
+            if (ec)
+            {
+                LOG_ERROR("创建归档目录{}失败：{}", _dir, ec.message());
+                return false;
+            }
+            return rescan();
+        }
+        // 校验归档目录是所有实例共享的同一个目录
+        //  目录中的 .archive_id 保存目录标识，第一个使用该目录的实例生成；数据库中登记第一个实例的目录标识，
+        //  之后的实例看到的标识不同说明使用的是各自的本地目录，这时归档文件只有写入的实例能读到，拒绝启动
+        bool verify(const std::shared_ptr<odb::core::database> &db)
+        {
+            std::string local;
+            if (_marker(local) == false)
+                return false;
+            std::string owner;
+            try
+            {
+                odb::transaction trans(db->begin());
+                db->execute("CREATE TABLE IF NOT EXISTS message_archive_meta "
+                            "(id INT PRIMARY KEY, archive_id VARCHAR(64) NOT NULL)");
+                db->execute("INSERT IGNORE INTO message_archive_meta (id, archive_id) VALUES (1, '" + local + "')");
+                trans.commit();
+                // 单值查询直接使用底层连接执行
+                auto mysql_db = std::static_pointer_cast<odb::mysql::database>(db);
+                odb::mysql::connection_ptr conn(mysql_db->connection());
+                MYSQL *handle = conn->handle();
+                if (mysql_query(handle, "SELECT archive_id FROM message_archive_meta WHERE id = 1") != 0)
+                {
+                    LOG_ERROR("读取归档目录标识失败：{}", mysql_error(handle));
+                    return false;
+                }
+                MYSQL_RES *res = mysql_store_result(handle);
+                if (res == nullptr)
+                {
+                    LOG_ERROR("读取归档目录标识失败：{}", mysql_error(handle));
+                    return false;
+                }
+                MYSQL_ROW row = mysql_fetch_row(res);
+                if (row && row[0])
+                    owner = row[0];
+                mysql_free_result(res);
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("登记归档目录标识失败：{}", e.what());
+                return false;
+            }
+            if (owner != local)
+            {
+                LOG_ERROR("归档目录{}的标识{}与已登记的{}不同，所有存储实例与归档工具必须使用同一个共享的归档目录！",
+                          _dir, local, owner);
+                return false;
+            }
+            return true;
+        }
+        // 扫描归档目录，加载新出现或内容发生变化(修改时间、大小不同)的归档文件
+        bool rescan()
+        {
+            boost::system::error_code ec;
+            for (boost::filesystem::directory_iterator it(_dir, ec), end; !ec && it != end; it.increment(ec))
+            {
+                if (it->path().extension() != ".marc")
+                    continue;
+                std::string path = it->path().string();
+                struct stat st;
+                if (stat(path.c_str(), &st) == -1)
+                    continue;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    auto sit = _stamps.find(path);
+                    if (sit != _stamps.end() && sit->second == Stamp{st.st_mtime, (size_t)st.st_size})
+                        continue;
+                }
+                load(path);
+            }
+            if (ec)
+                LOG_ERROR("扫描归档目录{}失败：{}", _dir, ec.message());
+            return !ec;
+        }
+        // 启动后台线程按interval周期扫描归档目录
+        void start(const std::chrono::seconds &interval)
+        {
+            std::unique_lock<std::mutex> lock(_thread_mutex);
+            if (_running)
+                return;
+            _running = true;
+            _thread = std::thread([this, interval]()
+                                  {
+                std::unique_lock<std::mutex> lock(_thread_mutex);
+                while (_running)
+                {
+                    _cond.wait_for(lock, interval, [this]() { return !_running; });
+                    if (!_running)
+                        break;
+                    lock.unlock();
+                    rescan();
+                    lock.lock();
+                } });
+        }
+        void stop()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_thread_mutex);
+                if (!_running)
+                    return;
+                _running = false;
+            }
+            _cond.notify_all();
+            if (_thread.joinable())
+                _thread.join();
+        }
+        // 归档create_time处于[begin, end)区间内的全部消息，先写临时文件，落盘后再重命名
+        //  file不为空时返回写入的归档文件路径，区间内没有消息时不生成文件，路径为空
+        bool archive(const std::shared_ptr<odb::core::database> &db,
+                     const boost::posix_time::ptime &begin, const boost::posix_time::ptime &end,
+                     const std::string &tag = "", std::string *file = nullptr)
+        {
+            if (file)
+                file->clear();
+            std::string name = (tag.empty() ? std::string() : tag + "_") + boost::posix_time::to_iso_string(begin) + "_" + boost::posix_time::to_iso_string(end) + ".marc";
+            std::string path = (boost::filesystem::path(_dir) / name).string();
+            std::string tmp = path + ".tmp";
+            ArchiveWriter writer(tmp, _level);
+            if (writer.open() == false)
+                return false;
+            // 任何一步失败都删除临时文件，不在归档目录中留下残缺的文件
+            try
+            {
+                odb::transaction trans(db->begin());
+                typedef odb::query<Message> query;
+                typedef odb::result<Message> result;
+                result r(db->query<Message>((query::create_time >= begin && query::create_time < end) +
+                                            "ORDER BY" + query::session_key + "," + query::create_time + "," + query::seq));
+                for (auto it = r.begin(); it != r.end(); it++)
+                {
+                    if (writer.append(*it) == false)
+                    {
+                        writer.discard();
+                        return false;
+                    }
+                }
+                trans.commit();
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("读取待归档消息失败 [{}:{}]：{}", boost::posix_time::to_simple_string(begin),
+                          boost::posix_time::to_simple_string(end), e.what());
+                writer.discard();
+                return false;
+            }
+            if (writer.finish() == false)
+            {
+                writer.discard();
+                return false;
+            }
+            if (writer.rows() == 0)
+            {
+                writer.discard();
+                return true;
+            }
+            if (rename(tmp.c_str(), path.c_str()) != 0)
+            {
+                LOG_ERROR("重命名归档文件{}失败：{}", path, strerror(errno));
+                writer.discard();
+                return false;
+            }
+            LOG_INFO("归档消息{}条到文件{}", writer.rows(), path);
+            if (load(path, end) == false)
+                return false;
+            if (file)
+                *file = path;
+            return true;
+        }
+        // 从消息表中删除归档文件中的消息：只删除确实写入了归档文件的行，
+        //  归档之后才写入的、时间落在归档区间内的迟到消息保留在消息表中
+        bool purge(const std::shared_ptr<odb::core::database> &db, const std::string &path)
+        {
+            ArchiveFile file(path);
+            if (file.open() == false)
+                return false;
+            MessageTable table(db);
+            size_t total = 0;
+            bool ret = file.scan([&table, &total](std::vector<Message> &msgs)
+                                 {
+                std::vector<std::string> mids;
+                mids.reserve(msgs.size());
+                for (auto &msg : msgs)
+                    mids.push_back(msg.message_id());
+                if (table.remove_messages(mids) == false)
+                    return false;
+                total += mids.size();
+                return true; });
+            if (ret == false)
+            {
+                LOG_ERROR("删除归档文件{}中的消息失败，已删除{}条！", path, total);
+                return false;
+            }
+            LOG_INFO("已从消息表中删除归档文件{}中的{}条消息", path, total);
+            return true;
+        }
+        // 从全部归档文件中获取会话在[stime, etime]区间内的消息，按时间和序号排序
+        //  任何一个归档文件读取失败都返回false，不返回残缺的历史
+        bool range(const std::string &ssid, const boost::posix_time::ptime &stime,
+                   const boost::posix_time::ptime &etime, std::vector<Message> &res)
+        {
+            std::vector<ArchiveFile::ptr> files;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                files = _files;
+            }
+            int64_t s = boost::posix_time::to_time_t(stime);
+            int64_t e = boost::posix_time::to_time_t(etime);
+            for (auto &file : files)
+            {
+                if (file->range(ssid, s, e, res) == false)
+                    return false;
+            }
+            std::stable_sort(res.begin(), res.end(), [](const Message &a, const Message &b)
+                             { return a.create_time() != b.create_time() ? a.create_time() < b.create_time() : a.seq() < b.seq(); });
+            return true;
+        }
+        // 已归档数据的时间上界，早于该时间的查询才需要读取归档文件
+        boost::posix_time::ptime boundary()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            return _boundary;
+        }
+
+    private:
+        // 读取目录标识，目录中还没有标识时生成一个：先写临时文件再以link发布，
+        //  link在目标已存在时失败，多个实例同时初始化同一个共享目录时只有一个标识生效
+        bool _marker(std::string &id)
+        {
+            std::string path = (boost::filesystem::path(_dir) / ".archive_id").string();
+            if (!boost::filesystem::exists(path))
+            {
+                std::random_device rd;
+                char buf[32];
+                snprintf(buf, sizeof(buf), "%08x%08x", rd(), rd());
+                std::string tmp = path + "." + buf;
+                {
+                    std::ofstream ofs(tmp, std::ios::trunc);
+                    ofs << buf;
+                    if (!ofs.good())
+                    {
+                        LOG_ERROR("写入归档目录标识{}失败！", tmp);
+                        return false;
+                    }
+                }
+                if (link(tmp.c_str(), path.c_str()) != 0 && errno != EEXIST)
+                {
+                    LOG_ERROR("发布归档目录标识{}失败：{}", path, strerror(errno));
+                    unlink(tmp.c_str());
+                    return false;
+                }
+                unlink(tmp.c_str());
+            }
+            std::ifstream ifs(path);
+            std::getline(ifs, id);
+            if (id.empty())
+            {
+                LOG_ERROR("读取归档目录标识{}失败！", path);
+                return false;
+            }
+            return true;
+        }
+        bool load(const std::string &path, boost::posix_time::ptime end = boost::posix_time::not_a_date_time)
+        {
+            struct stat st;
+            if (stat(path.c_str(), &st) == -1)
+            {
+                LOG_ERROR("获取归档文件{}信息失败：{}", path, strerror(errno));
+                return false;
+            }
+            auto file = std::make_shared<ArchiveFile>(path);
+            if (file->open() == false)
+                return false;
+            if (end.is_not_a_date_time())
+            {
+                // 从文件名中解析结束时间
+                std::string stem = boost::filesystem::path(path).stem().string();
+                auto pos = stem.rfind('_');
+                try
+                {
+                    end = boost::posix_time::from_iso_string(stem.substr(pos + 1));
+                }
+                catch (const std::exception &e)
+                {
+                    LOG_ERROR("归档文件名{}格式错误：{}", path, e.what());
+                    return false;
+                }
+            }
+            // 同名文件重新生成时替换旧的映射，查询中仍在使用的旧文件由共享指针保证在用完后才释放
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto it = std::find_if(_files.begin(), _files.end(), [&path](const ArchiveFile::ptr &f)
+                                   { return f->path() == path; });
+            if (it != _files.end())
+                *it = file;
+            else
+                _files.push_back(file);
+            _stamps[path] = Stamp{st.st_mtime, (size_t)st.st_size};
+            if (_boundary < end)
+                _boundary = end;
+            LOG_INFO("加载归档文件{}", path);
+            return true;
+        }
+
+    private:
+        struct Stamp
+        {
+            time_t mtime;
+            size_t size;
+            bool operator==(const Stamp &o) const { return mtime == o.mtime && size == o.size; }
+        };
+        std::string _dir;
+        int _level;
+        std::mutex _mutex;
+        std::vector<ArchiveFile::ptr> _files;
+        std::unordered_map<std::string, Stamp> _stamps; // 已加载文件的修改时间与大小
+        boost::posix_time::ptime _boundary;
+
+        bool _running;
+        std::mutex _thread_mutex;
+        std::condition_variable _cond;
+        std::thread _thread;
+    };
+}
@@ -0,0 +1,1098 @@
+#pragma once
+#include "message_search.hpp"
+#include "message_archive.hpp" // 复用archive_codec中的变长整数编解码
+#include "logger.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace lbk
+{
+    // 内嵌的消息全文索引，不依赖ES即可提供会话内的消息检索
+    //  1. 分词：连续的中日韩文字切分为单字与相邻二元组(bigram)，字母数字串转小写后作为一个词；
+    //     检索时长度不小于2的中文串只用二元组，所有词项取交集
+    //  2. 倒排表按 会话ID + 词项 组织，检索只在一个会话内进行
+    //  3. 新消息先写入预写日志并进入内存缓冲区，条数或时间达到阈值后落盘为只读的段文件；
+    //     段文件mmap映射，段数量超过上限时后台线程合并相邻的段
+    //  4. 文档编号全局递增，每个段覆盖一段连续的编号，倒排表内的编号有序，求交集时按块做SIMD比较
+    //  5. 新消息由实例独占的广播队列写入，实例停机期间的消息收不到，启动后由backfill从数据库补齐；
+    //     补齐与广播可能重复写入同一条消息，检索结果按消息ID去重
+    namespace text_index
+    {
+        static const uint32_t MAGIC = 0x5844494d; // "MIDX"
+        static const uint32_t VERSION = 1;
+        static const size_t FOOTER_SIZE = 56;
+        static const char KEY_SEP = '\x1f';
+
+        inline bool is_cjk(uint32_t cp)
+        {
+            return (cp >= 0x4E00 && cp <= 0x9FFF) || (cp >= 0x3400 && cp <= 0x4DBF) ||
+                   (cp >= 0x3040 && cp <= 0x30FF) || (cp >= 0xAC00 && cp <= 0xD7AF) ||
+                   (cp >= 0xF900 && cp <= 0xFAFF) || (cp >= 0x20000 && cp <= 0x2FFFF);
+        }
+        // 解码一个UTF-8字符，返回其字节数，非法字节按单字节处理
+        inline size_t decode(const std::string &text, size_t pos, uint32_t &cp)
+        {
+            unsigned char c = text[pos];
+            size_t len = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xE ? 3 : (c >> 3) == 0x1E ? 4 : 1;
+            if (pos + len > text.size())
+                len = 1;
+            if (len == 1)
+            {
+                cp = c;
+                return 1;
+            }
+            cp = c & (0xFF >> (len + 1));
+            for (size_t i = 1; i < len; ++i)
+                cp = (cp << 6) | (text[pos + i] & 0x3F);
+            return len;
+        }
+        // 单词字符：ASCII字母数字，以及中日韩文字与全角/中文标点以外的非ASCII字符
+        inline bool is_word(uint32_t cp)
+        {
+            if (cp < 0x80)
+                return isalnum(cp);
+            return !(cp >= 0x3000 && cp <= 0x303F) && !(cp >= 0xFF00 && cp <= 0xFFEF) && !(cp >= 0x2000 && cp <= 0x206F);
+        }
+        // 把文本切分为连续的中文串与单词串，单词中的ASCII字母转为小写
+        inline void split(const std::string &text, std::vector<std::pair<std::string, bool>> &runs)
+        {
+            std::string cur;
+            bool cur_cjk = false;
+            for (size_t pos = 0; pos < text.size();)
+            {
+                uint32_t cp;
+                size_t len = decode(text, pos, cp);
+                bool cjk = is_cjk(cp);
+                if (!cjk && !is_word(cp))
+                {
+                    if (!cur.empty())
+                        runs.emplace_back(std::move(cur), cur_cjk);
+                    cur.clear();
+                }
+                else
+                {
+                    if (!cur.empty() && cjk != cur_cjk)
+                    {
+                        runs.emplace_back(std::move(cur), cur_cjk);
+                        cur.clear();
+                    }
+                    cur_cjk = cjk;
+                    if (len == 1)
+                        cur += (char)tolower(text[pos]);
+                    else
+                        cur.append(text, pos, len);
+                }
+                pos += len;
+            }
+            if (!cur.empty())
+                runs.emplace_back(std::move(cur), cur_cjk);
+        }
+        // 生成词项：query为false时用于建索引，中文串的每个单字与二元组都是词项
+        inline void tokenize(const std::string &text, std::vector<std::string> &terms, bool query)
+        {
+            std::vector<std::pair<std::string, bool>> runs;
+            split(text, runs);
+            for (auto &run : runs)
+            {
+                if (!run.second)
+                {
+                    terms.push_back(run.first);
+                    continue;
+                }
+                std::vector<size_t> starts;
+                for (size_t pos = 0; pos < run.first.size();)
+                {
+                    uint32_t cp;
+                    starts.push_back(pos);
+                    pos += decode(run.first, pos, cp);
+                }
+                starts.push_back(run.first.size());
+                size_t chars = starts.size() - 1;
+                for (size_t i = 0; i < chars; ++i)
+                {
+                    if (!query || chars == 1)
+                        terms.push_back(run.first.substr(starts[i], starts[i + 1] - starts[i]));
+                    if (i + 1 < chars)
+                        terms.push_back(run.first.substr(starts[i], starts[i + 2] - starts[i]));
+                }
+            }
+            std::sort(terms.begin(), terms.end());
+            terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+        }
+        inline std::string key(const std::string &ssid, const std::string &term)
+        {
+            std::string res;
+            res.reserve(ssid.size() + term.size() + 1);
+            res.append(ssid).push_back(KEY_SEP);
+            res.append(term);
+            return res;
+        }
+
+        // 有序无重复编号列表求交集
+        //  长度相差悬殊时对长表二分查找；否则每次拿短表的一个元素与长表的4个元素并行比较：
+        //  长表当前块的最大值小于该元素时整块跳过，否则该元素若存在必在当前块内
+        inline void intersect(const std::vector<uint32_t> &x, const std::vector<uint32_t> &y, std::vector<uint32_t> &out)
+        {
+            out.clear();
+            const std::vector<uint32_t> &a = x.size() <= y.size() ? x : y;
+            const std::vector<uint32_t> &b = x.size() <= y.size() ? y : x;
+            size_t na = a.size(), nb = b.size();
+            size_t i = 0, j = 0;
+            if (na * 64 < nb)
+            {
+                for (; i < na; ++i)
+                {
+                    j = std::lower_bound(b.begin() + j, b.end(), a[i]) - b.begin();
+                    if (j == nb)
+                        break;
+                    if (b[j] == a[i])
+                        out.push_back(a[i]);
+                }
+                return;
+            }
+#ifdef __SSE2__
+            while (i < na && j + 4 <= nb)
+            {
+                if (b[j + 3] < a[i])
+                {
+                    j += 4;
+                    continue;
+                }
+                __m128i va = _mm_set1_epi32((int)a[i]);
+                __m128i vb = _mm_loadu_si128((const __m128i *)(b.data() + j));
+                if (_mm_movemask_epi8(_mm_cmpeq_epi32(va, vb)) != 0)
+                    out.push_back(a[i]);
+                ++i;
+            }
+#endif
+            while (i < na && j < nb)
+            {
+                if (a[i] < b[j])
+                    ++i;
+                else if (b[j] < a[i])
+                    ++j;
+                else
+                {
+                    out.push_back(a[i]);
+                    ++i;
+                    ++j;
+                }
+            }
+        }
+
+        // 被索引的一条消息
+        struct Doc
+        {
+            int64_t create_time = 0;
+            std::string message_id;
+            std::string user_id;
+            std::string session_id;
+            std::string content;
+        };
+        // 文档记录：消息ID在最前，排序时只需解码消息ID
+        inline void encode_doc(std::string &out, const Doc &doc)
+        {
+            archive_codec::put_string(out, doc.message_id);
+            archive_codec::put_string(out, doc.user_id);
+            archive_codec::put_string(out, doc.session_id);
+            archive_codec::put_string(out, doc.content);
+        }
+        inline void decode_doc(archive_codec::Reader &reader, Doc &doc)
+        {
+            doc.message_id = reader.string();
+            doc.user_id = reader.string();
+            doc.session_id = reader.string();
+            doc.content = reader.string();
+        }
+
+        // 段文件格式(.midx)
+        //  [文档记录...][文档表][倒排表...][词典][词典偏移表][文件尾]
+        //  文档表：每个文档一项 - 时间(8) | 记录偏移(8)
+        //  倒排表：编号个数 | 相对段起始编号的增量编码
+        //  词典：按键排序 - 键(会话ID 0x1f 词项) | 倒排表偏移；词典偏移表为每个词典项的偏移(8)，用于二分查找
+        //  文件尾：起始编号(4) | 文档数(4) | 文档表偏移(8) | 倒排表偏移(8) | 词典偏移(8) | 词典偏移表偏移(8) | 词项数(8) | 版本(4) | 魔数(4)
+        inline bool write_segment(const std::string &path, uint32_t base, const std::vector<std::pair<int64_t, std::string>> &docs,
+                                  const std::map<std::string, std::vector<uint32_t>> &postings)
+        {
+            std::string data;
+            std::vector<uint64_t> offsets;
+            offsets.reserve(docs.size());
+            for (auto &doc : docs)
+            {
+                offsets.push_back(data.size());
+                data.append(doc.second);
+            }
+            uint64_t table_off = data.size();
+            for (size_t i = 0; i < docs.size(); ++i)
+            {
+                archive_codec::put_fixed<int64_t>(data, docs[i].first);
+                archive_codec::put_fixed<uint64_t>(data, offsets[i]);
+            }
+            uint64_t post_off = data.size();
+            std::vector<uint64_t> post_offsets;
+            post_offsets.reserve(postings.size());
+            for (auto &entry : postings)
+            {
+                post_offsets.push_back(data.size() - post_off);
+                archive_codec::put_varint(data, entry.second.size());
+                uint32_t prev = base;
+                for (uint32_t id : entry.second)
+                {
+                    archive_codec::put_varint(data, id - prev);
+                    prev = id;
+                }
+            }
+            uint64_t dict_off = data.size();
+            std::vector<uint64_t> dict_offsets;
+            dict_offsets.reserve(postings.size());
+            size_t n = 0;
+            for (auto &entry : postings)
+            {
+                dict_offsets.push_back(data.size() - dict_off);
+                archive_codec::put_string(data, entry.first);
+                archive_codec::put_varint(data, post_offsets[n++]);
+            }
+            uint64_t dict_idx_off = data.size();
+            for (uint64_t off : dict_offsets)
+                archive_codec::put_fixed<uint64_t>(data, off);
+            archive_codec::put_fixed<uint32_t>(data, base);
+            archive_codec::put_fixed<uint32_t>(data, (uint32_t)docs.size());
+            archive_codec::put_fixed<uint64_t>(data, table_off);
+            archive_codec::put_fixed<uint64_t>(data, post_off);
+            archive_codec::put_fixed<uint64_t>(data, dict_off);
+            archive_codec::put_fixed<uint64_t>(data, dict_idx_off);
+            archive_codec::put_fixed<uint64_t>(data, (uint64_t)postings.size());
+            archive_codec::put_fixed<uint32_t>(data, VERSION);
+            archive_codec::put_fixed<uint32_t>(data, MAGIC);
+
+            // 先写临时文件并落盘，再改名为正式文件，避免留下不完整的段
+            std::string tmp = path + ".tmp";
+            FILE *fp = fopen(tmp.c_str(), "wb");
+            if (fp == nullptr)
+            {
+                LOG_ERROR("创建索引段文件{}失败：{}", tmp, strerror(errno));
+                return false;
+            }
+            bool ok = fwrite(data.data(), 1, data.size(), fp) == data.size() && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+            fclose(fp);
+            if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+            {
+                LOG_ERROR("写入索引段文件{}失败：{}", path, strerror(errno));
+                unlink(tmp.c_str());
+                return false;
+            }
+            return true;
+        }
+    }
+
+    // 只读的索引段：mmap映射整个文件
+    class IndexSegment
+    {
+    public:
+        using ptr = std::shared_ptr<IndexSegment>;
+        IndexSegment(const std::string &path) : _path(path), _fd(-1), _data(nullptr), _size(0), _removed(false) {}
+        ~IndexSegment()
+        {
+            if (_data)
+                munmap((void *)_data, _size);
+            if (_fd >= 0)
+                close(_fd);
+            // 合并后被替换的段在没有检索引用之后才删除文件
+            if (_removed)
+                unlink(_path.c_str());
+        }
+        bool open()
+        {
+            _fd = ::open(_path.c_str(), O_RDONLY);
+            struct stat st;
+            if (_fd < 0 || fstat(_fd, &st) != 0 || (size_t)st.st_size < text_index::FOOTER_SIZE)
+            {
+                LOG_ERROR("打开索引段文件{}失败！", _path);
+                return false;
+            }
+            _size = st.st_size;
+            void *data = mmap(nullptr, _size, PROT_READ, MAP_SHARED, _fd, 0);
+            if (data == MAP_FAILED)
+            {
+                _data = nullptr;
+                LOG_ERROR("映射索引段文件{}失败：{}", _path, strerror(errno));
+                return false;
+            }
+            _data = (const char *)data;
+            try
+            {
+                archive_codec::Reader footer(_data + _size - text_index::FOOTER_SIZE, text_index::FOOTER_SIZE);
+                _base = footer.fixed<uint32_t>();
+                _count = footer.fixed<uint32_t>();
+                _table_off = footer.fixed<uint64_t>();
+                _post_off = footer.fixed<uint64_t>();
+                _dict_off = footer.fixed<uint64_t>();
+                _dict_idx_off = footer.fixed<uint64_t>();
+                _terms = footer.fixed<uint64_t>();
+                uint32_t version = footer.fixed<uint32_t>();
+                uint32_t magic = footer.fixed<uint32_t>();
+                if (magic != text_index::MAGIC || version != text_index::VERSION ||
+                    _dict_idx_off + _terms * 8 + text_index::FOOTER_SIZE != _size)
+                {
+                    LOG_ERROR("索引段文件{}格式错误！", _path);
+                    return false;
+                }
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("索引段文件{}格式错误：{}", _path, e.what());
+                return false;
+            }
+            return true;
+        }
+        const std::string &path() const { return _path; }
+        uint32_t base() const { return _base; }
+        uint32_t end() const { return _base + _count; }
+        uint32_t count() const { return _count; }
+        void remove() { _removed = true; }
+        // 段内最晚的消息时间，段为空时为0
+        int64_t max_time() const
+        {
+            int64_t ret = 0;
+            for (uint32_t id = _base; id < end(); ++id)
+                ret = std::max(ret, time(id));
+            return ret;
+        }
+        // 查找词项的倒排表，返回全局文档编号
+        bool postings(const std::string &key, std::vector<uint32_t> &ids) const
+        {
+            ids.clear();
+            size_t lo = 0, hi = _terms;
+            while (lo < hi)
+            {
+                size_t mid = (lo + hi) / 2;
+                uint64_t post;
+                int cmp = _key_at(mid, post).compare(key);
+                if (cmp == 0)
+                {
+                    archive_codec::Reader reader(_data + _post_off + post, _dict_off - _post_off - post);
+                    size_t n = reader.varint();
+                    ids.reserve(n);
+                    uint32_t prev = _base;
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        prev += (uint32_t)reader.varint();
+                        ids.push_back(prev);
+                    }
+                    return true;
+                }
+                if (cmp < 0)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            return false;
+        }
+        int64_t time(uint32_t id) const
+        {
+            int64_t val;
+            memcpy(&val, _data + _table_off + (size_t)(id - _base) * 16, 8);
+            return val;
+        }
+        std::string message_id(uint32_t id) const
+        {
+            archive_codec::Reader reader = _record(id);
+            return reader.string();
+        }
+        void doc(uint32_t id, text_index::Doc &doc) const
+        {
+            archive_codec::Reader reader = _record(id);
+            text_index::decode_doc(reader, doc);
+            doc.create_time = time(id);
+        }
+        // 遍历所有文档与词项，用于段合并
+        void docs(std::vector<std::pair<int64_t, std::string>> &out) const
+        {
+            for (uint32_t id = _base; id < end(); ++id)
+            {
+                uint64_t off, next;
+                memcpy(&off, _data + _table_off + (size_t)(id - _base) * 16 + 8, 8);
+                if (id + 1 < end())
+                    memcpy(&next, _data + _table_off + (size_t)(id + 1 - _base) * 16 + 8, 8);
+                else
+                    next = _table_off;
+                out.emplace_back(time(id), std::string(_data + off, next - off));
+            }
+        }
+        void terms(std::map<std::string, std::vector<uint32_t>> &out) const
+        {
+            std::vector<uint32_t> ids;
+            for (size_t i = 0; i < _terms; ++i)
+            {
+                uint64_t post;
+                std::string key = _key_at(i, post);
+                postings(key, ids);
+                auto &list = out[key];
+                list.insert(list.end(), ids.begin(), ids.end());
+            }
+        }
+
+    private:
+        std::string _key_at(size_t i, uint64_t &post) const
+        {
+            uint64_t off;
+            memcpy(&off, _data + _dict_idx_off + i * 8, 8);
+            archive_codec::Reader reader(_data + _dict_off + off, _dict_idx_off - _dict_off - off);
+            std::string key = reader.string();
+            post = reader.varint();
+            return key;
+        }
+        archive_codec::Reader _record(uint32_t id) const
+        {
+            uint64_t off;
+            memcpy(&off, _data + _table_off + (size_t)(id - _base) * 16 + 8, 8);
+            return archive_codec::Reader(_data + off, _table_off - off);
+        }
+
+    private:
+        std::string _path;
+        int _fd;
+        const char *_data;
+        size_t _size;
+        bool _removed;
+        uint32_t _base = 0;
+        uint32_t _count = 0;
+        uint64_t _table_off = 0;
+        uint64_t _post_off = 0;
+        uint64_t _dict_off = 0;
+        uint64_t _dict_idx_off = 0;
+        uint64_t _terms = 0;
+    };
+
+    class LocalMessageIndex : public MessageSearcher
+    {
+    public:
+        using ptr = std::shared_ptr<LocalMessageIndex>;
+        // 补齐的数据源：将产生时间不早于since(秒)的全部文本消息逐条交给回调，回调返回false时停止，读取失败或中途停止返回false
+        using Source = std::function<bool(int64_t since, const std::function<bool(const Message &)> &cb)>;
+        // flush_docs/flush_interval_ms: 内存缓冲区落盘的条数与时间阈值；max_segments: 段数量超过时触发合并
+        LocalMessageIndex(const std::string &dir, size_t flush_docs = 10000, int flush_interval_ms = 5000, size_t max_segments = 8)
+            : _dir(dir), _flush_docs(flush_docs), _flush_interval(flush_interval_ms), _max_segments(max_segments),
+              _next(0), _max_time(0), _wal(nullptr), _running(false)
+        {
+        }
+        ~LocalMessageIndex()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _running = false;
+            }
+            _cond.notify_all();
+            if (_backfill_thread.joinable())
+                _backfill_thread.join();
+            if (_thread.joinable())
+                _thread.join();
+            if (_wal)
+                fclose(_wal);
+        }
+        // 加载已有的段文件并重放预写日志，然后启动后台落盘与合并线程
+        bool createIndex() override
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_running)
+                return true;
+            try
+            {
+                boost::filesystem::create_directories(_dir);
+                if (!_load_segments() || !_replay())
+                    return false;
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("加载本地消息索引{}失败：{}", _dir, e.what());
+                return false;
+            }
+            if (!_open_wal())
+                return false;
+            _running = true;
+            _last_flush = std::chrono::steady_clock::now();
+            _thread = std::thread(&LocalMessageIndex::_background, this);
+            LOG_INFO("本地消息索引加载完成：{}个段，{}条消息", _segments.size(), _next);
+            return true;
+        }
+        bool appendData(const std::string &user_id, const std::string &message_id, const std::string &chat_session_id,
+                        const long create_time, const std::string &content) override
+        {
+            text_index::Doc doc;
+            doc.create_time = create_time;
+            doc.message_id = message_id;
+            doc.user_id = user_id;
+            doc.session_id = chat_session_id;
+            doc.content = content;
+            std::string record;
+            archive_codec::put_svarint(record, doc.create_time);
+            text_index::encode_doc(record, doc);
+
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (!_running)
+            {
+                LOG_ERROR("本地消息索引尚未初始化！");
+                return false;
+            }
+            // 先写预写日志，进程崩溃后重启时重放
+            std::string entry;
+            archive_codec::put_varint(entry, record.size());
+            entry += record;
+            if (fwrite(entry.data(), 1, entry.size(), _wal) != entry.size() || fflush(_wal) != 0)
+            {
+                LOG_ERROR("写入本地消息索引日志失败：{}", strerror(errno));
+                return false;
+            }
+            _add(_mem, doc);
+            if (_mem->docs.size() >= _flush_docs)
+                _cond.notify_one();
+            return true;
+        }
+        // 已索引消息中最晚的产生时间(秒)，索引为空时为0
+        int64_t last_time()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            return _max_time;
+        }
+        // 在后台线程中从数据源补齐停机期间(或新实例没有)的消息，须在订阅广播队列之后调用：
+        //  从已索引的最晚时间往前overlap秒开始读取，覆盖停机前还没有送达的乱序消息；读取失败时每隔retry重试
+        void backfill(const Source &source, int64_t overlap, const std::chrono::seconds &retry)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (!_running || _backfill_thread.joinable())
+                return;
+            int64_t since = _max_time > overlap ? _max_time - overlap : 0;
+            _backfill_thread = std::thread([this, source, since, retry]()
+                                           {
+                std::unique_lock<std::mutex> lock(_mutex);
+                while (_running)
+                {
+                    lock.unlock();
+                    size_t count = 0;
+                    bool ok = source(since, [this, &count](const Message &msg)
+                                     {
+                        if (!appendData(msg.user_id(), msg.message_id(), msg.session_id(),
+                                        boost::posix_time::to_time_t(msg.create_time()), msg.content()))
+                            return false;
+                        ++count;
+                        return true; });
+                    lock.lock();
+                    if (ok)
+                    {
+                        LOG_INFO("本地消息索引从{}起补齐{}条消息", since, count);
+                        break;
+                    }
+                    LOG_ERROR("本地消息索引补齐失败，{}秒后重试", retry.count());
+                    _cond.wait_for(lock, retry, [this]() { return !_running; });
+                } });
+        }
+        std::vector<Message> search(const std::string &key, const std::string &ssid,
+                                    const MessageSearchPage &page, bool &has_more) override
+        {
+            has_more = false;
+            std::vector<std::string> terms;
+            text_index::tokenize(key, terms, true);
+            if (terms.empty())
+                return std::vector<Message>();
+            std::vector<std::string> keys;
+            for (auto &term : terms)
+                keys.push_back(text_index::key(ssid, term));
+
+            // 候选结果：时间、消息ID与所在位置，按(时间, 消息ID)倒序取前size+1条
+            std::vector<Hit> hits;
+            std::vector<IndexSegment::ptr> segments;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                segments = _segments;
+                if (_frozen)
+                    _search_mem(_frozen, keys, page, hits);
+                _search_mem(_mem, keys, page, hits);
+            }
+            std::vector<uint32_t> ids, list, tmp;
+            for (auto &segment : segments)
+            {
+                if (!_match(keys, ids, list, tmp, [&segment](const std::string &k, std::vector<uint32_t> &out)
+                            { return segment->postings(k, out); }))
+                    continue;
+                for (uint32_t id : ids)
+                {
+                    Hit hit;
+                    hit.time = segment->time(id);
+                    if (!page.after_id.empty() && hit.time > page.after_time)
+                        continue;
+                    hit.message_id = segment->message_id(id);
+                    if (!_before(hit, page))
+                        continue;
+                    hit.id = id;
+                    hit.segment = segment;
+                    hits.push_back(std::move(hit));
+                }
+            }
+            // 补齐与广播重复写入的消息时间与ID都相同，排序后相邻，只保留一条
+            std::sort(hits.begin(), hits.end(), [](const Hit &a, const Hit &b)
+                      { return a.time != b.time ? a.time > b.time : a.message_id > b.message_id; });
+            hits.erase(std::unique(hits.begin(), hits.end(), [](const Hit &a, const Hit &b)
+                                   { return a.time == b.time && a.message_id == b.message_id; }),
+                       hits.end());
+            size_t limit = std::min(hits.size(), (size_t)page.size + 1);
+            if (limit > (size_t)page.size)
+            {
+                has_more = true;
+                limit = page.size;
+            }
+            std::vector<Message> res;
+            std::vector<std::pair<std::string, bool>> runs;
+            if (page.highlight)
+                text_index::split(key, runs);
+            for (size_t i = 0; i < limit; ++i)
+            {
+                text_index::Doc doc;
+                if (hits[i].segment)
+                    hits[i].segment->doc(hits[i].id, doc);
+                else
+                    doc = hits[i].doc;
+                Message message;
+                message.user_id(doc.user_id);
+                message.message_id(doc.message_id);
+                message.create_time(boost::posix_time::from_time_t(doc.create_time));
+                message.session_id(doc.session_id);
+                message.content(page.highlight ? _highlight(doc.content, runs, page) : doc.content);
+                res.push_back(message);
+            }
+            return res;
+        }
+
+    private:
+        // 内存缓冲区：编号从base开始连续
+        struct MemBuffer
+        {
+            uint32_t base = 0;
+            std::vector<text_index::Doc> docs;
+            std::unordered_map<std::string, std::vector<uint32_t>> postings;
+            std::string wal_path;
+        };
+        struct Hit
+        {
+            int64_t time = 0;
+            std::string message_id;
+            uint32_t id = 0;
+            IndexSegment::ptr segment; // 为空时doc为内存缓冲区中文档的拷贝
+            text_index::Doc doc;
+        };
+        static bool _before(const Hit &hit, const MessageSearchPage &page)
+        {
+            if (page.after_id.empty())
+                return true;
+            return hit.time < page.after_time || (hit.time == page.after_time && hit.message_id < page.after_id);
+        }
+        // 对所有词项的倒排表求交集，从最短的表开始
+        template <typename F>
+        static bool _match(const std::vector<std::string> &keys, std::vector<uint32_t> &ids,
+                           std::vector<uint32_t> &list, std::vector<uint32_t> &tmp, F &&postings)
+        {
+            std::vector<std::vector<uint32_t>> lists(keys.size());
+            for (size_t i = 0; i < keys.size(); ++i)
+            {
+                if (!postings(keys[i], lists[i]) || lists[i].empty())
+                    return false;
+            }
+            std::sort(lists.begin(), lists.end(), [](const std::vector<uint32_t> &a, const std::vector<uint32_t> &b)
+                      { return a.size() < b.size(); });
+            ids.swap(lists[0]);
+            for (size_t i = 1; i < lists.size() && !ids.empty(); ++i)
+            {
+                text_index::intersect(ids, lists[i], tmp);
+                ids.swap(tmp);
+            }
+            return !ids.empty();
+        }
+        void _search_mem(const std::shared_ptr<MemBuffer> &mem, const std::vector<std::string> &keys,
+                         const MessageSearchPage &page, std::vector<Hit> &hits)
+        {
+            std::vector<uint32_t> ids, list, tmp;
+            bool found = _match(keys, ids, list, tmp, [&mem](const std::string &k, std::vector<uint32_t> &out)
+                                {
+                auto it = mem->postings.find(k);
+                if (it == mem->postings.end())
+                    return false;
+                out = it->second;
+                return true; });
+            if (!found)
+                return;
+            for (uint32_t id : ids)
+            {
+                const text_index::Doc &doc = mem->docs[id - mem->base];
+                Hit hit;
+                hit.time = doc.create_time;
+                hit.message_id = doc.message_id;
+                if (!_before(hit, page))
+                    continue;
+                hit.id = id;
+                hit.doc = doc;
+                hits.push_back(std::move(hit));
+            }
+        }
+        // 在命中的关键字前后加标记，只保留第一个命中位置附近fragment_size个字符
+        //  二元组命中时关键字不一定在原文中连续出现，找不到可标记的位置时返回原文
+        static std::string _highlight(const std::string &content, const std::vector<std::pair<std::string, bool>> &runs,
+                                      const MessageSearchPage &page)
+        {
+            std::string lower = content;
+            for (auto &c : lower)
+                c = (c & 0x80) ? c : (char)tolower(c);
+            // 标记所有命中的字节区间
+            std::vector<std::pair<size_t, size_t>> ranges;
+            for (auto &run : runs)
+            {
+                for (size_t pos = lower.find(run.first); pos != std::string::npos; pos = lower.find(run.first, pos + run.first.size()))
+                    ranges.emplace_back(pos, pos + run.first.size());
+            }
+            if (ranges.empty())
+                return content;
+            std::sort(ranges.begin(), ranges.end());
+            std::vector<std::pair<size_t, size_t>> merged;
+            for (auto &range : ranges)
+            {
+                if (!merged.empty() && range.first <= merged.back().second)
+                    merged.back().second = std::max(merged.back().second, range.second);
+                else
+                    merged.push_back(range);
+            }
+            // 以字符为单位确定片段窗口：第一个命中位置之前保留约三分之一
+            std::vector<size_t> starts;
+            for (size_t pos = 0; pos < content.size();)
+            {
+                uint32_t cp;
+                starts.push_back(pos);
+                pos += text_index::decode(content, pos, cp);
+            }
+            starts.push_back(content.size());
+            size_t first = std::lower_bound(starts.begin(), starts.end(), merged[0].first) - starts.begin();
+            size_t chars = starts.size() - 1;
+            size_t size = page.fragment_size > 0 ? page.fragment_size : chars;
+            size_t begin_char = first > size / 3 ? first - size / 3 : 0;
+            // 片段至少要包含第一个命中的关键字
+            size_t first_end = std::lower_bound(starts.begin(), starts.end(), merged[0].second) - starts.begin();
+            size_t end_char = std::min(chars, std::max(begin_char + size, first_end));
+            size_t begin = starts[begin_char], end = starts[end_char];
+
+            std::string res;
+            if (begin > 0)
+                res += "…";
+            size_t pos = begin;
+            for (auto &range : merged)
+            {
+                if (range.second <= begin || range.first >= end)
+                    continue;
+                size_t b = std::max(range.first, begin), e = std::min(range.second, end);
+                res.append(content, pos, b - pos);
+                res += page.pre_tag;
+                res.append(content, b, e - b);
+                res += page.post_tag;
+                pos = e;
+            }
+            res.append(content, pos, end - pos);
+            if (end < content.size())
+                res += "…";
+            return res;
+        }
+        void _add(const std::shared_ptr<MemBuffer> &mem, const text_index::Doc &doc)
+        {
+            uint32_t id = _next++;
+            std::vector<std::string> terms;
+            text_index::tokenize(doc.content, terms, false);
+            for (auto &term : terms)
+                mem->postings[text_index::key(doc.session_id, term)].push_back(id);
+            mem->docs.push_back(doc);
+            _max_time = std::max(_max_time, doc.create_time);
+        }
+        std::string _segment_path(uint32_t base, uint32_t end)
+        {
+            char name[64];
+            snprintf(name, sizeof(name), "seg_%010u_%010u.midx", base, end);
+            return _dir + "/" + name;
+        }
+        std::string _wal_path(uint32_t base)
+        {
+            char name[64];
+            snprintf(name, sizeof(name), "wal_%010u.log", base);
+            return _dir + "/" + name;
+        }
+        // 加载段文件：合并过程中崩溃时新旧段可能同时存在，保留覆盖范围最大的段，删除被其包含的段
+        bool _load_segments()
+        {
+            std::vector<IndexSegment::ptr> all;
+            for (boost::filesystem::directory_iterator it(_dir), end; it != end; ++it)
+            {
+                std::string name = it->path().filename().string();
+                if (it->path().extension() == ".tmp")
+                {
+                    boost::filesystem::remove(it->path());
+                    continue;
+                }
+                if (name.compare(0, 4, "seg_") != 0 || it->path().extension() != ".midx")
+                    continue;
+                auto segment = std::make_shared<IndexSegment>(it->path().string());
+                if (!segment->open())
+                    return false;
+                all.push_back(segment);
+            }
+            std::sort(all.begin(), all.end(), [](const IndexSegment::ptr &a, const IndexSegment::ptr &b)
+                      { return a->base() != b->base() ? a->base() < b->base() : a->end() > b->end(); });
+            _next = 0;
+            for (auto &segment : all)
+            {
+                if (segment->end() <= _next)
+                {
+                    segment->remove();
+                    continue;
+                }
+                if (segment->base() != _next)
+                {
+                    LOG_ERROR("索引段文件{}的编号不连续，期望从{}开始！", segment->path(), _next);
+                    return false;
+                }
+                _segments.push_back(segment);
+                _next = segment->end();
+                _max_time = std::max(_max_time, segment->max_time());
+            }
+            return true;
+        }
+        // 重放预写日志中尚未落盘为段的消息
+        bool _replay()
+        {
+            std::vector<std::pair<uint32_t, std::string>> wals;
+            for (boost::filesystem::directory_iterator it(_dir), end; it != end; ++it)
+            {
+                std::string name = it->path().filename().string();
+                if (name.compare(0, 4, "wal_") == 0 && it->path().extension() == ".log")
+                    wals.emplace_back((uint32_t)std::stoul(name.substr(4)), it->path().string());
+            }
+            std::sort(wals.begin(), wals.end());
+            _mem = std::make_shared<MemBuffer>();
+            _mem->base = _next;
+            for (auto &wal : wals)
+            {
+                std::ifstream ifs(wal.second, std::ios::binary);
+                std::string data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+                archive_codec::Reader reader(data.data(), data.size());
+                uint32_t id = wal.first;
+                size_t replayed = 0;
+                while (true)
+                {
+                    text_index::Doc doc;
+                    try
+                    {
+                        std::string record = reader.string();
+                        archive_codec::Reader rec(record.data(), record.size());
+                        doc.create_time = rec.svarint();
+                        text_index::decode_doc(rec, doc);
+                    }
+                    catch (const std::exception &e)
+                    {
+                        break; // 日志末尾写了一半的记录直接丢弃
+                    }
+                    // 已经落盘为段的消息跳过
+                    if (id++ < _next)
+                        continue;
+                    _add(_mem, doc);
+                    ++replayed;
+                }
+                if (replayed > 0)
+                    LOG_INFO("从本地消息索引日志{}中恢复{}条消息", wal.second, replayed);
+                _old_wals.push_back(wal.second);
+            }
+            return true;
+        }
+        // 重放出来的消息重新写入一个新的日志文件，写完后再删除旧日志
+        bool _open_wal()
+        {
+            _mem->wal_path = _wal_path(_mem->base);
+            std::string tmp = _mem->wal_path + ".tmp";
+            FILE *wal = fopen(tmp.c_str(), "wb");
+            if (wal == nullptr)
+            {
+                LOG_ERROR("打开本地消息索引日志{}失败：{}", tmp, strerror(errno));
+                return false;
+            }
+            for (auto &doc : _mem->docs)
+            {
+                std::string record, entry;
+                archive_codec::put_svarint(record, doc.create_time);
+                text_index::encode_doc(record, doc);
+                archive_codec::put_varint(entry, record.size());
+                entry += record;
+                fwrite(entry.data(), 1, entry.size(), wal);
+            }
+            if (fflush(wal) != 0 || fsync(fileno(wal)) != 0 || rename(tmp.c_str(), _mem->wal_path.c_str()) != 0)
+            {
+                LOG_ERROR("写入本地消息索引日志{}失败：{}", _mem->wal_path, strerror(errno));
+                fclose(wal);
+                unlink(tmp.c_str());
+                return false;
+            }
+            for (auto &old : _old_wals)
+            {
+                if (old != _mem->wal_path)
+                    unlink(old.c_str());
+            }
+            _old_wals.clear();
+            _wal = wal;
+            return true;
+        }
+        void _background()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (_running)
+            {
+                _cond.wait_for(lock, std::chrono::milliseconds(500));
+                bool due = _mem->docs.size() >= _flush_docs ||
+                           ((!_mem->docs.empty() || _frozen) && std::chrono::steady_clock::now() - _last_flush >= _flush_interval);
+                if (due || !_running)
+                    _flush(lock);
+                if (_segments.size() > _max_segments)
+                    _merge(lock);
+            }
+        }
+        // 内存缓冲区落盘：切换到新的缓冲区与日志，旧缓冲区在段文件写完之前仍可检索
+        //  上次写段失败的冻结缓冲区先重试，写成功之前不切换新的缓冲区，保证段文件的编号始终连续
+        void _flush(std::unique_lock<std::mutex> &lock)
+        {
+            _last_flush = std::chrono::steady_clock::now();
+            if (_frozen && !_write_frozen(lock))
+                return;
+            if (_mem->docs.empty())
+                return;
+            auto mem = std::make_shared<MemBuffer>();
+            mem->base = _next;
+            mem->wal_path = _wal_path(mem->base);
+            FILE *wal = fopen(mem->wal_path.c_str(), "ab");
+            if (wal == nullptr)
+            {
+                LOG_ERROR("打开本地消息索引日志{}失败：{}", mem->wal_path, strerror(errno));
+                return;
+            }
+            fclose(_wal);
+            _wal = wal;
+            _frozen = _mem;
+            _mem = mem;
+            _write_frozen(lock);
+        }
+        // 将冻结缓冲区写成段文件，写段期间释放锁
+        bool _write_frozen(std::unique_lock<std::mutex> &lock)
+        {
+            auto frozen = _frozen;
+            lock.unlock();
+
+            std::vector<std::pair<int64_t, std::string>> docs;
+            docs.reserve(frozen->docs.size());
+            for (auto &doc : frozen->docs)
+            {
+                std::string record;
+                text_index::encode_doc(record, doc);
+                docs.emplace_back(doc.create_time, std::move(record));
+            }
+            std::map<std::string, std::vector<uint32_t>> postings(frozen->postings.begin(), frozen->postings.end());
+            uint32_t end = frozen->base + (uint32_t)frozen->docs.size();
+            std::string path = _segment_path(frozen->base, end);
+            IndexSegment::ptr segment;
+            if (text_index::write_segment(path, frozen->base, docs, postings))
+            {
+                segment = std::make_shared<IndexSegment>(path);
+                if (!segment->open())
+                    segment.reset();
+            }
+
+            lock.lock();
+            if (!segment)
+            {
+                // 写段失败时消息仍在旧日志中，保持冻结缓冲区可检索，下次落盘时重试
+                LOG_ERROR("本地消息索引落盘失败，{}条消息暂留内存", frozen->docs.size());
+                return false;
+            }
+            _segments.push_back(segment);
+            _frozen.reset();
+            unlink(frozen->wal_path.c_str());
+            return true;
+        }
+        // 合并文档数之和最小的一对相邻段
+        void _merge(std::unique_lock<std::mutex> &lock)
+        {
+            size_t best = 0;
+            for (size_t i = 1; i + 1 < _segments.size(); ++i)
+            {
+                if (_segments[i]->count() + _segments[i + 1]->count() <
+                    _segments[best]->count() + _segments[best + 1]->count())
+                    best = i;
+            }
+            auto a = _segments[best], b = _segments[best + 1];
+            lock.unlock();
+
+            std::vector<std::pair<int64_t, std::string>> docs;
+            std::map<std::string, std::vector<uint32_t>> postings;
+            a->docs(docs);
+            b->docs(docs);
+            a->terms(postings);
+            b->terms(postings);
+            std::string path = _segment_path(a->base(), b->end());
+            IndexSegment::ptr merged;
+            if (text_index::write_segment(path, a->base(), docs, postings))
+            {
+                merged = std::make_shared<IndexSegment>(path);
+                if (!merged->open())
+                    merged.reset();
+            }
+
+            lock.lock();
+            if (!merged)
+            {
+                LOG_ERROR("合并索引段{}与{}失败！", a->path(), b->path());
+                return;
+            }
+            // 合并期间只有本线程会修改段列表，两个段的位置不变
+            _segments[best] = merged;
+            _segments.erase(_segments.begin() + best + 1);
+            a->remove();
+            b->remove();
+            LOG_INFO("合并索引段完成：{}，{}条消息", path, merged->count());
+        }
+
+    private:
+        std::string _dir;
+        size_t _flush_docs;
+        std::chrono::milliseconds _flush_interval;
+        size_t _max_segments;
+
+        std::mutex _mutex;
+        std::condition_variable _cond;
+        uint32_t _next;    // 下一条消息的编号
+        int64_t _max_time; // 已索引消息中最晚的产生时间
+        std::vector<IndexSegment::ptr> _segments;
+        std::shared_ptr<MemBuffer> _mem;
+        std::shared_ptr<MemBuffer> _frozen; // 正在落盘的缓冲区
+        FILE *_wal;
+        std::vector<std::string> _old_wals;
+        std::chrono::steady_clock::time_point _last_flush;
+        bool _running;
+        std::thread _thread;
+        std::thread _backfill_thread;
+    };
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "message.hxx"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace lbk
+{
+    // 消息检索的分页与高亮参数
+    struct MessageSearchPage
+    {
+        int size = 10;          // 每页条数
+        int64_t after_time = 0; // 上一页最后一条消息的时间与ID，after_id为空表示第一页
+        std::string after_id;
+        bool highlight = false; // 为true时content只返回命中关键字附近的片段
+        int fragment_size = 100;
+        int fragments = 3;
+        std::string pre_tag = "<em>";
+        std::string post_tag = "</em>";
+    };
+
+    // 消息全文检索接口，有ES(ESMessage)与内嵌本地索引(LocalMessageIndex)两种实现，由启动参数选择
+    //  检索结果按(create_time, message_id)倒序排列，分页游标为上一页最后一条的时间与消息ID
+    class MessageSearcher
+    {
+    public:
+        using ptr = std::shared_ptr<MessageSearcher>;
+        virtual ~MessageSearcher() {}
+        virtual bool createIndex() = 0;
+        virtual bool appendData(const std::string &user_id, const std::string &message_id, const std::string &chat_session_id,
+                                const long create_time, const std::string &content) = 0;
+        virtual std::vector<Message> search(const std::string &key, const std::string &ssid,
+                                            const MessageSearchPage &page, bool &has_more) = 0;
+    };
+}
@@ -2,8 +2,11 @@
 #include <iostream>
 #include <string>
 #include <memory>
+#include <sstream>
+#include <vector>
 #include <odb/database.hxx>
 #include <odb/mysql/database.hxx>
+#include "mysql_pool.hpp"
 
 namespace lbk
 {
@@ -19,10 +22,59 @@ namespace lbk
             int port,
             int conn_pool_count)
         {
-            std::unique_ptr<odb::mysql::connection_pool_factory> cpf(
-                new odb::mysql::connection_pool_factory(conn_pool_count, 0));
+            PoolOptions opts;
+            opts.min_size = opts.max_size = conn_pool_count;
+            return create(user, password, host, db, cset, port, opts);
+        }
+        // 连接池的等待、占用与获取耗时以 mysql_pool_<host>_<port>_<db>_* 导出为bvar
+        static std::shared_ptr<odb::core::database> create(
+            const std::string &user,
+            const std::string &password,
+            const std::string &host,
+            const std::string &db,
+            const std::string &cset,
+            int port,
+            const PoolOptions &opts)
+        {
+            std::string name = host + "_" + std::to_string(port) + "_" + db;
+            std::unique_ptr<odb::mysql::connection_pool_factory> cpf(new InstrumentedConnectionPool(name, opts));
             auto res = std::make_shared<odb::mysql::database>(user, password, db, host, port, "", cset, 0, std::move(cpf));
             return res;
         }
+        // 创建从库连接池：hosts为逗号分隔的 host:port 列表，账号、库名与主库相同
+        static std::vector<std::shared_ptr<odb::core::database>> create_replicas(
+            const std::string &user,
+            const std::string &password,
+            const std::string &hosts,
+            const std::string &db,
+            const std::string &cset,
+            int conn_pool_count)
+        {
+            PoolOptions opts;
+            opts.min_size = opts.max_size = conn_pool_count;
+            return create_replicas(user, password, hosts, db, cset, opts);
+        }
+        static std::vector<std::shared_ptr<odb::core::database>> create_replicas(
+            const std::string &user,
+            const std::string &password,
+            const std::string &hosts,
+            const std::string &db,
+            const std::string &cset,
+            const PoolOptions &opts)
+        {
+            std::vector<std::shared_ptr<odb::core::database>> res;
+            std::stringstream ss(hosts);
+            std::string item;
+            while (std::getline(ss, item, ','))
+            {
+                if (item.empty())
+                    continue;
+                auto pos = item.find(':');
+                std::string host = item.substr(0, pos);
+                int port = pos == std::string::npos ? 0 : std::stoi(item.substr(pos + 1));
+                res.push_back(create(user, password, host, db, cset, port, opts));
+            }
+            return res;
+        }
     };
 }
\ No newline at end of file
@@ -12,9 +12,16 @@ namespace lbk
     public:
         using ptr = std::shared_ptr<ChatSessionTable>;
         ChatSessionTable(const std::shared_ptr<odb::core::database> db)
-            : _db(db) {}
+            : _db(db), _id_map(std::make_shared<IdMapTable>(db)) {}
         bool insert(ChatSession &cs)
         {
+            unsigned long skey;
+            if (!_id_map->key(cs.chat_session_id(), skey))
+            {
+                LOG_ERROR("新增会话失败 {}:获取ID映射失败！", cs.chat_session_name());
+                return false;
+            }
+            cs.session_key(skey);
             try
             {
                 odb::transaction trans(_db->begin());
@@ -30,14 +37,17 @@ namespace lbk
         }
         bool remove(const std::string &ssid)
         {
+            unsigned long skey;
+            if (!_id_map->key(ssid, skey, false))
+                return true;
             try
             {
                 odb::transaction trans(_db->begin());
                 typedef odb::query<ChatSession> query;
-                _db->erase_query<ChatSession>(query::chat_session_id == ssid);
+                _db->erase_query<ChatSession>(query::session_key == skey);
 
                 typedef odb::query<ChatSessionMember> mquery;
-                _db->erase_query<ChatSessionMember>(mquery::session_id == ssid);
+                _db->erase_query<ChatSessionMember>(mquery::session_key == skey);
                 trans.commit();
             }
             catch (const std::exception &e)
@@ -50,18 +60,24 @@ namespace lbk
         // 单聊会话的删除，-- 根据单聊会话的两个成员
         bool remove(const std::string &uid, const std::string &pid)
         {
+            unsigned long ukey, pkey;
+            if (!_id_map->key(uid, ukey, false) || !_id_map->key(pid, pkey, false))
+            {
+                LOG_ERROR("删除会话失败 {}-{}:用户ID映射不存在！", uid, pid);
+                return false;
+            }
             try
             {
                 odb::transaction trans(_db->begin());
                 typedef odb::query<SingleChatSession> query;
                 auto r = _db->query_one<SingleChatSession>(query::css::chat_session_type == ChatSessionType::SINGLE &&
-                                                           query::csm1::user_id == uid && query::csm2::user_id == pid);
-                std::string ssid = r->chat_session_id;
+                                                           query::csm1::user_key == ukey && query::csm2::user_key == pkey);
+                unsigned long skey = r->session_key;
                 typedef odb::query<ChatSession> cquery;
-                _db->erase_query<ChatSession>(cquery::chat_session_id == ssid);
+                _db->erase_query<ChatSession>(cquery::session_key == skey);
 
                 typedef odb::query<ChatSessionMember> mquery;
-                _db->erase_query<ChatSessionMember>(mquery::session_id == ssid);
+                _db->erase_query<ChatSessionMember>(mquery::session_key == skey);
                 trans.commit();
             }
             catch (const std::exception &e)
@@ -92,14 +108,19 @@ namespace lbk
         // 通过用户ID获取单聊会话信息
         std::vector<SingleChatSession> singleChatSession(const std::string &uid)
         {
+            static StatementStat &stat = statement_latency("chat_session_single");
+            StatementTimer timer(stat);
             std::vector<SingleChatSession> ret;
+            unsigned long ukey;
+            if (!_id_map->key(uid, ukey, false))
+                return ret;
             try
             {
                 odb::transaction trans(_db->begin());
                 typedef odb::query<SingleChatSession> query;
                 typedef odb::result<SingleChatSession> result;
                 result r = _db->query<SingleChatSession>(query::css::chat_session_type == ChatSessionType::SINGLE &&
-                                                         query::csm1::user_id == uid && query::csm2::user_id != uid);
+                                                         query::csm1::user_key == ukey && query::csm2::user_key != ukey);
                 for (auto it = r.begin(); it != r.end(); it++)
                 {
                     ret.push_back(*it);
@@ -116,14 +137,19 @@ namespace lbk
         // 通过用户ID获取群聊会话信息
         std::vector<GroupChatSession> groupChatSession(const std::string &uid)
         {
+            static StatementStat &stat = statement_latency("chat_session_group");
+            StatementTimer timer(stat);
             std::vector<GroupChatSession> ret;
+            unsigned long ukey;
+            if (!_id_map->key(uid, ukey, false))
+                return ret;
             try
             {
                 odb::transaction trans(_db->begin());
                 typedef odb::query<GroupChatSession> query;
                 typedef odb::result<GroupChatSession> result;
                 result r = _db->query<GroupChatSession>(query::css::chat_session_type == ChatSessionType::GROUP &&
-                                                        query::csm::user_id == uid);
+                                                        query::csm::user_key == ukey);
                 for (auto it = r.begin(); it != r.end(); it++)
                 {
                     ret.push_back(*it);
@@ -139,5 +165,6 @@ namespace lbk
 
     private:
         std::shared_ptr<odb::core::database> _db;
+        IdMapTable::ptr _id_map;
     };
 }
\ No newline at end of file
@@ -2,6 +2,9 @@
 #include "mysql.hpp"
 #include "chat_session_member.hxx"
 #include "chat_session_member-odb.hxx"
+#include "mysql_id_map.hpp"
+#include "mysql_router.hpp"
+#include "singleflight.hpp"
 #include "logger.hpp"
 
 namespace lbk
@@ -11,10 +14,24 @@ namespace lbk
     public:
         using ptr = std::shared_ptr<ChatSessionMemberTable>;
         ChatSessionMemberTable(const std::shared_ptr<odb::core::database> &db)
-            : _db(db) {}
+            : ChatSessionMemberTable(std::make_shared<DBRouter>(db)) {}
+        // 读写分离：成员变更以会话ID和用户ID登记读己之写，sessions分发到从库；
+        //  members由转发服务在好友服务建立会话后立即读取，读己之写的令牌只在写入的进程内有效，因此始终走主库
+        ChatSessionMemberTable(const DBRouter::ptr &router)
+            : _db(router->primary()), _router(router), _id_map(std::make_shared<IdMapTable>(router->primary())) {}
         // 单个会话成员的新增 --- ssid & uid
         bool append(ChatSessionMember &csm)
         {
+            static StatementStat &stat = statement_latency("session_member_append");
+            StatementTimer timer(stat);
+            unsigned long skey, ukey;
+            if (!_id_map->key(csm.session_id(), skey) || !_id_map->key(csm.user_id(), ukey))
+            {
+                LOG_ERROR("新增单会话成员失败 {}-{}:获取ID映射失败！", csm.session_id(), csm.user_id());
+                return false;
+            }
+            csm.session_key(skey);
+            csm.user_key(ukey);
             try
             {
                 odb::transaction trans(_db->begin());
@@ -26,10 +43,33 @@ namespace lbk
                 LOG_ERROR("新增单会话成员失败 {}-{}:{}！", csm.session_id(), csm.user_id(), e.what());
                 return false;
             }
+            _router->written(csm.session_id());
+            _router->written(csm.user_id());
             return true;
         }
         bool append(std::vector<ChatSessionMember> &csm_list)
         {
+            if (csm_list.empty())
+                return true;
+            std::vector<std::string> ext_ids;
+            for (auto &csm : csm_list)
+            {
+                ext_ids.push_back(csm.session_id());
+                ext_ids.push_back(csm.user_id());
+            }
+            auto keys = _id_map->keys(ext_ids);
+            for (auto &csm : csm_list)
+            {
+                auto sit = keys.find(csm.session_id());
+                auto uit = keys.find(csm.user_id());
+                if (sit == keys.end() || uit == keys.end())
+                {
+                    LOG_ERROR("新增单会话成员失败 {}-{}:获取ID映射失败！", csm.session_id(), csm.user_id());
+                    return false;
+                }
+                csm.session_key(sit->second);
+                csm.user_key(uit->second);
+            }
             try
             {
                 odb::transaction trans(_db->begin());
@@ -42,17 +82,25 @@ namespace lbk
                 LOG_ERROR("新增单会话成员失败 {}-{}:{}！", csm_list[0].session_id(), csm_list.size(), e.what());
                 return false;
             }
+            for (auto &csm : csm_list)
+            {
+                _router->written(csm.session_id());
+                _router->written(csm.user_id());
+            }
             return true;
         }
 
         // 删除指定会话中的指定成员 -- ssid & uid
         bool remove(ChatSessionMember &csm)
         {
+            unsigned long skey, ukey;
+            if (!_id_map->key(csm.session_id(), skey, false) || !_id_map->key(csm.user_id(), ukey, false))
+                return true; // 没有映射说明成员本就不存在
             try
             {
                 odb::transaction trans(_db->begin());
                 typedef odb::query<ChatSessionMember> query;
-                _db->erase_query<ChatSessionMember>(query::session_id == csm.session_id() && query::user_id == csm.user_id());
+                _db->erase_query<ChatSessionMember>(query::session_key == skey && query::user_key == ukey);
                 trans.commit();
             }
             catch (const std::exception &e)
@@ -60,16 +108,21 @@ namespace lbk
                 LOG_ERROR("删除单会话成员失败 {}-{}:{}！", csm.session_id(), csm.user_id(), e.what());
                 return false;
             }
+            _router->written(csm.session_id());
+            _router->written(csm.user_id());
             return true;
         }
         // 删除会话的所有成员信息
         bool remove(const std::string &ssid)
         {
+            unsigned long skey;
+            if (!_id_map->key(ssid, skey, false))
+                return true;
             try
             {
                 odb::transaction trans(_db->begin());
                 typedef odb::query<ChatSessionMember> query;
-                _db->erase_query<ChatSessionMember>(query::session_id == ssid);
+                _db->erase_query<ChatSessionMember>(query::session_key == skey);
                 trans.commit();
             }
             catch (const std::exception &e)
@@ -77,18 +130,61 @@ namespace lbk
                 LOG_ERROR("删除会话所有成员失败 {}:{}！", ssid, e.what());
                 return false;
             }
+            _router->written(ssid);
             return true;
         }
         // 获取对应 session_id 下的 user_id
+        //  群聊消息密集时，同一会话的并发查询合并为一次数据库查询
         std::vector<std::string> members(const std::string &ssid)
         {
+            return _members_flight.run(ssid, [this, &ssid]()
+                                       { return _members(ssid); });
+        }
+        // 获取用户参与的所有会话ID
+        std::vector<std::string> sessions(const std::string &uid)
+        {
+            static StatementStat &stat = statement_latency("session_member_sessions");
+            StatementTimer timer(stat);
             std::vector<std::string> ret;
+            unsigned long ukey;
+            if (!_id_map->key(uid, ukey, false))
+                return ret;
+            try
+            {
+                auto db = _router->reader(uid);
+                odb::transaction trans(db->begin());
+                typedef odb::query<ChatSessionMember> query;
+                typedef odb::result<ChatSessionMember> result;
+                result res = db->query<ChatSessionMember>(query::user_key == ukey);
+                for (auto it = res.begin(); it != res.end(); it++)
+                {
+                    ret.push_back(it->session_id());
+                }
+                trans.commit();
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("获取用户会话列表失败:{}-{}！", uid, e.what());
+                return std::vector<std::string>();
+            }
+            return ret;
+        }
+
+    private:
+        std::vector<std::string> _members(const std::string &ssid)
+        {
+            static StatementStat &stat = statement_latency("session_member_members");
+            StatementTimer timer(stat);
+            std::vector<std::string> ret;
+            unsigned long skey;
+            if (!_id_map->key(ssid, skey, false))
+                return ret;
             try
             {
                 odb::transaction trans(_db->begin());
                 typedef odb::query<ChatSessionMember> query;
                 typedef odb::result<ChatSessionMember> result;
-                result res = _db->query<ChatSessionMember>(query::session_id == ssid);
+                result res = _db->query<ChatSessionMember>(query::session_key == skey);
                 for (auto it = res.begin(); it != res.end(); it++)
                 {
                     ret.push_back(it->user_id());
@@ -105,5 +201,8 @@ namespace lbk
 
     private:
         std::shared_ptr<odb::core::database> _db;
+        DBRouter::ptr _router;
+        IdMapTable::ptr _id_map;
+        SingleFlight<std::vector<std::string>> _members_flight;
     };
 }
\ No newline at end of file
@@ -0,0 +1,154 @@
+#pragma once
+#include "mysql.hpp"
+#include "id_map.hxx"
+#include "id_map-odb.hxx"
+#include "logger.hpp"
+#include "lru_cache.hpp"
+#include <chrono>
+#include <unordered_map>
+
+namespace lbk
+{
+    // 外部字符串ID与内部整数键的映射管理
+    //  1. 映射关系一旦建立就不会改变，因此进程内用分片LRU缓存热点映射，条数有上限，
+    //     长时间运行时不会随会话/用户总数无限增长；被淘汰的映射下次访问时重新查询
+    //  2. 注意：ODB同一线程内只允许一个活动事务，所以必须在业务事务开启之前完成键的解析
+    class IdMapTable
+    {
+    public:
+        using ptr = std::shared_ptr<IdMapTable>;
+        IdMapTable(const std::shared_ptr<odb::core::database> &db, size_t capacity = 100000,
+                   const std::chrono::milliseconds &ttl = std::chrono::hours(1))
+            : _db(db), _cache(capacity, ttl) {}
+        // 获取外部ID对应的整数键；create为true时不存在则新建映射
+        bool key(const std::string &ext_id, unsigned long &k, bool create = true)
+        {
+            if (_lookup(ext_id, k))
+                return true;
+            try
+            {
+                odb::transaction trans(_db->begin());
+                typedef odb::query<IdMap> query;
+                std::unique_ptr<IdMap> r(_db->query_one<IdMap>(query::ext_id == ext_id));
+                if (r)
+                    k = r->key();
+                else if (create)
+                {
+                    IdMap im(ext_id);
+                    _db->persist(im);
+                    k = im.key();
+                }
+                else
+                {
+                    trans.commit();
+                    return false;
+                }
+                trans.commit();
+            }
+            catch (const std::exception &e)
+            {
+                // 并发创建同一个映射时唯一索引冲突，重新查询一次即可
+                if (create && _select(ext_id, k))
+                {
+                    _store(ext_id, k);
+                    return true;
+                }
+                LOG_ERROR("获取ID映射失败 {}:{}！", ext_id, e.what());
+                return false;
+            }
+            _store(ext_id, k);
+            return true;
+        }
+        // 批量获取整数键，缺失的映射在一个事务中批量新建；create为false时结果中不包含不存在的ID
+        std::unordered_map<std::string, unsigned long> keys(const std::vector<std::string> &ext_ids, bool create = true)
+        {
+            std::unordered_map<std::string, unsigned long> res;
+            std::vector<std::string> miss;
+            for (auto &id : ext_ids)
+            {
+                unsigned long k;
+                if (_lookup(id, k))
+                    res[id] = k;
+                else if (res.find(id) == res.end())
+                    miss.push_back(id);
+            }
+            if (miss.empty())
+                return res;
+            try
+            {
+                odb::transaction trans(_db->begin());
+                typedef odb::query<IdMap> query;
+                typedef odb::result<IdMap> result;
+                result r(_db->query<IdMap>(query::ext_id.in_range(miss.begin(), miss.end())));
+                for (auto it = r.begin(); it != r.end(); it++)
+                {
+                    res[it->ext_id()] = it->key();
+                }
+                if (create)
+                {
+                    for (auto &id : miss)
+                    {
+                        if (res.find(id) != res.end())
+                            continue;
+                        IdMap im(id);
+                        _db->persist(im);
+                        res[id] = im.key();
+                    }
+                }
+                trans.commit();
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("批量获取ID映射失败 {}个:{}！", miss.size(), e.what());
+                // 批量失败时逐个回退，处理并发新建导致的冲突
+                for (auto &id : miss)
+                {
+                    unsigned long k;
+                    if (key(id, k, create))
+                        res[id] = k;
+                }
+                return res;
+            }
+            for (auto &id : miss)
+            {
+                auto it = res.find(id);
+                if (it != res.end())
+                    _store(id, it->second);
+            }
+            return res;
+        }
+
+    private:
+        bool _select(const std::string &ext_id, unsigned long &k)
+        {
+            try
+            {
+                odb::transaction trans(_db->begin());
+                typedef odb::query<IdMap> query;
+                std::unique_ptr<IdMap> r(_db->query_one<IdMap>(query::ext_id == ext_id));
+                trans.commit();
+                if (!r)
+                    return false;
+                k = r->key();
+                return true;
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("查询ID映射失败 {}:{}！", ext_id, e.what());
+                return false;
+            }
+        }
+        bool _lookup(const std::string &ext_id, unsigned long &k)
+        {
+            return _cache.get(ext_id, k);
+        }
+        void _store(const std::string &ext_id, unsigned long k)
+        {
+            _cache.put(ext_id, k);
+        }
+
+    private:
+        std::shared_ptr<odb::core::database> _db;
+        LRUCache<std::string, unsigned long> _cache;
+    };
+}
@@ -2,64 +2,169 @@
 #include "mysql.hpp"
 #include "message.hxx"
 #include "message-odb.hxx"
+#include "mysql_id_map.hpp"
+#include "mysql_router.hpp"
 #include "logger.hpp"
 #include <algorithm>
+#include <functional>
+#include <unordered_set>
 
 namespace lbk
 {
+    // 同步时被跳过的序号空洞，见MessageTable::since
+    struct MessageHoles
+    {
+        using Seqs = std::unordered_map<std::string, std::vector<unsigned long>>; // 会话ID -> 序号列表
+        static constexpr size_t MAX_SKIPPED = 64; // 一次同步中每个会话最多记录的跳过序号数量
+        Seqs pending; // 输入：之前跳过、需要检查是否已经落库的序号
+        Seqs skipped; // 输出：本次跳过的序号
+        Seqs filled;  // 输出：pending中本次找到并补发的序号
+    };
+
     class MessageTable
     {
     public:
         using ptr = std::shared_ptr<MessageTable>;
         MessageTable(const std::shared_ptr<odb::core::database> &db)
-            : _db(db) {}
+            : MessageTable(std::make_shared<DBRouter>(db)) {}
+        // 读写分离：写入走主库，recent/range/since按会话ID读己之写后分发到从库
+        MessageTable(const DBRouter::ptr &router)
+            : _db(router->primary()), _router(router), _id_map(std::make_shared<IdMapTable>(router->primary())) {}
         bool insert(Message &msg)
         {
+            static StatementStat &stat = statement_latency("message_insert");
+            StatementTimer timer(stat);
+            unsigned long skey;
+            if (!_id_map->key(msg.session_id(), skey))
+            {
+                LOG_ERROR("新增消息失败 {}:获取会话ID映射失败！", msg.message_id());
+                return false;
+            }
+            msg.session_key(skey);
             try
             {
                 odb::transaction trans(_db->begin());
                 _db->persist(msg);
                 trans.commit();
             }
+            catch (const odb::object_already_persistent &)
+            {
+                // (消息ID, 产生时间)唯一键冲突：同一条消息已经写入过，重复写入按成功处理(相当于INSERT IGNORE)
+                LOG_DEBUG("消息{}已存在，忽略重复写入", msg.message_id());
+            }
             catch (const std::exception &e)
             {
                 LOG_ERROR("新增消息失败 {}:{}！", msg.message_id(), e.what());
                 return false;
             }
+            _router->written(msg.session_id());
             return true;
         }
         bool remove(const std::string &ssid)
         {
+            static StatementStat &stat = statement_latency("message_remove");
+            StatementTimer timer(stat);
+            unsigned long skey;
+            if (!_id_map->key(ssid, skey, false))
+                return true;
+            // 分批删除，每批一个独立事务，避免大会话的历史消息在一个事务中长时间持锁、撑大undo日志
+            //  session_key=xx limit batch; 直到某一批删除的行数不足batch
+            try
+            {
+                std::stringstream ss;
+                ss << "session_key=" << skey << " limit " << REMOVE_BATCH;
+                while (true)
+                {
+                    odb::transaction trans(_db->begin());
+                    auto n = _db->erase_query<Message>(ss.str());
+                    trans.commit();
+                    if (n < REMOVE_BATCH)
+                        break;
+                }
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("删除会话所有消息失败 {}:{}！", ssid, e.what());
+                return false;
+            }
+            _router->written(ssid);
+            return true;
+        }
+        // 删除create_time早于etime的全部消息，用于归档之后清理热表，同样分批删除
+        bool remove_before(const boost::posix_time::ptime &etime)
+        {
+            try
+            {
+                typedef odb::query<Message> query;
+                while (true)
+                {
+                    odb::transaction trans(_db->begin());
+                    auto n = _db->erase_query<Message>((query::create_time < etime) + "LIMIT" + query::_val(REMOVE_BATCH));
+                    trans.commit();
+                    if (n < REMOVE_BATCH)
+                        break;
+                }
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("删除{}之前的消息失败:{}！", boost::posix_time::to_simple_string(etime), e.what());
+                return false;
+            }
+            return true;
+        }
+        // 按消息ID删除一批消息，归档工具只删除已写入归档文件的消息
+        bool remove_messages(const std::vector<std::string> &message_ids)
+        {
+            if (message_ids.empty())
+                return true;
             try
             {
-                odb::transaction trans(_db->begin());
                 typedef odb::query<Message> query;
-                _db->erase_query<Message>(query::session_id == ssid);
+                odb::transaction trans(_db->begin());
+                _db->erase_query<Message>(query::message_id.in_range(message_ids.begin(), message_ids.end()));
                 trans.commit();
             }
             catch (const std::exception &e)
             {
-                LOG_ERROR("删除会话所有消息失败 {}:{}！", ssid, e.what());
+                LOG_ERROR("按消息ID删除{}条消息失败:{}！", message_ids.size(), e.what());
                 return false;
             }
             return true;
         }
-        std::vector<Message> recent(const std::string &ssid, int count)
+        // before_seq不为0时获取该序号之前的count条消息，用于按序号稳定分页
+        std::vector<Message> recent(const std::string &ssid, int count, unsigned long before_seq = 0)
         {
+            static StatementStat &stat = statement_latency("message_recent");
+            StatementTimer timer(stat);
             std::vector<Message> res;
+            unsigned long skey;
+            if (!_id_map->key(ssid, skey, false))
+                return res;
             try
             {
-                odb::transaction trans(_db->begin());
-                // 本次查询是以ssid作为过滤条件，然后进行以时间字段进行逆序，通过limit
-                //  session_id='xx' order by create_time desc limit count;
+                auto db = _router->reader(ssid);
+                odb::transaction trans(db->begin());
+                // 本次查询是以会话键作为过滤条件，然后以会话内序号进行逆序，通过limit
+                //  同一秒内的消息create_time相同，只有序号能给出稳定的顺序；
+                //  没有序号的历史消息seq为0，按时间排在最后
+                //  session_key=xx [and seq<before] [and create_time>=窗口起点] order by seq desc, create_time desc limit count;
+                //  先只在最近的热分区(上个月1日至今)中查找，条数不足时再扫描全部分区
                 typedef odb::result<Message> result;
-                std::stringstream ss;
-                ss << "session_id='" << ssid << "' ";
-                ss << "order by create_time desc limit " << count;
-                result r(_db->query<Message>(ss.str()));
-                for (auto it = r.begin(); it != r.end(); it++)
+                for (int pass = 0; pass < 2 && (int)res.size() < count; ++pass)
                 {
-                    res.push_back(*it);
+                    res.clear();
+                    std::stringstream ss;
+                    ss << "session_key=" << skey << " ";
+                    if (before_seq > 0)
+                        ss << "and seq<" << before_seq << " ";
+                    if (pass == 0)
+                        ss << "and create_time>='" << _hot_since() << "' ";
+                    ss << "order by seq desc, create_time desc limit " << count;
+                    result r(db->query<Message>(ss.str()));
+                    for (auto it = r.begin(); it != r.end(); it++)
+                    {
+                        res.push_back(*it);
+                    }
                 }
                 std::reverse(res.begin(), res.end());
                 trans.commit();
@@ -73,14 +178,21 @@ namespace lbk
         }
         std::vector<Message> range(const std::string &ssid, boost::posix_time::ptime &stime, boost::posix_time::ptime &etime)
         {
+            static StatementStat &stat = statement_latency("message_range");
+            StatementTimer timer(stat);
             std::vector<Message> res;
+            unsigned long skey;
+            if (!_id_map->key(ssid, skey, false))
+                return res;
             try
             {
-                odb::transaction trans(_db->begin());
+                auto db = _router->reader(ssid);
+                odb::transaction trans(db->begin());
                 typedef odb::query<Message> query;
                 typedef odb::result<Message> result;
-                result r(_db->query<Message>(query::session_id == ssid &&
-                                             query::create_time >= stime && query::create_time <= etime));
+                result r(db->query<Message>((query::session_key == skey &&
+                                              query::create_time >= stime && query::create_time <= etime) +
+                                             "ORDER BY" + query::create_time + "," + query::seq));
                 for (auto it = r.begin(); it != r.end(); it++)
                 {
                     res.push_back(*it);
@@ -97,7 +209,216 @@ namespace lbk
             return res;
         }
 
+        // 获取会话中已存在的消息ID，用于数据迁移时减少重复写入(重复写入本身由唯一键保证被忽略)
+        bool existing(const std::string &ssid, const std::vector<std::string> &mids, std::unordered_set<std::string> &res)
+        {
+            unsigned long skey;
+            if (mids.empty() || !_id_map->key(ssid, skey, false))
+                return true;
+            try
+            {
+                odb::transaction trans(_db->begin());
+                typedef odb::query<Message> query;
+                typedef odb::result<Message> result;
+                result r(_db->query<Message>(query::session_key == skey &&
+                                             query::message_id.in_range(mids.begin(), mids.end())));
+                for (auto it = r.begin(); it != r.end(); it++)
+                {
+                    res.insert(it->message_id());
+                }
+                trans.commit();
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("查询会话已存在的消息失败:{}-{}！", ssid, e.what());
+                return false;
+            }
+            return true;
+        }
+        // 流式读取产生时间不早于since的某类消息(不排序)，回调返回false时停止并返回false，用于补齐本地消息索引
+        bool scan(const boost::posix_time::ptime &since, unsigned char message_type,
+                  const std::function<bool(const Message &)> &cb)
+        {
+            try
+            {
+                auto db = _router->reader();
+                odb::transaction trans(db->begin());
+                typedef odb::query<Message> query;
+                typedef odb::result<Message> result;
+                result r(db->query<Message>(query::create_time >= since && query::message_type == message_type));
+                for (auto it = r.begin(); it != r.end(); it++)
+                {
+                    if (cb(*it) == false)
+                        return false;
+                }
+                trans.commit();
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("读取{}之后的消息失败:{}！", boost::posix_time::to_simple_string(since), e.what());
+                return false;
+            }
+            return true;
+        }
+        // 按消息ID顺序分页获取一个会话的消息，last为上一页最后一条消息ID(空表示从头开始)，用于数据迁移
+        std::vector<Message> after(const std::string &ssid, const std::string &last, int count)
+        {
+            std::vector<Message> res;
+            unsigned long skey;
+            if (count <= 0 || !_id_map->key(ssid, skey, false))
+                return res;
+            try
+            {
+                odb::transaction trans(_db->begin());
+                typedef odb::query<Message> query;
+                typedef odb::result<Message> result;
+                result r(_db->query<Message>((query::session_key == skey && query::message_id > last) +
+                                             "ORDER BY" + query::message_id + "LIMIT" + query::_val(count)));
+                for (auto it = r.begin(); it != r.end(); it++)
+                {
+                    res.push_back(*it);
+                }
+                trans.commit();
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("分页获取会话消息失败:{}-{}！", ssid, e.what());
+                return std::vector<Message>();
+            }
+            return res;
+        }
+        // 批量获取多个会话中游标之后的消息：会话ID -> 已收到的最后一条消息的会话内序号(0表示还没有游标)
+        //  1. 序号在转发时分配，消息却由多个存储节点异步落库，较小的序号可能更晚提交(或还未同步到从库)，
+        //     所以每个会话只返回从游标起序号连续的消息，遇到空洞就停止，缺失的消息落库后下次同步再返回；
+        //     空洞之后的消息产生已超过settle仍未补上时先跳过，让之后的消息不被长期阻塞，
+        //     跳过的序号记入holes->skipped，由调用者保存；消息队列积压或重投递导致的迟到消息落库后，
+        //     调用者在之后的同步中通过holes->pending传回这些序号，找到的消息补发并记入holes->filled
+        //  2. 没有游标的会话只同步最近window内的消息，不会把整个历史一次性推给客户端
+        //  结果按会话分组、组内按序号升序(补发的迟到消息在各会话的最前面)，最多返回count条；
+        //  more为true表示查询达到了条数上限，之后可能还有消息
+        std::vector<Message> since(const std::unordered_map<std::string, unsigned long> &cursors, int count,
+                                   const boost::posix_time::time_duration &window,
+                                   const boost::posix_time::time_duration &settle, bool &more,
+                                   MessageHoles *holes = nullptr)
+        {
+            static StatementStat &stat = statement_latency("message_since");
+            StatementTimer timer(stat);
+            std::vector<Message> res;
+            more = false;
+            if (cursors.empty() || count <= 0)
+                return res;
+            std::vector<std::string> ssids;
+            for (auto &it : cursors)
+                ssids.push_back(it.first);
+            auto keys = _id_map->keys(ssids, false);
+            if (keys.empty())
+                return res;
+            // create_time按UTC时间写入
+            auto now = boost::posix_time::second_clock::universal_time();
+            std::unordered_map<unsigned long, unsigned long> from;
+            std::unordered_map<unsigned long, std::string> ssid_of;
+            std::unordered_map<unsigned long, std::unordered_set<unsigned long>> pending;
+            try
+            {
+                auto db = _router->reader(ssids);
+                odb::transaction trans(db->begin());
+                typedef odb::query<Message> query;
+                typedef odb::result<Message> result;
+                query q(false);
+                for (auto &it : cursors)
+                {
+                    auto kit = keys.find(it.first);
+                    if (kit == keys.end())
+                        continue;
+                    from[kit->second] = it.second;
+                    ssid_of[kit->second] = it.first;
+                    if (it.second > 0)
+                        q = q || (query::session_key == kit->second && query::seq > it.second);
+                    else
+                        q = q || (query::session_key == kit->second && query::seq > 0 && query::create_time >= now - window);
+                    if (holes == nullptr)
+                        continue;
+                    auto hit = holes->pending.find(it.first);
+                    if (hit != holes->pending.end() && !hit->second.empty())
+                    {
+                        pending[kit->second].insert(hit->second.begin(), hit->second.end());
+                        q = q || (query::session_key == kit->second &&
+                                  query::seq.in_range(hit->second.begin(), hit->second.end()));
+                    }
+                }
+                q = q + "ORDER BY" + query::session_key + "," + query::seq + "LIMIT" + query::_val(count);
+                result r(db->query<Message>(q));
+                int rows = 0;
+                unsigned long skey = 0, last = 0;
+                bool blocked = false;
+                for (auto it = r.begin(); it != r.end(); it++, rows++)
+                {
+                    if (it->session_key() != skey)
+                    {
+                        skey = it->session_key();
+                        last = from[skey];
+                        blocked = false;
+                    }
+                    // 之前被跳过的序号对应的迟到消息：游标已经越过时直接补发，否则按正常流程返回
+                    auto pit = pending.find(skey);
+                    bool late = pit != pending.end() && pit->second.count(it->seq()) > 0;
+                    if (it->seq() <= last)
+                    {
+                        if (late)
+                        {
+                            pit->second.erase(it->seq());
+                            holes->filled[ssid_of[skey]].push_back(it->seq());
+                            res.push_back(*it);
+                        }
+                        continue;
+                    }
+                    if (blocked)
+                        continue;
+                    if (last > 0 && it->seq() != last + 1 && it->create_time() + settle > now)
+                    {
+                        blocked = true;
+                        continue;
+                    }
+                    if (holes && last > 0 && it->seq() > last + 1)
+                    {
+                        auto &skipped = holes->skipped[ssid_of[skey]];
+                        for (unsigned long seq = last + 1; seq < it->seq() && skipped.size() < MessageHoles::MAX_SKIPPED; seq++)
+                            skipped.push_back(seq);
+                    }
+                    if (late)
+                    {
+                        pit->second.erase(it->seq());
+                        holes->filled[ssid_of[skey]].push_back(it->seq());
+                    }
+                    last = it->seq();
+                    res.push_back(*it);
+                }
+                // 本次没有任何会话前进时不再提示还有更多，避免客户端在空洞等待期间反复空转
+                more = rows >= count && !res.empty();
+                trans.commit();
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("批量同步游标之后的消息失败:{}！", e.what());
+                more = false;
+                return std::vector<Message>();
+            }
+            return res;
+        }
+
+    private:
+        // 热分区窗口起点：上个月1日零点，create_time按UTC写入
+        static std::string _hot_since()
+        {
+            auto today = boost::posix_time::second_clock::universal_time().date();
+            auto first = boost::gregorian::date(today.year(), today.month(), 1) - boost::gregorian::months(1);
+            return boost::gregorian::to_iso_extended_string(first) + " 00:00:00";
+        }
+
     private:
+        static constexpr unsigned long long REMOVE_BATCH = 5000;
         std::shared_ptr<odb::core::database> _db;
+        DBRouter::ptr _router;
+        IdMapTable::ptr _id_map;
     };
 }
@@ -0,0 +1,615 @@
+#pragma once
+#include "mysql_message.hpp"
+#include "db_executor.hpp"
+#include "etcd.hpp"
+#include "logger.hpp"
+#include <json/json.h>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <thread>
+
+namespace lbk
+{
+    // 消息分库布局：会话ID经FNV-1a哈希后落到固定数量的槽位上，每个槽位归属一个分库
+    //  扩容/迁移时只改变槽位的归属，不改变会话到槽位的映射；
+    //  迁移中的槽位带有迁移目标，写入同时落到原分库和目标分库，读取仍走原分库
+    //  配置格式：
+    //  {
+    //    "version": 1, "slots": 1024,
+    //    "shards": { "s0": {"host":"127.0.0.1", "port":3306, "user":"root", "password":"", "db":"chat_message_0",
+    //                       "cset":"utf8", "pool":4, "pool_min":2, "replicas":"10.0.0.2:3306,10.0.0.3:3306", "max_lag_ms":1000}, ... },
+    //    "ranges": [ {"begin":0, "end":1024, "shard":"s0", "migrate_to":"s1"}, ... ]
+    //  }
+    class ShardLayout
+    {
+    public:
+        using ptr = std::shared_ptr<ShardLayout>;
+        ShardLayout() : _version(0) {}
+        // 单库布局：全部槽位归属同一个分库，用于未配置分库的部署
+        static ptr single(const std::string &name)
+        {
+            auto layout = std::make_shared<ShardLayout>();
+            layout->_owner.assign(1, name);
+            layout->_migrate.assign(1, std::string());
+            return layout;
+        }
+        bool parse(const std::string &text)
+        {
+            Json::Value root;
+            Json::CharReaderBuilder crb;
+            std::unique_ptr<Json::CharReader> cr(crb.newCharReader());
+            std::string err;
+            if (!cr->parse(text.data(), text.data() + text.size(), &root, &err))
+            {
+                LOG_ERROR("解析分库配置失败：{}", err);
+                return false;
+            }
+            _version = root["version"].asUInt64();
+            size_t slots = root.get("slots", 1024).asUInt();
+            if (slots == 0)
+            {
+                LOG_ERROR("分库配置的槽位数量不能为0！");
+                return false;
+            }
+            _shards = root["shards"];
+            _owner.assign(slots, std::string());
+            _migrate.assign(slots, std::string());
+            for (auto &range : root["ranges"])
+            {
+                size_t begin = range["begin"].asUInt();
+                size_t end = std::min<size_t>(range["end"].asUInt(), slots);
+                std::string shard = range["shard"].asString();
+                std::string migrate = range.get("migrate_to", "").asString();
+                if (!_shards.isMember(shard) || (!migrate.empty() && !_shards.isMember(migrate)))
+                {
+                    LOG_ERROR("分库配置中槽位[{}, {})引用了不存在的分库！", begin, end);
+                    return false;
+                }
+                for (size_t i = begin; i < end; ++i)
+                {
+                    _owner[i] = shard;
+                    _migrate[i] = migrate;
+                }
+            }
+            for (size_t i = 0; i < slots; ++i)
+            {
+                if (_owner[i].empty())
+                {
+                    LOG_ERROR("分库配置中槽位{}没有归属的分库！", i);
+                    return false;
+                }
+            }
+            return true;
+        }
+        // 序列化为配置文本，连续且归属相同的槽位合并为一个区间
+        std::string dump() const
+        {
+            Json::Value root;
+            root["version"] = (Json::UInt64)_version;
+            root["slots"] = (Json::UInt)_owner.size();
+            root["shards"] = _shards;
+            Json::Value ranges(Json::arrayValue);
+            for (size_t i = 0; i < _owner.size();)
+            {
+                size_t j = i + 1;
+                while (j < _owner.size() && _owner[j] == _owner[i] && _migrate[j] == _migrate[i])
+                    ++j;
+                Json::Value range;
+                range["begin"] = (Json::UInt)i;
+                range["end"] = (Json::UInt)j;
+                range["shard"] = _owner[i];
+                if (!_migrate[i].empty())
+                    range["migrate_to"] = _migrate[i];
+                ranges.append(range);
+                i = j;
+            }
+            root["ranges"] = ranges;
+            Json::StreamWriterBuilder swb;
+            return Json::writeString(swb, root);
+        }
+        size_t slot(const std::string &ssid) const
+        {
+            // 各实例与迁移工具需要算出相同的槽位，使用FNV-1a而不是依赖实现的std::hash
+            uint64_t h = 14695981039346656037ULL;
+            for (unsigned char c : ssid)
+            {
+                h ^= c;
+                h *= 1099511628211ULL;
+            }
+            return h % _owner.size();
+        }
+        const std::string &owner(size_t slot) const { return _owner[slot]; }
+        const std::string &migrate_to(size_t slot) const { return _migrate[slot]; }
+        void owner(size_t slot, const std::string &shard) { _owner[slot] = shard; }
+        void migrate_to(size_t slot, const std::string &shard) { _migrate[slot] = shard; }
+        size_t slots() const { return _owner.size(); }
+        uint64_t version() const { return _version; }
+        void version(uint64_t val) { _version = val; }
+        std::vector<std::string> shard_names() const { return _shards.getMemberNames(); }
+        bool has_shard(const std::string &name) const { return _shards.isMember(name); }
+        // 按分库配置创建数据库连接
+        std::shared_ptr<odb::core::database> connect(const std::string &name) const
+        {
+            const Json::Value &conf = _shards[name];
+            return ODBFactory::create(conf["user"].asString(), conf["password"].asString(), conf["host"].asString(),
+                                      conf["db"].asString(), conf.get("cset", "utf8").asString(),
+                                      conf.get("port", 0).asInt(), _pool(conf));
+        }
+        // 按分库配置创建读写分离路由，配置了从库时启动复制延迟检测
+        DBRouter::ptr route(const std::string &name) const
+        {
+            const Json::Value &conf = _shards[name];
+            auto replicas = ODBFactory::create_replicas(conf["user"].asString(), conf["password"].asString(),
+                                                        conf.get("replicas", "").asString(), conf["db"].asString(),
+                                                        conf.get("cset", "utf8").asString(), _pool(conf));
+            auto router = std::make_shared<DBRouter>(connect(name), replicas, conf.get("max_lag_ms", 1000).asInt());
+            router->start(std::chrono::milliseconds(1000));
+            return router;
+        }
+
+    private:
+        // 连接池大小：pool为最大连接数，可选的pool_min小于pool时连接池自适应伸缩
+        static PoolOptions _pool(const Json::Value &conf)
+        {
+            PoolOptions opts;
+            opts.max_size = conf.get("pool", 4).asUInt();
+            opts.min_size = conf.get("pool_min", 0).asUInt();
+            if (opts.min_size == 0 || opts.min_size > opts.max_size)
+                opts.min_size = opts.max_size;
+            return opts;
+        }
+
+    private:
+        uint64_t _version;
+        Json::Value _shards;
+        std::vector<std::string> _owner;   // 槽位 -> 归属分库
+        std::vector<std::string> _migrate; // 槽位 -> 迁移目标分库，空表示未在迁移
+    };
+
+    // 分库配置的存取：本地配置文件或etcd中的一个键，两者二选一
+    class ShardConfigStore
+    {
+    public:
+        using ptr = std::shared_ptr<ShardConfigStore>;
+        // etcd_host为空时使用本地文件，否则path为etcd中的键
+        ShardConfigStore(const std::string &path, const std::string &etcd_host = "")
+            : _path(path)
+        {
+            if (!etcd_host.empty())
+                _client = std::make_shared<etcd::Client>(etcd_host);
+        }
+        bool load(ShardLayout &layout)
+        {
+            std::string text;
+            if (_client)
+            {
+                auto rsp = _client->get(_path).get();
+                if (rsp.is_ok() == false)
+                {
+                    LOG_ERROR("从etcd获取分库配置{}失败：{}", _path, rsp.error_message());
+                    return false;
+                }
+                text = rsp.value().as_string();
+            }
+            else
+            {
+                std::ifstream ifs(_path);
+                if (!ifs.is_open())
+                {
+                    LOG_ERROR("打开分库配置文件{}失败！", _path);
+                    return false;
+                }
+                std::stringstream ss;
+                ss << ifs.rdbuf();
+                text = ss.str();
+            }
+            return layout.parse(text);
+        }
+        bool save(const ShardLayout &layout)
+        {
+            std::string text = layout.dump();
+            if (_client)
+            {
+                auto rsp = _client->put(_path, text).get();
+                if (rsp.is_ok() == false)
+                {
+                    LOG_ERROR("向etcd写入分库配置{}失败：{}", _path, rsp.error_message());
+                    return false;
+                }
+                return true;
+            }
+            std::string tmp = _path + ".tmp";
+            {
+                std::ofstream ofs(tmp, std::ios::trunc);
+                ofs << text;
+                if (!ofs.good())
+                {
+                    LOG_ERROR("写入分库配置文件{}失败！", tmp);
+                    return false;
+                }
+            }
+            if (rename(tmp.c_str(), _path.c_str()) != 0)
+            {
+                LOG_ERROR("替换分库配置文件{}失败！", _path);
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        std::string _path;
+        std::shared_ptr<etcd::Client> _client;
+    };
+
+    // 分库消息表：接口与MessageTable一致，按会话ID路由到所属分库
+    //  单会话的读写只访问一个分库；跨会话的操作(同步、按时间清理)分发到各分库后合并结果，
+    //  设置了数据库线程池时各分库的查询投递到线程池中并行执行，否则在调用者线程中依次执行；
+    //  使用线程池时不能在线程池的任务中调用跨会话的操作，否则任务之间互相等待可能占满全部线程
+    class ShardedMessageTable
+    {
+    public:
+        using ptr = std::shared_ptr<ShardedMessageTable>;
+        // 分库回调：分库名称与该分库的主库连接
+        using ShardHook = std::function<void(const std::string &name, const std::shared_ptr<odb::core::database> &db)>;
+        static constexpr const char *SINGLE = "default"; // 单库模式下唯一分库的名称
+        // 单库模式：所有消息都在db中
+        ShardedMessageTable(const std::shared_ptr<odb::core::database> &db)
+            : _layout(ShardLayout::single(SINGLE)), _running(false)
+        {
+            _dbs[SINGLE] = db;
+            _tables[SINGLE] = std::make_shared<MessageTable>(db);
+        }
+        // 单库读写分离模式
+        ShardedMessageTable(const DBRouter::ptr &router)
+            : _layout(ShardLayout::single(SINGLE)), _running(false)
+        {
+            _dbs[SINGLE] = router->primary();
+            _tables[SINGLE] = std::make_shared<MessageTable>(router);
+        }
+        // 分库模式：从配置中加载分库布局，加载失败时抛出异常
+        ShardedMessageTable(const ShardConfigStore::ptr &store)
+            : _store(store), _running(false)
+        {
+            if (reload() == false)
+                throw std::runtime_error("加载消息分库配置失败");
+        }
+        ~ShardedMessageTable() { stop(); }
+        // 重新加载分库配置，新出现的分库建立连接，已有分库复用连接
+        bool reload()
+        {
+            if (!_store)
+                return true;
+            auto layout = std::make_shared<ShardLayout>();
+            if (_store->load(*layout) == false)
+                return false;
+            std::unordered_map<std::string, std::shared_ptr<odb::core::database>> added;
+            ShardHook hook;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (_layout && _layout->version() == layout->version())
+                    return true;
+                for (auto &name : layout->shard_names())
+                {
+                    if (_tables.count(name))
+                        continue;
+                    auto router = layout->route(name);
+                    _dbs[name] = router->primary();
+                    _tables[name] = std::make_shared<MessageTable>(router);
+                    added[name] = _dbs[name];
+                }
+                LOG_INFO("加载消息分库配置，版本：{}", layout->version());
+                _layout = layout;
+                hook = _on_shard;
+            }
+            if (hook && !added.empty())
+            {
+                std::unique_lock<std::mutex> lock(_hook_mutex);
+                for (auto &it : added)
+                    hook(it.first, it.second);
+            }
+            return true;
+        }
+        // 注册分库回调：立即对已有的全部分库各调用一次，之后reload新加入的分库时再调用，
+        //  用于为每个分库启动后台任务(例如分区维护)；同一个分库只会调用一次，回调之间串行执行
+        void on_shard(const ShardHook &hook)
+        {
+            std::unique_lock<std::mutex> hook_lock(_hook_mutex);
+            std::unordered_map<std::string, std::shared_ptr<odb::core::database>> dbs;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _on_shard = hook;
+                dbs = _dbs;
+            }
+            for (auto &it : dbs)
+                hook(it.first, it.second);
+        }
+        // 启动后台线程周期性重新加载配置，迁移工具修改配置后各实例在一个周期内生效
+        void start(const std::chrono::seconds &interval)
+        {
+            std::unique_lock<std::mutex> lock(_thread_mutex);
+            if (_running || !_store)
+                return;
+            _running = true;
+            _thread = std::thread([this, interval]()
+                                  {
+                std::unique_lock<std::mutex> lock(_thread_mutex);
+                while (_running)
+                {
+                    _cond.wait_for(lock, interval, [this]() { return !_running; });
+                    if (!_running)
+                        break;
+                    lock.unlock();
+                    reload();
+                    lock.lock();
+                } });
+        }
+        void stop()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_thread_mutex);
+                if (!_running)
+                    return;
+                _running = false;
+            }
+            _cond.notify_all();
+            if (_thread.joinable())
+                _thread.join();
+        }
+        // 设置执行跨分库查询的数据库线程池
+        void executor(const DBExecutor::ptr &executor)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _executor = executor;
+        }
+        // 获取全部分库的数据库连接，用于分区维护等按库执行的任务
+        std::unordered_map<std::string, std::shared_ptr<odb::core::database>> databases()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            return _dbs;
+        }
+        // 获取会话所在的分库表，迁移中的槽位同时返回迁移目标
+        MessageTable::ptr table(const std::string &ssid, MessageTable::ptr *migrate = nullptr)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            size_t slot = _layout->slot(ssid);
+            if (migrate && !_layout->migrate_to(slot).empty())
+                *migrate = _tables[_layout->migrate_to(slot)];
+            return _tables[_layout->owner(slot)];
+        }
+
+        bool insert(Message &msg)
+        {
+            MessageTable::ptr migrate;
+            auto owner = table(msg.session_id(), &migrate);
+            if (owner->insert(msg) == false)
+                return false;
+            if (migrate)
+            {
+                // 双写失败不影响本次写入，迁移工具在切换归属后还会补齐一遍；
+                //  与迁移工具的复制并发写入同一条消息时，由(消息ID, 产生时间)唯一键去重
+                Message copy(msg);
+                if (migrate->insert(copy) == false)
+                    LOG_WARN("消息{}双写到迁移目标分库失败！", msg.message_id());
+            }
+            return true;
+        }
+        bool remove(const std::string &ssid)
+        {
+            MessageTable::ptr migrate;
+            auto owner = table(ssid, &migrate);
+            bool ret = owner->remove(ssid);
+            if (migrate)
+                ret = migrate->remove(ssid) && ret;
+            return ret;
+        }
+        bool remove_before(const boost::posix_time::ptime &etime)
+        {
+            std::vector<MessageTable::ptr> tables;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                for (auto &it : _tables)
+                    tables.push_back(it.second);
+            }
+            bool ret = true;
+            for (bool r : scatter(tables, [etime](const MessageTable::ptr &table)
+                                  { return table->remove_before(etime); }))
+            {
+                ret = r && ret;
+            }
+            return ret;
+        }
+        std::vector<Message> recent(const std::string &ssid, int count, unsigned long before_seq = 0)
+        {
+            return table(ssid)->recent(ssid, count, before_seq);
+        }
+        // 依次读取每个分库中产生时间不早于since的某类消息，迁移中双写的消息可能读到两次
+        bool scan(const boost::posix_time::ptime &since, unsigned char message_type,
+                  const std::function<bool(const Message &)> &cb)
+        {
+            std::vector<MessageTable::ptr> tables;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                for (auto &it : _tables)
+                    tables.push_back(it.second);
+            }
+            for (auto &t : tables)
+            {
+                if (t->scan(since, message_type, cb) == false)
+                    return false;
+            }
+            return true;
+        }
+        std::vector<Message> range(const std::string &ssid, boost::posix_time::ptime &stime, boost::posix_time::ptime &etime)
+        {
+            return table(ssid)->range(ssid, stime, etime);
+        }
+        // 按分库拆分游标分别查询后合并：各会话内保持序号升序，会话之间按(产生时间, 序号)归并后取前count条，
+        //  不会因为某些会话(或分库)的消息较多而让其他会话一直拿不到消息
+        std::vector<Message> since(const std::unordered_map<std::string, unsigned long> &cursors, int count,
+                                   const boost::posix_time::time_duration &window,
+                                   const boost::posix_time::time_duration &settle, bool &more,
+                                   MessageHoles *holes = nullptr)
+        {
+            std::unordered_map<MessageTable::ptr, std::unordered_map<std::string, unsigned long>> groups;
+            for (auto &it : cursors)
+                groups[table(it.first)][it.first] = it.second;
+            more = false;
+            if (groups.empty())
+                return std::vector<Message>();
+            struct Part
+            {
+                MessageTable::ptr table;
+                std::unordered_map<std::string, unsigned long> cursors;
+                std::vector<Message> msgs;
+                bool more = false;
+                MessageHoles holes;
+            };
+            std::vector<Part> parts;
+            for (auto &group : groups)
+            {
+                Part part;
+                part.table = group.first;
+                part.cursors = std::move(group.second);
+                // 各分库只检查属于自己的会话中之前跳过的序号
+                for (auto &it : part.cursors)
+                {
+                    if (holes == nullptr)
+                        break;
+                    auto hit = holes->pending.find(it.first);
+                    if (hit != holes->pending.end())
+                        part.holes.pending[it.first] = hit->second;
+                }
+                parts.push_back(std::move(part));
+            }
+            parts = scatter(parts, [count, window, settle](Part part)
+                            {
+                part.msgs = part.table->since(part.cursors, count, window, settle, part.more, &part.holes);
+                return part; });
+            std::vector<Message> all;
+            for (auto &part : parts)
+            {
+                more = more || part.more;
+                std::move(part.msgs.begin(), part.msgs.end(), std::back_inserter(all));
+                if (holes == nullptr)
+                    continue;
+                for (auto &it : part.holes.skipped)
+                    holes->skipped[it.first] = it.second;
+                for (auto &it : part.holes.filled)
+                    holes->filled[it.first] = it.second;
+            }
+            bool truncated = false;
+            auto res = _merge(all, count, truncated);
+            if (truncated)
+            {
+                more = true;
+                // 被截掉的补发消息不算已补发，下次同步继续检查
+                if (holes)
+                {
+                    std::unordered_map<std::string, std::unordered_set<unsigned long>> kept;
+                    for (auto &msg : res)
+                        kept[msg.session_id()].insert(msg.seq());
+                    for (auto &it : holes->filled)
+                    {
+                        auto &seqs = it.second;
+                        auto &k = kept[it.first];
+                        seqs.erase(std::remove_if(seqs.begin(), seqs.end(), [&k](unsigned long seq)
+                                                  { return k.count(seq) == 0; }),
+                                   seqs.end());
+                    }
+                }
+            }
+            return res;
+        }
+
+    private:
+        // 对每个元素执行func，结果与items一一对应；有线程池时全部投递到线程池并行执行，调用者只等待结果
+        template <typename T, typename F>
+        auto scatter(const std::vector<T> &items, const F &func) -> std::vector<decltype(func(items[0]))>
+        {
+            using R = decltype(func(items[0]));
+            DBExecutor::ptr executor;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                executor = _executor;
+            }
+            std::vector<R> res;
+            if (!executor)
+            {
+                for (auto &item : items)
+                    res.push_back(func(item));
+                return res;
+            }
+            std::vector<DBFuture<R>> futures;
+            for (auto &item : items)
+            {
+                futures.push_back(executor->submit([&func, &item]()
+                                                   { return func(item); }));
+            }
+            for (auto &f : futures)
+                res.push_back(f.get());
+            return res;
+        }
+        // 归并各分库的同步结果：输入中同一会话的消息按序号升序，每次取各会话队首中(产生时间, 序号)最小的一条，
+        //  最多取count条；每个会话取到的总是序号连续的前缀，游标不会越过没有返回的消息
+        static std::vector<Message> _merge(std::vector<Message> &msgs, int count, bool &truncated)
+        {
+            std::unordered_map<std::string, size_t> index;
+            std::vector<std::vector<Message>> sessions;
+            for (auto &msg : msgs)
+            {
+                auto it = index.find(msg.session_id());
+                if (it == index.end())
+                {
+                    it = index.emplace(msg.session_id(), sessions.size()).first;
+                    sessions.emplace_back();
+                }
+                sessions[it->second].push_back(std::move(msg));
+            }
+            // (会话下标, 会话内位置)，按队首消息的产生时间、序号、会话下标排序的小顶堆
+            using Head = std::pair<size_t, size_t>;
+            auto later = [&sessions](const Head &a, const Head &b)
+            {
+                auto &ma = sessions[a.first][a.second];
+                auto &mb = sessions[b.first][b.second];
+                if (ma.create_time() != mb.create_time())
+                    return ma.create_time() > mb.create_time();
+                if (ma.seq() != mb.seq())
+                    return ma.seq() > mb.seq();
+                return a.first > b.first;
+            };
+            std::priority_queue<Head, std::vector<Head>, decltype(later)> heads(later);
+            for (size_t i = 0; i < sessions.size(); ++i)
+                heads.emplace(i, 0);
+            std::vector<Message> res;
+            while (!heads.empty() && (int)res.size() < count)
+            {
+                auto head = heads.top();
+                heads.pop();
+                res.push_back(std::move(sessions[head.first][head.second]));
+                if (head.second + 1 < sessions[head.first].size())
+                    heads.emplace(head.first, head.second + 1);
+            }
+            truncated = !heads.empty();
+            return res;
+        }
+
+    private:
+        ShardConfigStore::ptr _store;
+        std::mutex _mutex;
+        ShardLayout::ptr _layout;
+        std::unordered_map<std::string, std::shared_ptr<odb::core::database>> _dbs;
+        std::unordered_map<std::string, MessageTable::ptr> _tables;
+        DBExecutor::ptr _executor;
+        ShardHook _on_shard;
+        std::mutex _hook_mutex; // 串行执行分库回调
+
+        bool _running;
+        std::mutex _thread_mutex;
+        std::condition_variable _cond;
+        std::thread _thread;
+    };
+}
@@ -0,0 +1,384 @@
+#pragma once
+#include "mysql.hpp"
+#include "message_partition.hxx"
+#include "message_partition-odb.hxx"
+#include "logger.hpp"
+#include <odb/mysql/connection.hxx>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace lbk
+{
+    // 消息表按月分区管理
+    //  1. 按 UNIX_TIMESTAMP(create_time) 进行RANGE分区，每月一个分区 pYYYYMM，
+    //     p_history存放启用分区之前的全部历史，p_max兜底；带时间条件的查询由MySQL自动裁剪到相关分区
+    //  2. 定期预建未来若干个月的分区，新分区从空的p_max中拆出，不搬移数据
+    //  3. 超过保留期的分区交给归档回调写入冷存储，归档成功后直接DROP PARTITION，
+    //     代替逐行删除，热表的索引深度和缓冲池占用不再随历史总量增长
+    //  4. create_time按UTC写入，而分区边界 UNIX_TIMESTAMP('YYYY-MM-01') 按会话时区计算，两者在非UTC的服务器上相差若干小时，
+    //     因此归档区间不从分区边界推算，而是取分区内实际的最早/最晚时间，保证删除的分区中每一行都已归档
+    class MessagePartitionManager
+    {
+    public:
+        using ptr = std::shared_ptr<MessagePartitionManager>;
+        // 归档回调：归档create_time处于[begin, end)区间内的全部消息，返回true后该分区才会被删除
+        using ArchiveFunc = std::function<bool(const boost::posix_time::ptime &begin, const boost::posix_time::ptime &end)>;
+        // months_ahead: 预建的未来分区个数；retain_months: 热表保留的月数，0表示不归档
+        MessagePartitionManager(const std::shared_ptr<odb::core::database> &db, int months_ahead = 3,
+                                int retain_months = 0, const ArchiveFunc &archive = ArchiveFunc())
+            : _db(db), _months_ahead(months_ahead < 1 ? 1 : months_ahead),
+              _retain_months(retain_months), _archive(archive), _running(false) {}
+        ~MessagePartitionManager() { stop(); }
+        // 执行一轮分区维护：首次运行时将普通表转换为分区表，之后预建分区并归档过期分区
+        //  每个存储实例、每个分库都有维护线程，同一个库由命名锁保证只有一个执行者，其他实例本轮直接跳过；
+        //  锁绑定在单独取出的一个连接上，维护语句与归档另外占用连接，连接池至少需要两个连接
+        bool maintain()
+        {
+            odb::connection_ptr conn;
+            if (_lock(conn) == false)
+                return true;
+            bool ret = _maintain();
+            _unlock(conn);
+            return ret;
+        }
+        // 启动后台维护线程，按interval周期执行maintain
+        void start(const std::chrono::seconds &interval)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_running)
+                return;
+            _running = true;
+            _thread = std::thread([this, interval]()
+                                  {
+                std::unique_lock<std::mutex> lock(_mutex);
+                while (_running)
+                {
+                    lock.unlock();
+                    maintain();
+                    lock.lock();
+                    _cond.wait_for(lock, interval, [this]() { return !_running; });
+                } });
+        }
+        void stop()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (!_running)
+                    return;
+                _running = false;
+            }
+            _cond.notify_all();
+            if (_thread.joinable())
+                _thread.join();
+        }
+        // 查询消息表是否已经建立(message_id, create_time)唯一索引，迁移工具依赖它保证复制与双写不产生重复消息
+        bool message_id_unique(bool &unique)
+        {
+            try
+            {
+                odb::transaction trans(_db->begin());
+                typedef odb::result<MessageIdIndex> result;
+                result r(_db->query<MessageIdIndex>());
+                unique = false;
+                for (auto it = r.begin(); it != r.end(); it++)
+                {
+                    unique = it->columns == 2;
+                }
+                trans.commit();
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("查询消息ID唯一索引失败：{}", e.what());
+                return false;
+            }
+            return true;
+        }
+        // 获取消息表的分区信息，查询失败返回false；普通表只有一条名称为空的记录，表不存在时为空
+        bool partitions(std::vector<MessagePartition> &res)
+        {
+            res.clear();
+            try
+            {
+                odb::transaction trans(_db->begin());
+                typedef odb::result<MessagePartition> result;
+                result r(_db->query<MessagePartition>());
+                for (auto it = r.begin(); it != r.end(); it++)
+                {
+                    res.push_back(*it);
+                }
+                trans.commit();
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("获取消息表分区信息失败：{}", e.what());
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        struct Month
+        {
+            int year;
+            int month;
+            Month next() const { return month == 12 ? Month{year + 1, 1} : Month{year, month + 1}; }
+            Month prev() const { return month == 1 ? Month{year - 1, 12} : Month{year, month - 1}; }
+            bool operator<(const Month &o) const { return year != o.year ? year < o.year : month < o.month; }
+            int index() const { return year * 12 + month - 1; }
+            std::string name() const
+            {
+                char buf[16];
+                snprintf(buf, sizeof(buf), "p%04d%02d", year, month);
+                return buf;
+            }
+            boost::posix_time::ptime begin() const
+            {
+                return boost::posix_time::ptime(boost::gregorian::date(year, month, 1));
+            }
+            // 分区上界：下个月1日零点
+            std::string bound() const
+            {
+                char buf[64];
+                Month n = next();
+                snprintf(buf, sizeof(buf), "UNIX_TIMESTAMP('%04d-%02d-01 00:00:00')", n.year, n.month);
+                return buf;
+            }
+            std::string definition() const
+            {
+                return "PARTITION " + name() + " VALUES LESS THAN (" + bound() + ")";
+            }
+        };
+        static Month _current()
+        {
+            auto today = boost::posix_time::second_clock::universal_time().date();
+            return Month{(int)today.year(), (int)today.month()};
+        }
+        // 从分区名pYYYYMM解析月份，非月分区返回false
+        static bool _parse(const std::string &name, Month &m)
+        {
+            if (name.size() != 7 || name[0] != 'p')
+                return false;
+            for (size_t i = 1; i < name.size(); ++i)
+            {
+                if (name[i] < '0' || name[i] > '9')
+                    return false;
+            }
+            m.year = std::stoi(name.substr(1, 4));
+            m.month = std::stoi(name.substr(5, 2));
+            return m.month >= 1 && m.month <= 12;
+        }
+        bool _maintain()
+        {
+            std::vector<MessagePartition> parts;
+            if (partitions(parts) == false)
+                return false;
+            if (parts.empty())
+            {
+                LOG_WARN("消息表不存在，跳过本轮分区维护！");
+                return false;
+            }
+            // 只有确认是普通表时才转换，查询失败或表不存在都不会触发转换
+            if (parts.size() == 1 && parts[0].name.empty())
+                return _convert();
+            bool ret = _unique();
+            ret = _extend(parts) && ret;
+            if (_retain_months > 0 && _archive)
+                ret = _expire(parts) && ret;
+            return ret;
+        }
+        // 旧版本分区表上的消息ID只有普通索引，升级为(message_id, create_time)唯一索引
+        //  表中已经存在重复消息时升级会失败，需要先清理重复的行
+        bool _unique()
+        {
+            bool unique = false;
+            if (message_id_unique(unique) == false)
+                return false;
+            if (unique)
+                return true;
+            return _execute("ALTER TABLE message DROP INDEX message_message_id_i, "
+                            "ADD UNIQUE INDEX message_message_id_i (message_id, create_time)");
+        }
+        // 获取维护命名锁，成功时conn保存持有锁的连接
+        bool _lock(odb::connection_ptr &conn)
+        {
+            try
+            {
+                conn = _db->connection();
+                odb::transaction trans(conn->begin());
+                typedef odb::result<PartitionLock> result;
+                result r(_db->query<PartitionLock>());
+                bool acquired = false;
+                for (auto it = r.begin(); it != r.end(); it++)
+                {
+                    acquired = it->acquired == 1;
+                }
+                trans.commit();
+                if (acquired)
+                    return true;
+                LOG_DEBUG("其他实例正在维护消息表分区，跳过本轮维护");
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("获取分区维护锁失败：{}", e.what());
+            }
+            conn.reset();
+            return false;
+        }
+        void _unlock(odb::connection_ptr &conn)
+        {
+            try
+            {
+                odb::transaction trans(conn->begin());
+                conn->execute("DO RELEASE_LOCK(CONCAT('message_partition.', DATABASE()))");
+                trans.commit();
+            }
+            catch (const std::exception &e)
+            {
+                // 释放失败时关闭连接，由MySQL在会话结束时释放锁
+                LOG_ERROR("释放分区维护锁失败：{}", e.what());
+                static_cast<odb::mysql::connection &>(*conn).mark_failed();
+            }
+            conn.reset();
+        }
+        bool _execute(const std::string &sql)
+        {
+            try
+            {
+                odb::transaction trans(_db->begin());
+                _db->execute(sql);
+                trans.commit();
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("执行分区维护语句失败：{} - {}", sql, e.what());
+                return false;
+            }
+            LOG_INFO("执行分区维护语句：{}", sql);
+            return true;
+        }
+        // 普通表转换为分区表：主键与唯一索引都必须包含分区列，因此主键调整为(id, create_time)
+        bool _convert()
+        {
+            Month cur = _current();
+            std::string sql = "ALTER TABLE message DROP PRIMARY KEY, ADD PRIMARY KEY (id, create_time), "
+                              "DROP INDEX message_message_id_i, ADD UNIQUE INDEX message_message_id_i (message_id, create_time) "
+                              "PARTITION BY RANGE (UNIX_TIMESTAMP(create_time)) (";
+            sql += "PARTITION p_history VALUES LESS THAN (" + cur.prev().bound() + "), ";
+            Month m = cur;
+            for (int i = 0; i <= _months_ahead; ++i, m = m.next())
+            {
+                sql += m.definition() + ", ";
+            }
+            sql += "PARTITION p_max VALUES LESS THAN MAXVALUE)";
+            return _execute(sql);
+        }
+        // 保证当前月之后至少有months_ahead个空分区
+        bool _extend(const std::vector<MessagePartition> &parts)
+        {
+            Month last{0, 0};
+            bool found = false;
+            for (auto &p : parts)
+            {
+                Month m;
+                if (_parse(p.name, m) && (!found || last < m))
+                {
+                    last = m;
+                    found = true;
+                }
+            }
+            Month target = _current();
+            for (int i = 0; i < _months_ahead; ++i)
+                target = target.next();
+            if (!found)
+                last = _current().prev();
+            if (!(last < target))
+                return true;
+            std::string sql = "ALTER TABLE message REORGANIZE PARTITION p_max INTO (";
+            for (Month m = last.next(); !(target < m); m = m.next())
+            {
+                sql += m.definition() + ", ";
+            }
+            sql += "PARTITION p_max VALUES LESS THAN MAXVALUE)";
+            return _execute(sql);
+        }
+        // 查询分区内create_time的最小/最大值，分区为空时empty为true
+        //  分区名只能拼接在语句中，与复制心跳一样直接使用底层连接执行
+        bool _bounds(const std::string &name, boost::posix_time::ptime &min, boost::posix_time::ptime &max, bool &empty)
+        {
+            std::string sql = "SELECT MIN(create_time), MAX(create_time) FROM message PARTITION (" + name + ")";
+            try
+            {
+                auto mysql_db = std::static_pointer_cast<odb::mysql::database>(_db);
+                odb::mysql::connection_ptr conn(mysql_db->connection());
+                MYSQL *handle = conn->handle();
+                if (mysql_query(handle, sql.c_str()) != 0)
+                {
+                    LOG_ERROR("查询分区{}时间范围失败：{}", name, mysql_error(handle));
+                    return false;
+                }
+                MYSQL_RES *res = mysql_store_result(handle);
+                if (res == nullptr)
+                {
+                    LOG_ERROR("查询分区{}时间范围失败：{}", name, mysql_error(handle));
+                    return false;
+                }
+                MYSQL_ROW row = mysql_fetch_row(res);
+                empty = !row || !row[0] || !row[1];
+                if (!empty)
+                {
+                    min = boost::posix_time::time_from_string(row[0]);
+                    max = boost::posix_time::time_from_string(row[1]);
+                }
+                mysql_free_result(res);
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("查询分区{}时间范围失败：{}", name, e.what());
+                return false;
+            }
+            return true;
+        }
+        // 归档并删除超过保留期的分区，按从旧到新的顺序处理，某个分区归档失败则停止
+        //  归档区间为分区内实际数据的[最早时间, 最晚时间+1秒)，空分区直接删除
+        bool _expire(const std::vector<MessagePartition> &parts)
+        {
+            int oldest_hot = _current().index() - _retain_months + 1;
+            for (auto &p : parts)
+            {
+                Month m;
+                bool history = p.name == "p_history";
+                if (!history && !(_parse(p.name, m) && m.index() < oldest_hot))
+                    break;
+                boost::posix_time::ptime min, max;
+                bool empty = true;
+                if (_bounds(p.name, min, max, empty) == false)
+                    return false;
+                // p_history按其中最新的数据所在月份判断是否过期
+                if (history && !empty && (int)max.date().year() * 12 + (int)max.date().month() - 1 >= oldest_hot)
+                    break;
+                if (!empty && _archive(min, max + boost::posix_time::seconds(1)) == false)
+                {
+                    LOG_ERROR("归档消息分区{}失败，保留该分区！", p.name);
+                    return false;
+                }
+                if (_execute("ALTER TABLE message DROP PARTITION " + p.name) == false)
+                    return false;
+            }
+            return true;
+        }
+
+    private:
+        std::shared_ptr<odb::core::database> _db;
+        int _months_ahead;
+        int _retain_months;
+        ArchiveFunc _archive;
+
+        bool _running;
+        std::mutex _mutex;
+        std::condition_variable _cond;
+        std::thread _thread;
+    };
+}
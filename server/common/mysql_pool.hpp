@@ -0,0 +1,288 @@
+#pragma once
+#include <odb/mysql/connection-factory.hxx>
+#include <odb/details/lock.hxx>
+#include <odb/details/shared-ptr.hxx>
+#include <bthread/mutex.h>
+#include <bthread/condition_variable.h>
+#include <bvar/bvar.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include "logger.hpp"
+#include "trace.hpp"
+
+namespace lbk
+{
+    // 连接池参数：min_size == max_size 时为固定大小，否则在两者之间按排队情况自适应伸缩
+    struct PoolOptions
+    {
+        size_t min_size = 4;
+        size_t max_size = 4;
+        int grow_wait_us = 1000;     // 一个调整周期内出现过超过该时长的等待则扩容
+        int adjust_interval_ms = 1000;
+        int shrink_idle_rounds = 10; // 连续多少个周期峰值占用都低于上限时缩容
+    };
+
+    // 带监控的ODB MySQL连接池
+    //  导出的bvar(前缀 mysql_pool_<名称>_)：
+    //    checkout     - 获取连接耗时的分位值与qps
+    //    wait_us      - 累计等待连接的时长(微秒)
+    //    in_use/idle/waiting/limit - 正在使用/空闲/排队的连接数与当前上限
+    //  自适应模式下底层池按max_size创建，实际可同时借出的连接数由limit控制：
+    //  出现排队时逐个扩容，长时间用不满时逐个缩容，超过min_size的空闲连接归还时由底层池释放
+    //  超出limit的请求在bthread条件变量上排队(只挂起bthread，不占用工作线程)，连接归还时唤醒
+    class InstrumentedConnectionPool : public odb::mysql::connection_pool_factory
+    {
+    public:
+        InstrumentedConnectionPool(const std::string &name, const PoolOptions &opts)
+            : odb::mysql::connection_pool_factory(opts.max_size, opts.min_size == 0 ? 1 : opts.min_size),
+              _opts(opts), _adaptive(opts.max_size > opts.min_size), _limit(opts.min_size == 0 ? 1 : opts.min_size),
+              _waiting(0), _granted(0), _peak(0), _idle_rounds(0), _max_wait_us(0), _running(false),
+              _in_use_var(&InstrumentedConnectionPool::_get_in_use, this),
+              _idle_var(&InstrumentedConnectionPool::_get_idle, this),
+              _waiting_var(&InstrumentedConnectionPool::_get_waiting, this),
+              _limit_var(&InstrumentedConnectionPool::_get_limit, this)
+        {
+            if (!_adaptive)
+                _limit = opts.max_size;
+            // 同一地址可能存在多个连接池(如多个分库在同一实例上)，名称冲突时追加序号
+            std::string prefix = "mysql_pool_" + name;
+            for (int i = 2; _checkout.expose(prefix + "_checkout") != 0; ++i)
+                prefix = "mysql_pool_" + name + "_" + std::to_string(i);
+            _wait_us.expose(prefix + "_wait_us");
+            _in_use_var.expose(prefix + "_in_use");
+            _idle_var.expose(prefix + "_idle");
+            _waiting_var.expose(prefix + "_waiting");
+            _limit_var.expose(prefix + "_limit");
+            if (_adaptive)
+            {
+                _running = true;
+                _thread = std::thread(&InstrumentedConnectionPool::_adjust_loop, this);
+            }
+        }
+        ~InstrumentedConnectionPool()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_thread_mutex);
+                _running = false;
+            }
+            _thread_cond.notify_all();
+            if (_thread.joinable())
+                _thread.join();
+        }
+        virtual odb::mysql::connection_ptr connect()
+        {
+            auto start = std::chrono::steady_clock::now();
+            odb::mysql::connection_ptr conn;
+            if (_adaptive)
+            {
+                // 先在闸门处领取一个借出名额再释放闸门去底层池取连接：名额总数不超过limit，底层池不会阻塞
+                {
+                    std::unique_lock<bthread::Mutex> lock(_gate_mutex);
+                    if (_granted >= _limit)
+                    {
+                        ++_waiting;
+                        while (_granted >= _limit)
+                            _gate_cond.wait(lock);
+                        --_waiting;
+                    }
+                    if (++_granted > _peak)
+                        _peak = _granted;
+                }
+                try
+                {
+                    conn = odb::mysql::connection_pool_factory::connect();
+                }
+                catch (...)
+                {
+                    _released();
+                    throw;
+                }
+                // 连接都由create创建，归还时经过GatedConnection的回调交还名额
+                static_cast<GatedConnection *>(conn.get())->hook();
+            }
+            else
+            {
+                conn = odb::mysql::connection_pool_factory::connect();
+            }
+            int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+            _checkout << us;
+            _wait_us << us;
+            int64_t prev = _max_wait_us.load(std::memory_order_relaxed);
+            while (us > prev && !_max_wait_us.compare_exchange_weak(prev, us))
+                ;
+            return conn;
+        }
+
+    protected:
+        // 底层池归还连接时没有可重写的回调，借出时在连接的引用计数回调前插入一层：
+        //  引用计数归零时先交给底层池原有的回调回收连接，再交还闸门名额并唤醒排队的请求
+        //  底层池借出连接时会重置回调，因此每次借出后都要重新hook
+        class GatedConnection : public pooled_connection
+        {
+        public:
+            GatedConnection(InstrumentedConnectionPool &pool)
+                : pooled_connection(pool), _pool(&pool), _origin(nullptr)
+            {
+                _gate_callback.arg = this;
+                _gate_callback.zero_counter = &GatedConnection::_zero_counter;
+            }
+            void hook()
+            {
+                _origin = odb::details::shared_base::callback_;
+                odb::details::shared_base::callback_ = &_gate_callback;
+            }
+
+        private:
+            static bool _zero_counter(void *arg)
+            {
+                GatedConnection *self = static_cast<GatedConnection *>(arg);
+                // 原有回调返回true时连接随后会被删除，需要先取出用到的成员
+                InstrumentedConnectionPool *pool = self->_pool;
+                odb::details::shared_base::refcount_callback *origin = self->_origin;
+                bool ret = origin->zero_counter(origin->arg);
+                pool->_released();
+                return ret;
+            }
+
+        private:
+            InstrumentedConnectionPool *_pool;
+            odb::details::shared_base::refcount_callback *_origin;
+            odb::details::shared_base::refcount_callback _gate_callback;
+        };
+        virtual pooled_connection_ptr create()
+        {
+            return pooled_connection_ptr(new (odb::details::shared) GatedConnection(*this));
+        }
+
+    private:
+        // 连接归还，交还名额并唤醒一个排队的请求
+        void _released()
+        {
+            std::unique_lock<bthread::Mutex> lock(_gate_mutex);
+            --_granted;
+            _gate_cond.notify_one();
+        }
+        size_t _in_use()
+        {
+            odb::details::lock l(mutex_);
+            return in_use_;
+        }
+        size_t _idle()
+        {
+            odb::details::lock l(mutex_);
+            return connections_.size();
+        }
+        static int64_t _get_in_use(void *arg) { return ((InstrumentedConnectionPool *)arg)->_in_use(); }
+        static int64_t _get_idle(void *arg) { return ((InstrumentedConnectionPool *)arg)->_idle(); }
+        static int64_t _get_waiting(void *arg) { return ((InstrumentedConnectionPool *)arg)->_waiting.load(); }
+        static int64_t _get_limit(void *arg) { return ((InstrumentedConnectionPool *)arg)->_limit.load(); }
+        // 周期性根据排队情况调整上限
+        void _adjust_loop()
+        {
+            std::unique_lock<std::mutex> lock(_thread_mutex);
+            while (_running)
+            {
+                _thread_cond.wait_for(lock, std::chrono::milliseconds(_opts.adjust_interval_ms),
+                                      [this]()
+                                      { return !_running; });
+                if (!_running)
+                    break;
+                _adjust();
+            }
+        }
+        void _adjust()
+        {
+            std::unique_lock<bthread::Mutex> lock(_gate_mutex);
+            int64_t max_wait = _max_wait_us.exchange(0);
+            size_t limit = _limit;
+            if ((max_wait > _opts.grow_wait_us || _waiting > 0) && limit < _opts.max_size)
+            {
+                _limit = limit + 1;
+                _idle_rounds = 0;
+                _gate_cond.notify_one();
+                LOG_INFO("Mysql连接池出现排队(最长等待{}us)，上限扩容到{}", max_wait, limit + 1);
+            }
+            else if (_peak + 1 < limit && limit > _opts.min_size)
+            {
+                if (++_idle_rounds >= _opts.shrink_idle_rounds)
+                {
+                    _limit = limit - 1;
+                    _idle_rounds = 0;
+                    LOG_INFO("Mysql连接池长时间用不满，上限缩容到{}", limit - 1);
+                }
+            }
+            else
+            {
+                _idle_rounds = 0;
+            }
+            _peak = _granted;
+        }
+
+    private:
+        PoolOptions _opts;
+        bool _adaptive;
+        std::atomic<size_t> _limit;
+        std::atomic<size_t> _waiting;
+        // 以下受_gate_mutex保护
+        size_t _granted; // 已发出的借出名额
+        size_t _peak;    // 本周期内借出名额的峰值
+        int _idle_rounds;
+        std::atomic<int64_t> _max_wait_us;
+        bthread::Mutex _gate_mutex;
+        bthread::ConditionVariable _gate_cond;
+
+        bool _running;
+        std::mutex _thread_mutex;
+        std::condition_variable _thread_cond;
+        std::thread _thread;
+
+        bvar::LatencyRecorder _checkout;
+        bvar::Adder<int64_t> _wait_us;
+        bvar::PassiveStatus<int64_t> _in_use_var;
+        bvar::PassiveStatus<int64_t> _idle_var;
+        bvar::PassiveStatus<int64_t> _waiting_var;
+        bvar::PassiveStatus<int64_t> _limit_var;
+    };
+
+    // 一条语句的统计：耗时分位值与qps导出为 mysql_stmt_<名称>，有所属请求时同时记录为追踪span
+    struct StatementStat
+    {
+        StatementStat(const std::string &name)
+            : span_name("mysql." + name), latency("mysql_stmt_" + name) {}
+        std::string span_name;
+        bvar::LatencyRecorder latency;
+    };
+    // 按语句名称取得统计对象
+    inline StatementStat &statement_latency(const std::string &name)
+    {
+        static std::mutex mutex;
+        static std::unordered_map<std::string, std::unique_ptr<StatementStat>> stats;
+        std::unique_lock<std::mutex> lock(mutex);
+        auto &stat = stats[name];
+        if (!stat)
+            stat.reset(new StatementStat(name));
+        return *stat;
+    }
+    // 作用域计时：析构时将耗时(微秒)记录到对应语句的统计中
+    class StatementTimer
+    {
+    public:
+        StatementTimer(StatementStat &stat)
+            : _stat(stat), _span(stat.span_name, "db"), _start(std::chrono::steady_clock::now()) {}
+        ~StatementTimer()
+        {
+            _stat.latency << std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _start).count();
+        }
+
+    private:
+        StatementStat &_stat;
+        trace::Span _span;
+        std::chrono::steady_clock::time_point _start;
+    };
+}
@@ -2,6 +2,8 @@
 #include "mysql.hpp"
 #include "relation.hxx"
 #include "relation-odb.hxx"
+#include "mysql_id_map.hpp"
+#include "mysql_router.hpp"
 #include "logger.hpp"
 
 namespace lbk
@@ -11,15 +13,30 @@ namespace lbk
     public:
         using ptr = std::shared_ptr<RelationTable>;
         RelationTable(const std::shared_ptr<odb::core::database> db)
-            : _db(db) {}
+            : RelationTable(std::make_shared<DBRouter>(db)) {}
+        // 读写分离：关系变更以双方用户ID登记读己之写，exists/friends分发到从库
+        RelationTable(const DBRouter::ptr &router)
+            : _db(router->primary()), _router(router), _id_map(std::make_shared<IdMapTable>(router->primary())) {}
         // 新增关系信息
         bool insert(const std::string &uid, const std::string &pid)
         {
+            static StatementStat &stat = statement_latency("relation_insert");
+            StatementTimer timer(stat);
+            unsigned long ukey, pkey;
+            if (!_id_map->key(uid, ukey) || !_id_map->key(pid, pkey))
+            {
+                LOG_ERROR("新增用户好友关系信息失败 {}-{}:获取ID映射失败！", uid, pid);
+                return false;
+            }
             try
             {
                 odb::transaction trans(_db->begin());
                 Relation r1(uid, pid);
+                r1.user_key(ukey);
+                r1.peer_key(pkey);
                 Relation r2(pid, uid);
+                r2.user_key(pkey);
+                r2.peer_key(ukey);
                 _db->persist(r1);
                 _db->persist(r2);
                 trans.commit();
@@ -29,17 +46,22 @@ namespace lbk
                 LOG_ERROR("新增用户好友关系信息失败 {}-{}:{}！", uid, pid, e.what());
                 return false;
             }
+            _router->written(uid);
+            _router->written(pid);
             return true;
         }
         // 移除关系信息
         bool remove(const std::string &uid, const std::string &pid)
         {
+            unsigned long ukey, pkey;
+            if (!_id_map->key(uid, ukey, false) || !_id_map->key(pid, pkey, false))
+                return true; // 没有映射说明关系本就不存在
             try
             {
                 odb::transaction trans(_db->begin());
                 typedef odb::query<Relation> query;
-                _db->erase_query<Relation>(query::user_id == uid && query::peer_id == pid);
-                _db->erase_query<Relation>(query::user_id == pid && query::peer_id == uid);
+                _db->erase_query<Relation>(query::user_key == ukey && query::peer_key == pkey);
+                _db->erase_query<Relation>(query::user_key == pkey && query::peer_key == ukey);
                 trans.commit();
             }
             catch (const std::exception &e)
@@ -47,18 +69,26 @@ namespace lbk
                 LOG_ERROR("删除好友关系信息失败 {}-{}:{}！", uid, pid, e.what());
                 return false;
             }
+            _router->written(uid);
+            _router->written(pid);
             return true;
         }
         // 判断关系是否存在
         bool exists(const std::string &uid, const std::string &pid)
         {
+            static StatementStat &stat = statement_latency("relation_exists");
+            StatementTimer timer(stat);
             bool ret = false;
+            unsigned long ukey, pkey;
+            if (!_id_map->key(uid, ukey, false) || !_id_map->key(pid, pkey, false))
+                return false;
             try
             {
-                odb::transaction trans(_db->begin());
+                auto db = _router->reader(uid);
+                odb::transaction trans(db->begin());
                 typedef odb::query<Relation> query;
                 typedef odb::result<Relation> result;
-                result r = _db->query<Relation>(query::user_id == uid && query::peer_id == pid);
+                result r = db->query<Relation>(query::user_key == ukey && query::peer_key == pkey);
                 if (!r.empty())
                     ret = true;
                 trans.commit();
@@ -73,13 +103,19 @@ namespace lbk
         // 获取指定用户的好友ID
         std::unordered_set<std::string> friends(const std::string &uid)
         {
+            static StatementStat &stat = statement_latency("relation_friends");
+            StatementTimer timer(stat);
             std::unordered_set<std::string> ret;
+            unsigned long ukey;
+            if (!_id_map->key(uid, ukey, false))
+                return ret;
             try
             {
-                odb::transaction trans(_db->begin());
+                auto db = _router->reader(uid);
+                odb::transaction trans(db->begin());
                 typedef odb::query<Relation> query;
                 typedef odb::result<Relation> result;
-                result r = _db->query<Relation>(query::user_id == uid);
+                result r = db->query<Relation>(query::user_key == ukey);
                 for (auto it = r.begin(); it != r.end(); it++)
                 {
                     ret.insert(it->peer_id());
@@ -95,5 +131,7 @@ namespace lbk
 
     private:
         std::shared_ptr<odb::core::database> _db;
+        DBRouter::ptr _router;
+        IdMapTable::ptr _id_map;
     };
 }
\ No newline at end of file
@@ -0,0 +1,263 @@
+#pragma once
+#include "mysql.hpp"
+#include "logger.hpp"
+#include <odb/mysql/connection.hxx>
+#include <odb/mysql/transaction.hxx>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace lbk
+{
+    // 读写分离路由：写操作与事务始终走主库，只读查询分发到健康的从库
+    //  1. 复制延迟：所有实例通过主库上的GET_LOCK竞争一个心跳写入者，只有持有锁的实例以主库的NOW(6)写入心跳；
+    //     各实例在从库上用从库的NOW(6)减去复制过来的心跳即为延迟，不依赖各实例所在主机的时钟；
+    //     持锁实例退出后连接断开、锁自动释放，由其他实例接替写入；长时间无人写入时延迟增大，读请求回落到主库
+    //     延迟超过max_lag或检测失败的从库暂停使用，全部不可用时读请求回落到主库
+    //  2. 读己之写：写操作以令牌(会话ID/用户ID等)登记，令牌在ryw窗口内的读请求直接走主库，
+    //     保证刚写入的数据立即可见；窗口不小于允许的最大延迟
+    //     令牌只登记在本进程内：在一个实例写入、随后由另一个实例读取的数据看不到这次登记，可能读到从库上的旧数据；
+    //     这类跨实例先写后读的场景(例如会话成员在好友子服务写入、由转发子服务读取，见ChatSessionMemberTable::members)需要直接读主库
+    class DBRouter
+    {
+    public:
+        using ptr = std::shared_ptr<DBRouter>;
+        using DB = std::shared_ptr<odb::core::database>;
+        DBRouter(const DB &primary, const std::vector<DB> &replicas = std::vector<DB>(),
+                 int max_lag_ms = 1000, int ryw_ms = 0)
+            : _primary(primary), _max_lag_ms(max_lag_ms),
+              _ryw_ms(ryw_ms > max_lag_ms ? ryw_ms : max_lag_ms * 2), _next(0),
+              _sweep_at(WRITTEN_SWEEP_SIZE), _running(false)
+        {
+            for (auto &db : replicas)
+            {
+                auto replica = std::make_shared<Replica>();
+                replica->db = db;
+                replica->healthy = false; // 首次检测通过之前不使用
+                _replicas.push_back(replica);
+            }
+        }
+        ~DBRouter() { stop(); }
+        const DB &primary() const { return _primary; }
+        // 获取读库：令牌最近写过或没有健康的从库时返回主库，否则在健康从库间轮询
+        DB reader(const std::string &token = "")
+        {
+            if (_replicas.empty() || (!token.empty() && _recently_written(token)))
+                return _primary;
+            return _pick();
+        }
+        DB reader(const std::vector<std::string> &tokens)
+        {
+            if (_replicas.empty())
+                return _primary;
+            for (auto &token : tokens)
+            {
+                if (_recently_written(token))
+                    return _primary;
+            }
+            return _pick();
+        }
+        // 登记一次写操作，之后ryw窗口内该令牌的读请求走主库
+        void written(const std::string &token)
+        {
+            if (_replicas.empty() || token.empty())
+                return;
+            int64_t now = _now_ms();
+            std::unique_lock<std::mutex> lock(_mutex);
+            _written[token] = now + _ryw_ms;
+            // 表增长到阈值时清理过期令牌，清理后阈值调整为剩余数量的两倍，避免每次写入都全表扫描
+            if (_written.size() > _sweep_at)
+            {
+                for (auto it = _written.begin(); it != _written.end();)
+                {
+                    if (it->second <= now)
+                        it = _written.erase(it);
+                    else
+                        ++it;
+                }
+                _sweep_at = std::max(WRITTEN_SWEEP_SIZE, _written.size() * 2);
+            }
+        }
+        // 启动复制延迟检测线程
+        void start(const std::chrono::milliseconds &interval)
+        {
+            std::unique_lock<std::mutex> lock(_thread_mutex);
+            if (_running || _replicas.empty())
+                return;
+            _running = true;
+            _execute(_primary, "CREATE TABLE IF NOT EXISTS replica_heartbeat_ts "
+                               "(id INT PRIMARY KEY, beat TIMESTAMP(6) NOT NULL)");
+            _thread = std::thread([this, interval]()
+                                  {
+                std::unique_lock<std::mutex> lock(_thread_mutex);
+                while (_running)
+                {
+                    lock.unlock();
+                    _check();
+                    lock.lock();
+                    _cond.wait_for(lock, interval, [this]() { return !_running; });
+                }
+                _writer.reset(); });
+        }
+        void stop()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_thread_mutex);
+                if (!_running)
+                    return;
+                _running = false;
+            }
+            _cond.notify_all();
+            if (_thread.joinable())
+                _thread.join();
+        }
+
+    private:
+        struct Replica
+        {
+            DB db;
+            std::atomic<bool> healthy;
+        };
+        static int64_t _now_ms()
+        {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::system_clock::now().time_since_epoch())
+                .count();
+        }
+        bool _recently_written(const std::string &token)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto it = _written.find(token);
+            return it != _written.end() && it->second > _now_ms();
+        }
+        DB _pick()
+        {
+            size_t n = _replicas.size();
+            size_t start = _next.fetch_add(1, std::memory_order_relaxed);
+            for (size_t i = 0; i < n; ++i)
+            {
+                auto &replica = _replicas[(start + i) % n];
+                if (replica->healthy.load(std::memory_order_relaxed))
+                    return replica->db;
+            }
+            return _primary;
+        }
+        // 持有写入锁时在主库写入心跳，再逐个读取从库上的复制延迟
+        void _check()
+        {
+            _beat();
+            for (size_t i = 0; i < _replicas.size(); ++i)
+            {
+                auto &replica = _replicas[i];
+                int64_t lag_us = 0;
+                bool healthy = _lag(replica->db, lag_us) && lag_us <= (int64_t)_max_lag_ms * 1000;
+                if (healthy != replica->healthy.load())
+                {
+                    if (healthy)
+                        LOG_INFO("从库{}复制延迟恢复正常，重新启用", i);
+                    else
+                        LOG_WARN("从库{}复制延迟超过{}ms或检测失败，读请求回落到其他库", i, _max_lag_ms);
+                }
+                replica->healthy.store(healthy);
+            }
+        }
+        bool _execute(const DB &db, const std::string &sql)
+        {
+            try
+            {
+                odb::transaction trans(db->begin());
+                db->execute(sql);
+                trans.commit();
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("执行复制心跳语句失败：{} - {}", sql, e.what());
+                return false;
+            }
+            return true;
+        }
+        // 心跳写入者：在一条专用的主库连接上持有GET_LOCK，只有持锁时才写入心跳；
+        //  写入失败时丢弃连接(锁随之释放)，下次检测重新竞争
+        void _beat()
+        {
+            try
+            {
+                if (!_writer)
+                {
+                    auto mysql_db = std::static_pointer_cast<odb::mysql::database>(_primary);
+                    odb::mysql::connection_ptr conn(mysql_db->connection());
+                    int64_t locked = 0;
+                    if (!_query(conn->handle(), "SELECT GET_LOCK('replica_heartbeat_writer', 0)", locked) || locked != 1)
+                        return; // 其他实例正在写入心跳
+                    LOG_INFO("成为从库复制心跳的写入者");
+                    _writer = conn;
+                }
+                if (mysql_query(_writer->handle(), "REPLACE INTO replica_heartbeat_ts (id, beat) VALUES (1, NOW(6))") != 0)
+                {
+                    LOG_ERROR("写入从库复制心跳失败：{}", mysql_error(_writer->handle()));
+                    _writer.reset();
+                }
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("写入从库复制心跳失败：{}", e.what());
+                _writer.reset();
+            }
+        }
+        // 在从库上以从库的当前时间减去复制过来的心跳时间，得到复制延迟(微秒)
+        bool _lag(const DB &db, int64_t &lag_us)
+        {
+            try
+            {
+                auto mysql_db = std::static_pointer_cast<odb::mysql::database>(db);
+                odb::mysql::connection_ptr conn(mysql_db->connection());
+                return _query(conn->handle(), "SELECT TIMESTAMPDIFF(MICROSECOND, beat, NOW(6)) FROM replica_heartbeat_ts WHERE id = 1", lag_us);
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("读取从库复制心跳失败：{}", e.what());
+                return false;
+            }
+        }
+        // 心跳相关的查询都只是单值查询，直接使用底层连接执行，不需要为此生成ODB映射代码
+        static bool _query(MYSQL *handle, const char *sql, int64_t &val)
+        {
+            if (mysql_query(handle, sql) != 0)
+            {
+                LOG_ERROR("执行复制心跳查询失败：{} - {}", sql, mysql_error(handle));
+                return false;
+            }
+            MYSQL_RES *res = mysql_store_result(handle);
+            if (res == nullptr)
+                return false;
+            MYSQL_ROW row = mysql_fetch_row(res);
+            bool ret = row && row[0];
+            if (ret)
+                val = std::stoll(row[0]);
+            mysql_free_result(res);
+            return ret;
+        }
+
+    private:
+        static constexpr size_t WRITTEN_SWEEP_SIZE = 100000;
+        DB _primary;
+        std::vector<std::shared_ptr<Replica>> _replicas;
+        int _max_lag_ms;
+        int _ryw_ms;
+        std::atomic<size_t> _next;
+
+        std::mutex _mutex;
+        std::unordered_map<std::string, int64_t> _written; // 令牌 -> 读主库截止时间(ms)
+        size_t _sweep_at;
+
+        odb::mysql::connection_ptr _writer; // 持有心跳写入锁的主库连接，只在检测线程中访问
+
+        bool _running;
+        std::mutex _thread_mutex;
+        std::condition_variable _cond;
+        std::thread _thread;
+    };
+}
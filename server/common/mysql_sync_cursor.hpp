@@ -0,0 +1,277 @@
+#pragma once
+#include "mysql.hpp"
+#include "sync_cursor.hxx"
+#include "sync_cursor-odb.hxx"
+#include "mysql_id_map.hpp"
+#include "logger.hpp"
+#include <algorithm>
+#include <ctime>
+#include <sstream>
+#include <unordered_map>
+
+namespace lbk
+{
+    // 用户消息同步游标管理：会话ID -> 用户在该会话中已收到的最后一条消息的会话内序号
+    //  同时记录同步时跳过的序号空洞(会话ID -> 序号列表)，空洞在HOLE_TTL_SEC内一直被检查，
+    //  期间迟到的消息落库后补发；超过时限仍未出现的序号认为分配后没有发送成功，不再检查
+    class SyncCursorTable
+    {
+    public:
+        using ptr = std::shared_ptr<SyncCursorTable>;
+        using Holes = std::unordered_map<std::string, std::vector<unsigned long>>;
+        static const long HOLE_TTL_SEC = 24 * 3600; // 空洞的检查时限，应大于消息队列积压与重投递的最长时间
+        static const size_t MAX_HOLES = 64;         // 每个会话最多记录的空洞数量，超过时丢弃最早的
+        SyncCursorTable(const std::shared_ptr<odb::core::database> &db)
+            : _db(db), _id_map(std::make_shared<IdMapTable>(db)) {}
+        // 获取用户在所有会话中的同步游标，holes不为空时同时返回未过期的序号空洞
+        std::unordered_map<std::string, unsigned long> cursors(const std::string &uid, Holes *holes = nullptr)
+        {
+            std::unordered_map<std::string, unsigned long> res;
+            unsigned long ukey;
+            if (!_id_map->key(uid, ukey, false))
+                return res;
+            std::unordered_map<unsigned long, unsigned long> by_key;
+            std::unordered_map<unsigned long, std::vector<unsigned long>> holes_by_key;
+            long now = time(nullptr);
+            try
+            {
+                odb::transaction trans(_db->begin());
+                typedef odb::query<SyncCursor> query;
+                typedef odb::result<SyncCursor> result;
+                result r(_db->query<SyncCursor>(query::user_key == ukey));
+                for (auto it = r.begin(); it != r.end(); it++)
+                {
+                    by_key[it->session_key()] = it->seq();
+                    if (holes == nullptr || it->holes().empty())
+                        continue;
+                    for (auto &h : _decode(it->holes()))
+                    {
+                        if (h.second + HOLE_TTL_SEC > now)
+                            holes_by_key[it->session_key()].push_back(h.first);
+                    }
+                }
+                trans.commit();
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("获取用户同步游标失败:{}-{}！", uid, e.what());
+                return res;
+            }
+            // 游标表只存储整数键，这里将会话键还原为会话ID
+            if (by_key.empty())
+                return res;
+            try
+            {
+                odb::transaction trans(_db->begin());
+                std::vector<unsigned long> keys;
+                for (auto &it : by_key)
+                    keys.push_back(it.first);
+                typedef odb::query<IdMap> query;
+                typedef odb::result<IdMap> result;
+                result r(_db->query<IdMap>(query::id.in_range(keys.begin(), keys.end())));
+                for (auto it = r.begin(); it != r.end(); it++)
+                {
+                    res[it->ext_id()] = by_key[it->key()];
+                    auto hit = holes_by_key.find(it->key());
+                    if (hit != holes_by_key.end())
+                        (*holes)[it->ext_id()] = hit->second;
+                }
+                trans.commit();
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("还原同步游标的会话ID失败:{}-{}！", uid, e.what());
+                return std::unordered_map<std::string, unsigned long>();
+            }
+            return res;
+        }
+        // 推进用户的同步游标：会话ID -> 已收到的最后一条消息序号
+        //  游标只会前进不会后退，重复或乱序的确认不会导致消息被重新同步
+        bool advance(const std::string &uid, const std::unordered_map<std::string, unsigned long> &acks)
+        {
+            if (acks.empty())
+                return true;
+            std::vector<std::string> ext_ids;
+            ext_ids.push_back(uid);
+            for (auto &it : acks)
+                ext_ids.push_back(it.first);
+            auto keys = _id_map->keys(ext_ids, false);
+            auto uit = keys.find(uid);
+            if (uit == keys.end())
+            {
+                LOG_ERROR("推进同步游标失败：用户{}不存在ID映射！", uid);
+                return false;
+            }
+            unsigned long ukey = uit->second;
+            std::unordered_map<unsigned long, unsigned long> pending;
+            for (auto &it : acks)
+            {
+                auto sit = keys.find(it.first);
+                if (sit == keys.end() || it.second == 0)
+                    continue;
+                pending[sit->second] = it.second;
+            }
+            if (pending.empty())
+                return true;
+            try
+            {
+                odb::transaction trans(_db->begin());
+                std::vector<unsigned long> skeys;
+                for (auto &it : pending)
+                    skeys.push_back(it.first);
+                typedef odb::query<SyncCursor> query;
+                typedef odb::result<SyncCursor> result;
+                result r(_db->query<SyncCursor>(query::user_key == ukey &&
+                                                query::session_key.in_range(skeys.begin(), skeys.end())));
+                for (auto it = r.begin(); it != r.end(); it++)
+                {
+                    auto pit = pending.find(it->session_key());
+                    if (pit->second > it->seq())
+                    {
+                        it->seq(pit->second);
+                        _db->update(*it);
+                    }
+                    pending.erase(pit);
+                }
+                for (auto &it : pending)
+                {
+                    SyncCursor cursor(ukey, it.first, it.second);
+                    _db->persist(cursor);
+                }
+                trans.commit();
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("推进用户同步游标失败:{}-{}！", uid, e.what());
+                return false;
+            }
+            return true;
+        }
+
+        // 更新用户的序号空洞：记录本次同步跳过的序号，删除已经补发的序号与过期的序号
+        //  在主库上加锁读取后修改，同一用户并发同步时不会互相覆盖；没有游标的会话不记录
+        bool update_holes(const std::string &uid, const Holes &skipped, const Holes &filled)
+        {
+            if (skipped.empty() && filled.empty())
+                return true;
+            std::vector<std::string> ext_ids;
+            ext_ids.push_back(uid);
+            for (auto &it : skipped)
+                ext_ids.push_back(it.first);
+            for (auto &it : filled)
+                ext_ids.push_back(it.first);
+            auto keys = _id_map->keys(ext_ids, false);
+            auto uit = keys.find(uid);
+            if (uit == keys.end())
+            {
+                LOG_ERROR("更新序号空洞失败：用户{}不存在ID映射！", uid);
+                return false;
+            }
+            std::unordered_map<unsigned long, const std::vector<unsigned long> *> add, remove;
+            for (auto &it : skipped)
+            {
+                auto sit = keys.find(it.first);
+                if (sit != keys.end())
+                    add[sit->second] = &it.second;
+            }
+            for (auto &it : filled)
+            {
+                auto sit = keys.find(it.first);
+                if (sit != keys.end())
+                    remove[sit->second] = &it.second;
+            }
+            std::vector<unsigned long> skeys;
+            for (auto &it : add)
+                skeys.push_back(it.first);
+            for (auto &it : remove)
+                skeys.push_back(it.first);
+            if (skeys.empty())
+                return true;
+            long now = time(nullptr);
+            try
+            {
+                odb::transaction trans(_db->begin());
+                typedef odb::query<SyncCursor> query;
+                typedef odb::result<SyncCursor> result;
+                result r(_db->query<SyncCursor>((query::user_key == uit->second &&
+                                                 query::session_key.in_range(skeys.begin(), skeys.end())) +
+                                                "FOR UPDATE"));
+                for (auto it = r.begin(); it != r.end(); it++)
+                {
+                    std::vector<std::pair<unsigned long, long>> holes;
+                    for (auto &h : _decode(it->holes()))
+                    {
+                        if (h.second + HOLE_TTL_SEC <= now)
+                            continue;
+                        auto rit = remove.find(it->session_key());
+                        if (rit != remove.end() &&
+                            std::find(rit->second->begin(), rit->second->end(), h.first) != rit->second->end())
+                            continue;
+                        holes.push_back(h);
+                    }
+                    auto ait = add.find(it->session_key());
+                    if (ait != add.end())
+                    {
+                        for (auto seq : *ait->second)
+                        {
+                            auto exist = std::find_if(holes.begin(), holes.end(), [seq](const std::pair<unsigned long, long> &h)
+                                                      { return h.first == seq; });
+                            if (exist == holes.end())
+                                holes.emplace_back(seq, now);
+                        }
+                    }
+                    if (holes.size() > MAX_HOLES)
+                        holes.erase(holes.begin(), holes.end() - MAX_HOLES);
+                    std::string encoded = _encode(holes);
+                    if (encoded != it->holes())
+                    {
+                        it->holes(encoded);
+                        _db->update(*it);
+                    }
+                }
+                trans.commit();
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("更新用户序号空洞失败:{}-{}！", uid, e.what());
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        // 空洞编码为 "序号:跳过时的unix时间" 以逗号分隔
+        static std::vector<std::pair<unsigned long, long>> _decode(const std::string &str)
+        {
+            std::vector<std::pair<unsigned long, long>> res;
+            std::stringstream ss(str);
+            std::string item;
+            while (std::getline(ss, item, ','))
+            {
+                size_t sep = item.find(':');
+                if (sep == std::string::npos)
+                    continue;
+                unsigned long seq = strtoul(item.c_str(), nullptr, 10);
+                long ts = strtol(item.c_str() + sep + 1, nullptr, 10);
+                if (seq > 0)
+                    res.emplace_back(seq, ts);
+            }
+            return res;
+        }
+        static std::string _encode(const std::vector<std::pair<unsigned long, long>> &holes)
+        {
+            std::string res;
+            for (auto &h : holes)
+            {
+                if (!res.empty())
+                    res += ',';
+                res += std::to_string(h.first) + ':' + std::to_string(h.second);
+            }
+            return res;
+        }
+
+    private:
+        std::shared_ptr<odb::core::database> _db;
+        IdMapTable::ptr _id_map;
+    };
+}
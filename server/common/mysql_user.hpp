@@ -1,7 +1,11 @@
 #pragma once
+#include <algorithm>
+#include <chrono>
+#include <functional>
 #include "mysql.hpp"
 #include "user.hxx"
 #include "user-odb.hxx"
+#include "mysql_router.hpp"
 #include "logger.hpp"
 
 namespace lbk
@@ -11,9 +15,18 @@ namespace lbk
     public:
         using ptr = std::shared_ptr<UserTable>;
         UserTable(const std::shared_ptr<odb::core::database> db)
-            : _db(db) {}
+            : UserTable(std::make_shared<DBRouter>(db)) {}
+        // 读写分离：用户信息变更以用户ID登记读己之写，按ID查询分发到从库；
+        //  按昵称/手机号的查询用于注册与登录校验，始终走主库
+        //  修改用户信息必须通过modify在主库上加锁读取后更新，不能用从库读到的数据整行写回
+        //  每次写入都推进行版本号，作为ES用户文档的外部版本号
+        UserTable(const DBRouter::ptr &router)
+            : _db(router->primary()), _router(router) {}
         bool insert(const std::shared_ptr<User> &user)
         {
+            static StatementStat &stat = statement_latency("user_insert");
+            StatementTimer timer(stat);
+            _bump(*user);
             try
             {
                 odb::transaction trans(_db->begin());
@@ -25,10 +38,14 @@ namespace lbk
                 LOG_ERROR("新增用户失败{}:{}!", user->nickname(), e.what());
                 return false;
             }
+            _router->written(user->user_id());
             return true;
         }
         bool update(const std::shared_ptr<User> &user)
         {
+            static StatementStat &stat = statement_latency("user_update");
+            StatementTimer timer(stat);
+            _bump(*user);
             try
             {
                 odb::transaction trans(_db->begin());
@@ -40,8 +57,39 @@ namespace lbk
                 LOG_ERROR("更新用户失败{}:{}!", user->nickname(), e.what());
                 return false;
             }
+            _router->written(user->user_id());
             return true;
         }
+        // 在同一个主库事务中 SELECT ... FOR UPDATE 读出用户、由fn修改后整行更新，返回更新后的用户
+        //  行锁保证不同实例并发修改不同字段时不会互相覆盖；用户不存在或更新失败时返回空
+        std::shared_ptr<User> modify(const std::string &user_id, const std::function<void(User &)> &fn)
+        {
+            static StatementStat &stat = statement_latency("user_modify");
+            StatementTimer timer(stat);
+            std::shared_ptr<User> res;
+            try
+            {
+                odb::transaction trans(_db->begin());
+                typedef odb::query<User> query;
+                res.reset(_db->query_one<User>((query::user_id == user_id) + "FOR UPDATE"));
+                if (!res)
+                {
+                    LOG_ERROR("修改用户失败，未找到用户{}!", user_id);
+                    return res;
+                }
+                fn(*res);
+                _bump(*res);
+                _db->update(*res);
+                trans.commit();
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("修改用户失败{}:{}!", user_id, e.what());
+                return std::shared_ptr<User>();
+            }
+            _router->written(user_id);
+            return res;
+        }
         std::shared_ptr<User> select_by_nickname(const std::string &nickname)
         {
             std::shared_ptr<User> res;
@@ -78,12 +126,15 @@ namespace lbk
         }
         std::shared_ptr<User> select_by_id(const std::string &user_id)
         {
+            static StatementStat &stat = statement_latency("user_select_by_id");
+            StatementTimer timer(stat);
             std::shared_ptr<User> res;
             try
             {
-                odb::transaction trans(_db->begin());
+                auto db = _router->reader(user_id);
+                odb::transaction trans(db->begin());
                 typedef odb::query<User> query;
-                res.reset(_db->query_one<User>(query::user_id == user_id));
+                res.reset(db->query_one<User>(query::user_id == user_id));
                 trans.commit();
             }
             catch (const std::exception &e)
@@ -93,15 +144,19 @@ namespace lbk
             }
             return res;
         }
-        std::vector<User> select_multi_users(const std::vector<std::string> &id_list)
+        // from_primary: 结果会回填到所有实例共享的缓存时读主库，避免从库的旧数据在缓存中长期有效
+        std::vector<User> select_multi_users(const std::vector<std::string> &id_list, bool from_primary = false)
         {
+            static StatementStat &stat = statement_latency("user_select_multi");
+            StatementTimer timer(stat);
             // select * from user where user_id in ('id1', 'id2', ...)
             if (id_list.empty())
                 return std::vector<User>();
             std::vector<User> res;
             try
             {
-                odb::transaction trans(_db->begin());
+                auto db = from_primary ? _db : _router->reader(id_list);
+                odb::transaction trans(db->begin());
                 typedef odb::query<User> query;
                 typedef odb::result<User> result;
                 std::stringstream ss;
@@ -111,7 +166,7 @@ namespace lbk
                 std::string condition = ss.str();
                 condition.pop_back();
                 condition += ")";
-                result r(_db->query<User>(condition));
+                result r(db->query<User>(condition));
                 for (result::iterator it = r.begin(); it != r.end(); it++)
                 {
                     res.push_back(*it);
@@ -126,7 +181,18 @@ namespace lbk
             return res;
         }
 
+    private:
+        // 新版本号取 max(原版本号+1, 当前微秒)：modify在行锁内推进，同一用户的版本号严格递增，
+        //  与各实例的时钟偏差无关；取当前微秒只是为了与以前按写入时刻生成的ES文档版本号保持可比
+        static void _bump(User &user)
+        {
+            auto now = std::chrono::system_clock::now().time_since_epoch();
+            int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+            user.version(std::max(user.version() + 1, us));
+        }
+
     private:
         std::shared_ptr<odb::core::database> _db;
+        DBRouter::ptr _router;
     };
 }
\ No newline at end of file
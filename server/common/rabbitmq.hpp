@@ -6,7 +6,9 @@
 #include <openssl/opensslv.h>
 #include <iostream>
 #include <functional>
+#include <future>
 #include "logger.hpp"
+#include "trace.hpp"
 namespace lbk
 {
     class MQClient
@@ -46,7 +48,7 @@ namespace lbk
             _channel->declareExchange(exchange, exchange_type)
                 .onError([&exchange](const char *msg)
                          {
-        LOG_ERROR("{}交换机创建失败：{}",exchange,msg);
+        LOG_FATAL("{}交换机创建失败：{}",exchange,msg);
         exit(1); })
                 .onSuccess([&exchange]()
                            { LOG_INFO("{}交换机创建成功！", exchange); });
@@ -54,7 +56,7 @@ namespace lbk
             _channel->declareQueue(queue)
                 .onError([&queue](const char *msg)
                          {
-        LOG_ERROR("{}队列创建失败：{}",queue,msg);
+        LOG_FATAL("{}队列创建失败：{}",queue,msg);
         exit(1); })
                 .onSuccess([&queue]()
                            { LOG_INFO("{}队列创建成功！", queue); });
@@ -62,15 +64,37 @@ namespace lbk
             _channel->bindQueue(exchange, queue, routing_key)
                 .onError([&exchange, &queue](const char *msg)
                          {
-        LOG_ERROR("{} - {}绑定失败：{}",exchange,queue,msg);
+        LOG_FATAL("{} - {}绑定失败：{}",exchange,queue,msg);
         exit(1); })
                 .onSuccess([&exchange, &queue]()
                            { LOG_INFO("{} - {}绑定成功！", exchange, queue); });
         }
+        // 只声明交换机，用于只发布不订阅的一方(例如fanout广播)
+        void declareExchange(const std::string &exchange, AMQP::ExchangeType exchange_type = AMQP::ExchangeType::direct)
+        {
+            _channel->declareExchange(exchange, exchange_type)
+                .onError([exchange](const char *msg)
+                         {
+        LOG_FATAL("{}交换机创建失败：{}",exchange,msg);
+        exit(1); })
+                .onSuccess([exchange]()
+                           { LOG_INFO("{}交换机创建成功！", exchange); });
+        }
         bool publish(const std::string &exchange, const std::string &msg, const std::string &routing_key = "routing_key")
         {
             LOG_DEBUG("向交换机 {}-{} 发布消息！", exchange, routing_key);
-            bool ret = _channel->publish(exchange, routing_key, msg);
+            trace::Span span("mq.publish " + exchange, "mq");
+            AMQP::Envelope envelope(msg.data(), msg.size());
+            if (span.active())
+            {
+                // 追踪上下文放在消息头中，订阅方处理消息时以本次发布为父span
+                AMQP::Table headers;
+                headers.set("trace_id", span.context().trace_id);
+                headers.set("span_id", std::to_string(span.context().span_id));
+                envelope.setHeaders(headers);
+            }
+            bool ret = _channel->publish(exchange, routing_key, envelope);
+            span.finish(ret);
             if (ret == false)
             {
                 LOG_ERROR("{} 发布消息失败：", exchange);
@@ -82,16 +106,55 @@ namespace lbk
         {
             LOG_DEBUG("开始订阅 {} 队列消息！", queue);
             _channel->consume(queue, "consume-tags")
-                .onReceived([this, cb](const AMQP::Message &message, uint32_t deliveryTag, bool redelivered)
+                .onReceived([this, cb, queue](const AMQP::Message &message, uint32_t deliveryTag, bool redelivered)
                             {
+            trace::Context ctx;
+            ctx.trace_id = (const std::string &)message.headers().get("trace_id");
+            if (ctx.valid())
+                ctx.span_id = strtoull(((const std::string &)message.headers().get("span_id")).c_str(), nullptr, 10);
+            trace::ContextScope scope(ctx);
+            trace::Span span("mq.consume " + queue, "mq");
             cb(message.body(),message.bodySize());
+            span.finish();
             _channel->ack(deliveryTag); })
                 .onError([&queue](const char *message)
                          {
-                    LOG_ERROR("订阅 {} 队列消息失败: {}", queue, message);
+                    LOG_FATAL("订阅 {} 队列消息失败: {}", queue, message);
                     exit(1); });
         }
 
+        // 以广播方式订阅交换机：为当前实例声明一个由服务器命名的独占、自动删除的队列并绑定，
+        //  每个实例都能收到全部消息(而不是与其他实例的同名队列竞争消费)，实例退出后队列随连接一起删除；
+        //  订阅生效后才返回。direct交换机需要给出与发布方相同的routing_key
+        void consumeBroadcast(const std::string &exchange, const MessageCallback &cb, const std::string &routing_key = "",
+                              AMQP::ExchangeType exchange_type = AMQP::ExchangeType::fanout)
+        {
+            auto subscribed = std::make_shared<std::promise<void>>();
+            _channel->declareExchange(exchange, exchange_type)
+                .onError([exchange](const char *msg)
+                         {
+        LOG_FATAL("{}交换机创建失败：{}",exchange,msg);
+        exit(1); });
+            _channel->declareQueue(AMQP::exclusive | AMQP::autodelete)
+                .onError([exchange](const char *msg)
+                         {
+        LOG_FATAL("{}广播订阅队列创建失败：{}",exchange,msg);
+        exit(1); })
+                .onSuccess([this, exchange, routing_key, cb, subscribed](const std::string &queue, uint32_t, uint32_t)
+                           {
+        _channel->bindQueue(exchange, queue, routing_key)
+            .onError([exchange, queue](const char *msg)
+                     {
+            LOG_FATAL("{} - {}绑定失败：{}",exchange,queue,msg);
+            exit(1); })
+            .onSuccess([this, exchange, queue, cb, subscribed]()
+                       {
+            LOG_INFO("{} - {}广播订阅成功！", exchange, queue);
+            consume(queue, cb);
+            subscribed->set_value(); }); });
+            subscribed->get_future().wait();
+        }
+
     private:
         static void watcher_callback(struct ev_loop *loop, ev_async *watcher, int32_t revents)
         {
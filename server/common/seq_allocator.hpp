@@ -0,0 +1,131 @@
+#pragma once
+#include <sw/redis++/redis++.h>
+#include <bthread/mutex.h>
+#include <bthread/condition_variable.h>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "logger.hpp"
+
+namespace lbk
+{
+    // 会话内消息序号分配器
+    //  1. 每个会话在redis中维护一个计数器 seq:<会话ID>，记录已经分配出去的最大序号
+    //  2. 序号由redis统一分配，多实例下同一会话的序号也按分配时间严格递增
+    //  3. 同一会话在本进程内同一时刻最多只有一次INCRBY在途：在途期间到达的请求排成一批，
+    //     上一次返回后由一个请求代表整批执行一次INCRBY，再按到达顺序分配这段序号；
+    //     热点会话的redis往返次数随并发自动合并，不会预先租出用不完的号段
+    //  4. 分配出去的序号都对应一次正在进行的请求，INCRBY失败时整批请求都失败，序号段中不会留下空洞
+    class SeqAllocator
+    {
+    public:
+        using ptr = std::shared_ptr<SeqAllocator>;
+        SeqAllocator(const std::shared_ptr<sw::redis::Redis> &redis_client,
+                     size_t max_sessions = 100000, size_t shard_count = 16)
+            : _redis_client(redis_client),
+              _max_sessions_per_shard(std::max<size_t>(1, max_sessions / (shard_count == 0 ? 1 : shard_count)))
+        {
+            if (shard_count == 0)
+                shard_count = 1;
+            for (size_t i = 0; i < shard_count; ++i)
+            {
+                _shards.emplace_back(new Shard());
+            }
+        }
+        // 分配会话内的下一个序号，失败时返回0（有效序号从1开始）
+        //  等待使用bthread的锁和条件变量，在brpc处理线程中等待时只挂起bthread，不会阻塞工作线程
+        uint64_t next(const std::string &ssid)
+        {
+            auto session = _session(ssid);
+            std::unique_lock<bthread::Mutex> lock(session->mutex);
+            if (!session->waiting)
+                session->waiting = std::make_shared<Batch>();
+            auto batch = session->waiting;
+            uint64_t index = batch->count++;
+            while (batch->done == false)
+            {
+                if (session->running)
+                {
+                    session->cond.wait(lock);
+                    continue;
+                }
+                // 没有在途的INCRBY，由当前请求代表本批执行；取走后新到达的请求进入下一批
+                session->running = true;
+                session->waiting.reset();
+                lock.unlock();
+                uint64_t end = _incrby(ssid, batch->count);
+                lock.lock();
+                batch->end = end;
+                batch->done = true;
+                session->running = false;
+                session->cond.notify_all();
+            }
+            if (batch->end == 0)
+                return 0;
+            return batch->end - batch->count + 1 + index;
+        }
+
+    private:
+        struct Batch
+        {
+            uint64_t count = 0; // 本批请求数量
+            uint64_t end = 0;   // INCRBY返回的计数器值，0表示分配失败
+            bool done = false;
+        };
+        struct Session
+        {
+            bthread::Mutex mutex;
+            bthread::ConditionVariable cond;
+            bool running = false;          // 是否有INCRBY在途
+            std::shared_ptr<Batch> waiting; // 等待下一次INCRBY的请求批次
+        };
+        struct Shard
+        {
+            std::mutex mutex;
+            std::unordered_map<std::string, std::shared_ptr<Session>> sessions;
+        };
+        // 返回增加后的计数器值，失败时返回0
+        uint64_t _incrby(const std::string &ssid, long long count)
+        {
+            try
+            {
+                return _redis_client->incrby("seq:" + ssid, count);
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("会话{}消息序号分配失败：{}", ssid, e.what());
+                return 0;
+            }
+        }
+        std::shared_ptr<Session> _session(const std::string &ssid)
+        {
+            auto &shard = *_shards[std::hash<std::string>()(ssid) % _shards.size()];
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            auto it = shard.sessions.find(ssid);
+            if (it != shard.sessions.end())
+                return it->second;
+            // 活跃会话过多时清理本分片中没有请求正在使用的会话
+            if (shard.sessions.size() >= _max_sessions_per_shard)
+            {
+                for (auto it = shard.sessions.begin(); it != shard.sessions.end();)
+                {
+                    if (it->second.use_count() == 1)
+                        it = shard.sessions.erase(it);
+                    else
+                        ++it;
+                }
+            }
+            auto session = std::make_shared<Session>();
+            shard.sessions.emplace(ssid, session);
+            return session;
+        }
+
+    private:
+        std::shared_ptr<sw::redis::Redis> _redis_client;
+        size_t _max_sessions_per_shard;
+        std::vector<std::unique_ptr<Shard>> _shards;
+    };
+}
@@ -0,0 +1,101 @@
+// 并发请求合并(singleflight)
+//  同一时刻对同一个key的多个并发调用，只有第一个调用者真正执行，
+//  其余调用者等待其完成后共享同一份结果，避免缓存击穿和下游的重复调用
+//  使用bthread的锁和条件变量进行等待，在brpc处理线程中等待时只挂起bthread，不会阻塞工作线程
+#pragma once
+#include <bthread/mutex.h>
+#include <bthread/condition_variable.h>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <unordered_map>
+
+namespace lbk
+{
+    template <typename T>
+    class SingleFlight
+    {
+    public:
+        using ptr = std::shared_ptr<SingleFlight<T>>;
+        // 执行key对应的调用，shared用于返回本次结果是否是与其他调用者共享的
+        T run(const std::string &key, const std::function<T()> &fn, bool *shared = nullptr)
+        {
+            std::shared_ptr<Call> call;
+            bool leader = false;
+            {
+                std::unique_lock<bthread::Mutex> lock(_mutex);
+                auto it = _calls.find(key);
+                if (it != _calls.end())
+                    call = it->second;
+                else
+                {
+                    call = std::make_shared<Call>();
+                    _calls[key] = call;
+                    leader = true;
+                }
+            }
+            if (shared)
+                *shared = !leader;
+            if (!leader)
+            {
+                std::unique_lock<bthread::Mutex> lock(call->mutex);
+                while (call->done == false)
+                    call->cond.wait(lock);
+                if (call->error)
+                    std::rethrow_exception(call->error);
+                return call->val;
+            }
+            try
+            {
+                call->val = fn();
+            }
+            catch (...)
+            {
+                call->error = std::current_exception();
+            }
+            {
+                std::unique_lock<bthread::Mutex> lock(_mutex);
+                _calls.erase(key);
+            }
+            {
+                std::unique_lock<bthread::Mutex> lock(call->mutex);
+                call->done = true;
+                call->cond.notify_all();
+            }
+            if (call->error)
+                std::rethrow_exception(call->error);
+            return call->val;
+        }
+
+    private:
+        struct Call
+        {
+            bthread::Mutex mutex;
+            bthread::ConditionVariable cond;
+            bool done = false;
+            T val;
+            std::exception_ptr error;
+        };
+        bthread::Mutex _mutex;
+        std::unordered_map<std::string, std::shared_ptr<Call>> _calls;
+    };
+    // 将一组ID排序去重后拼接为合并请求的key，保证相同集合(与顺序无关)得到相同的key
+    template <typename Container>
+    std::string flight_key(const Container &ids)
+    {
+        std::vector<std::string> sorted(ids.begin(), ids.end());
+        std::sort(sorted.begin(), sorted.end());
+        sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+        std::string key;
+        for (auto &id : sorted)
+        {
+            key += id;
+            key += ',';
+        }
+        return key;
+    }
+}
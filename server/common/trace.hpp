@@ -0,0 +1,282 @@
+#pragma once
+#include <brpc/controller.h>
+#include <bthread/bthread.h>
+#include <butil/fast_rand.h>
+#include <butil/time.h>
+#include <spdlog/async.h>
+#include <spdlog/sinks/rotating_file_sink.h>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "logger.hpp"
+
+namespace lbk
+{
+    // 跨服务的请求追踪
+    //  trace_id直接使用各请求中已有的request_id，一个请求经过的每个服务处理函数、下游Rpc调用、
+    //  数据库语句、ES请求与MQ发布都记录为一个span(开始/结束时间、父span)，按trace_id汇总即可看出耗时分布
+    //  1. 服务内：当前span保存在bthread局部存储中，下层模块(数据库、ES、MQ)直接取当前span作为父span，不需要逐层传参
+    //  2. 服务间：Rpc调用把当前span ID放在brpc的log_id中，对端处理函数以其作为父span；MQ消息放在消息头中
+    //  3. span写入内存环形缓冲(可通过 /trace?trace_id=xxx 查看)，指定文件时同时按行写入json，由日志后台线程异步落盘
+    namespace trace
+    {
+        // 当前所在的追踪上下文
+        struct Context
+        {
+            std::string trace_id;
+            uint64_t span_id = 0;
+            bool valid() const { return !trace_id.empty(); }
+        };
+
+        struct SpanRecord
+        {
+            std::string trace_id;
+            uint64_t span_id = 0;
+            uint64_t parent_id = 0;
+            std::string name;
+            const char *kind = ""; // server/rpc/db/es/mq
+            int64_t start_us = 0;
+            int64_t end_us = 0;
+            bool ok = true;
+        };
+
+        class Tracer
+        {
+        public:
+            static Tracer &instance()
+            {
+                static Tracer tracer;
+                return tracer;
+            }
+            // service: 当前服务名称；ring_size: 内存中保留的最近span数量，为0表示关闭追踪
+            //  file不为空时span同时写入该文件(按大小滚动)，需要在init_logger之后调用
+            void init(const std::string &service, size_t ring_size, const std::string &file = "")
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _service = service;
+                _ring.clear();
+                _ring.reserve(ring_size);
+                _capacity = ring_size;
+                _next = 0;
+                if (!file.empty() && ring_size > 0)
+                {
+                    try
+                    {
+                        _exporter = spdlog::create_async_nb<spdlog::sinks::rotating_file_sink_mt>("trace", file, 100 * 1024 * 1024, 5);
+                        _exporter->set_pattern("%v");
+                        _exporter->set_level(spdlog::level::level_enum::info);
+                    }
+                    catch (const std::exception &e)
+                    {
+                        LOG_ERROR("创建追踪文件 {} 失败：{}", file, e.what());
+                    }
+                }
+                _enabled = ring_size > 0;
+            }
+            bool enabled() const { return _enabled; }
+            void record(SpanRecord &&span)
+            {
+                if (_exporter)
+                    _exporter->info(to_json(span));
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (_ring.size() < _capacity)
+                    _ring.push_back(std::move(span));
+                else
+                    _ring[_next] = std::move(span);
+                _next = (_next + 1) % _capacity;
+            }
+            // 最近的span，trace_id不为空时只返回该请求的span并按开始时间排序，否则按结束时间由新到旧
+            std::vector<SpanRecord> recent(const std::string &trace_id, size_t limit)
+            {
+                std::vector<SpanRecord> ret;
+                std::unique_lock<std::mutex> lock(_mutex);
+                for (size_t i = 0; i < _ring.size() && ret.size() < limit; ++i)
+                {
+                    // _next之前一个位置是最新写入的span
+                    const SpanRecord &span = _ring[(_next + _ring.size() - 1 - i) % _ring.size()];
+                    if (trace_id.empty() || span.trace_id == trace_id)
+                        ret.push_back(span);
+                }
+                lock.unlock();
+                if (!trace_id.empty())
+                    std::sort(ret.begin(), ret.end(), [](const SpanRecord &a, const SpanRecord &b)
+                              { return a.start_us < b.start_us; });
+                return ret;
+            }
+            std::string to_json(const SpanRecord &span) const
+            {
+                std::string json = "{\"trace_id\":";
+                _escape(span.trace_id, json);
+                json += ",\"span_id\":\"" + std::to_string(span.span_id) + "\"";
+                json += ",\"parent_id\":\"" + std::to_string(span.parent_id) + "\"";
+                json += ",\"service\":";
+                _escape(_service, json);
+                json += ",\"name\":";
+                _escape(span.name, json);
+                json += ",\"kind\":\"" + std::string(span.kind) + "\"";
+                json += ",\"start_us\":" + std::to_string(span.start_us);
+                json += ",\"duration_us\":" + std::to_string(span.end_us - span.start_us);
+                json += span.ok ? ",\"ok\":true}" : ",\"ok\":false}";
+                return json;
+            }
+
+        private:
+            Tracer() {}
+            static void _escape(const std::string &str, std::string &out)
+            {
+                out += '"';
+                for (char c : str)
+                {
+                    if (c == '"' || c == '\\')
+                        out += '\\';
+                    if ((unsigned char)c < 0x20)
+                        continue;
+                    out += c;
+                }
+                out += '"';
+            }
+
+        private:
+            bool _enabled = false;
+            std::string _service;
+            std::mutex _mutex;
+            std::vector<SpanRecord> _ring;
+            size_t _capacity = 0;
+            size_t _next = 0;
+            std::shared_ptr<spdlog::logger> _exporter;
+        };
+
+        // 当前上下文存放在bthread局部存储中：在bthread里随bthread切换线程，在普通线程里就是线程局部变量
+        inline bthread_key_t context_key()
+        {
+            static bthread_key_t key = []()
+            {
+                bthread_key_t key;
+                bthread_key_create(&key, nullptr);
+                return key;
+            }();
+            return key;
+        }
+        inline const Context *current()
+        {
+            return static_cast<const Context *>(bthread_getspecific(context_key()));
+        }
+        // 复制当前上下文，用于把上下文带到其他线程中(例如数据库线程池)
+        inline Context capture()
+        {
+            const Context *ctx = current();
+            return ctx ? *ctx : Context();
+        }
+
+        // 作用域内把ctx设为当前上下文，离开时恢复之前的上下文
+        class ContextScope
+        {
+        public:
+            ContextScope(const Context &ctx) : _ctx(ctx), _prev(nullptr), _active(ctx.valid())
+            {
+                if (!_active)
+                    return;
+                _prev = current();
+                bthread_setspecific(context_key(), &_ctx);
+            }
+            ~ContextScope()
+            {
+                if (_active)
+                    bthread_setspecific(context_key(), const_cast<Context *>(_prev));
+            }
+
+        private:
+            Context _ctx;
+            const Context *_prev;
+            bool _active;
+        };
+
+        // 作用域span：构造时开始计时并成为当前span，finish或析构时结束并记录
+        //  追踪关闭或者没有所属请求(例如后台任务)时什么也不做
+        //  同一个bthread中的span需要按后进先出的顺序结束
+        class Span
+        {
+        public:
+            // 当前上下文中的子span，kind为 rpc/db/es/mq
+            Span(const std::string &name, const char *kind)
+            {
+                const Context *parent = current();
+                if (parent && Tracer::instance().enabled())
+                    _start(parent->trace_id, parent->span_id, name, kind);
+            }
+            // 指定所属请求与父span，请求的起点(例如网关)parent_id为0
+            Span(const std::string &request_id, uint64_t parent_id, const std::string &name, const char *kind)
+            {
+                if (!request_id.empty() && Tracer::instance().enabled())
+                    _start(request_id, parent_id, name, kind);
+            }
+            // 服务端处理函数入口：trace_id为请求中的request_id，父span由调用方经log_id传入
+            Span(google::protobuf::RpcController *controller, const std::string &request_id, const std::string &name)
+                : Span(request_id, static_cast<brpc::Controller *>(controller)->log_id(), name, "server") {}
+            ~Span() { finish(); }
+            Span(const Span &) = delete;
+            Span &operator=(const Span &) = delete;
+
+            bool active() const { return _active; }
+            const Context &context() const { return _ctx; }
+            // 发起Rpc调用前调用，对端以当前span为父span
+            void inject(brpc::Controller &cntl) const
+            {
+                if (_active)
+                    cntl.set_log_id(_ctx.span_id);
+            }
+            void finish(bool ok = true)
+            {
+                if (!_active)
+                    return;
+                _active = false;
+                bthread_setspecific(context_key(), const_cast<Context *>(_prev));
+                _record.end_us = butil::gettimeofday_us();
+                _record.ok = ok;
+                Tracer::instance().record(std::move(_record));
+            }
+
+        private:
+            void _start(const std::string &trace_id, uint64_t parent_id, const std::string &name, const char *kind)
+            {
+                _active = true;
+                _ctx.trace_id = trace_id;
+                _ctx.span_id = butil::fast_rand();
+                _record.trace_id = trace_id;
+                _record.span_id = _ctx.span_id;
+                _record.parent_id = parent_id;
+                _record.name = name;
+                _record.kind = kind;
+                _record.start_us = butil::gettimeofday_us();
+                _prev = current();
+                bthread_setspecific(context_key(), &_ctx);
+            }
+
+        private:
+            bool _active = false;
+            Context _ctx;
+            const Context *_prev = nullptr;
+            SpanRecord _record;
+        };
+
+        // 直接记录一段已经结束的操作，用于在回调中结束的异步调用(例如ES请求)
+        inline void record(const Context &parent, const std::string &name, const char *kind,
+                           int64_t start_us, int64_t end_us, bool ok)
+        {
+            if (!parent.valid() || !Tracer::instance().enabled())
+                return;
+            SpanRecord span;
+            span.trace_id = parent.trace_id;
+            span.span_id = butil::fast_rand();
+            span.parent_id = parent.span_id;
+            span.name = name;
+            span.kind = kind;
+            span.start_us = start_us;
+            span.end_us = end_us;
+            span.ok = ok;
+            Tracer::instance().record(std::move(span));
+        }
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <brpc/server.h>
+#include "trace.hpp"
+#include "trace.pb.h"
+
+namespace lbk
+{
+    namespace trace
+    {
+        // 在各服务的Rpc服务器上提供追踪数据的查看页面，与brpc内置页面共用同一端口
+        //  /trace?trace_id=xxx 返回该请求在本服务中的所有span，不带trace_id时返回最近的span
+        class TraceServiceImpl : public lbk::TraceService
+        {
+        public:
+            void Spans(google::protobuf::RpcController *controller,
+                       const ::lbk::TraceQueryReq *request,
+                       ::lbk::TraceQueryRsp *response,
+                       ::google::protobuf::Closure *done)
+            {
+                brpc::ClosureGuard rpc_guard(done);
+                brpc::Controller *cntl = static_cast<brpc::Controller *>(controller);
+                const std::string *trace_id = cntl->http_request().uri().GetQuery("trace_id");
+                const std::string *limit = cntl->http_request().uri().GetQuery("limit");
+                size_t count = 100;
+                if (limit && atol(limit->c_str()) > 0)
+                    count = atol(limit->c_str());
+                auto spans = Tracer::instance().recent(trace_id ? *trace_id : "", count);
+                butil::IOBufBuilder os;
+                os << "[";
+                for (size_t i = 0; i < spans.size(); ++i)
+                {
+                    if (i > 0)
+                        os << ",\n";
+                    os << Tracer::instance().to_json(spans[i]);
+                }
+                os << "]\n";
+                cntl->http_response().set_content_type("application/json");
+                os.move_to(cntl->response_attachment());
+            }
+        };
+        // 将追踪查看服务添加到Rpc服务器，失败时返回false
+        inline bool add_service(brpc::Server &server)
+        {
+            int ret = server.AddService(new TraceServiceImpl(), brpc::ServiceOwnership::SERVER_OWNS_SERVICE,
+                                        "/trace => Spans");
+            return ret == 0;
+        }
+    }
+}
@@ -0,0 +1,342 @@
+#pragma once
+#include "logger.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace lbk
+{
+    // 稀疏位图：按用户序号分块，每块4096位，只为出现过的块分配空间
+    //  用于检索结果的后置过滤(排除好友)，几千个好友只占用少量内存块，判断是否排除为O(1)
+    class SparseBitmap
+    {
+    public:
+        void set(uint32_t pos)
+        {
+            auto &block = _blocks[pos >> 12];
+            block[(pos >> 6) & 63] |= (uint64_t)1 << (pos & 63);
+        }
+        bool test(uint32_t pos) const
+        {
+            auto it = _blocks.find(pos >> 12);
+            if (it == _blocks.end())
+                return false;
+            return (it->second[(pos >> 6) & 63] >> (pos & 63)) & 1;
+        }
+
+    private:
+        std::unordered_map<uint32_t, std::array<uint64_t, 64>> _blocks;
+    };
+
+    // 用户检索的本地前缀索引(输入联想)
+    //  1. 字节级前缀树(ASCII转小写)，索引项为：用户ID、手机号、完整昵称，以及昵称中从第二个字符起
+    //     每个位置开始的GRAM_CHARS个字符(n-gram)；每个用户的节点数与昵称长度成线性关系
+    //  2. 每个用户分配一个稠密的序号，前缀树节点中只保存序号；检索时先按深度广度优先遍历关键字对应的子树，
+    //     完全匹配的排在最前，补全越短越靠前；关键字长于GRAM_CHARS个字符时再用它的第一个n-gram找出候选，
+    //     逐个确认昵称中包含整个关键字，以此匹配昵称中间的一段
+    //  3. 遍历按访问的节点数封顶(max_visit)，热门前缀下也不会在读锁中遍历整棵树
+    //  4. 用户资料变更时整体替换该用户的索引项，不再使用的节点回收到空闲链表中复用；
+    //     启动时由bootstrap分页加载全量用户，加载期间到达的增量更新优先，不会被加载的旧数据覆盖
+    class UserTypeahead
+    {
+    public:
+        using ptr = std::shared_ptr<UserTypeahead>;
+        struct Entry
+        {
+            std::string user_id;
+            std::string phone;
+            std::string nickname;
+        };
+        // 分页加载函数：从after之后取一页用户放入page，返回false表示加载失败
+        using PageLoader = std::function<bool(const std::string &after, std::vector<Entry> &page)>;
+
+        UserTypeahead(size_t max_visit = 4096) : _max_visit(max_visit), _ready(false), _running(true) { _nodes.emplace_back(); }
+        ~UserTypeahead()
+        {
+            _running = false;
+            if (_loader.joinable())
+                _loader.join();
+        }
+        // 新增或更新用户；overwrite为false时已存在的用户保持不变(全量加载时使用)
+        void upsert(const Entry &entry, bool overwrite = true)
+        {
+            std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+            auto it = _ordinals.find(entry.user_id);
+            uint32_t ord;
+            if (it == _ordinals.end())
+            {
+                ord = _users.size();
+                _ordinals.emplace(entry.user_id, ord);
+                _users.emplace_back();
+                _users.back().user_id = entry.user_id;
+            }
+            else
+            {
+                if (!overwrite)
+                    return;
+                ord = it->second;
+                // 资料未变化时无需重建索引项
+                if (_users[ord].phone == entry.phone && _users[ord].nickname == entry.nickname)
+                    return;
+                for (uint32_t node : _users[ord].nodes)
+                {
+                    auto &users = _nodes[node].users;
+                    users.erase(std::remove(users.begin(), users.end(), ord), users.end());
+                    _release(node);
+                }
+                _users[ord].nodes.clear();
+            }
+            User &user = _users[ord];
+            user.phone = entry.phone;
+            user.nickname = entry.nickname;
+            std::vector<std::string> keys;
+            keys.push_back(_normalize(entry.user_id));
+            if (!entry.phone.empty())
+                keys.push_back(entry.phone);
+            std::string nickname = _normalize(entry.nickname);
+            if (!nickname.empty())
+                keys.push_back(nickname);
+            for (size_t pos = _next_char(nickname, 0); pos < nickname.size(); pos = _next_char(nickname, pos))
+                keys.push_back(nickname.substr(pos, _chars(nickname, pos, GRAM_CHARS) - pos));
+            std::sort(keys.begin(), keys.end());
+            keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+            for (auto &key : keys)
+            {
+                uint32_t node = _insert(key);
+                _nodes[node].users.push_back(ord);
+                user.nodes.push_back(node);
+            }
+        }
+        // 检索以key为前缀的用户ID，exclude中的用户序号被过滤掉
+        std::vector<std::string> search(const std::string &key, const SparseBitmap &exclude, size_t limit) const
+        {
+            std::vector<std::string> res;
+            std::string prefix = _normalize(key);
+            if (prefix.empty())
+                return res;
+            std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+            std::unordered_set<uint32_t> seen;
+            size_t visited = 0;
+            // 1. 关键字是某个索引项的前缀：用户ID、手机号、昵称的前缀，或者昵称中间不超过GRAM_CHARS个字符的一段
+            uint32_t node = _find(prefix, prefix.size());
+            std::deque<uint32_t> queue;
+            if (node != 0)
+                queue.push_back(node);
+            while (!queue.empty() && res.size() < limit && visited < _max_visit)
+            {
+                const Node &cur = _nodes[queue.front()];
+                queue.pop_front();
+                ++visited;
+                for (uint32_t ord : cur.users)
+                {
+                    if (res.size() >= limit)
+                        break;
+                    if (exclude.test(ord) || !seen.insert(ord).second)
+                        continue;
+                    res.push_back(_users[ord].user_id);
+                }
+                for (auto &child : cur.children)
+                    queue.push_back(child.second);
+            }
+            // 2. 关键字较长时，昵称中间的匹配只能通过第一个n-gram找到候选，再确认昵称包含整个关键字
+            size_t gram = _chars(prefix, 0, GRAM_CHARS);
+            if (gram >= prefix.size() || res.size() >= limit)
+                return res;
+            node = _find(prefix, gram);
+            if (node == 0)
+                return res;
+            for (uint32_t ord : _nodes[node].users)
+            {
+                if (res.size() >= limit || visited >= _max_visit)
+                    break;
+                ++visited;
+                if (exclude.test(ord) || seen.count(ord))
+                    continue;
+                if (_normalize(_users[ord].nickname).find(prefix) == std::string::npos)
+                    continue;
+                seen.insert(ord);
+                res.push_back(_users[ord].user_id);
+            }
+            return res;
+        }
+        // 把用户ID列表转换为序号位图，尚未被索引的用户本来也不会出现在结果中，直接忽略
+        template <typename Container>
+        void bitmap(const Container &user_ids, SparseBitmap &out) const
+        {
+            std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+            for (const auto &uid : user_ids)
+            {
+                auto it = _ordinals.find(uid);
+                if (it != _ordinals.end())
+                    out.set(it->second);
+            }
+        }
+        // 在后台线程中分页加载全量用户，完成后ready()返回true；加载失败时间隔重试
+        void bootstrap(const PageLoader &loader)
+        {
+            _loader = std::thread([this, loader]()
+                                  {
+                std::string after;
+                size_t count = 0;
+                while (_running)
+                {
+                    std::vector<Entry> page;
+                    if (loader(after, page) == false)
+                    {
+                        LOG_ERROR("加载用户检索索引失败，稍后重试！");
+                        for (int i = 0; i < 50 && _running; ++i)
+                            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                        continue;
+                    }
+                    if (page.empty())
+                        break;
+                    for (auto &entry : page)
+                        upsert(entry, false);
+                    count += page.size();
+                    after = page.back().user_id;
+                }
+                _ready = true;
+                LOG_INFO("用户检索索引加载完成，共{}个用户", count); });
+        }
+        bool ready() const { return _ready; }
+        size_t size() const
+        {
+            std::shared_lock<std::shared_timed_mutex> lock(_mutex);
+            return _users.size();
+        }
+
+    private:
+        // 昵称n-gram的字符数
+        static constexpr size_t GRAM_CHARS = 3;
+        struct Node
+        {
+            std::vector<std::pair<char, uint32_t>> children; // 按字节有序
+            std::vector<uint32_t> users;
+            uint32_t parent = 0;
+            char byte = 0; // 父节点指向本节点的字节
+        };
+        struct User
+        {
+            std::string user_id;
+            std::string phone;
+            std::string nickname;
+            std::vector<uint32_t> nodes; // 该用户出现在哪些节点中，更新时据此删除
+        };
+        static std::string _normalize(const std::string &key)
+        {
+            std::string res = key;
+            for (auto &c : res)
+                c = (c & 0x80) ? c : (char)tolower(c);
+            return res;
+        }
+        // 下一个UTF-8字符首字节的位置
+        static size_t _next_char(const std::string &str, size_t pos)
+        {
+            if (pos >= str.size())
+                return str.size();
+            ++pos;
+            while (pos < str.size() && (str[pos] & 0xC0) == 0x80)
+                ++pos;
+            return pos;
+        }
+        // 从pos开始count个UTF-8字符之后的位置
+        static size_t _chars(const std::string &str, size_t pos, size_t count)
+        {
+            for (size_t i = 0; i < count && pos < str.size(); ++i)
+                pos = _next_char(str, pos);
+            return pos;
+        }
+        static std::vector<std::pair<char, uint32_t>>::iterator _lower_bound(std::vector<std::pair<char, uint32_t>> &children, char c)
+        {
+            return std::lower_bound(children.begin(), children.end(), c,
+                                    [](const std::pair<char, uint32_t> &a, char b)
+                                    { return a.first < b; });
+        }
+        // 返回子节点编号，不存在时返回0(根节点不会是任何节点的子节点)
+        uint32_t _child(uint32_t node, char c) const
+        {
+            auto &children = _nodes[node].children;
+            auto it = std::lower_bound(children.begin(), children.end(), c,
+                                       [](const std::pair<char, uint32_t> &a, char b)
+                                       { return a.first < b; });
+            return (it != children.end() && it->first == c) ? it->second : 0;
+        }
+        // 返回key前len个字节对应的节点，不存在时返回0
+        uint32_t _find(const std::string &key, size_t len) const
+        {
+            uint32_t node = 0;
+            for (size_t i = 0; i < len; ++i)
+            {
+                node = _child(node, key[i]);
+                if (node == 0)
+                    return 0;
+            }
+            return node;
+        }
+        uint32_t _insert(const std::string &key)
+        {
+            uint32_t node = 0;
+            for (char c : key)
+            {
+                uint32_t next = _child(node, c);
+                if (next == 0)
+                {
+                    // 优先复用回收的节点
+                    if (!_free.empty())
+                    {
+                        next = _free.back();
+                        _free.pop_back();
+                        _nodes[next] = Node();
+                    }
+                    else
+                    {
+                        next = _nodes.size();
+                        _nodes.emplace_back();
+                    }
+                    _nodes[next].parent = node;
+                    _nodes[next].byte = c;
+                    auto &children = _nodes[node].children;
+                    children.emplace(_lower_bound(children, c), c, next);
+                }
+                node = next;
+            }
+            return node;
+        }
+        // 节点上没有用户也没有子节点时从父节点摘下放入空闲链表，并沿路径向上继续检查
+        void _release(uint32_t node)
+        {
+            while (node != 0 && _nodes[node].users.empty() && _nodes[node].children.empty())
+            {
+                uint32_t parent = _nodes[node].parent;
+                auto &children = _nodes[parent].children;
+                auto it = _lower_bound(children, _nodes[node].byte);
+                if (it != children.end() && it->second == node)
+                    children.erase(it);
+                _nodes[node] = Node();
+                _free.push_back(node);
+                node = parent;
+            }
+        }
+
+    private:
+        size_t _max_visit; // 单次检索最多访问的节点/候选数
+        mutable std::shared_timed_mutex _mutex;
+        std::vector<Node> _nodes;
+        std::vector<uint32_t> _free; // 回收的节点编号
+        std::vector<User> _users;
+        std::unordered_map<std::string, uint32_t> _ordinals;
+        std::atomic<bool> _ready;
+        std::atomic<bool> _running;
+        std::thread _loader;
+    };
+}
@@ -1,6 +1,7 @@
 // 实现项目中一些公共的工具类接口
 // 1. 生成一个唯一ID的接口
-// 2. 文件的读写操作接口
+// 2. 生成按时间有序的64位ID的接口（雪花算法）
+// 3. 文件的读写操作接口
 #pragma once
 #include <iostream>
 #include <sstream>
@@ -9,31 +10,168 @@
 #include <string>
 #include <atomic>
 #include <random>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
 #include "logger.hpp"
 
 namespace lbk
 {
     // 生成一个由16位随机字符组成的字符串作为唯一ID
+    // 随机数部分不可预测，用于请求ID、登录会话ID等需要防猜测的场景
     std::string uuid()
     {
+        static const char hex[] = "0123456789abcdef";
         // 1. 生成6个0~255之间的随机数字(1字节-转换为16进制字符)--生成12位16进制字符
-        std::random_device rd;                                   // 实例化设备随机数对象-用于生成设备随机数
-        std::mt19937 generator(rd());                            // 以设备随机数为种子，实例化伪随机数对象
+        //    随机数引擎每个线程只初始化一次，避免每次调用都读取设备随机数
+        thread_local std::mt19937 generator(std::random_device{}());
         std::uniform_int_distribution<int> distribution(0, 255); // 限定数据范围
 
-        std::stringstream ss;
+        std::string ret;
+        ret.reserve(18);
         for (int i = 0; i < 6; i++)
         {
             if (i == 2)
-                ss << "-";
-            ss << std::setw(2) << std::setfill('0') << std::hex << distribution(generator);
+                ret.push_back('-');
+            int num = distribution(generator);
+            ret.push_back(hex[num >> 4]);
+            ret.push_back(hex[num & 0x0f]);
         }
-        ss << "-";
+        ret.push_back('-');
         // 2. 通过一个静态变量生成一个2字节的编号数字--生成4位16进制数字字符
-        static std::atomic<short> idx(0);
-        short tmp = idx.fetch_add(1);
-        ss << std::setw(4) << std::setfill('0') << std::hex << tmp;
-        return ss.str();
+        static std::atomic<uint16_t> idx(0);
+        uint16_t tmp = idx.fetch_add(1, std::memory_order_relaxed);
+        for (int shift = 12; shift >= 0; shift -= 4)
+            ret.push_back(hex[(tmp >> shift) & 0x0f]);
+        return ret;
+    }
+
+    // 雪花算法ID生成器：41位毫秒时间戳 + 10位节点ID + 12位序号
+    //  1. 同一节点生成的ID严格递增，可以直接作为按时间排序的游标使用
+    //  2. 时间戳与序号打包在一个原子变量中，通过CAS推进，无锁
+    //  3. 同一毫秒内序号用尽或系统时钟回拨时，逻辑时间向前借用，保证不重复且不阻塞
+    class Snowflake
+    {
+    public:
+        static constexpr int NODE_BITS = 10;
+        static constexpr int SEQ_BITS = 12;
+        static constexpr uint64_t MAX_NODE = (1ULL << NODE_BITS) - 1;
+        static constexpr uint64_t MAX_SEQ = (1ULL << SEQ_BITS) - 1;
+        static constexpr uint64_t EPOCH_MS = 1704067200000ULL; // 2024-01-01 00:00:00 UTC
+        static constexpr size_t ENCODE_LEN = 13;               // 64位整数的base32编码长度
+
+        // 进程启动时设置节点ID，不同的服务实例必须使用不同的节点ID
+        //  节点ID没有默认值：未指定(负数)或超出范围时直接退出，避免多个实例共用同一个节点ID生成重复ID
+        static void init(int64_t node_id)
+        {
+            if (node_id < 0 || (uint64_t)node_id > MAX_NODE)
+            {
+                LOG_FATAL("雪花ID节点编号 {} 无效，必须通过 --node_id 为每个实例指定 0~{} 之间互不相同的编号", node_id, MAX_NODE);
+                abort();
+            }
+            node().store((uint32_t)node_id, std::memory_order_relaxed);
+        }
+        // 生成一个整数ID
+        static uint64_t next()
+        {
+            return next(now_ms());
+        }
+        // 以指定的当前时间(相对EPOCH_MS的毫秒数)生成ID，供测试模拟时钟回拨
+        static uint64_t next(uint64_t now)
+        {
+            std::atomic<uint64_t> &st = state();
+            uint64_t old = st.load(std::memory_order_relaxed);
+            uint64_t val;
+            do
+            {
+                uint64_t last_ms = old >> SEQ_BITS;
+                uint64_t seq = old & MAX_SEQ;
+                if (now > last_ms)
+                    val = now << SEQ_BITS;
+                else if (seq < MAX_SEQ)
+                    val = old + 1;
+                else
+                    val = (last_ms + 1) << SEQ_BITS;
+            } while (!st.compare_exchange_weak(old, val, std::memory_order_relaxed));
+            uint64_t ms = val >> SEQ_BITS;
+            uint64_t seq = val & MAX_SEQ;
+            return (ms << (NODE_BITS + SEQ_BITS)) |
+                   ((uint64_t)node().load(std::memory_order_relaxed) << SEQ_BITS) | seq;
+        }
+        // 将整数ID编码为定长的base32字符串(Crockford字母表)，字典序与数值序一致
+        static std::string encode(uint64_t id)
+        {
+            static const char alphabet[] = "0123456789ABCDEFGHJKMNPQRSTVWXYZ";
+            std::string ret(ENCODE_LEN, '0');
+            for (int i = ENCODE_LEN - 1; i >= 0; i--)
+            {
+                ret[i] = alphabet[id & 0x1f];
+                id >>= 5;
+            }
+            return ret;
+        }
+        // 将base32字符串解码为整数ID，格式不正确时返回false
+        static bool decode(const std::string &str, uint64_t &id)
+        {
+            if (str.size() != ENCODE_LEN)
+                return false;
+            uint64_t ret = 0;
+            for (char c : str)
+            {
+                int v = decode_char(c);
+                if (v < 0)
+                    return false;
+                ret = (ret << 5) | v;
+            }
+            id = ret;
+            return true;
+        }
+        // 从ID中提取生成时的毫秒时间戳(unix时间)
+        static uint64_t timestamp_ms(uint64_t id)
+        {
+            return (id >> (NODE_BITS + SEQ_BITS)) + EPOCH_MS;
+        }
+
+    private:
+        static uint64_t now_ms()
+        {
+            auto now = std::chrono::system_clock::now().time_since_epoch();
+            uint64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+            return ms > EPOCH_MS ? ms - EPOCH_MS : 0;
+        }
+        static int decode_char(char c)
+        {
+            if (c >= '0' && c <= '9')
+                return c - '0';
+            if (c >= 'a' && c <= 'z')
+                c = c - 'a' + 'A';
+            if (c == 'O')
+                return 0;
+            if (c == 'I' || c == 'L')
+                return 1;
+            static const char alphabet[] = "0123456789ABCDEFGHJKMNPQRSTVWXYZ";
+            for (int i = 10; i < 32; i++)
+            {
+                if (alphabet[i] == c)
+                    return i;
+            }
+            return -1;
+        }
+        static std::atomic<uint64_t> &state()
+        {
+            static std::atomic<uint64_t> st(0);
+            return st;
+        }
+        static std::atomic<uint32_t> &node()
+        {
+            static std::atomic<uint32_t> id(0);
+            return id;
+        }
+    };
+    // 生成一个按时间有序的字符串ID，用于消息、文件、会话、用户等实体的ID
+    std::string sid()
+    {
+        return Snowflake::encode(Snowflake::next());
     }
     // 实现读取一个文件的所有数据，放入body中
     bool readFile(const std::string &filename, std::string &body)
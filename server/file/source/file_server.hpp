@@ -8,6 +8,7 @@
 
 #include "etcd.hpp"   //服务注册模块封装
 #include "logger.hpp" //日志模块封装
+#include "trace_service.hpp" // 请求追踪
 #include "file.pb.h"  //protobuf代码框架
 #include "base.pb.h"  //protobuf代码框架
 #include "utils.hpp"
@@ -32,6 +33,7 @@ namespace lbk
                            google::protobuf::Closure *done)
         {
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "FileService.GetSingleFile");
             response->set_request_id(request->request_id());
             // 1. 取出请求中的文件ID（文件名）
             std::string filename = _storage_path + request->file_id();
@@ -55,6 +57,7 @@ namespace lbk
                           google::protobuf::Closure *done)
         {
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "FileService.GetMultiFile");
             response->set_request_id(request->request_id());
             // 循环取出请求中的文件ID，读取文件数据进行填充
             for (int i = 0; i < request->file_id_list_size(); i++)
@@ -84,9 +87,10 @@ namespace lbk
                            google::protobuf::Closure *done)
         {
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "FileService.PutSingleFile");
             response->set_request_id(request->request_id());
-            // 1. 为文件生成一个唯一uudi作为文件名 以及 文件ID
-            std::string fid = uuid();
+            // 1. 为文件生成一个唯一ID作为文件名 以及 文件ID
+            std::string fid = sid();
             std::string filename = _storage_path + fid;
             // 2. 取出请求中的文件数据，进行文件数据写入
             bool ret = writeFile(filename, request->file_data().file_content());
@@ -108,11 +112,12 @@ namespace lbk
                           google::protobuf::Closure *done)
         {
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "FileService.PutMultiFile");
             response->set_request_id(request->request_id());
             for (int i = 0; i < request->file_data_size(); i++)
             {
-                // 1. 为文件生成一个唯一uudi作为文件名 以及 文件ID
-                std::string fid = uuid();
+                // 1. 为文件生成一个唯一ID作为文件名 以及 文件ID
+                std::string fid = sid();
                 std::string filename = _storage_path + fid;
                 // 2. 取出请求中的文件数据，进行文件数据写入
                 bool ret = writeFile(filename, request->file_data(i).file_content());
@@ -176,7 +181,12 @@ namespace lbk
             int ret = _rpc_server->AddService(speech_service, brpc::ServiceOwnership::SERVER_OWNS_SERVICE);
             if (ret == -1)
             {
-                LOG_ERROR("添加Rpc服务失败！");
+                LOG_FATAL("添加Rpc服务失败！");
+                abort();
+            }
+            if (trace::add_service(*_rpc_server) == false)
+            {
+                LOG_FATAL("添加追踪查看服务失败！");
                 abort();
             }
             brpc::ServerOptions options;
@@ -185,7 +195,7 @@ namespace lbk
             ret = _rpc_server->Start(port, &options);
             if (ret == -1)
             {
-                LOG_ERROR("服务启动失败！");
+                LOG_FATAL("服务启动失败！");
                 abort();
             }
         }
@@ -193,12 +203,12 @@ namespace lbk
         {
             if (!_reg_client)
             {
-                LOG_ERROR("还未初始化服务注册模块！");
+                LOG_FATAL("还未初始化服务注册模块！");
                 abort();
             }
             if (!_rpc_server)
             {
-                LOG_ERROR("还未初始化RPC服务器模块！");
+                LOG_FATAL("还未初始化RPC服务器模块！");
                 abort();
             }
             FileServer::ptr server = std::make_shared<FileServer>(_reg_client, _rpc_server);
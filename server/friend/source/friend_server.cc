@@ -4,11 +4,14 @@
 DEFINE_bool(run_mode, false, "程序的运行模式，false-调试，true-发布");
 DEFINE_string(log_file, "", "发布模式下，用于指定日志的输出文件");
 DEFINE_int32(log_level, 0, "发布模式下，用于指定日志输出等级");
+DEFINE_int32(trace_ring_size, 10000, "内存中保留的最近追踪span数量，可通过/trace页面查看，0表示关闭请求追踪");
+DEFINE_string(trace_file, "", "追踪span的输出文件(每行一个json)，为空表示只保留在内存中");
 
 DEFINE_string(registry_host, "http://127.0.0.1:2379", "服务注册中心地址");
 DEFINE_string(base_service, "/service", "服务监控根目录");
 DEFINE_string(instance_name, "/friend_service/instance", "当前实例名称");
 DEFINE_string(access_host, "127.0.0.1:10006", "当前实例的外部访问地址");
+DEFINE_int32(node_id, -1, "当前实例的节点编号(0~1023)，用于生成全局唯一ID，必须显式指定且不同实例必须不同");
 
 DEFINE_int32(listen_port, 10006, "Rpc服务器监听端口");
 DEFINE_int32(rpc_timeout, -1, "Rpc调用超时时间");
@@ -23,6 +26,17 @@ DEFINE_string(mysql_db, "chat_system", "Mysql默认库名称");
 DEFINE_string(mysql_cset, "utf8", "Mysql客户端字符集");
 DEFINE_int32(mysql_port, 0, "Mysql服务器访问端口");
 DEFINE_int32(mysql_conn_pool_count, 4, "Mysql连接池最大连接数量");
+DEFINE_string(mysql_replicas, "", "Mysql从库地址列表，逗号分隔的host:port，为空表示不做读写分离");
+DEFINE_int32(mysql_max_lag_ms, 1000, "从库允许的最大复制延迟(毫秒)，超过后读请求回落到主库");
+DEFINE_int32(mysql_conn_pool_min, 0, "Mysql连接池最小连接数量，小于最大数量时连接池按排队情况自适应伸缩，0表示固定大小");
+DEFINE_int32(db_threads, 4, "数据库异步执行线程数量");
+DEFINE_int32(db_max_pending, 1024, "数据库异步任务排队上限，超过后在Rpc线程中同步执行");
+
+DEFINE_string(mq_user, "root", "消息队列服务器访问用户名");
+DEFINE_string(mq_password, "2162627569", "消息队列服务器访问密码");
+DEFINE_string(mq_host, "127.0.0.1:5672", "消息队列服务器访问地址");
+DEFINE_string(mq_user_exchange, "user_exchange", "用户资料变更广播的交换机名称，为空表示不使用本地用户检索索引");
+DEFINE_int32(user_search_limit, 10, "用户搜索返回的最大条数");
 
 DEFINE_string(user_service, "/service/user_service", "用户管理子服务名称");
 DEFINE_string(message_service, "/service/message_service", "消息存储子服务名称");
@@ -31,11 +45,18 @@ int main(int argc, char *argv[])
 {
     google::ParseCommandLineFlags(&argc, &argv, true);
     lbk::init_logger(FLAGS_run_mode, FLAGS_log_file, FLAGS_log_level);
+    lbk::trace::Tracer::instance().init("friend_service", FLAGS_trace_ring_size, FLAGS_trace_file);
+    lbk::Snowflake::init(FLAGS_node_id);
 
     lbk::FriendServerBuilder usb;
     usb.make_es_object({FLAGS_es_host});
     usb.make_mysql_object(FLAGS_mysql_user, FLAGS_mysql_password, FLAGS_mysql_host,
-                          FLAGS_mysql_db, FLAGS_mysql_cset, FLAGS_mysql_port, FLAGS_mysql_conn_pool_count);
+                          FLAGS_mysql_db, FLAGS_mysql_cset, FLAGS_mysql_port, FLAGS_mysql_conn_pool_count,
+                          FLAGS_mysql_replicas, FLAGS_mysql_max_lag_ms, FLAGS_mysql_conn_pool_min);
+    usb.make_executor_object(FLAGS_db_threads, FLAGS_db_max_pending);
+    if (!FLAGS_mq_user_exchange.empty())
+        usb.make_typeahead_object(FLAGS_mq_user, FLAGS_mq_password, FLAGS_mq_host,
+                                  FLAGS_mq_user_exchange, FLAGS_user_search_limit);
     usb.make_discovery_object(FLAGS_registry_host, FLAGS_base_service, FLAGS_user_service,FLAGS_message_service);
     usb.make_rpc_object(FLAGS_listen_port, FLAGS_rpc_timeout, FLAGS_rpc_threads);
     usb.make_registry_object(FLAGS_registry_host, FLAGS_base_service + FLAGS_instance_name, FLAGS_access_host);
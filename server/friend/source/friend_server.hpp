@@ -9,7 +9,9 @@
 #include "channel.hpp"
 #include "utils.hpp"
 #include "logger.hpp" //日志模块封装
+#include "trace_service.hpp" // 请求追踪
 #include "data_es.hpp"
+#include "singleflight.hpp"
 
 #include "base.pb.h"    //protobuf代码框架
 #include "user.pb.h"    //protobuf代码框架
@@ -20,18 +22,23 @@
 #include "mysql_chat_session.hpp"
 #include "mysql_relation.hpp"
 #include "mysql_apply.hpp"
+#include "db_executor.hpp" // 数据库异步执行线程池
+#include "user_typeahead.hpp" // 本地用户检索索引
+#include "rabbitmq.hpp"
 namespace lbk
 {
     // 继承实现FriendService
     class FriendServiceImpl : public lbk::FriendService
     {
     public:
-        FriendServiceImpl(const std::shared_ptr<odb::core::database> &db, const std::shared_ptr<elasticlient::Client> es_client,
-                          const ServiceManager::ptr &mm_channels, const std::string &user_service_name, const std::string &message_service_name)
-            : _mysql_chat_session_member(std::make_shared<ChatSessionMemberTable>(db)), _mysql_chat_session(std::make_shared<ChatSessionTable>(db)),
-              _mysql_relation(std::make_shared<RelationTable>(db)), _mysql_apply(std::make_shared<FriendApplyTable>(db)),
+        FriendServiceImpl(const DBRouter::ptr &router, const DBExecutor::ptr &db_executor, const ESClient::ptr es_client,
+                          const ServiceManager::ptr &mm_channels, const std::string &user_service_name, const std::string &message_service_name,
+                          const UserTypeahead::ptr &typeahead = UserTypeahead::ptr(), size_t search_limit = 10)
+            : _mysql_chat_session_member(std::make_shared<ChatSessionMemberTable>(router)), _mysql_chat_session(std::make_shared<ChatSessionTable>(router->primary())),
+              _mysql_relation(std::make_shared<RelationTable>(router)), _mysql_apply(std::make_shared<FriendApplyTable>(router->primary())),
+              _db_executor(db_executor),
               _mm_channels(mm_channels), _user_service_name(user_service_name), _message_service_name(message_service_name),
-              _es_user(std::make_shared<ESUser>(es_client))
+              _es_user(std::make_shared<ESUser>(es_client)), _typeahead(typeahead), _search_limit(search_limit)
         {
         }
         virtual void GetFriendList(::google::protobuf::RpcController *controller,
@@ -40,6 +47,7 @@ namespace lbk
                                    ::google::protobuf::Closure *done)
         {
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "FriendService.GetFriendList");
             response->set_request_id(request->request_id());
             // 定义一个错误处理函数，当出错时调用该函数
             auto err_response = [this, &response](const std::string &err_msg)
@@ -51,7 +59,7 @@ namespace lbk
             std::string rid = request->request_id();
             std::string uid = request->user_id();
             // 2. 从数据库中查询获取用户的好友ID
-            unordered_set<std::string> uid_list = _mysql_relation->friends(uid);
+            unordered_set<std::string> uid_list = _db_executor->async(_mysql_relation, &RelationTable::friends, uid).get();
             // 3. 从用户子服务批量获取用户信息
             unordered_map<std::string, UserInfo> user_list;
             bool ret = GetUserInfo(rid, uid_list, user_list);
@@ -74,6 +82,7 @@ namespace lbk
                                   ::google::protobuf::Closure *done)
         {
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "FriendService.FriendRemove");
             response->set_request_id(request->request_id());
             // 定义一个错误处理函数，当出错时调用该函数
             auto err_response = [this, &response](const std::string &err_msg)
@@ -86,14 +95,16 @@ namespace lbk
             std::string pid = request->peer_id();
             std::string rid = request->request_id();
             // 2. 从好友关系表中删除好友关系信息
-            bool ret = _mysql_relation->remove(uid, pid);
+            bool ret = _db_executor->async(_mysql_relation, &RelationTable::remove, uid, pid).get();
             if (!ret)
             {
                 LOG_ERROR("{} - 从数据库删除好友会话信息失败！", rid);
                 return err_response("从数据库删除好友会话信息失败！");
             }
             // 3. 从会话信息表中，删除对应的聊天会话
-            ret = _mysql_chat_session->remove(uid, pid);
+            ret = _db_executor->submit([&]()
+                                       { return _mysql_chat_session->remove(uid, pid); })
+                      .get();
             if (!ret)
             {
                 LOG_ERROR("{} - 从数据库删除好友会话信息失败！", rid);
@@ -108,6 +119,7 @@ namespace lbk
                                ::google::protobuf::Closure *done)
         {
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "FriendService.FriendAdd");
             response->set_request_id(request->request_id());
             // 定义一个错误处理函数，当出错时调用该函数
             auto err_response = [this, &response](const std::string &err_msg)
@@ -120,14 +132,14 @@ namespace lbk
             std::string uid = request->user_id();
             std::string pid = request->respondent_id();
             // 2. 判断两人是否已经是好友
-            bool ret = _mysql_relation->exists(uid, pid);
+            bool ret = _db_executor->async(_mysql_relation, &RelationTable::exists, uid, pid).get();
             if (ret)
             {
                 LOG_ERROR("{} - 申请好友失败-两者{}-{}已经是好友关系", rid, uid, pid);
                 return err_response("两者已经是好友关系！");
             }
             // 3. 当前是否已经申请过好友
-            ret = _mysql_apply->exists(uid, pid);
+            ret = _db_executor->async(_mysql_apply, &FriendApplyTable::exists, uid, pid).get();
             if (ret)
             {
                 LOG_ERROR("{}- 申请好友失败-已经申请过对方好友！", rid);
@@ -135,7 +147,9 @@ namespace lbk
             }
             // 4. 向好友申请表中，新增申请信息
             FriendApply fa(uid, pid);
-            ret = _mysql_apply->insert(fa);
+            ret = _db_executor->submit([&]()
+                                       { return _mysql_apply->insert(fa); })
+                      .get();
             if (!ret)
             {
                 LOG_ERROR("{}- 新增申请失败！", rid);
@@ -150,6 +164,7 @@ namespace lbk
                                       ::google::protobuf::Closure *done)
         {
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "FriendService.FriendAddProcess");
             response->set_request_id(request->request_id());
             // 定义一个错误处理函数，当出错时调用该函数
             auto err_response = [this, &response](const std::string &err_msg)
@@ -163,14 +178,14 @@ namespace lbk
             std::string pid = request->apply_user_id();
             bool agree = request->agree();
             // 2. 判断有没有该申请事件
-            bool ret = _mysql_apply->exists(pid, uid);
+            bool ret = _db_executor->async(_mysql_apply, &FriendApplyTable::exists, pid, uid).get();
             if (!ret)
             {
                 LOG_ERROR("{} - 没有找到{}-{}对应的好友申请事件！", rid, pid, uid);
                 return err_response("没有找到对应的好友申请事件!");
             }
             // 3. 如果有： 可以处理； --- 删除申请事件--事件已经处理完毕
-            ret = _mysql_apply->remove(pid, uid);
+            ret = _db_executor->async(_mysql_apply, &FriendApplyTable::remove, pid, uid).get();
             if (!ret)
             {
                 LOG_ERROR("{} - 从数据库删除申请事件 {}-{} 失败！", rid, pid, uid);
@@ -180,15 +195,17 @@ namespace lbk
             std::string ssid;
             if (agree)
             {
-                ret = _mysql_relation->insert(uid, pid);
+                ret = _db_executor->async(_mysql_relation, &RelationTable::insert, uid, pid).get();
                 if (!ret)
                 {
                     LOG_ERROR("{} - 新增好友关系信息 {}-{} 失败！", rid, uid, pid);
                     return err_response("新增好友关系信息失败！");
                 }
-                ssid = uuid();
+                ssid = sid();
                 ChatSession cs(ssid, "", ChatSessionType::SINGLE);
-                ret = _mysql_chat_session->insert(cs);
+                ret = _db_executor->submit([&]()
+                                           { return _mysql_chat_session->insert(cs); })
+                          .get();
                 if (!ret)
                 {
                     LOG_ERROR("{} - 新增会话信息 {} 失败！", rid, ssid);
@@ -197,7 +214,9 @@ namespace lbk
                 ChatSessionMember csm1(ssid, uid);
                 ChatSessionMember csm2(ssid, pid);
                 std::vector<ChatSessionMember> csm_list({csm1, csm2});
-                ret = _mysql_chat_session_member->append(csm_list);
+                ret = _db_executor->submit([&]()
+                                           { return _mysql_chat_session_member->append(csm_list); })
+                          .get();
                 if (!ret)
                 {
                     LOG_ERROR("{} - 新增会话成员 {} 失败！", rid, ssid);
@@ -214,6 +233,7 @@ namespace lbk
                                   ::google::protobuf::Closure *done)
         {
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "FriendService.FriendSearch");
             response->set_request_id(request->request_id());
             // 定义一个错误处理函数，当出错时调用该函数
             auto err_response = [this, &response](const std::string &err_msg)
@@ -226,18 +246,32 @@ namespace lbk
             std::string uid = request->user_id();
             std::string skey = request->search_key();
             // 2. 根据用户ID，获取用户的好友ID列表
-            auto friend_list = _mysql_relation->friends(uid);
+            auto friend_list = _db_executor->async(_mysql_relation, &RelationTable::friends, uid).get();
             // 把自己也过滤掉
             friend_list.insert(uid);
-            std::vector<std::string> search_arg(friend_list.begin(), friend_list.end());
-            // 3. 从ES搜索引擎进行用户信息搜索 --- 过滤掉当前的好友
-            auto search_res = _es_user->search(skey, search_arg);
-            // 4. 根据获取到的用户ID， 从用户子服务器进行批量用户信息获取
+            // 3. 进行用户信息搜索 --- 过滤掉当前的好友
+            //  本地索引加载完成后走本地前缀索引，好友在遍历时按位图过滤，不再拼进检索条件；
+            //  加载完成前仍使用ES检索
             unordered_set<std::string> uid_list;
-            for(auto& user:search_res)
+            if (_typeahead && _typeahead->ready())
             {
-                uid_list.insert(user.user_id());
+                SparseBitmap exclude;
+                _typeahead->bitmap(friend_list, exclude);
+                for (auto &id : _typeahead->search(skey, exclude, _search_limit))
+                {
+                    uid_list.insert(id);
+                }
             }
+            else
+            {
+                std::vector<std::string> search_arg(friend_list.begin(), friend_list.end());
+                auto search_res = _es_user->search(skey, search_arg);
+                for (auto &user : search_res)
+                {
+                    uid_list.insert(user.user_id());
+                }
+            }
+            // 4. 根据获取到的用户ID， 从用户子服务器进行批量用户信息获取
             unordered_map<std::string, UserInfo> user_info_list;
             bool ret = GetUserInfo(rid, uid_list, user_info_list);
             if (!ret)
@@ -259,6 +293,7 @@ namespace lbk
                                                ::google::protobuf::Closure *done)
         {
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "FriendService.GetPendingFriendEventList");
             response->set_request_id(request->request_id());
             // 定义一个错误处理函数，当出错时调用该函数
             auto err_response = [this, &response](const std::string &err_msg)
@@ -270,7 +305,7 @@ namespace lbk
             std::string rid = request->request_id();
             std::string uid = request->user_id();
             // 2. 从数据库获取待处理的申请事件信息 --- 申请人用户ID列表
-            auto uid_list = _mysql_apply->applyUsers(uid);
+            auto uid_list = _db_executor->async(_mysql_apply, &FriendApplyTable::applyUsers, uid).get();
             // 3. 批量获取申请人用户信息
             unordered_map<std::string, UserInfo> user_list;
             bool ret = GetUserInfo(rid, uid_list, user_list);
@@ -294,6 +329,7 @@ namespace lbk
                                         ::google::protobuf::Closure *done)
         {
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "FriendService.GetChatSessionList");
             response->set_request_id(request->request_id());
             // 定义一个错误处理函数，当出错时调用该函数
             auto err_response = [this, &response](const std::string &err_msg)
@@ -304,8 +340,9 @@ namespace lbk
             // 1. 提取请求中的关键要素：当前请求用户ID
             std::string rid = request->request_id();
             std::string uid = request->user_id();
-            // 2. 从数据库中查询出用户的单聊会话列表
-            auto scs_list = _mysql_chat_session->singleChatSession(uid);
+            // 2. 从数据库中查询出用户的单聊会话列表，群聊会话列表同时开始查询
+            auto gcs_future = _db_executor->async(_mysql_chat_session, &ChatSessionTable::groupChatSession, uid);
+            auto scs_list = _db_executor->async(_mysql_chat_session, &ChatSessionTable::singleChatSession, uid).get();
             //  2.1 从单聊会话列表中，取出所有的好友ID，从用户子服务获取用户信息
             unordered_set<std::string> uid_list;
             for (auto &e : scs_list)
@@ -335,7 +372,7 @@ namespace lbk
                 chat_session_info->mutable_prev_message()->CopyFrom(msg);
             }
             // 3. 从数据库中查询出用户的群聊会话列表
-            auto gcs_list = _mysql_chat_session->groupChatSession(uid);
+            auto gcs_list = gcs_future.get();
             for (auto &e : gcs_list)
             {
                 auto chat_session_info = response->add_chat_session_info_list();
@@ -358,6 +395,7 @@ namespace lbk
                                        ::google::protobuf::Closure *done)
         {
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "FriendService.ChatSessionCreate");
             response->set_request_id(request->request_id());
             // 定义一个错误处理函数，当出错时调用该函数
             auto err_response = [this, &response](const std::string &err_msg)
@@ -369,9 +407,11 @@ namespace lbk
             std::string rid = request->request_id();
             std::string ssname = request->chat_session_name();
             // 2. 生成会话ID，向数据库添加会话信息，添加会话成员信息
-            std::string ssid = uuid();
+            std::string ssid = sid();
             ChatSession cs(ssid, ssname, ChatSessionType::GROUP);
-            bool ret = _mysql_chat_session->insert(cs);
+            bool ret = _db_executor->submit([&]()
+                                            { return _mysql_chat_session->insert(cs); })
+                           .get();
             if (!ret)
             {
                 LOG_ERROR("{} - 向数据库添加会话信息失败: {}", rid, ssname);
@@ -383,7 +423,9 @@ namespace lbk
                 ChatSessionMember csm(ssid, request->member_id_list(i));
                 csm_list.push_back(csm);
             }
-            ret = _mysql_chat_session_member->append(csm_list);
+            ret = _db_executor->submit([&]()
+                                       { return _mysql_chat_session_member->append(csm_list); })
+                      .get();
             if (!ret)
             {
                 LOG_ERROR("{} - 向数据库添加会话成员信息失败: {}", rid, ssname);
@@ -401,6 +443,7 @@ namespace lbk
                                           ::google::protobuf::Closure *done)
         {
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "FriendService.GetChatSessionMember");
             response->set_request_id(request->request_id());
             // 定义一个错误处理函数，当出错时调用该函数
             auto err_response = [this, &response](const std::string &err_msg)
@@ -412,7 +455,7 @@ namespace lbk
             std::string rid = request->request_id();
             std::string cssid = request->chat_session_id();
             // 2. 从数据库获取会话成员ID列表
-            auto v_uid_list = _mysql_chat_session_member->members(cssid);
+            auto v_uid_list = _db_executor->async(_mysql_chat_session_member, &ChatSessionMemberTable::members, cssid).get();
             unordered_set<std::string> uid_list(v_uid_list.begin(), v_uid_list.end());
             // 3. 从用户子服务批量获取用户信息
             unordered_map<std::string, UserInfo> user_list;
@@ -447,7 +490,10 @@ namespace lbk
             req.set_chat_session_id(cssid);
             req.set_msg_count(1);
             brpc::Controller cntl;
+            trace::Span call_span("MsgStorageService.GetRecentMsg", "rpc");
+            call_span.inject(cntl);
             stub.GetRecentMsg(&cntl, &req, &rsp, nullptr);
+            call_span.finish(!cntl.Failed());
             if (cntl.Failed())
             {
                 LOG_ERROR("{} -消息存储子服务调用失败: {}", rid, cntl.ErrorText());
@@ -465,40 +511,52 @@ namespace lbk
             }
             return false;
         }
+        // 相同用户集合的并发请求合并为一次用户子服务调用，结果共享给所有等待者
         bool GetUserInfo(const std::string &rid, const unordered_set<std::string> &uid_list,
                          unordered_map<std::string, UserInfo> &user_list)
+        {
+            auto rsp = _user_flight.run(flight_key(uid_list), [this, &rid, &uid_list]()
+                                        { return _GetMultiUserInfo(rid, uid_list); });
+            if (!rsp)
+                return false;
+            for (auto &e : rsp->users_info())
+            {
+                user_list[e.first] = e.second;
+            }
+            return true;
+        }
+        std::shared_ptr<GetMultiUserInfoRsp> _GetMultiUserInfo(const std::string &rid, const unordered_set<std::string> &uid_list)
         {
             auto channel = _mm_channels->choose(_user_service_name);
             if (!channel)
             {
                 LOG_ERROR("{} - 获取用户子服务信道失败！！", rid);
-                return false;
+                return std::shared_ptr<GetMultiUserInfoRsp>();
             }
             UserService_Stub stub(channel.get());
             GetMultiUserInfoReq req;
-            GetMultiUserInfoRsp rsp;
+            auto rsp = std::make_shared<GetMultiUserInfoRsp>();
             req.set_request_id(rid);
             for (auto &e : uid_list)
             {
                 req.add_users_id(e);
             }
             brpc::Controller cntl;
-            stub.GetMultiUserInfo(&cntl, &req, &rsp, nullptr);
+            trace::Span call_span("UserService.GetMultiUserInfo", "rpc");
+            call_span.inject(cntl);
+            stub.GetMultiUserInfo(&cntl, &req, rsp.get(), nullptr);
+            call_span.finish(!cntl.Failed());
             if (cntl.Failed())
             {
                 LOG_ERROR("{} - 用户子服务调用失败: {}", rid, cntl.ErrorText());
-                return false;
+                return std::shared_ptr<GetMultiUserInfoRsp>();
             }
-            if (rsp.success() == false)
+            if (rsp->success() == false)
             {
-                LOG_ERROR("{} - 批量获取用户信息失败: {}", rid, rsp.errmsg());
-                return false;
-            }
-            for (auto &e : rsp.users_info())
-            {
-                user_list[e.first] = e.second;
+                LOG_ERROR("{} - 批量获取用户信息失败: {}", rid, rsp->errmsg());
+                return std::shared_ptr<GetMultiUserInfoRsp>();
             }
-            return true;
+            return rsp;
         }
 
     private:
@@ -506,14 +564,18 @@ namespace lbk
         std::string _user_service_name;
         std::string _message_service_name;
         ServiceManager::ptr _mm_channels;
+        SingleFlight<std::shared_ptr<GetMultiUserInfoRsp>> _user_flight;
 
         // mysql的操作句柄
         ChatSessionMemberTable::ptr _mysql_chat_session_member;
         ChatSessionTable::ptr _mysql_chat_session;
         RelationTable::ptr _mysql_relation;
         FriendApplyTable::ptr _mysql_apply;
+        DBExecutor::ptr _db_executor; // 数据库读写投递到独立线程执行，不占用brpc的worker线程
 
         ESUser::ptr _es_user;
+        UserTypeahead::ptr _typeahead; // 为空时用户搜索只走ES
+        size_t _search_limit;
     };
 
     // 使用建造者模式实现FriendServer
@@ -522,7 +584,7 @@ namespace lbk
     public:
         using ptr = std::shared_ptr<FriendServer>;
         FriendServer(const std::shared_ptr<odb::core::database> &db,
-                     const std::shared_ptr<elasticlient::Client> &es_client,
+                     const ESClient::ptr &es_client,
                      const Discovery::ptr &discovery_client,
                      const Registry::ptr &reg_client,
                      const std::shared_ptr<brpc::Server> &rpc_server)
@@ -537,7 +599,7 @@ namespace lbk
 
     private:
         std::shared_ptr<odb::core::database> _db;
-        std::shared_ptr<elasticlient::Client> _es_client;
+        ESClient::ptr _es_client;
         Discovery::ptr _discovery_client;
         Registry::ptr _registry_client;
         std::shared_ptr<brpc::Server> _rpc_server;
@@ -550,6 +612,11 @@ namespace lbk
         void make_es_object(const std::vector<std::string> &host_list)
         {
             _es_client = ESClientFactory::create(host_list);
+            if (!_es_client)
+            {
+                LOG_FATAL("初始化ES搜索引擎客户端失败！");
+                abort();
+            }
         }
         // 构造mysql客户端对象
         void make_mysql_object(const std::string &user,
@@ -558,9 +625,59 @@ namespace lbk
                                const std::string &db,
                                const std::string &cset,
                                int port,
-                               int conn_pool_count)
+                               int conn_pool_count,
+                               const std::string &replicas = "",
+                               int max_lag_ms = 1000,
+                               int conn_pool_min = 0)
         {
-            _mysql_client = ODBFactory::create(user, password, host, db, cset, port, conn_pool_count);
+            // 连接池：conn_pool_min小于最大数量时在两者之间按排队情况自适应伸缩，否则为固定大小
+            PoolOptions pool;
+            pool.max_size = conn_pool_count;
+            pool.min_size = conn_pool_min > 0 && conn_pool_min < conn_pool_count ? conn_pool_min : conn_pool_count;
+            _mysql_client = ODBFactory::create(user, password, host, db, cset, port, pool);
+            // 读写分离：replicas为逗号分隔的从库 host:port 列表，为空时所有读写都走主库
+            auto replica_list = ODBFactory::create_replicas(user, password, replicas, db, cset, pool);
+            _mysql_router = std::make_shared<DBRouter>(_mysql_client, replica_list, max_lag_ms);
+            _mysql_router->start(std::chrono::milliseconds(1000));
+        }
+        // 构造数据库异步执行线程池，threads为执行线程数量，max_pending为排队任务上限
+        void make_executor_object(size_t threads, size_t max_pending)
+        {
+            _db_executor = std::make_shared<DBExecutor>(threads, max_pending);
+        }
+        // 构造本地用户检索索引：订阅用户子服务的资料变更广播做增量更新，同时从ES分页加载全量用户
+        //  queue为当前实例独占的队列，多个实例使用同一队列会导致变更被分摊而各自索引不全
+        void make_typeahead_object(const std::string &user, const std::string &password, const std::string &host,
+                                   const std::string &exchange, size_t search_limit)
+        {
+            if (!_es_client)
+            {
+                LOG_FATAL("还未初始化ES搜索引擎模块！");
+                abort();
+            }
+            _search_limit = search_limit;
+            _typeahead = std::make_shared<UserTypeahead>();
+            _mq_client = std::make_shared<MQClient>(user, password, host);
+            // 每个实例使用自己的独占队列，各自都能收到全部变更；先订阅再加载全量，加载期间的变更不会丢失
+            auto typeahead = _typeahead;
+            _mq_client->consumeBroadcast(exchange, [typeahead](const char *body, size_t len)
+                                         {
+                UserInfo info;
+                if (info.ParseFromArray(body, len) == false)
+                {
+                    LOG_ERROR("用户资料变更消息反序列化失败！");
+                    return;
+                }
+                typeahead->upsert({info.user_id(), info.phone(), info.nickname()}); });
+            auto es_user = std::make_shared<ESUser>(_es_client);
+            _typeahead->bootstrap([es_user](const std::string &after, std::vector<UserTypeahead::Entry> &page)
+                                  {
+                std::vector<User> users;
+                if (es_user->scan(after, 1000, users) == false)
+                    return false;
+                for (auto &user : users)
+                    page.push_back({user.user_id(), user.phone(), user.nickname()});
+                return true; });
         }
         // 用于构造服务发现客户端&信道管理对象
         void make_discovery_object(const std::string &reg_host, const std::string &base_service_name,
@@ -591,26 +708,37 @@ namespace lbk
         {
             if (!_mm_channels)
             {
-                LOG_ERROR("还未初始化信道管理模块！");
+                LOG_FATAL("还未初始化信道管理模块！");
                 abort();
             }
             if (!_mysql_client)
             {
-                LOG_ERROR("还未初始化Mysql数据库模块！");
+                LOG_FATAL("还未初始化Mysql数据库模块！");
+                abort();
+            }
+            if (!_db_executor)
+            {
+                LOG_FATAL("还未初始化数据库异步执行模块！");
                 abort();
             }
             if (!_es_client)
             {
-                LOG_ERROR("还未初始化ES搜索引擎模块！");
+                LOG_FATAL("还未初始化ES搜索引擎模块！");
                 abort();
             }
             _rpc_server = std::make_shared<brpc::Server>();
             FriendServiceImpl *transmite_service = new FriendServiceImpl(
-                _mysql_client, _es_client, _mm_channels, _user_service_name, _message_service_name);
+                _mysql_router, _db_executor, _es_client, _mm_channels, _user_service_name, _message_service_name,
+                _typeahead, _search_limit);
             int ret = _rpc_server->AddService(transmite_service, brpc::ServiceOwnership::SERVER_OWNS_SERVICE);
             if (ret == -1)
             {
-                LOG_ERROR("添加Rpc服务失败！");
+                LOG_FATAL("添加Rpc服务失败！");
+                abort();
+            }
+            if (trace::add_service(*_rpc_server) == false)
+            {
+                LOG_FATAL("添加追踪查看服务失败！");
                 abort();
             }
             brpc::ServerOptions options;
@@ -619,7 +747,7 @@ namespace lbk
             ret = _rpc_server->Start(port, &options);
             if (ret == -1)
             {
-                LOG_ERROR("服务启动失败！");
+                LOG_FATAL("服务启动失败！");
                 abort();
             }
         }
@@ -627,17 +755,17 @@ namespace lbk
         {
             if (!_discover_client)
             {
-                LOG_ERROR("还未初始化服务发现模块！");
+                LOG_FATAL("还未初始化服务发现模块！");
                 abort();
             }
             if (!_registry_client)
             {
-                LOG_ERROR("还未初始化服务注册模块！");
+                LOG_FATAL("还未初始化服务注册模块！");
                 abort();
             }
             if (!_rpc_server)
             {
-                LOG_ERROR("还未初始化RPC服务器模块！");
+                LOG_FATAL("还未初始化RPC服务器模块！");
                 abort();
             }
             FriendServer::ptr server = std::make_shared<FriendServer>(
@@ -654,8 +782,14 @@ namespace lbk
 
         // mysql数据库客户端
         std::shared_ptr<odb::core::database> _mysql_client;
+        DBRouter::ptr _mysql_router;
+        DBExecutor::ptr _db_executor;
         // es搜索引擎客户端
-        std::shared_ptr<elasticlient::Client> _es_client;
+        ESClient::ptr _es_client;
+        // 本地用户检索索引及其增量更新订阅
+        UserTypeahead::ptr _typeahead;
+        MQClient::ptr _mq_client;
+        size_t _search_limit = 10;
 
         Registry::ptr _registry_client;
         std::shared_ptr<brpc::Server> _rpc_server;
@@ -0,0 +1,269 @@
+// 网关长连接管理
+#pragma once
+#include <websocketpp/config/asio_no_tls.hpp>
+#include <websocketpp/server.hpp>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <unordered_map>
+#include "logger.hpp"
+
+namespace lbk
+{
+    typedef websocketpp::server<websocketpp::config::asio> server_t;
+
+    // 单个客户端长连接
+    // 推送数据先进入连接自己的写队列，再投递到io线程中一次性取出发送，
+    // 同一连接上短时间内的多条通知会在一次调度中写出，由websocketpp合并为一次socket写操作
+    // websocketpp的连接对象只在io线程中访问：发送缓冲区的积压量由io线程在发送后记录，关闭连接也投递到io线程
+    class Client : public std::enable_shared_from_this<Client>
+    {
+    public:
+        using ptr = std::shared_ptr<Client>;
+        Client(server_t *server, const server_t::connection_ptr &conn,
+               const std::string &uid, const std::string &ssid, size_t max_pending)
+            : _server(server), _conn(conn), _uid(uid), _ssid(ssid),
+              _max_pending(max_pending), _pending_bytes(0), _buffered(0), _scheduled(false), _closed(false) {}
+        const std::string &uid() const { return _uid; }
+        const std::string &ssid() const { return _ssid; }
+        const server_t::connection_ptr &conn() const { return _conn; }
+        // 投递一条推送数据，可在任意线程调用
+        bool push(const std::string &frame)
+        {
+            bool schedule = false;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (_closed)
+                    return false;
+                // 慢连接：客户端长期不读取数据，继续堆积只会占满内存，断开后由客户端重连拉取离线消息
+                if (_pending.size() >= _max_pending ||
+                    _pending_bytes + _buffered.load(std::memory_order_relaxed) >= _max_pending * 4096)
+                {
+                    _closed = true;
+                    _pending.clear();
+                    _pending_bytes = 0;
+                    lock.unlock();
+                    LOG_WARN("用户{}的连接写队列堆积过多，断开慢连接！", _uid);
+                    close("slow consumer");
+                    return false;
+                }
+                _pending.push_back(frame);
+                _pending_bytes += frame.size();
+                if (_scheduled == false)
+                {
+                    _scheduled = true;
+                    schedule = true;
+                }
+            }
+            if (schedule)
+            {
+                auto self = shared_from_this();
+                _server->get_io_service().post([self]()
+                                               { self->flush(); });
+            }
+            return true;
+        }
+        // 关闭连接，可在任意线程调用，实际关闭在io线程中执行
+        void close(const std::string &reason)
+        {
+            auto self = shared_from_this();
+            _server->get_io_service().post([self, reason]()
+                                           {
+                websocketpp::lib::error_code ec;
+                self->_conn->close(websocketpp::close::status::policy_violation, reason, ec);
+                if (ec)
+                {
+                    LOG_WARN("关闭用户{}的长连接失败：{}", self->_uid, ec.message());
+                } });
+        }
+
+    private:
+        // 在io线程中执行，一次取出队列中积压的全部数据
+        void flush()
+        {
+            std::deque<std::string> frames;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                frames.swap(_pending);
+                _pending_bytes = 0;
+                _scheduled = false;
+            }
+            for (auto &frame : frames)
+            {
+                websocketpp::lib::error_code ec;
+                _conn->send(frame, websocketpp::frame::opcode::value::binary, ec);
+                if (ec)
+                {
+                    LOG_WARN("向用户{}推送数据失败：{}", _uid, ec.message());
+                    break;
+                }
+            }
+            _buffered.store(_conn->get_buffered_amount(), std::memory_order_relaxed);
+        }
+
+    private:
+        server_t *_server;
+        server_t::connection_ptr _conn;
+        std::string _uid;
+        std::string _ssid;
+        size_t _max_pending;
+        std::mutex _mutex;
+        std::deque<std::string> _pending;
+        size_t _pending_bytes;           // 写队列中数据的字节数
+        std::atomic<size_t> _buffered;   // 上次发送后连接发送缓冲区中积压的字节数，只由io线程更新
+        bool _scheduled;
+        bool _closed;
+    };
+
+    // 长连接管理表，按用户ID分片，每个分片独立加锁，推送和上下线不会争抢同一把锁
+    class Connection
+    {
+    public:
+        using ptr = std::shared_ptr<Connection>;
+        Connection(size_t shard_count = std::thread::hardware_concurrency())
+        {
+            if (shard_count == 0)
+                shard_count = 1;
+            for (size_t i = 0; i < shard_count; ++i)
+            {
+                _user_shards.emplace_back(new UserShard());
+                _conn_shards.emplace_back(new ConnShard());
+            }
+        }
+        // 新增连接，返回同一用户在本节点上被替换掉的旧连接（如果有）
+        //  同一条连接重新认证为其他用户时，之前的用户不再对应这条连接，从用户表中移除并通过previous返回
+        Client::ptr insert(const Client::ptr &client, Client::ptr *previous = nullptr)
+        {
+            Client::ptr old, prev;
+            {
+                auto &shard = conn_shard(client->conn().get());
+                std::unique_lock<std::mutex> lock(shard.mutex);
+                auto it = shard.clients.find(client->conn().get());
+                if (it != shard.clients.end() && it->second->uid() != client->uid())
+                    prev = it->second;
+                shard.clients[client->conn().get()] = client;
+            }
+            if (prev)
+            {
+                auto &shard = user_shard(prev->uid());
+                std::unique_lock<std::mutex> lock(shard.mutex);
+                auto it = shard.clients.find(prev->uid());
+                if (it != shard.clients.end() && it->second == prev)
+                    shard.clients.erase(it);
+            }
+            if (previous)
+                *previous = prev;
+            {
+                auto &shard = user_shard(client->uid());
+                std::unique_lock<std::mutex> lock(shard.mutex);
+                auto it = shard.clients.find(client->uid());
+                if (it != shard.clients.end())
+                    old = it->second;
+                shard.clients[client->uid()] = client;
+            }
+            LOG_DEBUG("新增长连接用户信息：{}", client->uid());
+            return old;
+        }
+        // 连接关闭时调用，返回该连接对应的客户端信息；
+        // 只有当用户表中记录的仍是这条连接时才移除，避免把重连后的新连接删掉
+        Client::ptr remove(const server_t::connection_ptr &conn)
+        {
+            Client::ptr client;
+            {
+                auto &shard = conn_shard(conn.get());
+                std::unique_lock<std::mutex> lock(shard.mutex);
+                auto it = shard.clients.find(conn.get());
+                if (it == shard.clients.end())
+                {
+                    LOG_DEBUG("未找到长连接对应的客户端信息！");
+                    return Client::ptr();
+                }
+                client = it->second;
+                shard.clients.erase(it);
+            }
+            {
+                auto &shard = user_shard(client->uid());
+                std::unique_lock<std::mutex> lock(shard.mutex);
+                auto it = shard.clients.find(client->uid());
+                if (it != shard.clients.end() && it->second == client)
+                    shard.clients.erase(it);
+            }
+            LOG_DEBUG("删除长连接用户信息：{}", client->uid());
+            return client;
+        }
+        // 判断该客户端是否仍是用户当前的连接
+        bool current(const Client::ptr &client)
+        {
+            return connection(client->uid()) == client;
+        }
+        Client::ptr connection(const std::string &uid)
+        {
+            auto &shard = user_shard(uid);
+            std::unique_lock<std::mutex> lock(shard.mutex);
+            auto it = shard.clients.find(uid);
+            if (it == shard.clients.end())
+                return Client::ptr();
+            return it->second;
+        }
+        // 获取本节点所有在线用户，用于批量心跳
+        std::vector<std::string> uids()
+        {
+            std::vector<std::string> res;
+            for (auto &shard : _user_shards)
+            {
+                std::unique_lock<std::mutex> lock(shard->mutex);
+                for (auto &it : shard->clients)
+                    res.push_back(it.first);
+            }
+            return res;
+        }
+        // 获取本节点所有在线用户的登录会话ID，用于心跳时续期会话
+        std::vector<std::string> ssids()
+        {
+            std::vector<std::string> res;
+            for (auto &shard : _user_shards)
+            {
+                std::unique_lock<std::mutex> lock(shard->mutex);
+                for (auto &it : shard->clients)
+                    res.push_back(it.second->ssid());
+            }
+            return res;
+        }
+        size_t size()
+        {
+            size_t count = 0;
+            for (auto &shard : _user_shards)
+            {
+                std::unique_lock<std::mutex> lock(shard->mutex);
+                count += shard->clients.size();
+            }
+            return count;
+        }
+
+    private:
+        struct UserShard
+        {
+            std::mutex mutex;
+            std::unordered_map<std::string, Client::ptr> clients;
+        };
+        struct ConnShard
+        {
+            std::mutex mutex;
+            std::unordered_map<const void *, Client::ptr> clients;
+        };
+        UserShard &user_shard(const std::string &uid)
+        {
+            return *_user_shards[std::hash<std::string>()(uid) % _user_shards.size()];
+        }
+        ConnShard &conn_shard(const void *conn)
+        {
+            return *_conn_shards[std::hash<const void *>()(conn) % _conn_shards.size()];
+        }
+
+    private:
+        std::vector<std::unique_ptr<UserShard>> _user_shards;
+        std::vector<std::unique_ptr<ConnShard>> _conn_shards;
+    };
+}
@@ -0,0 +1,59 @@
+// 实现网关服务器的搭建
+#include "gateway_server.hpp"
+
+DEFINE_bool(run_mode, false, "程序的运行模式，false-调试，true-发布");
+DEFINE_string(log_file, "", "发布模式下，用于指定日志的输出文件");
+DEFINE_int32(log_level, 0, "发布模式下，用于指定日志输出等级");
+DEFINE_int32(trace_ring_size, 10000, "内存中保留的最近追踪span数量，可通过/trace页面查看，0表示关闭请求追踪");
+DEFINE_string(trace_file, "", "追踪span的输出文件(每行一个json)，为空表示只保留在内存中");
+
+DEFINE_int32(http_listen_port, 9000, "HTTP服务器监听端口");
+DEFINE_int32(websocket_listen_port, 9001, "Websocket服务器监听端口");
+DEFINE_int32(websocket_threads, 4, "Websocket服务器的IO线程数量");
+DEFINE_int32(conn_shards, 0, "长连接管理表的分片数量，0表示与CPU核数相同");
+DEFINE_int32(conn_max_pending, 1024, "单个长连接写队列的最大积压条数，超过则断开慢连接");
+DEFINE_string(access_host, "127.0.0.1:10008", "当前网关实例推送RPC的外部访问地址，作为用户所在节点的标识");
+
+DEFINE_int32(listen_port, 10008, "推送Rpc服务器监听端口，接收其他网关节点转推的通知");
+DEFINE_int32(rpc_timeout, -1, "Rpc调用超时时间");
+DEFINE_int32(rpc_threads, 1, "Rpc的IO线程数量");
+DEFINE_int32(push_max_batch, 128, "发往单个网关节点的一次推送请求中最多合并的推送条数");
+DEFINE_int32(push_max_node_pending, 10000, "发往单个网关节点的推送队列最大积压条数");
+
+DEFINE_string(registry_host, "http://127.0.0.1:2379", "服务注册中心地址");
+DEFINE_string(base_service, "/service", "服务监控根目录");
+DEFINE_string(file_service, "/service/file_service", "文件存储子服务名称");
+DEFINE_string(friend_service, "/service/friend_service", "好友管理子服务名称");
+DEFINE_string(message_service, "/service/message_service", "消息存储子服务名称");
+DEFINE_string(user_service, "/service/user_service", "用户管理子服务名称");
+DEFINE_string(speech_service, "/service/speech_service", "语音识别子服务名称");
+DEFINE_string(transmite_service, "/service/transmite_service", "转发管理子服务名称");
+
+DEFINE_string(redis_host, "127.0.0.1", "Redis服务器访问地址");
+DEFINE_int32(redis_port, 6379, "Redis服务器访问端口");
+DEFINE_int32(redis_db, 0, "Redis默认库号");
+DEFINE_bool(redis_keep_alive, true, "Redis长连接保活选项");
+DEFINE_int32(redis_pool_size, 8, "Redis连接池大小");
+DEFINE_int32(presence_ttl_sec, 60, "用户在线状态的过期时间(秒)，网关按三分之一周期续期");
+DEFINE_int32(session_ttl_sec, 600, "登录会话过期时间(秒)，需与用户管理子服务一致，保持长连接的会话随心跳续期");
+
+int main(int argc, char *argv[])
+{
+    google::ParseCommandLineFlags(&argc, &argv, true);
+    lbk::init_logger(FLAGS_run_mode, FLAGS_log_file, FLAGS_log_level);
+    lbk::trace::Tracer::instance().init("gateway_service", FLAGS_trace_ring_size, FLAGS_trace_file);
+
+    lbk::GatewayServerBuilder gsb;
+    gsb.make_redis_object(FLAGS_redis_host, FLAGS_redis_port, FLAGS_redis_db, FLAGS_redis_keep_alive,
+                          FLAGS_redis_pool_size, FLAGS_presence_ttl_sec, FLAGS_session_ttl_sec);
+    gsb.make_discovery_object(FLAGS_registry_host, FLAGS_base_service, FLAGS_file_service,
+                              FLAGS_speech_service, FLAGS_message_service, FLAGS_friend_service,
+                              FLAGS_user_service, FLAGS_transmite_service);
+    gsb.make_server_object(FLAGS_websocket_listen_port, FLAGS_http_listen_port, FLAGS_websocket_threads,
+                           FLAGS_conn_shards, FLAGS_conn_max_pending, FLAGS_access_host);
+    gsb.make_rpc_object(FLAGS_listen_port, FLAGS_rpc_timeout, FLAGS_rpc_threads,
+                        FLAGS_push_max_batch, FLAGS_push_max_node_pending);
+    auto server = gsb.build();
+    server->start();
+    return 0;
+}
@@ -0,0 +1,735 @@
+// 实现网关服务：对客户端提供HTTP接口与WebSocket长连接，对内转发请求到各个子服务并推送通知
+#pragma once
+#include <brpc/server.h>
+#include <butil/logging.h>
+#include <atomic>
+#include <condition_variable>
+#include <type_traits>
+#include "httplib.h"
+
+#include "connection.hpp"  // 长连接管理
+#include "push_router.hpp" // 跨网关推送路由
+#include "data_redis.hpp" // redis数据管理客户端封装
+#include "etcd.hpp"       // 服务注册模块封装
+#include "logger.hpp"     // 日志模块封装
+#include "trace_service.hpp" // 请求追踪
+#include "channel.hpp"    // 信道管理模块封装
+#include "utils.hpp"
+
+#include "base.pb.h" // protobuf框架代码
+#include "user.pb.h"
+#include "file.pb.h"
+#include "friend.pb.h"
+#include "gateway.pb.h"
+#include "message.pb.h"
+#include "notify.pb.h"
+#include "speech.pb.h"
+#include "transmite.pb.h"
+
+namespace lbk
+{
+#define GET_PHONE_VERIFY_CODE "/service/user/get_phone_verify_code"
+#define USERNAME_REGISTER "/service/user/username_register"
+#define USERNAME_LOGIN "/service/user/username_login"
+#define PHONE_REGISTER "/service/user/phone_register"
+#define PHONE_LOGIN "/service/user/phone_login"
+#define GET_USERINFO "/service/user/get_user_info"
+#define SET_USER_AVATAR "/service/user/set_avatar"
+#define SET_USER_NICKNAME "/service/user/set_nickname"
+#define SET_USER_DESC "/service/user/set_description"
+#define SET_USER_PHONE "/service/user/set_phone"
+#define FRIEND_GET_LIST "/service/friend/get_friend_list"
+#define FRIEND_APPLY "/service/friend/add_friend_apply"
+#define FRIEND_APPLY_PROCESS "/service/friend/add_friend_process"
+#define FRIEND_REMOVE "/service/friend/remove_friend"
+#define FRIEND_SEARCH "/service/friend/search_friend"
+#define FRIEND_GET_PENDING_EV "/service/friend/get_pending_friend_events"
+#define CSS_GET_LIST "/service/friend/get_chat_session_list"
+#define CSS_CREATE "/service/friend/create_chat_session"
+#define CSS_GET_MEMBER "/service/friend/get_chat_session_member"
+#define MSG_GET_RANGE "/service/message_storage/get_history"
+#define MSG_GET_RECENT "/service/message_storage/get_recent"
+#define MSG_KEY_SEARCH "/service/message_storage/search_history"
+#define MSG_SYNC "/service/message_storage/sync"
+#define NEW_MESSAGE "/service/message_transmit/new_message"
+#define FILE_GET_SINGLE "/service/file/get_single_file"
+#define FILE_GET_MULTI "/service/file/get_multi_file"
+#define FILE_PUT_SINGLE "/service/file/put_single_file"
+#define FILE_PUT_MULTI "/service/file/put_multi_file"
+#define SPEECH_RECOGNITION "/service/speech/recognition"
+
+    // 与子服务名称无关的rpc方法指针类型，如 &UserService_Stub::GetUserInfo
+    template <typename Stub, typename Req, typename Rsp>
+    using RpcMethod = void (Stub::*)(google::protobuf::RpcController *, const Req *, Rsp *, google::protobuf::Closure *);
+    // 让回调参数不参与模板参数推导，调用时可以直接传入lambda
+    template <typename T>
+    using NonDeduced = typename std::common_type<T>::type;
+
+    class GatewayServer
+    {
+    public:
+        using ptr = std::shared_ptr<GatewayServer>;
+        GatewayServer(int websocket_port, int http_port, int websocket_threads,
+                      size_t max_pending, const std::string &node,
+                      const std::shared_ptr<sw::redis::Redis> &redis_client,
+                      const Presence::ptr &presence,
+                      const std::chrono::seconds &session_ttl,
+                      const Connection::ptr &connections,
+                      const PushRouter::ptr &push_router,
+                      const std::shared_ptr<brpc::Server> &rpc_server,
+                      const ServiceManager::ptr &channels,
+                      const Discovery::ptr &dis_client,
+                      const std::string &user_service_name,
+                      const std::string &file_service_name,
+                      const std::string &speech_service_name,
+                      const std::string &message_service_name,
+                      const std::string &transmite_service_name,
+                      const std::string &friend_service_name)
+            : _websocket_threads(websocket_threads < 1 ? 1 : websocket_threads),
+              _http_port(http_port), _max_pending(max_pending), _node(node),
+              _redis_session(std::make_shared<Session>(redis_client)),
+              _presence(presence), _session_ttl(session_ttl), _connections(connections),
+              _push_router(push_router), _rpc_server(rpc_server),
+              _mm_channels(channels), _service_discoverer(dis_client),
+              _user_service_name(user_service_name),
+              _file_service_name(file_service_name),
+              _speech_service_name(speech_service_name),
+              _message_service_name(message_service_name),
+              _transmite_service_name(transmite_service_name),
+              _friend_service_name(friend_service_name),
+              _running(false)
+        {
+            _ws_server.set_access_channels(websocketpp::log::alevel::none);
+            _ws_server.init_asio();
+            _ws_server.set_reuse_addr(true);
+            _ws_server.set_open_handler(std::bind(&GatewayServer::onOpen, this, std::placeholders::_1));
+            _ws_server.set_close_handler(std::bind(&GatewayServer::onClose, this, std::placeholders::_1));
+            _ws_server.set_message_handler(std::bind(&GatewayServer::onMessage, this,
+                                                     std::placeholders::_1, std::placeholders::_2));
+            _ws_server.listen(websocket_port);
+            _ws_server.start_accept();
+
+            _http_server.Post(GET_PHONE_VERIFY_CODE, (httplib::Server::Handler)std::bind(&GatewayServer::GetPhoneVerifyCode, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(USERNAME_REGISTER, (httplib::Server::Handler)std::bind(&GatewayServer::UserRegister, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(USERNAME_LOGIN, (httplib::Server::Handler)std::bind(&GatewayServer::UserLogin, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(PHONE_REGISTER, (httplib::Server::Handler)std::bind(&GatewayServer::PhoneRegister, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(PHONE_LOGIN, (httplib::Server::Handler)std::bind(&GatewayServer::PhoneLogin, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(GET_USERINFO, (httplib::Server::Handler)std::bind(&GatewayServer::GetUserInfo, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(SET_USER_AVATAR, (httplib::Server::Handler)std::bind(&GatewayServer::SetUserAvatar, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(SET_USER_NICKNAME, (httplib::Server::Handler)std::bind(&GatewayServer::SetUserNickname, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(SET_USER_DESC, (httplib::Server::Handler)std::bind(&GatewayServer::SetUserDescription, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(SET_USER_PHONE, (httplib::Server::Handler)std::bind(&GatewayServer::SetUserPhoneNumber, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(FRIEND_GET_LIST, (httplib::Server::Handler)std::bind(&GatewayServer::GetFriendList, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(FRIEND_APPLY, (httplib::Server::Handler)std::bind(&GatewayServer::FriendAdd, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(FRIEND_APPLY_PROCESS, (httplib::Server::Handler)std::bind(&GatewayServer::FriendAddProcess, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(FRIEND_REMOVE, (httplib::Server::Handler)std::bind(&GatewayServer::FriendRemove, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(FRIEND_SEARCH, (httplib::Server::Handler)std::bind(&GatewayServer::FriendSearch, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(FRIEND_GET_PENDING_EV, (httplib::Server::Handler)std::bind(&GatewayServer::GetPendingFriendEventList, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(CSS_GET_LIST, (httplib::Server::Handler)std::bind(&GatewayServer::GetChatSessionList, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(CSS_CREATE, (httplib::Server::Handler)std::bind(&GatewayServer::ChatSessionCreate, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(CSS_GET_MEMBER, (httplib::Server::Handler)std::bind(&GatewayServer::GetChatSessionMember, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(MSG_GET_RANGE, (httplib::Server::Handler)std::bind(&GatewayServer::GetHistoryMsg, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(MSG_GET_RECENT, (httplib::Server::Handler)std::bind(&GatewayServer::GetRecentMsg, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(MSG_KEY_SEARCH, (httplib::Server::Handler)std::bind(&GatewayServer::MsgSearch, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(MSG_SYNC, (httplib::Server::Handler)std::bind(&GatewayServer::SyncMessage, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(NEW_MESSAGE, (httplib::Server::Handler)std::bind(&GatewayServer::NewMessage, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(FILE_GET_SINGLE, (httplib::Server::Handler)std::bind(&GatewayServer::GetSingleFile, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(FILE_GET_MULTI, (httplib::Server::Handler)std::bind(&GatewayServer::GetMultiFile, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(FILE_PUT_SINGLE, (httplib::Server::Handler)std::bind(&GatewayServer::PutSingleFile, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(FILE_PUT_MULTI, (httplib::Server::Handler)std::bind(&GatewayServer::PutMultiFile, this, std::placeholders::_1, std::placeholders::_2));
+            _http_server.Post(SPEECH_RECOGNITION, (httplib::Server::Handler)std::bind(&GatewayServer::SpeechRecognition, this, std::placeholders::_1, std::placeholders::_2));
+        }
+        // 启动长连接服务器、HTTP服务器以及在线状态心跳，阻塞直到服务退出
+        void start()
+        {
+            _running = true;
+            std::vector<std::thread> threads;
+            for (int i = 0; i < _websocket_threads; ++i)
+            {
+                threads.emplace_back([this]()
+                                     { _ws_server.run(); });
+            }
+            std::thread heartbeat(&GatewayServer::heartbeatLoop, this);
+            _http_server.listen("0.0.0.0", _http_port);
+            {
+                std::unique_lock<std::mutex> lock(_heartbeat_mutex);
+                _running = false;
+            }
+            _heartbeat_cond.notify_all();
+            heartbeat.join();
+            _ws_server.stop();
+            for (auto &t : threads)
+                t.join();
+        }
+
+    private:
+        ///////////////////////////////////////////////////////////长连接管理
+        void onOpen(websocketpp::connection_hdl hdl)
+        {
+            LOG_DEBUG("websocket长连接建立成功 {}", (size_t)_ws_server.get_con_from_hdl(hdl).get());
+        }
+        void onClose(websocketpp::connection_hdl hdl)
+        {
+            auto conn = _ws_server.get_con_from_hdl(hdl);
+            auto client = _connections->remove(conn);
+            if (!client)
+                return;
+            // 同一用户已经在本节点建立了新连接时，不能把新连接的在线状态清除
+            if (_connections->connection(client->uid()))
+                return;
+            // 只清除在线状态，登录会话保留到过期，客户端断线后可以用同一个会话重新建立长连接；
+            // 会话不过期时没有其他机制回收，断开时直接删除
+            _presence->offline(client->uid(), _node);
+            if (_session_ttl.count() <= 0)
+                _redis_session->remove(client->ssid());
+            LOG_DEBUG("{} {} {} 长连接断开，清除在线状态!", client->ssid(), client->uid(), (size_t)conn.get());
+        }
+        // 客户端建立长连接后发送的第一条消息为身份认证请求
+        void onMessage(websocketpp::connection_hdl hdl, server_t::message_ptr msg)
+        {
+            auto conn = _ws_server.get_con_from_hdl(hdl);
+            ClientAuthenticationReq request;
+            bool ret = request.ParseFromString(msg->get_payload());
+            if (ret == false)
+            {
+                LOG_ERROR("长连接身份识别失败：正文反序列化失败！");
+                _ws_server.close(hdl, websocketpp::close::status::unsupported_data, "正文反序列化失败!");
+                return;
+            }
+            std::string ssid = request.session_id();
+            auto uid = _redis_session->uid(ssid);
+            if (!uid)
+            {
+                LOG_ERROR("长连接身份识别失败：未找到会话信息 {}！", ssid);
+                _ws_server.close(hdl, websocketpp::close::status::unsupported_data, "未找到会话信息!");
+                return;
+            }
+            auto client = std::make_shared<Client>(&_ws_server, conn, *uid, ssid, _max_pending);
+            Client::ptr previous;
+            auto old = _connections->insert(client, &previous);
+            if (old && old->conn() != conn)
+            {
+                old->close("login elsewhere");
+            }
+            // 同一条连接重新认证为其他用户，之前的用户在本节点上没有其他连接时下线
+            if (previous && !_connections->connection(previous->uid()))
+                _presence->offline(previous->uid(), _node);
+            _presence->online(*uid, _node);
+            LOG_DEBUG("新增长连接管理：{}-{}-{}", ssid, *uid, (size_t)conn.get());
+        }
+        // 周期性地为本节点上的所有连接续期在线状态
+        void heartbeatLoop()
+        {
+            auto interval = std::chrono::seconds(std::max<long>(1, _presence->ttl().count() / 3));
+            std::unique_lock<std::mutex> lock(_heartbeat_mutex);
+            while (_running)
+            {
+                _heartbeat_cond.wait_for(lock, interval);
+                if (!_running)
+                    break;
+                lock.unlock();
+                try
+                {
+                    _presence->heartbeat(_connections->uids(), _node);
+                    _redis_session->refresh(_connections->ssids(), _session_ttl);
+                    _presence->sweep();
+                }
+                catch (std::exception &e)
+                {
+                    LOG_ERROR("在线状态心跳续期失败：{}", e.what());
+                }
+                lock.lock();
+            }
+        }
+        // 向用户推送通知，由推送路由找到用户长连接所在的网关节点
+        void _Notify(const std::string &rid, const std::string &uid, const NotifyMessage &notify)
+        {
+            _push_router->push(rid, uid, notify);
+        }
+        void _Notify(const std::string &rid, const std::vector<std::string> &uids, const NotifyMessage &notify)
+        {
+            _push_router->push(rid, uids, notify);
+        }
+
+        ///////////////////////////////////////////////////////////请求转发
+        template <typename Req>
+        bool _Authenticate(Req &req)
+        {
+            auto uid = _redis_session->uid(req.session_id());
+            if (!uid)
+            {
+                LOG_ERROR("{} 获取登录会话关联用户信息失败！", req.session_id());
+                return false;
+            }
+            req.set_user_id(*uid);
+            return true;
+        }
+        // 调用子服务，失败时填充错误响应
+        template <typename Stub, typename Req, typename Rsp>
+        bool _Call(const std::string &service_name, RpcMethod<Stub, Req, Rsp> method, const Req &req, Rsp &rsp)
+        {
+            auto channel = _mm_channels->choose(service_name);
+            if (!channel)
+            {
+                LOG_ERROR("{} 未找到可提供业务处理的{}节点！", req.request_id(), service_name);
+                rsp.set_success(false);
+                rsp.set_errmsg("未找到可提供业务处理的子服务节点！");
+                return false;
+            }
+            Stub stub(channel.get());
+            brpc::Controller cntl;
+            // 网关是请求的起点，以请求ID开启追踪，子服务中的span都挂在这一次调用之下
+            trace::Span call_span(req.request_id(), 0, service_name + " " + Req::descriptor()->name(), "rpc");
+            call_span.inject(cntl);
+            (stub.*method)(&cntl, &req, &rsp, nullptr);
+            call_span.finish(!cntl.Failed() && rsp.success());
+            if (cntl.Failed())
+            {
+                LOG_ERROR("{} {}调用失败：{}！", req.request_id(), service_name, cntl.ErrorText());
+                rsp.set_success(false);
+                rsp.set_errmsg("子服务调用失败！");
+                return false;
+            }
+            return rsp.success();
+        }
+        // 处理一个HTTP请求：反序列化请求 -> (鉴权) -> 转发子服务 -> (成功后的通知推送) -> 序列化响应
+        template <bool Auth, typename Stub, typename Req, typename Rsp>
+        void _Forward(const httplib::Request &request, httplib::Response &response,
+                      const std::string &service_name, RpcMethod<Stub, Req, Rsp> method,
+                      NonDeduced<std::function<void(const Req &, Rsp &)>> on_success = nullptr)
+        {
+            Req req;
+            Rsp rsp;
+            auto err_response = [&req, &rsp, &response](const std::string &errmsg) -> void
+            {
+                rsp.set_success(false);
+                rsp.set_errmsg(errmsg);
+                response.set_content(rsp.SerializeAsString(), "application/x-protbuf");
+            };
+            bool ret = req.ParseFromString(request.body);
+            if (ret == false)
+            {
+                LOG_ERROR("{} 正文反序列化失败！", request.path);
+                return err_response("正文反序列化失败！");
+            }
+            rsp.set_request_id(req.request_id());
+            if constexpr (Auth)
+            {
+                if (_Authenticate(req) == false)
+                    return err_response("获取登录会话关联用户信息失败！");
+            }
+            if (_Call(service_name, method, req, rsp) && on_success)
+            {
+                on_success(req, rsp);
+            }
+            response.set_content(rsp.SerializeAsString(), "application/x-protbuf");
+        }
+        bool _GetUserInfo(const std::string &rid, const std::string &uid, UserInfo &info)
+        {
+            GetUserInfoReq req;
+            GetUserInfoRsp rsp;
+            req.set_request_id(rid);
+            req.set_user_id(uid);
+            if (_Call(_user_service_name, &UserService_Stub::GetUserInfo, req, rsp) == false)
+            {
+                LOG_ERROR("{} 获取用户{}信息失败：{}", rid, uid, rsp.errmsg());
+                return false;
+            }
+            info.CopyFrom(rsp.user_info());
+            return true;
+        }
+
+        ///////////////////////////////////////////////////////////用户子服务
+        void GetPhoneVerifyCode(const httplib::Request &request, httplib::Response &response)
+        {
+            _Forward<false>(request, response, _user_service_name, &UserService_Stub::GetPhoneVerifyCode);
+        }
+        void UserRegister(const httplib::Request &request, httplib::Response &response)
+        {
+            _Forward<false>(request, response, _user_service_name, &UserService_Stub::UserRegister);
+        }
+        void UserLogin(const httplib::Request &request, httplib::Response &response)
+        {
+            _Forward<false>(request, response, _user_service_name, &UserService_Stub::UserLogin);
+        }
+        void PhoneRegister(const httplib::Request &request, httplib::Response &response)
+        {
+            _Forward<false>(request, response, _user_service_name, &UserService_Stub::PhoneRegister);
+        }
+        void PhoneLogin(const httplib::Request &request, httplib::Response &response)
+        {
+            _Forward<false>(request, response, _user_service_name, &UserService_Stub::PhoneLogin);
+        }
+        void GetUserInfo(const httplib::Request &request, httplib::Response &response)
+        {
+            _Forward<true>(request, response, _user_service_name, &UserService_Stub::GetUserInfo);
+        }
+        void SetUserAvatar(const httplib::Request &request, httplib::Response &response)
+        {
+            _Forward<true>(request, response, _user_service_name, &UserService_Stub::SetUserAvatar);
+        }
+        void SetUserNickname(const httplib::Request &request, httplib::Response &response)
+        {
+            _Forward<true>(request, response, _user_service_name, &UserService_Stub::SetUserNickname);
+        }
+        void SetUserDescription(const httplib::Request &request, httplib::Response &response)
+        {
+            _Forward<true>(request, response, _user_service_name, &UserService_Stub::SetUserDescription);
+        }
+        void SetUserPhoneNumber(const httplib::Request &request, httplib::Response &response)
+        {
+            _Forward<true>(request, response, _user_service_name, &UserService_Stub::SetUserPhoneNumber);
+        }
+
+        ///////////////////////////////////////////////////////////好友子服务
+        void GetFriendList(const httplib::Request &request, httplib::Response &response)
+        {
+            _Forward<true>(request, response, _friend_service_name, &FriendService_Stub::GetFriendList);
+        }
+        void FriendAdd(const httplib::Request &request, httplib::Response &response)
+        {
+            // 申请成功后通知被申请人
+            _Forward<true>(request, response, _friend_service_name, &FriendService_Stub::FriendAdd,
+                           [this](const FriendAddReq &req, FriendAddRsp &rsp)
+                           {
+                               NotifyMessage notify;
+                               notify.set_notify_type(NotifyType::FRIEND_ADD_APPLY_NOTIFY);
+                               if (rsp.has_notify_event_id())
+                                   notify.set_notify_event_id(rsp.notify_event_id());
+                               if (!_GetUserInfo(req.request_id(), req.user_id(),
+                                                 *notify.mutable_friend_add_apply()->mutable_user_info()))
+                                   return;
+                               _Notify(req.request_id(), req.respondent_id(), notify);
+                           });
+        }
+        void FriendAddProcess(const httplib::Request &request, httplib::Response &response)
+        {
+            // 处理成功后通知申请人处理结果，同意时向双方推送新建的单聊会话
+            _Forward<true>(request, response, _friend_service_name, &FriendService_Stub::FriendAddProcess,
+                           [this](const FriendAddProcessReq &req, FriendAddProcessRsp &rsp)
+                           {
+                               UserInfo process_user, apply_user;
+                               if (!_GetUserInfo(req.request_id(), req.user_id(), process_user) ||
+                                   !_GetUserInfo(req.request_id(), req.apply_user_id(), apply_user))
+                                   return;
+                               NotifyMessage notify;
+                               notify.set_notify_type(NotifyType::FRIEND_ADD_PROCESS_NOTIFY);
+                               notify.mutable_friend_process_result()->set_agree(req.agree());
+                               notify.mutable_friend_process_result()->mutable_user_info()->CopyFrom(process_user);
+                               _Notify(req.request_id(), req.apply_user_id(), notify);
+                               if (req.agree() == false)
+                                   return;
+                               auto session_notify = [this, &req, &rsp](const std::string &to, const UserInfo &peer)
+                               {
+                                   NotifyMessage notify;
+                                   notify.set_notify_type(NotifyType::CHAT_SESSION_CREATE_NOTIFY);
+                                   auto info = notify.mutable_new_chat_session_info()->mutable_chat_session_info();
+                                   info->set_single_chat_friend_id(peer.user_id());
+                                   info->set_chat_session_id(rsp.new_session_id());
+                                   info->set_chat_session_name(peer.nickname());
+                                   info->set_avatar(peer.avatar());
+                                   _Notify(req.request_id(), to, notify);
+                               };
+                               session_notify(req.apply_user_id(), process_user);
+                               session_notify(req.user_id(), apply_user);
+                           });
+        }
+        void FriendRemove(const httplib::Request &request, httplib::Response &response)
+        {
+            // 删除成功后通知被删除的好友
+            _Forward<true>(request, response, _friend_service_name, &FriendService_Stub::FriendRemove,
+                           [this](const FriendRemoveReq &req, FriendRemoveRsp &rsp)
+                           {
+                               NotifyMessage notify;
+                               notify.set_notify_type(NotifyType::FRIEND_REMOVE_NOTIFY);
+                               notify.mutable_friend_remove()->set_user_id(req.user_id());
+                               _Notify(req.request_id(), req.peer_id(), notify);
+                           });
+        }
+        void FriendSearch(const httplib::Request &request, httplib::Response &response)
+        {
+            _Forward<true>(request, response, _friend_service_name, &FriendService_Stub::FriendSearch);
+        }
+        void GetPendingFriendEventList(const httplib::Request &request, httplib::Response &response)
+        {
+            _Forward<true>(request, response, _friend_service_name, &FriendService_Stub::GetPendingFriendEventList);
+        }
+        void GetChatSessionList(const httplib::Request &request, httplib::Response &response)
+        {
+            _Forward<true>(request, response, _friend_service_name, &FriendService_Stub::GetChatSessionList);
+        }
+        void ChatSessionCreate(const httplib::Request &request, httplib::Response &response)
+        {
+            // 会话信息只通过通知推送给所有成员，不放在响应中
+            _Forward<true>(request, response, _friend_service_name, &FriendService_Stub::ChatSessionCreate,
+                           [this](const ChatSessionCreateReq &req, ChatSessionCreateRsp &rsp)
+                           {
+                               NotifyMessage notify;
+                               notify.set_notify_type(NotifyType::CHAT_SESSION_CREATE_NOTIFY);
+                               notify.mutable_new_chat_session_info()->mutable_chat_session_info()->CopyFrom(rsp.chat_session_info());
+                               std::vector<std::string> members(req.member_id_list().begin(), req.member_id_list().end());
+                               _Notify(req.request_id(), members, notify);
+                               rsp.clear_chat_session_info();
+                           });
+        }
+        void GetChatSessionMember(const httplib::Request &request, httplib::Response &response)
+        {
+            _Forward<true>(request, response, _friend_service_name, &FriendService_Stub::GetChatSessionMember);
+        }
+
+        ///////////////////////////////////////////////////////////消息存储子服务
+        void GetHistoryMsg(const httplib::Request &request, httplib::Response &response)
+        {
+            _Forward<true>(request, response, _message_service_name, &MsgStorageService_Stub::GetHistoryMsg);
+        }
+        void GetRecentMsg(const httplib::Request &request, httplib::Response &response)
+        {
+            _Forward<true>(request, response, _message_service_name, &MsgStorageService_Stub::GetRecentMsg);
+        }
+        void MsgSearch(const httplib::Request &request, httplib::Response &response)
+        {
+            _Forward<true>(request, response, _message_service_name, &MsgStorageService_Stub::MsgSearch);
+        }
+        void SyncMessage(const httplib::Request &request, httplib::Response &response)
+        {
+            _Forward<true>(request, response, _message_service_name, &MsgStorageService_Stub::SyncMessage);
+        }
+
+        ///////////////////////////////////////////////////////////消息转发子服务
+        void NewMessage(const httplib::Request &request, httplib::Response &response)
+        {
+            NewMessageReq req;
+            NewMessageRsp rsp;
+            GetTransmitTargetRsp target_rsp;
+            auto err_response = [&req, &rsp, &response](const std::string &errmsg) -> void
+            {
+                rsp.set_success(false);
+                rsp.set_errmsg(errmsg);
+                response.set_content(rsp.SerializeAsString(), "application/x-protbuf");
+            };
+            bool ret = req.ParseFromString(request.body);
+            if (ret == false)
+            {
+                LOG_ERROR("新消息请求正文反序列化失败！");
+                return err_response("正文反序列化失败！");
+            }
+            rsp.set_request_id(req.request_id());
+            if (_Authenticate(req) == false)
+                return err_response("获取登录会话关联用户信息失败！");
+            // 1. 由消息转发子服务组织完整消息并获取转发目标
+            if (_Call(_transmite_service_name, &MsgTransmitService_Stub::GetTransmitTarget, req, target_rsp) == false)
+                return err_response(target_rsp.errmsg());
+            // 2. 向在线的转发目标推送新消息通知，发送者自己不需要推送
+            //    所有目标一次查询所在节点，每个网关节点只发起一次批量推送
+            NotifyMessage notify;
+            notify.set_notify_type(NotifyType::CHAT_MESSAGE_NOTIFY);
+            notify.mutable_new_message_info()->mutable_message_info()->CopyFrom(target_rsp.message());
+            std::vector<std::string> targets;
+            targets.reserve(target_rsp.target_id_list_size());
+            for (auto &uid : target_rsp.target_id_list())
+            {
+                if (uid == req.user_id())
+                    continue;
+                targets.push_back(uid);
+            }
+            _Notify(req.request_id(), targets, notify);
+            rsp.set_success(true);
+            response.set_content(rsp.SerializeAsString(), "application/x-protbuf");
+        }
+
+        ///////////////////////////////////////////////////////////文件子服务
+        void GetSingleFile(const httplib::Request &request, httplib::Response &response)
+        {
+            _Forward<true>(request, response, _file_service_name, &FileService_Stub::GetSingleFile);
+        }
+        void GetMultiFile(const httplib::Request &request, httplib::Response &response)
+        {
+            _Forward<true>(request, response, _file_service_name, &FileService_Stub::GetMultiFile);
+        }
+        void PutSingleFile(const httplib::Request &request, httplib::Response &response)
+        {
+            _Forward<true>(request, response, _file_service_name, &FileService_Stub::PutSingleFile);
+        }
+        void PutMultiFile(const httplib::Request &request, httplib::Response &response)
+        {
+            _Forward<true>(request, response, _file_service_name, &FileService_Stub::PutMultiFile);
+        }
+
+        ///////////////////////////////////////////////////////////语音子服务
+        void SpeechRecognition(const httplib::Request &request, httplib::Response &response)
+        {
+            _Forward<true>(request, response, _speech_service_name, &SpeechService_Stub::SpeechRecognition);
+        }
+
+    private:
+        int _websocket_threads;
+        int _http_port;
+        size_t _max_pending; // 单连接写队列的最大积压条数
+        std::string _node;   // 当前网关节点标识，记录在用户的在线状态中
+        Session::ptr _redis_session;
+        Presence::ptr _presence;
+        std::chrono::seconds _session_ttl; // 登录会话过期时间，与用户管理子服务保持一致
+        Connection::ptr _connections;
+        PushRouter::ptr _push_router;
+        std::shared_ptr<brpc::Server> _rpc_server; // 接收其他网关节点转推的通知
+
+        ServiceManager::ptr _mm_channels;
+        Discovery::ptr _service_discoverer;
+        std::string _user_service_name;
+        std::string _file_service_name;
+        std::string _speech_service_name;
+        std::string _message_service_name;
+        std::string _transmite_service_name;
+        std::string _friend_service_name;
+
+        bool _running;
+        std::mutex _heartbeat_mutex;
+        std::condition_variable _heartbeat_cond;
+        server_t _ws_server;
+        httplib::Server _http_server;
+    };
+
+    class GatewayServerBuilder
+    {
+    public:
+        // 构造redis客户端对象
+        void make_redis_object(const std::string &host, int port, int db, bool keep_alive,
+                               size_t pool_size, int presence_ttl_sec, int session_ttl_sec)
+        {
+            _redis_client = RedisClientFactory::create(host, port, db, keep_alive, pool_size);
+            _presence = std::make_shared<Presence>(_redis_client, std::chrono::seconds(presence_ttl_sec));
+            _session_ttl = std::chrono::seconds(session_ttl_sec);
+        }
+        // 用于构造服务发现客户端&信道管理对象
+        void make_discovery_object(const std::string &reg_host,
+                                   const std::string &base_service_name,
+                                   const std::string &file_service_name,
+                                   const std::string &speech_service_name,
+                                   const std::string &message_service_name,
+                                   const std::string &friend_service_name,
+                                   const std::string &user_service_name,
+                                   const std::string &transmite_service_name)
+        {
+            _file_service_name = file_service_name;
+            _speech_service_name = speech_service_name;
+            _message_service_name = message_service_name;
+            _friend_service_name = friend_service_name;
+            _user_service_name = user_service_name;
+            _transmite_service_name = transmite_service_name;
+            _mm_channels = std::make_shared<ServiceManager>();
+            _mm_channels->declared(file_service_name);
+            _mm_channels->declared(speech_service_name);
+            _mm_channels->declared(message_service_name);
+            _mm_channels->declared(friend_service_name);
+            _mm_channels->declared(user_service_name);
+            _mm_channels->declared(transmite_service_name);
+            auto put_cb = std::bind(&ServiceManager::onServiceOnline, _mm_channels.get(), std::placeholders::_1, std::placeholders::_2);
+            auto del_cb = std::bind(&ServiceManager::onServiceOffline, _mm_channels.get(), std::placeholders::_1, std::placeholders::_2);
+            _discovery_client = std::make_shared<Discovery>(reg_host, base_service_name, put_cb, del_cb);
+        }
+        // 设置长连接与HTTP服务器参数
+        // conn_shards: 长连接表分片数，0表示与CPU核数相同；max_pending: 单连接写队列最大积压条数
+        // node: 当前网关节点的推送RPC访问地址，记录在用户的在线状态中，其他节点据此转推
+        void make_server_object(int websocket_port, int http_port, int websocket_threads,
+                                size_t conn_shards, size_t max_pending, const std::string &node)
+        {
+            _websocket_port = websocket_port;
+            _http_port = http_port;
+            _websocket_threads = websocket_threads;
+            _max_pending = max_pending;
+            _node = node;
+            _connections = std::make_shared<Connection>(conn_shards == 0 ? std::thread::hardware_concurrency() : conn_shards);
+        }
+        // 构造推送RPC服务器，接收其他网关节点转推过来的通知
+        // max_batch: 发往单个节点的一次请求中最多合并的推送条数
+        void make_rpc_object(uint16_t port, int32_t timeout, uint8_t num_threads,
+                             size_t max_batch, size_t max_node_pending)
+        {
+            if (!_connections)
+            {
+                LOG_FATAL("还未初始化长连接管理模块！");
+                abort();
+            }
+            _push_max_batch = max_batch;
+            _push_max_pending = max_node_pending;
+            _rpc_server = std::make_shared<brpc::Server>();
+            GatewayPushServiceImpl *push_service = new GatewayPushServiceImpl(_connections);
+            int ret = _rpc_server->AddService(push_service, brpc::ServiceOwnership::SERVER_OWNS_SERVICE);
+            if (ret == -1)
+            {
+                LOG_FATAL("添加Rpc服务失败！");
+                abort();
+            }
+            if (trace::add_service(*_rpc_server) == false)
+            {
+                LOG_FATAL("添加追踪查看服务失败！");
+                abort();
+            }
+            brpc::ServerOptions options;
+            options.idle_timeout_sec = timeout;
+            options.num_threads = num_threads;
+            ret = _rpc_server->Start(port, &options);
+            if (ret == -1)
+            {
+                LOG_FATAL("服务启动失败！");
+                abort();
+            }
+        }
+        GatewayServer::ptr build()
+        {
+            if (!_redis_client)
+            {
+                LOG_FATAL("还未初始化Redis客户端模块！");
+                abort();
+            }
+            if (!_discovery_client)
+            {
+                LOG_FATAL("还未初始化服务发现模块！");
+                abort();
+            }
+            if (!_mm_channels)
+            {
+                LOG_FATAL("还未初始化信道管理模块！");
+                abort();
+            }
+            if (!_rpc_server)
+            {
+                LOG_FATAL("还未初始化推送RPC服务器模块！");
+                abort();
+            }
+            auto push_router = std::make_shared<PushRouter>(_node, _presence, _connections,
+                                                            _push_max_batch, _push_max_pending);
+            GatewayServer::ptr server = std::make_shared<GatewayServer>(
+                _websocket_port, _http_port, _websocket_threads, _max_pending, _node,
+                _redis_client, _presence, _session_ttl, _connections, push_router, _rpc_server,
+                _mm_channels, _discovery_client,
+                _user_service_name, _file_service_name, _speech_service_name,
+                _message_service_name, _transmite_service_name, _friend_service_name);
+            return server;
+        }
+
+    private:
+        int _websocket_port = 9001;
+        int _http_port = 9000;
+        int _websocket_threads = 1;
+        size_t _max_pending = 1024;
+        std::string _node;
+        Connection::ptr _connections;
+        size_t _push_max_batch = 128;
+        size_t _push_max_pending = 10000;
+        std::shared_ptr<brpc::Server> _rpc_server;
+
+        std::shared_ptr<sw::redis::Redis> _redis_client;
+        Presence::ptr _presence;
+        std::chrono::seconds _session_ttl{0};
+
+        std::string _file_service_name;
+        std::string _speech_service_name;
+        std::string _message_service_name;
+        std::string _friend_service_name;
+        std::string _user_service_name;
+        std::string _transmite_service_name;
+        ServiceManager::ptr _mm_channels;
+        Discovery::ptr _discovery_client;
+    };
+}
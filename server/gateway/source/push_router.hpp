@@ -0,0 +1,238 @@
+// 跨网关推送路由：根据用户所在的网关节点分组，本节点直接推送，其他节点按节点合并后批量转推
+#pragma once
+#include <brpc/channel.h>
+#include <brpc/controller.h>
+#include <brpc/server.h>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include "connection.hpp"
+#include "data_redis.hpp"
+#include "logger.hpp"
+#include "trace.hpp"
+#include "utils.hpp"
+#include "gateway.pb.h"
+#include "notify.pb.h"
+
+namespace lbk
+{
+    // 本节点推送：将通知写入用户长连接的写队列，返回不在本节点上的用户
+    inline std::vector<std::string> push_local(const Connection::ptr &connections,
+                                               const std::string &frame,
+                                               const std::vector<std::string> &uids)
+    {
+        std::vector<std::string> offline;
+        for (auto &uid : uids)
+        {
+            auto client = connections->connection(uid);
+            if (!client || client->push(frame) == false)
+                offline.push_back(uid);
+        }
+        return offline;
+    }
+
+    // 接收其他网关节点转推过来的通知
+    class GatewayPushServiceImpl : public lbk::GatewayPushService
+    {
+    public:
+        GatewayPushServiceImpl(const Connection::ptr &connections)
+            : _connections(connections) {}
+        void PushNotify(google::protobuf::RpcController *controller,
+                        const lbk::PushNotifyReq *request,
+                        lbk::PushNotifyRsp *response,
+                        google::protobuf::Closure *done)
+        {
+            brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "GatewayPushService.PushNotify");
+            response->set_request_id(request->request_id());
+            for (auto &item : request->items())
+            {
+                std::string frame = item.notify().SerializeAsString();
+                std::vector<std::string> uids(item.user_id_list().begin(), item.user_id_list().end());
+                for (auto &uid : push_local(_connections, frame, uids))
+                {
+                    response->add_offline_id_list(uid);
+                }
+            }
+            response->set_success(true);
+        }
+
+    private:
+        Connection::ptr _connections;
+    };
+
+    // 发往单个网关节点的推送队列
+    // 同一时刻每个节点最多只有一个推送请求在途，在途期间到达的推送在队列中积攒，
+    // 请求返回后一次取出合并为下一个请求，节点越忙合并得越多
+    class NodePushQueue : public std::enable_shared_from_this<NodePushQueue>
+    {
+    public:
+        using ptr = std::shared_ptr<NodePushQueue>;
+        NodePushQueue(const std::string &host, size_t max_batch, size_t max_pending)
+            : _host(host), _max_batch(max_batch == 0 ? 1 : max_batch),
+              _max_pending(max_pending), _sending(false) {}
+        bool init(int timeout_ms)
+        {
+            brpc::ChannelOptions options;
+            options.connect_timeout_ms = timeout_ms;
+            options.timeout_ms = timeout_ms;
+            options.max_retry = 0; // 推送不重试，失败的用户重连后会拉取离线消息
+            options.protocol = "baidu_std";
+            if (_channel.Init(_host.c_str(), &options) == -1)
+            {
+                LOG_ERROR("初始化网关节点{}的推送信道失败！", _host);
+                return false;
+            }
+            return true;
+        }
+        void enqueue(PushItem &&item)
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (_pending.size() >= _max_pending)
+                {
+                    LOG_WARN("网关节点{}的推送队列已满，丢弃最早的推送！", _host);
+                    _pending.pop_front();
+                }
+                _pending.push_back(std::move(item));
+                if (_sending)
+                    return;
+                _sending = true;
+            }
+            send();
+        }
+
+    private:
+        struct PushDone : public google::protobuf::Closure
+        {
+            NodePushQueue::ptr self;
+            brpc::Controller cntl;
+            PushNotifyReq req;
+            PushNotifyRsp rsp;
+            void Run() override
+            {
+                std::unique_ptr<PushDone> guard(this);
+                if (cntl.Failed())
+                {
+                    LOG_ERROR("{} 向网关节点{}转推通知失败：{}", req.request_id(), self->_host, cntl.ErrorText());
+                }
+                else if (rsp.offline_id_list_size() > 0)
+                {
+                    LOG_DEBUG("{} 网关节点{}上有{}个用户已离线", req.request_id(), self->_host, rsp.offline_id_list_size());
+                }
+                self->send();
+            }
+        };
+        // 取出队列中积攒的推送合并发送，队列为空时结束本轮发送
+        void send()
+        {
+            auto done = new PushDone();
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (_pending.empty())
+                {
+                    _sending = false;
+                    delete done;
+                    return;
+                }
+                for (size_t i = 0; i < _max_batch && !_pending.empty(); ++i)
+                {
+                    done->req.add_items()->Swap(&_pending.front());
+                    _pending.pop_front();
+                }
+            }
+            done->self = shared_from_this();
+            done->req.set_request_id(uuid());
+            GatewayPushService_Stub stub(&_channel);
+            stub.PushNotify(&done->cntl, &done->req, &done->rsp, done);
+        }
+
+    private:
+        std::string _host;
+        size_t _max_batch;
+        size_t _max_pending;
+        brpc::Channel _channel;
+        std::mutex _mutex;
+        std::deque<PushItem> _pending;
+        bool _sending;
+    };
+
+    // 推送路由：查询目标用户所在节点，按节点分组推送
+    class PushRouter
+    {
+    public:
+        using ptr = std::shared_ptr<PushRouter>;
+        PushRouter(const std::string &node, const Presence::ptr &presence, const Connection::ptr &connections,
+                   size_t max_batch = 128, size_t max_pending = 10000, int timeout_ms = 3000)
+            : _node(node), _presence(presence), _connections(connections),
+              _max_batch(max_batch), _max_pending(max_pending), _timeout_ms(timeout_ms) {}
+        void push(const std::string &rid, const std::string &uid, const NotifyMessage &notify)
+        {
+            push(rid, std::vector<std::string>{uid}, notify);
+        }
+        // 一次查询所有目标的在线节点，本节点的用户直接推送，其他节点每个节点只入队一条推送
+        void push(const std::string &rid, const std::vector<std::string> &uids, const NotifyMessage &notify)
+        {
+            if (uids.empty())
+                return;
+            std::unordered_map<std::string, std::string> online;
+            try
+            {
+                online = _presence->online_among(uids);
+            }
+            catch (std::exception &e)
+            {
+                LOG_ERROR("{} 查询用户在线节点失败：{}", rid, e.what());
+                return;
+            }
+            std::unordered_map<std::string, std::vector<std::string>> groups;
+            for (auto &it : online)
+            {
+                // 节点为空表示用户已登录但还没有建立长连接
+                if (it.second.empty())
+                    continue;
+                groups[it.second].push_back(it.first);
+            }
+            for (auto &group : groups)
+            {
+                if (group.first == _node)
+                {
+                    push_local(_connections, notify.SerializeAsString(), group.second);
+                    continue;
+                }
+                auto queue = node_queue(group.first);
+                if (!queue)
+                    continue;
+                PushItem item;
+                item.mutable_notify()->CopyFrom(notify);
+                for (auto &uid : group.second)
+                    item.add_user_id_list(uid);
+                queue->enqueue(std::move(item));
+            }
+        }
+
+    private:
+        NodePushQueue::ptr node_queue(const std::string &host)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto it = _queues.find(host);
+            if (it != _queues.end())
+                return it->second;
+            auto queue = std::make_shared<NodePushQueue>(host, _max_batch, _max_pending);
+            if (queue->init(_timeout_ms) == false)
+                return NodePushQueue::ptr();
+            _queues[host] = queue;
+            return queue;
+        }
+
+    private:
+        std::string _node;
+        Presence::ptr _presence;
+        Connection::ptr _connections;
+        size_t _max_batch;
+        size_t _max_pending;
+        int _timeout_ms;
+        std::mutex _mutex;
+        std::unordered_map<std::string, NodePushQueue::ptr> _queues;
+    };
+}
@@ -4,6 +4,8 @@
 DEFINE_bool(run_mode, false, "程序的运行模式，false-调试，true-发布");
 DEFINE_string(log_file, "", "发布模式下，用于指定日志的输出文件");
 DEFINE_int32(log_level, 0, "发布模式下，用于指定日志输出等级");
+DEFINE_int32(trace_ring_size, 10000, "内存中保留的最近追踪span数量，可通过/trace页面查看，0表示关闭请求追踪");
+DEFINE_string(trace_file, "", "追踪span的输出文件(每行一个json)，为空表示只保留在内存中");
 
 DEFINE_string(registry_host, "http://127.0.0.1:2379", "服务注册中心地址");
 DEFINE_string(base_service, "/service", "服务监控根目录");
@@ -21,8 +23,36 @@ DEFINE_string(mysql_db, "chat_system", "Mysql默认库名称");
 DEFINE_string(mysql_cset, "utf8", "Mysql客户端字符集");
 DEFINE_int32(mysql_port, 0, "Mysql服务器访问端口");
 DEFINE_int32(mysql_conn_pool_count, 4, "Mysql连接池最大连接数量");
+DEFINE_string(mysql_replicas, "", "Mysql从库地址列表，逗号分隔的host:port，为空表示不做读写分离");
+DEFINE_int32(mysql_max_lag_ms, 1000, "从库允许的最大复制延迟(毫秒)，超过后读请求回落到主库");
+DEFINE_int32(mysql_conn_pool_min, 0, "Mysql连接池最小连接数量，小于最大数量时连接池按排队情况自适应伸缩，0表示固定大小");
+DEFINE_int32(db_threads, 4, "数据库异步执行线程数量");
+DEFINE_int32(db_max_pending, 1024, "数据库异步任务排队上限，超过后在Rpc线程中同步执行");
 
+DEFINE_string(shard_config, "", "消息分库配置文件路径，shard_etcd_host不为空时为etcd中的键；为空表示不分库");
+DEFINE_string(shard_etcd_host, "", "保存消息分库配置的etcd地址，为空表示使用本地配置文件");
+DEFINE_int32(shard_reload_interval, 10, "重新加载消息分库配置的周期(秒)");
+
+DEFINE_int32(partition_months_ahead, 3, "消息表预建的未来月分区个数");
+DEFINE_int32(partition_retain_months, 0, "消息表热数据保留月数，更早的分区归档后删除，0表示不归档");
+DEFINE_int32(partition_check_interval, 3600, "消息表分区维护周期(秒)");
+DEFINE_string(archive_dir, "", "冷消息归档文件目录，必须是所有存储实例共享的同一目录，为空表示不启用归档");
+DEFINE_int32(archive_level, 3, "冷消息归档的zstd压缩等级");
+DEFINE_int32(archive_rescan_sec, 30, "扫描归档目录加载新归档文件的周期(秒)");
+
+DEFINE_string(search_engine, "es", "消息检索引擎：es使用ES集群，local使用内嵌的本地索引");
+DEFINE_string(search_index_dir, "./message_index", "本地消息索引的数据目录");
+DEFINE_int32(search_flush_docs, 10000, "本地消息索引内存中积累多少条新消息后落盘为一个索引段");
+DEFINE_int32(search_flush_interval_ms, 5000, "本地消息索引新消息落盘的最长间隔(毫秒)");
+DEFINE_int32(search_max_segments, 8, "本地消息索引段数量上限，超过时后台合并相邻的段");
 DEFINE_string(es_host, "http://127.0.0.1:9200/", "ES搜索引擎服务器URL");
+DEFINE_int32(es_shards, 1, "新建ES索引的主分片数");
+DEFINE_int32(es_replicas, 1, "新建ES索引的副本数");
+DEFINE_string(es_refresh_interval, "2s", "新建ES索引的刷新间隔，调大可提高写入吞吐，但写入后更晚才能被检索到");
+DEFINE_int32(es_bulk_docs, 500, "ES批量写入单批最大文档数，0表示不使用批量写入，每条文档同步写入");
+DEFINE_int32(es_bulk_bytes, 5 * 1024 * 1024, "ES批量写入单批最大字节数");
+DEFINE_int32(es_bulk_interval_ms, 1000, "ES批量写入的最长刷新间隔(毫秒)，也是写入后可被检索的最大延迟");
+DEFINE_int32(es_bulk_capacity, 10000, "ES批量写入队列的文档数上限，队满时写入方会被阻塞");
 
 DEFINE_string(mq_user, "root", "消息队列服务器访问用户名");
 DEFINE_string(mq_password, "2162627569", "消息队列服务器访问密码");
@@ -38,12 +68,31 @@ int main(int argc, char *argv[])
 {
     google::ParseCommandLineFlags(&argc, &argv, true);
     lbk::init_logger(FLAGS_run_mode, FLAGS_log_file, FLAGS_log_level);
+    lbk::trace::Tracer::instance().init("message_service", FLAGS_trace_ring_size, FLAGS_trace_file);
 
+    lbk::ESIndexSettings es_settings;
+    es_settings.shards = FLAGS_es_shards;
+    es_settings.replicas = FLAGS_es_replicas;
+    es_settings.refresh_interval = FLAGS_es_refresh_interval;
     lbk::MsgStorageServerBuilder mssb;
     mssb.make_mq_object(FLAGS_mq_user, FLAGS_mq_password, FLAGS_mq_host, FLAGS_mq_msg_exchange, FLAGS_mq_msg_queue, FLAGS_mq_msg_routing_key);
-    mssb.make_es_object({FLAGS_es_host});
+    if (FLAGS_search_engine == "local")
+        mssb.make_local_search_object(FLAGS_search_index_dir, FLAGS_search_flush_docs, FLAGS_search_flush_interval_ms, FLAGS_search_max_segments);
+    else
+    {
+        mssb.make_es_object({FLAGS_es_host}, es_settings);
+        if (FLAGS_es_bulk_docs > 0)
+            mssb.make_es_bulk_object(FLAGS_es_bulk_docs, FLAGS_es_bulk_bytes, FLAGS_es_bulk_interval_ms, FLAGS_es_bulk_capacity);
+    }
     mssb.make_mysql_object(FLAGS_mysql_user, FLAGS_mysql_password, FLAGS_mysql_host,
-                           FLAGS_mysql_db, FLAGS_mysql_cset, FLAGS_mysql_port, FLAGS_mysql_conn_pool_count);
+                           FLAGS_mysql_db, FLAGS_mysql_cset, FLAGS_mysql_port, FLAGS_mysql_conn_pool_count,
+                           FLAGS_mysql_replicas, FLAGS_mysql_max_lag_ms, FLAGS_mysql_conn_pool_min);
+    mssb.make_executor_object(FLAGS_db_threads, FLAGS_db_max_pending);
+    if (!FLAGS_shard_config.empty())
+        mssb.make_shard_object(FLAGS_shard_config, FLAGS_shard_etcd_host, FLAGS_shard_reload_interval);
+    if (!FLAGS_archive_dir.empty())
+        mssb.make_archive_object(FLAGS_archive_dir, FLAGS_archive_level, FLAGS_archive_rescan_sec);
+    mssb.make_partition_object(FLAGS_partition_months_ahead, FLAGS_partition_retain_months, FLAGS_partition_check_interval);
     mssb.make_discovery_object(FLAGS_registry_host, FLAGS_base_service, FLAGS_user_service, FLAGS_file_service);
     mssb.make_rpc_object(FLAGS_listen_port, FLAGS_rpc_timeout, FLAGS_rpc_threads);
     mssb.make_registry_object(FLAGS_registry_host, FLAGS_base_service + FLAGS_instance_name, FLAGS_access_host);
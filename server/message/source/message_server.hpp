@@ -3,6 +3,7 @@
 //  a. 获取最近 N 条消息：用于登录成功后，点击对方头像打开聊天框时显示最近的消息
 //  b. 获取指定时间段内的消息：用户可以进行聊天消息的按时间搜索
 // 2. 消息搜索：用户可以进行聊天消息的关键字搜索
+// 3. 消息同步：断线重连后按用户的同步游标一次拉取所有会话中错过的消息
 #pragma once
 
 #include <brpc/server.h>
@@ -12,11 +13,20 @@
 #include <string>
 
 #include "data_es.hpp"       // es数据管理客户端封装
+#include "message_index.hpp"  // 内嵌本地消息索引
 #include "mysql_message.hpp" // mysql数据管理客户端封装
+#include "mysql_message_shard.hpp" // 消息分库路由
+#include "mysql_chat_session_member.hpp"
+#include "mysql_sync_cursor.hpp"
+#include "mysql_partition.hpp"  // 消息表分区管理
+#include "message_archive.hpp"  // 冷消息归档
+#include "db_executor.hpp"    // 数据库异步执行
 #include "etcd.hpp"          // 服务注册模块封装
 #include "logger.hpp"        // 日志模块封装
+#include "trace_service.hpp" // 请求追踪
 #include "utils.hpp"         // 基础工具接口
 #include "channel.hpp"       // 信道管理模块封装
+#include "singleflight.hpp"   // 并发请求合并
 #include "rabbitmq.hpp"
 
 #include "message.pb.h" // protobuf框架代码
@@ -30,9 +40,17 @@ namespace lbk
     class MsgStorageServiceImpl : public lbk::MsgStorageService
     {
     public:
-        MsgStorageServiceImpl(const std::shared_ptr<odb::core::database> &db, const std::shared_ptr<elasticlient::Client> &es,
-                              const ServiceManager::ptr &mm_channels, const std::string &user_service_name, const std::string &file_service_name)
-            : _mysql_message(std::make_shared<MessageTable>(db)), _es_message(std::make_shared<ESMessage>(es)),
+        MsgStorageServiceImpl(const DBRouter::ptr &router, const MessageSearcher::ptr &searcher,
+                              const ServiceManager::ptr &mm_channels, const std::string &user_service_name, const std::string &file_service_name,
+                              const DBExecutor::ptr &db_executor,
+                              const MessageArchive::ptr &archive = MessageArchive::ptr(),
+                              const ShardedMessageTable::ptr &messages = ShardedMessageTable::ptr(),
+                              bool index_on_store = true)
+            : _mysql_message(messages ? messages : std::make_shared<ShardedMessageTable>(router)), _archive(archive), _es_message(searcher),
+              _index_on_store(index_on_store),
+              _mysql_member(std::make_shared<ChatSessionMemberTable>(router)),
+              _mysql_cursor(std::make_shared<SyncCursorTable>(router->primary())),
+              _db_executor(db_executor),
               _mm_channels(mm_channels), _user_service_name(user_service_name), _file_service_name(file_service_name)
         {
             _es_message->createIndex();
@@ -44,6 +62,7 @@ namespace lbk
                                    ::google::protobuf::Closure *done)
         {
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "MsgStorageService.GetHistoryMsg");
             response->set_request_id(request->request_id());
             // 定义一个错误处理函数，当出错时调用该函数
             auto err_response = [this, &response](const std::string &err_msg)
@@ -56,8 +75,20 @@ namespace lbk
             std::string ssid = request->chat_session_id();
             boost::posix_time::ptime stime = boost::posix_time::from_time_t(request->start_time());
             boost::posix_time::ptime etime = boost::posix_time::from_time_t(request->over_time());
-            // 2. 从数据库中进行消息查询
-            auto msg_lists = _mysql_message->range(ssid, stime, etime);
+            // 2. 从数据库中进行消息查询，数据库查询在执行线程池中进行，同时读取归档文件
+            auto db_future = _db_executor->async(_mysql_message, &ShardedMessageTable::range, ssid, stime, etime);
+            // 起始时间早于归档边界时，较早的部分从归档文件中读取
+            std::vector<Message> cold;
+            bool archived = _archive && stime < _archive->boundary();
+            bool cold_ok = !archived || _archive->range(ssid, stime, etime, cold);
+            auto msg_lists = db_future.get();
+            if (cold_ok == false)
+            {
+                LOG_ERROR("{} 读取归档消息失败 - {}！", rid, ssid);
+                return err_response("读取归档消息失败!");
+            }
+            if (archived)
+                msg_lists = _MergeArchived(std::move(cold), msg_lists);
             if (msg_lists.empty())
             {
                 response->set_success(true);
@@ -98,6 +129,7 @@ namespace lbk
             {
                 auto message_info = response->add_msg_list();
                 message_info->set_message_id(msg.message_id());
+                message_info->set_seq(msg.seq());
                 message_info->set_chat_session_id(msg.session_id());
                 message_info->set_timestamp(boost::posix_time::to_time_t(msg.create_time()));
                 message_info->mutable_sender()->CopyFrom(user_lists[msg.user_id()]);
@@ -136,6 +168,7 @@ namespace lbk
                                   ::google::protobuf::Closure *done)
         {
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "MsgStorageService.GetRecentMsg");
             response->set_request_id(request->request_id());
             // 定义一个错误处理函数，当出错时调用该函数
             auto err_response = [this, &response](const std::string &err_msg)
@@ -149,7 +182,9 @@ namespace lbk
             std::string ssid = request->chat_session_id();
             int msg_count = request->msg_count();
             // 2. 从数据库中进行消息查询
-            auto msg_lists = _mysql_message->recent(ssid, msg_count);
+            auto msg_lists = _db_executor->async(_mysql_message, &ShardedMessageTable::recent, ssid, msg_count,
+                                                 (unsigned long)request->before_seq())
+                                 .get();
             if (msg_lists.empty())
             {
                 response->set_success(true);
@@ -190,6 +225,7 @@ namespace lbk
             {
                 auto message_info = response->add_msg_list();
                 message_info->set_message_id(msg.message_id());
+                message_info->set_seq(msg.seq());
                 message_info->set_chat_session_id(msg.session_id());
                 message_info->set_timestamp(boost::posix_time::to_time_t(msg.create_time()));
                 message_info->mutable_sender()->CopyFrom(user_lists[msg.user_id()]);
@@ -228,6 +264,7 @@ namespace lbk
                                ::google::protobuf::Closure *done)
         {
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "MsgStorageService.MsgSearch");
             response->set_request_id(request->request_id());
             // 定义一个错误处理函数，当出错时调用该函数
             auto err_response = [this, &response](const std::string &err_msg)
@@ -241,8 +278,22 @@ namespace lbk
             std::string rid = request->request_id();
             std::string ssid = request->chat_session_id();
             std::string search_key = request->search_key();
-            // 2. 从ES搜索引擎中进行关键字消息搜索，得到消息列表
-            auto msg_lists = _es_message->search(search_key, ssid);
+            // 2. 从ES搜索引擎中进行关键字消息搜索，得到一页消息列表
+            MessageSearchPage page;
+            page.size = request->has_page_size() && request->page_size() > 0 ? request->page_size() : SEARCH_PAGE_SIZE;
+            if (page.size > SEARCH_MAX_PAGE_SIZE)
+                page.size = SEARCH_MAX_PAGE_SIZE;
+            page.after_time = request->after_time();
+            page.after_id = request->after_message_id();
+            page.highlight = request->highlight();
+            if (request->has_fragment_size() && request->fragment_size() > 0)
+                page.fragment_size = request->fragment_size();
+            if (request->has_highlight_pre_tag())
+                page.pre_tag = request->highlight_pre_tag();
+            if (request->has_highlight_post_tag())
+                page.post_tag = request->highlight_post_tag();
+            bool has_more = false;
+            auto msg_lists = _es_message->search(search_key, ssid, page, has_more);
             if (msg_lists.empty())
             {
                 response->set_success(true);
@@ -273,8 +324,108 @@ namespace lbk
                 message_info->mutable_message()->set_message_type(MessageType::STRING);
                 message_info->mutable_message()->mutable_string_message()->set_content(msg.content());
             }
+            response->set_has_more(has_more);
+            response->set_next_time(boost::posix_time::to_time_t(msg_lists.back().create_time()));
+            response->set_next_message_id(msg_lists.back().message_id());
+        }
+
+        virtual void SyncMessage(::google::protobuf::RpcController *controller,
+                                 const ::lbk::SyncMessageReq *request,
+                                 ::lbk::SyncMessageRsp *response,
+                                 ::google::protobuf::Closure *done)
+        {
+            brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "MsgStorageService.SyncMessage");
+            response->set_request_id(request->request_id());
+            // 定义一个错误处理函数，当出错时调用该函数
+            auto err_response = [this, &response](const std::string &err_msg)
+            {
+                response->set_success(false);
+                response->set_errmsg(err_msg);
+            };
+            // 1. 提取关键要素：用户ID，确认游标，本次同步条数
+            std::string rid = request->request_id();
+            std::string uid = request->user_id();
+            int max_count = request->max_count();
+            if (max_count <= 0 || max_count > SYNC_MAX_COUNT)
+                max_count = SYNC_MAX_COUNT;
+            // 2. 根据客户端的确认推进同步游标；会话列表的查询与游标无关，同时发起
+            auto ssids_future = _db_executor->async(_mysql_member, &ChatSessionMemberTable::sessions, uid);
+            // 游标为会话内消息序号的十进制字符串，无法解析的确认直接忽略
+            std::unordered_map<std::string, unsigned long> acks;
+            for (auto &it : request->ack_cursor())
+            {
+                unsigned long seq = strtoul(it.second.c_str(), nullptr, 10);
+                if (seq > 0)
+                    acks[it.first] = seq;
+            }
+            bool ret = _db_executor->async(_mysql_cursor, &SyncCursorTable::advance, uid, acks).get();
+            if (ret == false)
+            {
+                LOG_ERROR("{} 推进用户{}的同步游标失败！", rid, uid);
+                return err_response("推进同步游标失败!");
+            }
+            // 3. 获取用户参与的所有会话以及各会话的游标，没有游标的会话只同步最近一段时间内的消息
+            auto ssids = ssids_future.get();
+            if (ssids.empty())
+            {
+                response->set_success(true);
+                return;
+            }
+            MessageHoles holes;
+            auto cursors = _db_executor->async(_mysql_cursor, &SyncCursorTable::cursors, uid, &holes.pending).get();
+            std::unordered_map<std::string, unsigned long> from;
+            for (auto &ssid : ssids)
+            {
+                auto it = cursors.find(ssid);
+                from[ssid] = it == cursors.end() ? 0 : it->second;
+            }
+            // 4. 一次查询所有会话游标之后序号连续的消息，以及之前跳过的序号中已经落库的迟到消息
+            bool has_more = false;
+            boost::posix_time::seconds window(static_cast<long>(SYNC_WINDOW_SEC));
+            boost::posix_time::seconds settle(static_cast<long>(SYNC_SETTLE_SEC));
+            //  各分库的查询由分库消息表投递到数据库线程池执行，这里直接调用，不能再套一层线程池任务
+            auto msg_lists = _mysql_message->since(from, max_count, window, settle, has_more, &holes);
+            // 记录本次跳过的空洞、删除已补发的空洞；失败时只会重复补发或推迟检查，不影响本次同步
+            if (!holes.skipped.empty() || !holes.filled.empty())
+            {
+                ret = _db_executor->async(_mysql_cursor, &SyncCursorTable::update_holes, uid, holes.skipped, holes.filled).get();
+                if (ret == false)
+                    LOG_WARN("{} 更新用户{}的序号空洞失败！", rid, uid);
+            }
+            // 5. 组织响应
+            ret = _BuildMsgList(rid, msg_lists, response->mutable_msg_list());
+            if (ret == false)
+                return err_response("组织消息数据失败!");
+            std::unordered_map<std::string, unsigned long> next;
+            for (auto &msg : msg_lists)
+            {
+                // 补发的迟到消息序号小于游标，游标取各会话本次返回的最大序号
+                auto &seq = next[msg.session_id()];
+                seq = std::max(seq, msg.seq());
+            }
+            for (auto &it : next)
+                (*response->mutable_next_cursor())[it.first] = std::to_string(std::max(it.second, from[it.first]));
+            response->set_has_more(has_more);
+            response->set_success(true);
         }
 
+        // 本地索引由每个实例各自的订阅队列写入：存储队列是多个实例竞争消费的，每个实例只能收到一部分消息
+        void onIndexMessage(const char *body, size_t sz)
+        {
+            lbk::MessageInfo message;
+            if (message.ParseFromArray(body, sz) == false)
+            {
+                LOG_ERROR("对消费到的消息进行反序列化失败！");
+                return;
+            }
+            if (message.message().message_type() != MessageType::STRING)
+                return;
+            bool ret = _es_message->appendData(message.sender().user_id(), message.message_id(), message.chat_session_id(),
+                                               message.timestamp(), message.message().string_message().content());
+            if (ret == false)
+                LOG_ERROR("文本消息写入本地消息索引失败！");
+        }
         void onMessage(const char *body, size_t sz)
         {
             LOG_DEBUG("收到新消息，进行存储处理！");
@@ -294,6 +445,8 @@ namespace lbk
             //   2.1 如果是一个文本类型消息，取元信息存储到ES中
             case MessageType::STRING:
                 content = message.message().string_message().content();
+                if (!_index_on_store)
+                    break;
                 ret = _es_message->appendData(message.sender().user_id(), message.message_id(),
                                               message.chat_session_id(), message.timestamp(), content);
                 if (ret == false)
@@ -346,6 +499,7 @@ namespace lbk
             // 3. 提取消息的元信息，存储到mysql数据库中
             Message msg_table(message.message_id(), message.chat_session_id(), message.sender().user_id(),
                               message.message().message_type(), boost::posix_time::from_time_t(message.timestamp()));
+            msg_table.seq(message.seq());
             msg_table.file_id(file_id);
             msg_table.file_name(file_name);
             msg_table.file_size(file_size);
@@ -359,6 +513,85 @@ namespace lbk
         }
 
     private:
+        // 合并归档消息与数据库消息：归档后删除前的短暂窗口内两边可能都有同一条消息，按消息ID去重
+        std::vector<Message> _MergeArchived(std::vector<Message> &&cold, const std::vector<Message> &hot)
+        {
+            if (cold.empty())
+                return hot;
+            unordered_set<std::string> mids;
+            for (auto &msg : cold)
+                mids.insert(msg.message_id());
+            for (auto &msg : hot)
+            {
+                if (mids.count(msg.message_id()) == 0)
+                    cold.push_back(msg);
+            }
+            std::stable_sort(cold.begin(), cold.end(), [](const Message &a, const Message &b)
+                             { return a.create_time() != b.create_time() ? a.create_time() < b.create_time() : a.seq() < b.seq(); });
+            return std::move(cold);
+        }
+        // 补全消息的文件数据与发送者信息，组织为MessageInfo列表
+        bool _BuildMsgList(const std::string &rid, const std::vector<Message> &msg_lists,
+                           google::protobuf::RepeatedPtrField<MessageInfo> *msg_infos)
+        {
+            if (msg_lists.empty())
+                return true;
+            unordered_set<std::string> file_id_lists;
+            unordered_set<std::string> user_id_lists;
+            for (auto &msg : msg_lists)
+            {
+                user_id_lists.insert(msg.user_id());
+                if (!msg.file_id().empty())
+                    file_id_lists.insert(msg.file_id());
+            }
+            unordered_map<std::string, std::string> file_data_lists;
+            if (!file_id_lists.empty() && _GetFile(rid, file_id_lists, file_data_lists) == false)
+            {
+                LOG_ERROR("{} 批量文件数据下载失败！", rid);
+                return false;
+            }
+            unordered_map<std::string, UserInfo> user_lists;
+            if (_GetUser(rid, user_id_lists, user_lists) == false)
+            {
+                LOG_ERROR("{} 批量用户数据获取失败！", rid);
+                return false;
+            }
+            for (auto &msg : msg_lists)
+            {
+                auto message_info = msg_infos->Add();
+                message_info->set_message_id(msg.message_id());
+                message_info->set_seq(msg.seq());
+                message_info->set_chat_session_id(msg.session_id());
+                message_info->set_timestamp(boost::posix_time::to_time_t(msg.create_time()));
+                message_info->mutable_sender()->CopyFrom(user_lists[msg.user_id()]);
+                auto content = message_info->mutable_message();
+                content->set_message_type((MessageType)msg.message_type());
+                switch (msg.message_type())
+                {
+                case MessageType::STRING:
+                    content->mutable_string_message()->set_content(msg.content());
+                    break;
+                case MessageType::IMAGE:
+                    content->mutable_image_message()->set_file_id(msg.file_id());
+                    content->mutable_image_message()->set_image_content(file_data_lists[msg.file_id()]);
+                    break;
+                case MessageType::FILE:
+                    content->mutable_file_message()->set_file_id(msg.file_id());
+                    content->mutable_file_message()->set_file_size(msg.file_size());
+                    content->mutable_file_message()->set_file_name(msg.file_name());
+                    content->mutable_file_message()->set_file_contents(file_data_lists[msg.file_id()]);
+                    break;
+                case MessageType::SPEECH:
+                    content->mutable_speech_message()->set_file_id(msg.file_id());
+                    content->mutable_speech_message()->set_file_contents(file_data_lists[msg.file_id()]);
+                    break;
+                default:
+                    LOG_ERROR("消息类型错误！！");
+                    break;
+                }
+            }
+            return true;
+        }
         bool _PutFile(const std::string &name, const std::string &body, int64_t sz, std::string &fid)
         {
             auto channel = _mm_channels->choose(_file_service_name);
@@ -374,7 +607,10 @@ namespace lbk
             req.mutable_file_data()->set_file_content(body);
             req.mutable_file_data()->set_file_size(sz);
             brpc::Controller cntl;
+            trace::Span call_span("FileService.PutSingleFile", "rpc");
+            call_span.inject(cntl);
             stub.PutSingleFile(&cntl, &req, &rsp, nullptr);
+            call_span.finish(!cntl.Failed());
             if (cntl.Failed() == true || rsp.success() == false)
             {
                 LOG_ERROR("文件子服务调用失败：{}！", cntl.ErrorText());
@@ -384,17 +620,31 @@ namespace lbk
             return true;
         }
 
+        // 相同文件集合的并发下载合并为一次文件子服务调用
         bool _GetFile(const std::string &rid, const unordered_set<std::string> &file_id_lists,
                       unordered_map<std::string, std::string> &file_data_lists)
+        {
+            auto rsp = _file_flight.run(flight_key(file_id_lists), [this, &rid, &file_id_lists]()
+                                        { return _GetMultiFile(rid, file_id_lists); });
+            if (!rsp)
+                return false;
+            const auto &fmap = rsp->file_data();
+            for (auto it = fmap.begin(); it != fmap.end(); it++)
+            {
+                file_data_lists[it->first] = it->second.file_content();
+            }
+            return true;
+        }
+        std::shared_ptr<GetMultiFileRsp> _GetMultiFile(const std::string &rid, const unordered_set<std::string> &file_id_lists)
         {
             auto channel = _mm_channels->choose(_file_service_name);
             if (!channel)
             {
                 LOG_ERROR("{} 没有可供访问的文件子服务节点！", _file_service_name);
-                return false;
+                return std::shared_ptr<GetMultiFileRsp>();
             }
             GetMultiFileReq req;
-            GetMultiFileRsp rsp;
+            auto rsp = std::make_shared<GetMultiFileRsp>();
             FileService_Stub stub(channel.get());
             req.set_request_id(rid);
             for (auto &id : file_id_lists)
@@ -402,30 +652,42 @@ namespace lbk
                 req.add_file_id_list(id);
             }
             brpc::Controller cntl;
-            stub.GetMultiFile(&cntl, &req, &rsp, nullptr);
-            if (cntl.Failed() == true || rsp.success() == false)
+            trace::Span call_span("FileService.GetMultiFile", "rpc");
+            call_span.inject(cntl);
+            stub.GetMultiFile(&cntl, &req, rsp.get(), nullptr);
+            call_span.finish(!cntl.Failed());
+            if (cntl.Failed() == true || rsp->success() == false)
             {
                 LOG_ERROR("文件子服务调用失败：{}！", cntl.ErrorText());
-                return false;
+                return std::shared_ptr<GetMultiFileRsp>();
             }
-            const auto &fmap = rsp.file_data();
-            for (auto it = fmap.begin(); it != fmap.end(); it++)
+            return rsp;
+        }
+        // 相同用户集合的并发查询合并为一次用户子服务调用
+        bool _GetUser(const std::string &rid, const unordered_set<std::string> &user_id_lists,
+                      unordered_map<std::string, UserInfo> &file_data_lists)
+        {
+            auto rsp = _user_flight.run(flight_key(user_id_lists), [this, &rid, &user_id_lists]()
+                                        { return _GetMultiUser(rid, user_id_lists); });
+            if (!rsp)
+                return false;
+            const auto &umap = rsp->users_info();
+            for (auto it = umap.begin(); it != umap.end(); it++)
             {
-                file_data_lists[it->first] = it->second.file_content();
+                file_data_lists[it->first] = it->second;
             }
             return true;
         }
-        bool _GetUser(const std::string &rid, const unordered_set<std::string> &user_id_lists,
-                      unordered_map<std::string, UserInfo> &file_data_lists)
+        std::shared_ptr<GetMultiUserInfoRsp> _GetMultiUser(const std::string &rid, const unordered_set<std::string> &user_id_lists)
         {
             auto channel = _mm_channels->choose(_user_service_name);
             if (!channel)
             {
                 LOG_ERROR("{} 没有可供访问的用户子服务节点！", _user_service_name);
-                return false;
+                return std::shared_ptr<GetMultiUserInfoRsp>();
             }
             GetMultiUserInfoReq req;
-            GetMultiUserInfoRsp rsp;
+            auto rsp = std::make_shared<GetMultiUserInfoRsp>();
             UserService_Stub stub(channel.get());
             req.set_request_id(rid);
             for (auto &id : user_id_lists)
@@ -433,18 +695,16 @@ namespace lbk
                 req.add_users_id(id);
             }
             brpc::Controller cntl;
-            stub.GetMultiUserInfo(&cntl, &req, &rsp, nullptr);
-            if (cntl.Failed() == true || rsp.success() == false)
+            trace::Span call_span("UserService.GetMultiUserInfo", "rpc");
+            call_span.inject(cntl);
+            stub.GetMultiUserInfo(&cntl, &req, rsp.get(), nullptr);
+            call_span.finish(!cntl.Failed());
+            if (cntl.Failed() == true || rsp->success() == false)
             {
                 LOG_ERROR("用户子服务调用失败：{}！", cntl.ErrorText());
-                return false;
+                return std::shared_ptr<GetMultiUserInfoRsp>();
             }
-            const auto &umap = rsp.users_info();
-            for (auto it = umap.begin(); it != umap.end(); it++)
-            {
-                file_data_lists[it->first] = it->second;
-            }
-            return true;
+            return rsp;
         }
 
     private:
@@ -452,10 +712,25 @@ namespace lbk
         std::string _user_service_name;
         std::string _file_service_name;
         ServiceManager::ptr _mm_channels;
+        SingleFlight<std::shared_ptr<GetMultiUserInfoRsp>> _user_flight;
+        SingleFlight<std::shared_ptr<GetMultiFileRsp>> _file_flight;
 
         // 消息成员表的操作句柄
-        ESMessage::ptr _es_message;
-        MessageTable::ptr _mysql_message;
+        MessageSearcher::ptr _es_message; // ES或本地索引，由search_engine参数选择
+        bool _index_on_store;             // 存储消息时是否同时写入检索引擎，本地索引由onIndexMessage写入
+        ShardedMessageTable::ptr _mysql_message; // 消息按会话分库存储，未配置分库时即为单库
+        // 冷消息归档，为空表示未启用归档
+        MessageArchive::ptr _archive;
+        // 消息同步相关：会话成员表与用户同步游标表
+        ChatSessionMemberTable::ptr _mysql_member;
+        SyncCursorTable::ptr _mysql_cursor;
+        // 数据库操作的执行线程池，处理函数中的查询都投递到这里，避免阻塞bthread的worker线程
+        DBExecutor::ptr _db_executor;
+        static const int SYNC_MAX_COUNT = 200;           // 单次同步最多返回的消息条数
+        static const int SYNC_WINDOW_SEC = 7 * 24 * 3600; // 没有游标的会话只同步最近7天的消息
+        static const int SYNC_SETTLE_SEC = 10;            // 序号空洞超过该时间仍未补上时跳过
+        static const int SEARCH_PAGE_SIZE = 20;      // 消息搜索默认每页条数
+        static const int SEARCH_MAX_PAGE_SIZE = 100; // 消息搜索每页最多条数
     };
 
     // 使用建造者模式实现MsgStorageServer
@@ -463,7 +738,7 @@ namespace lbk
     {
     public:
         using ptr = std::shared_ptr<MsgStorageServer>;
-        MsgStorageServer(const std::shared_ptr<odb::core::database> &db, const std::shared_ptr<elasticlient::Client> &es,
+        MsgStorageServer(const std::shared_ptr<odb::core::database> &db, const ESClient::ptr &es,
                          const MQClient::ptr &mq_client, const Discovery::ptr &discovery_client,
                          const Registry::ptr &reg_client, const std::shared_ptr<brpc::Server> &rpc_server)
             : _db_client(db), _es_client(es), _mq_client(mq_client),
@@ -478,7 +753,7 @@ namespace lbk
 
     private:
         std::shared_ptr<odb::core::database> _db_client;
-        std::shared_ptr<elasticlient::Client> _es_client;
+        ESClient::ptr _es_client;
         MQClient::ptr _mq_client;
 
         Discovery::ptr _discovery_client;
@@ -507,14 +782,130 @@ namespace lbk
                                const std::string &db,
                                const std::string &cset,
                                int port,
-                               int conn_pool_count)
+                               int conn_pool_count,
+                               const std::string &replicas = "",
+                               int max_lag_ms = 1000,
+                               int conn_pool_min = 0)
+        {
+            // 连接池：conn_pool_min小于最大数量时在两者之间按排队情况自适应伸缩，否则为固定大小
+            PoolOptions pool;
+            pool.max_size = conn_pool_count;
+            pool.min_size = conn_pool_min > 0 && conn_pool_min < conn_pool_count ? conn_pool_min : conn_pool_count;
+            _mysql_client = ODBFactory::create(user, password, host, db, cset, port, pool);
+            // 读写分离：replicas为逗号分隔的从库 host:port 列表，为空时所有读写都走主库
+            auto replica_list = ODBFactory::create_replicas(user, password, replicas, db, cset, pool);
+            _mysql_router = std::make_shared<DBRouter>(_mysql_client, replica_list, max_lag_ms);
+            _mysql_router->start(std::chrono::milliseconds(1000));
+        }
+        // 构造数据库异步执行线程池，threads为执行线程数量，max_pending为排队任务上限
+        void make_executor_object(size_t threads, size_t max_pending)
         {
-            _mysql_client = ODBFactory::create(user, password, host, db, cset, port, conn_pool_count);
+            _db_executor = std::make_shared<DBExecutor>(threads, max_pending);
         }
-        // 构造es客户端对象
-        void make_es_object(const std::vector<std::string> &host_list)
+        // 构造消息分库路由对象：config为分库配置文件路径，etcd_host不为空时config为etcd中的键
+        //  reload_interval: 重新加载配置的周期(秒)，迁移工具修改配置后在一个周期内生效
+        void make_shard_object(const std::string &config, const std::string &etcd_host, int reload_interval)
+        {
+            try
+            {
+                _messages = std::make_shared<ShardedMessageTable>(std::make_shared<ShardConfigStore>(config, etcd_host));
+            }
+            catch (const std::exception &e)
+            {
+                LOG_FATAL("初始化消息分库失败：{}", e.what());
+                abort();
+            }
+            _messages->start(std::chrono::seconds(reload_interval));
+        }
+        // 构造冷消息归档对象，过期分区会先归档到该目录再删除；须在make_mysql_object之后、make_partition_object之前调用
+        //  dir必须是所有存储实例共享的同一目录(例如共享存储的挂载点)，启动时校验，不是同一目录时拒绝启动
+        //  rescan_interval: 扫描目录加载其他实例与离线归档工具新写入文件的周期(秒)
+        void make_archive_object(const std::string &dir, int level, int rescan_interval)
+        {
+            if (!_mysql_client)
+            {
+                LOG_FATAL("还未初始化Mysql数据库模块！");
+                abort();
+            }
+            _message_archive = std::make_shared<MessageArchive>(dir, level);
+            if (_message_archive->init() == false || _message_archive->verify(_mysql_client) == false)
+            {
+                LOG_FATAL("初始化冷消息归档目录失败！");
+                abort();
+            }
+            _archive_rescan = std::chrono::seconds(rescan_interval);
+            _message_archive->start(_archive_rescan);
+        }
+        // 为每个消息分库构造分区管理对象，并启动后台维护线程；运行中通过配置新加入的分库在加载时同样创建
+        //  months_ahead: 预建未来分区个数；retain_months: 热表保留月数(0不归档)；check_interval: 维护周期(秒)
+        void make_partition_object(int months_ahead, int retain_months, int check_interval)
+        {
+            auto archive = _message_archive;
+            // 归档文件写入后等待其他实例扫描加载再删除分区，避免这段时间内其他实例查不到这部分历史
+            auto settle = _archive_rescan * 2;
+            // 分区管理对象随回调由消息表持有，消息表销毁时一并停止
+            auto partitions = std::make_shared<std::vector<MessagePartitionManager::ptr>>();
+            message_table()->on_shard([=](const std::string &name, const std::shared_ptr<odb::core::database> &db)
+                                      {
+                MessagePartitionManager::ArchiveFunc func;
+                if (archive)
+                {
+                    // 不同分库的归档文件以分库名区分，单库模式不加前缀
+                    std::string tag = name == ShardedMessageTable::SINGLE ? std::string() : name;
+                    func = [archive, db, tag, settle](const boost::posix_time::ptime &begin, const boost::posix_time::ptime &end)
+                    {
+                        std::string file;
+                        if (archive->archive(db, begin, end, tag, &file) == false)
+                            return false;
+                        if (!file.empty())
+                            std::this_thread::sleep_for(settle);
+                        return true;
+                    };
+                }
+                auto partition = std::make_shared<MessagePartitionManager>(db, months_ahead, retain_months, func);
+                partition->start(std::chrono::seconds(check_interval));
+                partitions->push_back(partition);
+                LOG_INFO("启动消息分库{}的分区维护", name); });
+        }
+        // 构造es客户端对象，并检查/创建消息索引；按新映射重建索引使用es_reindex_tool离线执行
+        void make_es_object(const std::vector<std::string> &host_list,
+                            const ESIndexSettings &settings = ESIndexSettings())
         {
             _es_client = ESClientFactory::create(host_list);
+            if (!_es_client)
+            {
+                LOG_FATAL("初始化ES搜索引擎客户端失败！");
+                abort();
+            }
+            _es_settings = settings;
+            ESMessage es(_es_client, ESBulkWriter::ptr(), settings);
+            bool ret = es.createIndex();
+            if (ret == false)
+                LOG_ERROR("消息索引初始化失败，检索功能可能不可用！");
+        }
+        // 构造ES批量写入器：max_docs/max_bytes/flush_interval_ms任一达到即发送一批，capacity为排队文档上限
+        void make_es_bulk_object(size_t max_docs, size_t max_bytes, int flush_interval_ms, size_t capacity)
+        {
+            if (!_es_client)
+            {
+                LOG_FATAL("还未初始化ES搜索引擎模块！");
+                abort();
+            }
+            _es_bulk = std::make_shared<ESBulkWriter>(_es_client, max_docs, max_bytes, flush_interval_ms, capacity);
+        }
+        // 构造内嵌的本地消息索引，替代ES提供消息检索；不调用时使用ES
+        //  flush_docs/flush_interval_ms: 内存中的新消息落盘为索引段的条数与时间阈值；max_segments: 段数量超过时后台合并
+        void make_local_search_object(const std::string &dir, size_t flush_docs, int flush_interval_ms, size_t max_segments)
+        {
+            auto index = std::make_shared<LocalMessageIndex>(dir, flush_docs, flush_interval_ms, max_segments);
+            if (index->createIndex() == false)
+            {
+                LOG_FATAL("初始化本地消息索引失败！");
+                abort();
+            }
+            _searcher = index;
+            _local_index = index;
+            _local_search = true;
         }
         // 用于构造服务发现客户端&信道管理对象
         void make_discovery_object(const std::string &reg_host, const std::string &base_service_name,
@@ -541,28 +932,42 @@ namespace lbk
         // 构造RPC服务器对象
         void make_rpc_object(uint16_t port, int32_t timeout, uint8_t num_threads)
         {
-            if (!_es_client)
+            if (!_searcher && !_es_client)
             {
-                LOG_ERROR("还未初始化ES搜索引擎模块！");
+                LOG_FATAL("还未初始化ES搜索引擎模块！");
                 abort();
             }
+            if (!_searcher)
+                _searcher = std::make_shared<ESMessage>(_es_client, _es_bulk, _es_settings);
             if (!_mm_channels)
             {
-                LOG_ERROR("还未初始化信道管理模块！");
+                LOG_FATAL("还未初始化信道管理模块！");
                 abort();
             }
             if (!_mysql_client)
             {
-                LOG_ERROR("还未初始化Mysql数据库模块！");
+                LOG_FATAL("还未初始化Mysql数据库模块！");
                 abort();
             }
+            if (!_db_executor)
+            {
+                LOG_FATAL("还未初始化数据库异步执行模块！");
+                abort();
+            }
+            message_table()->executor(_db_executor);
             _rpc_server = std::make_shared<brpc::Server>();
             MsgStorageServiceImpl *msg_service = new MsgStorageServiceImpl(
-                _mysql_client, _es_client, _mm_channels, _user_service_name, _file_service_name);
+                _mysql_router, _searcher, _mm_channels, _user_service_name, _file_service_name, _db_executor,
+                _message_archive, message_table(), !_local_search);
             int ret = _rpc_server->AddService(msg_service, brpc::ServiceOwnership::SERVER_OWNS_SERVICE);
             if (ret == -1)
             {
-                LOG_ERROR("添加Rpc服务失败！");
+                LOG_FATAL("添加Rpc服务失败！");
+                abort();
+            }
+            if (trace::add_service(*_rpc_server) == false)
+            {
+                LOG_FATAL("添加追踪查看服务失败！");
                 abort();
             }
             brpc::ServerOptions options;
@@ -571,28 +976,39 @@ namespace lbk
             ret = _rpc_server->Start(port, &options);
             if (ret == -1)
             {
-                LOG_ERROR("服务启动失败！");
+                LOG_FATAL("服务启动失败！");
                 abort();
             }
 
             auto cb = std::bind(&MsgStorageServiceImpl::onMessage, msg_service, std::placeholders::_1, std::placeholders::_2);
             _mq_client->consume(_queue_name, cb);
+            if (_local_search)
+            {
+                // 每个实例的本地索引都需要全部消息，另外绑定一个实例独占的队列
+                auto index_cb = std::bind(&MsgStorageServiceImpl::onIndexMessage, msg_service, std::placeholders::_1, std::placeholders::_2);
+                _mq_client->consumeBroadcast(_exchange_name, index_cb, _routing_key, AMQP::ExchangeType::direct);
+                // 独占队列在实例停机期间不保留消息，新实例的索引也是空的：订阅之后从数据库补齐已索引最晚时间之后的消息
+                auto messages = message_table();
+                _local_index->backfill([messages](int64_t since, const std::function<bool(const Message &)> &cb)
+                                       { return messages->scan(boost::posix_time::from_time_t(since), MessageType::STRING, cb); },
+                                       INDEX_BACKFILL_OVERLAP_SEC, std::chrono::seconds(10));
+            }
         }
         MsgStorageServer::ptr build()
         {
             if (!_discover_client)
             {
-                LOG_ERROR("还未初始化服务发现模块！");
+                LOG_FATAL("还未初始化服务发现模块！");
                 abort();
             }
             if (!_registry_client)
             {
-                LOG_ERROR("还未初始化服务注册模块！");
+                LOG_FATAL("还未初始化服务注册模块！");
                 abort();
             }
             if (!_rpc_server)
             {
-                LOG_ERROR("还未初始化RPC服务器模块！");
+                LOG_FATAL("还未初始化RPC服务器模块！");
                 abort();
             }
 
@@ -601,6 +1017,21 @@ namespace lbk
             return server;
         }
 
+    private:
+        ShardedMessageTable::ptr message_table()
+        {
+            if (!_messages)
+            {
+                if (!_mysql_client)
+                {
+                    LOG_FATAL("还未初始化Mysql数据库模块！");
+                    abort();
+                }
+                _messages = std::make_shared<ShardedMessageTable>(_mysql_router);
+            }
+            return _messages;
+        }
+
     private:
         // 用户子服务和文件子服务调用相关信息
         std::string _user_service_name;
@@ -610,9 +1041,23 @@ namespace lbk
 
         // mysql数据库客户端
         std::shared_ptr<odb::core::database> _mysql_client;
+        DBRouter::ptr _mysql_router;
+        DBExecutor::ptr _db_executor;
+        // 消息分库路由，未调用make_shard_object时为单库；各分库的分区管理对象由其持有
+        ShardedMessageTable::ptr _messages;
+        // 冷消息归档，过期分区归档成功后才会被删除
+        MessageArchive::ptr _message_archive;
+        std::chrono::seconds _archive_rescan{0};
 
         // es搜索引擎客户端
-        std::shared_ptr<elasticlient::Client> _es_client;
+        ESClient::ptr _es_client;
+        ESBulkWriter::ptr _es_bulk;
+        ESIndexSettings _es_settings;
+        // 消息检索实现
+        MessageSearcher::ptr _searcher;
+        bool _local_search = false; // 使用本地索引时，另外订阅实例独占的队列写入索引
+        LocalMessageIndex::ptr _local_index;
+        static const int INDEX_BACKFILL_OVERLAP_SEC = 3600; // 本地索引补齐时向前多读的时间，覆盖停机前未送达的乱序消息
 
         // 消息队列客户端句柄
         std::string _exchange_name;
@@ -0,0 +1,46 @@
+#include "../../../common/message_index.hpp"
+#include <gflags/gflags.h>
+
+DEFINE_bool(run_mode, false, "程序的运行模式，false-调试； true-发布；");
+DEFINE_string(log_file, "", "发布模式下，用于指定日志的输出文件");
+DEFINE_int32(log_level, 0, "发布模式下，用于指定日志输出等级");
+
+DEFINE_string(index_dir, "./message_index", "本地消息索引目录");
+
+int main(int argc, char *argv[])
+{
+    google::ParseCommandLineFlags(&argc, &argv, true);
+    lbk::init_logger(FLAGS_run_mode, FLAGS_log_file, FLAGS_log_level);
+
+    // 每2条消息落盘一个段，段数超过2个时合并
+    auto index = std::make_shared<lbk::LocalMessageIndex>(FLAGS_index_dir, 2, 1000, 2);
+    if (index->createIndex() == false)
+        return -1;
+    index->appendData("用户ID1", "消息ID1", "会话ID1", 1723025035, "吃饭了吗？");
+    index->appendData("用户ID2", "消息ID2", "会话ID1", 1723025035 - 100, "吃的盖浇饭！");
+    index->appendData("用户ID3", "消息ID3", "会话ID2", 1723025035, "吃饭了吗？");
+    index->appendData("用户ID4", "消息ID4", "会话ID2", 1723025035 - 100, "吃的盖浇饭！");
+    index->appendData("用户ID5", "消息ID5", "会话ID1", 1723025035 + 100, "今天的盖浇饭不错，明天还吃盖浇饭");
+    std::this_thread::sleep_for(std::chrono::seconds(2));
+
+    lbk::MessageSearchPage page;
+    page.size = 1;
+    page.highlight = true;
+    bool has_more = true;
+    while (has_more)
+    {
+        auto res = index->search("盖浇饭", "会话ID1", page, has_more);
+        for (auto &u : res)
+        {
+            std::cout << "-----------------" << std::endl;
+            std::cout << u.user_id() << std::endl;
+            std::cout << u.message_id() << std::endl;
+            std::cout << u.session_id() << std::endl;
+            std::cout << boost::posix_time::to_simple_string(u.create_time()) << std::endl;
+            std::cout << u.content() << std::endl;
+            page.after_time = boost::posix_time::to_time_t(u.create_time());
+            page.after_id = u.message_id();
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,58 @@
+// 离线冷消息归档工具：将消息表中早于N天的消息写入归档文件，然后从消息表中删除
+//  归档文件与消息存储服务的 --archive_dir 使用同一个共享目录(启动时校验)，存储服务运行中按 --archive_rescan_sec 周期扫描加载
+//  归档文件写入后先等待各存储实例完成加载再删除数据库中的消息，避免这段时间内的历史查询两边都查不到
+//  删除时只删除写入了归档文件的消息，归档之后才到达的迟到消息保留在消息表中，下次执行时再归档
+#include <gflags/gflags.h>
+#include <chrono>
+#include <thread>
+#include "message_archive.hpp"
+
+DEFINE_bool(run_mode, false, "程序的运行模式，false-调试，true-发布");
+DEFINE_string(log_file, "", "发布模式下，用于指定日志的输出文件");
+DEFINE_int32(log_level, 0, "发布模式下，用于指定日志输出等级");
+
+DEFINE_string(mysql_user, "root", "Mysql服务器访问用户名");
+DEFINE_string(mysql_password, "2162627569", "Mysql服务器访问密码");
+DEFINE_string(mysql_host, "127.0.0.1", "Mysql服务器访问地址");
+DEFINE_string(mysql_db, "chat_system", "Mysql默认库名称");
+DEFINE_string(mysql_cset, "utf8", "Mysql客户端字符集");
+DEFINE_int32(mysql_port, 0, "Mysql服务器访问端口");
+
+DEFINE_string(archive_dir, "./archive", "冷消息归档文件目录");
+DEFINE_int32(archive_level, 3, "冷消息归档的zstd压缩等级");
+DEFINE_int32(archive_days, 180, "归档早于多少天的消息");
+DEFINE_int32(wait_sec, 60, "归档文件写入后等待各存储实例加载的时间，应大于存储服务的archive_rescan_sec");
+
+int main(int argc, char *argv[])
+{
+    google::ParseCommandLineFlags(&argc, &argv, true);
+    lbk::init_logger(FLAGS_run_mode, FLAGS_log_file, FLAGS_log_level);
+
+    auto db = lbk::ODBFactory::create(FLAGS_mysql_user, FLAGS_mysql_password, FLAGS_mysql_host,
+                                      FLAGS_mysql_db, FLAGS_mysql_cset, FLAGS_mysql_port, 1);
+    auto archive = std::make_shared<lbk::MessageArchive>(FLAGS_archive_dir, FLAGS_archive_level);
+    if (archive->init() == false || archive->verify(db) == false)
+        return -1;
+    // 以天(UTC，与create_time一致)为边界，重复执行时同一天生成的归档文件会覆盖而不是重复
+    auto today = boost::posix_time::second_clock::universal_time().date();
+    boost::posix_time::ptime end(today - boost::gregorian::days(FLAGS_archive_days));
+    boost::posix_time::ptime begin(boost::gregorian::date(1970, 1, 1));
+    std::string file;
+    if (archive->archive(db, begin, end, "", &file) == false)
+    {
+        LOG_ERROR("归档{}之前的消息失败！", boost::posix_time::to_simple_string(end));
+        return -1;
+    }
+    if (file.empty())
+    {
+        LOG_INFO("{}之前没有需要归档的消息", boost::posix_time::to_simple_string(end));
+        return 0;
+    }
+    // 只有归档文件落盘并被各存储实例加载后才删除，删除失败时重复的消息会在查询时按消息ID去重
+    LOG_INFO("归档文件已写入，等待{}秒后清理数据库中的消息", FLAGS_wait_sec);
+    std::this_thread::sleep_for(std::chrono::seconds(FLAGS_wait_sec));
+    if (archive->purge(db, file) == false)
+        return -1;
+    LOG_INFO("归档并清理{}之前的消息完成", boost::posix_time::to_simple_string(end));
+    return 0;
+}
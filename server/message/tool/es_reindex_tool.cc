@@ -0,0 +1,51 @@
+// ES索引重建工具：按当前版本的字段映射与设置重建用户/消息索引，复制数据后切换别名
+//  1. 服务照常运行，读写都经别名进行；重建只需在一个地方执行一次，不要同时对同一索引执行多个
+//  2. 旧版本直接创建的同名索引(没有别名)在最后一次补齐到切换完成之间禁止写入，期间写入该索引的请求会失败
+//  3. 失败时以非0退出，已创建但未切换的新版本索引需要手动删除后再重新执行
+#include <gflags/gflags.h>
+#include "data_es.hpp"
+
+DEFINE_bool(run_mode, false, "程序的运行模式，false-调试，true-发布");
+DEFINE_string(log_file, "", "发布模式下，用于指定日志的输出文件");
+DEFINE_int32(log_level, 0, "发布模式下，用于指定日志输出等级");
+
+DEFINE_string(es_host, "http://127.0.0.1:9200/", "ES搜索引擎服务器URL");
+DEFINE_string(index, "message", "需要重建的索引：user/message");
+DEFINE_int32(es_shards, 1, "新版本索引的主分片数");
+DEFINE_int32(es_replicas, 1, "新版本索引的副本数");
+DEFINE_string(es_refresh_interval, "1s", "新版本索引的刷新间隔");
+
+using namespace lbk;
+
+int main(int argc, char *argv[])
+{
+    google::ParseCommandLineFlags(&argc, &argv, true);
+    lbk::init_logger(FLAGS_run_mode, FLAGS_log_file, FLAGS_log_level);
+
+    auto es_client = ESClientFactory::create({FLAGS_es_host});
+    if (!es_client)
+    {
+        LOG_ERROR("初始化ES搜索引擎客户端失败！");
+        return -1;
+    }
+    ESIndexSettings settings;
+    settings.shards = FLAGS_es_shards;
+    settings.replicas = FLAGS_es_replicas;
+    settings.refresh_interval = FLAGS_es_refresh_interval;
+    bool ret = false;
+    if (FLAGS_index == "user")
+        ret = ESUser(es_client, ESBulkWriter::ptr(), settings).reindex();
+    else if (FLAGS_index == "message")
+        ret = ESMessage(es_client, ESBulkWriter::ptr(), settings).reindex();
+    else
+    {
+        LOG_ERROR("未知的索引：{}", FLAGS_index);
+        return -1;
+    }
+    if (ret == false)
+    {
+        LOG_ERROR("重建ES索引{}失败！", FLAGS_index);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,212 @@
+// 整数键迁移工具：为已有数据补齐 relation/chat_session/chat_session_member/message 中的 *_key 列
+//  新版本的查询与联表只使用整数键，未补齐的历史数据(键为0)对新版本不可见，上线顺序：
+//  1. --step=schema   旧版本服务照常运行，建立id_map表、以默认值0新增键列及联合索引，旧版本写入不受影响
+//  2. --step=backfill 补齐已有数据的键，可重复执行，只处理键为0的行
+//  3. 滚动发布新版本的 friend/message/transmite 服务
+//  4. --step=backfill 再执行一遍，补齐发布期间旧版本实例写入的数据
+//  5. --step=finalize 全部补齐后为 chat_session.session_key 建立唯一索引
+//  每个数据库分别执行：消息分库时对每个分库都要执行(键只在同一个库的id_map中有效)
+#include <gflags/gflags.h>
+#include <odb/mysql/exceptions.hxx>
+#include <algorithm>
+#include "mysql.hpp"
+#include "logger.hpp"
+
+DEFINE_bool(run_mode, false, "程序的运行模式，false-调试，true-发布");
+DEFINE_string(log_file, "", "发布模式下，用于指定日志的输出文件");
+DEFINE_int32(log_level, 0, "发布模式下，用于指定日志输出等级");
+
+DEFINE_string(mysql_user, "root", "Mysql服务器访问用户名");
+DEFINE_string(mysql_password, "2162627569", "Mysql服务器访问密码");
+DEFINE_string(mysql_host, "127.0.0.1", "Mysql服务器访问地址");
+DEFINE_string(mysql_db, "chat_system", "Mysql默认库名称");
+DEFINE_string(mysql_cset, "utf8", "Mysql客户端字符集");
+DEFINE_int32(mysql_port, 0, "Mysql服务器访问端口");
+
+DEFINE_string(step, "backfill", "执行的步骤：schema/backfill/finalize");
+DEFINE_string(tables, "relation,chat_session,chat_session_member,message", "需要处理的表，逗号分隔");
+DEFINE_int32(batch, 1000, "每批补齐的行数");
+
+using namespace lbk;
+
+// 一张表中需要补齐的键列及其对应的字符串ID列
+struct KeyTable
+{
+    std::string table;
+    std::vector<std::pair<std::string, std::string>> keys; // <键列, 字符串ID列>
+    std::vector<std::string> indexes;                      // 新增的普通索引定义
+};
+
+static const std::vector<KeyTable> &key_tables()
+{
+    static const std::vector<KeyTable> tables = {
+        {"relation", {{"user_key", "user_id"}, {"peer_key", "peer_id"}}, {"INDEX relation_user_peer_i (user_key, peer_key)"}},
+        {"chat_session", {{"session_key", "chat_session_id"}}, {}},
+        {"chat_session_member", {{"session_key", "session_id"}, {"user_key", "user_id"}},
+         {"INDEX chat_session_member_session_key_i (session_key)", "INDEX csm_user_session_i (user_key, session_key)"}},
+        {"message", {{"session_key", "session_id"}}, {"INDEX message_session_time_i (session_key, create_time)"}},
+    };
+    return tables;
+}
+
+// 执行一条语句，返回影响的行数；ignore中的错误码视为已经执行过
+static bool execute(const std::shared_ptr<odb::core::database> &db, const std::string &sql,
+                    unsigned long long &affected, const std::vector<unsigned int> &ignore = {})
+{
+    try
+    {
+        odb::transaction trans(db->begin());
+        affected = db->execute(sql);
+        trans.commit();
+    }
+    catch (const odb::mysql::database_exception &e)
+    {
+        if (std::find(ignore.begin(), ignore.end(), e.error()) != ignore.end())
+        {
+            LOG_INFO("已经执行过，跳过：{}", sql);
+            affected = 0;
+            return true;
+        }
+        LOG_ERROR("执行语句失败：{} - {}", sql, e.what());
+        return false;
+    }
+    catch (const std::exception &e)
+    {
+        LOG_ERROR("执行语句失败：{} - {}", sql, e.what());
+        return false;
+    }
+    return true;
+}
+
+// 1060: 列已存在；1061: 索引已存在
+static const std::vector<unsigned int> ALREADY_DONE = {1060, 1061};
+
+static bool schema(const std::vector<const KeyTable *> &tables, const std::shared_ptr<odb::core::database> &db)
+{
+    unsigned long long affected;
+    if (execute(db, "CREATE TABLE IF NOT EXISTS id_map (id BIGINT UNSIGNED NOT NULL AUTO_INCREMENT PRIMARY KEY, "
+                    "ext_id VARCHAR(64) NOT NULL, UNIQUE INDEX id_map_ext_id_i (ext_id)) ENGINE=InnoDB",
+                affected) == false)
+        return false;
+    for (auto t : tables)
+    {
+        // 键列带默认值0，旧版本的插入语句不包含这些列也能正常写入
+        for (auto &k : t->keys)
+        {
+            if (execute(db, "ALTER TABLE " + t->table + " ADD COLUMN " + k.first + " BIGINT UNSIGNED NOT NULL DEFAULT 0",
+                        affected, ALREADY_DONE) == false)
+                return false;
+        }
+        for (auto &index : t->indexes)
+        {
+            if (execute(db, "ALTER TABLE " + t->table + " ADD " + index, affected, ALREADY_DONE) == false)
+                return false;
+        }
+    }
+    return true;
+}
+
+// 按主键顺序每次取前batch个键未补齐的行：先为其中的字符串ID建立映射，再回填整数键
+//  两步之间并发写入的新行可能还没有映射，这些行的键保持为0，在下一轮中处理
+static bool backfill(const KeyTable &t, const std::shared_ptr<odb::core::database> &db)
+{
+    std::string pending;
+    for (auto &k : t.keys)
+        pending += (pending.empty() ? "" : " OR ") + k.first + " = 0";
+    std::string limit = " ORDER BY id LIMIT " + std::to_string(FLAGS_batch);
+    std::string assign;
+    for (auto &k : t.keys)
+    {
+        if (!assign.empty())
+            assign += ", ";
+        assign += k.first + " = COALESCE((SELECT m.id FROM id_map m WHERE m.ext_id = " + t.table + "." + k.second + "), 0)";
+    }
+    size_t total = 0;
+    while (true)
+    {
+        unsigned long long affected;
+        for (auto &k : t.keys)
+        {
+            std::string sql = "INSERT IGNORE INTO id_map (ext_id) SELECT DISTINCT p." + k.second +
+                              " FROM (SELECT " + k.second + " FROM " + t.table + " WHERE " + pending + limit + ") p";
+            if (execute(db, sql, affected) == false)
+                return false;
+        }
+        if (execute(db, "UPDATE " + t.table + " SET " + assign + " WHERE " + pending + limit, affected) == false)
+            return false;
+        if (affected == 0)
+            break;
+        total += affected;
+        LOG_INFO("{} 已补齐 {} 行", t.table, total);
+    }
+    LOG_INFO("{} 补齐完成，共 {} 行", t.table, total);
+    return true;
+}
+
+// 所有行补齐后会话键才满足唯一性，旧版本写入的新会话键为0，因此唯一索引只能最后建立
+static bool finalize(const std::vector<const KeyTable *> &tables, const std::shared_ptr<odb::core::database> &db)
+{
+    for (auto t : tables)
+    {
+        if (t->table != "chat_session")
+            continue;
+        unsigned long long affected;
+        return execute(db, "ALTER TABLE chat_session ADD UNIQUE INDEX chat_session_session_key_i (session_key)",
+                       affected, ALREADY_DONE);
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    google::ParseCommandLineFlags(&argc, &argv, true);
+    lbk::init_logger(FLAGS_run_mode, FLAGS_log_file, FLAGS_log_level);
+    if (FLAGS_batch <= 0)
+    {
+        LOG_ERROR("batch必须大于0！");
+        return -1;
+    }
+
+    std::vector<const KeyTable *> tables;
+    std::stringstream ss(FLAGS_tables);
+    std::string name;
+    while (std::getline(ss, name, ','))
+    {
+        if (name.empty())
+            continue;
+        auto it = std::find_if(key_tables().begin(), key_tables().end(), [&name](const KeyTable &t)
+                               { return t.table == name; });
+        if (it == key_tables().end())
+        {
+            LOG_ERROR("未知的表：{}", name);
+            return -1;
+        }
+        tables.push_back(&*it);
+    }
+
+    auto db = ODBFactory::create(FLAGS_mysql_user, FLAGS_mysql_password, FLAGS_mysql_host,
+                                 FLAGS_mysql_db, FLAGS_mysql_cset, FLAGS_mysql_port, 1);
+    bool ret = false;
+    if (FLAGS_step == "schema")
+        ret = schema(tables, db);
+    else if (FLAGS_step == "backfill")
+    {
+        ret = true;
+        for (auto t : tables)
+        {
+            if (backfill(*t, db) == false)
+            {
+                ret = false;
+                break;
+            }
+        }
+    }
+    else if (FLAGS_step == "finalize")
+        ret = finalize(tables, db);
+    else
+        LOG_ERROR("未知的步骤：{}", FLAGS_step);
+    if (ret == false)
+        return -1;
+    LOG_INFO("{} 步骤执行完成", FLAGS_step);
+    return 0;
+}
@@ -0,0 +1,195 @@
+// 消息分库在线迁移工具：将槽位区间[begin_slot, end_slot)迁移到目标分库
+//  1. 标记槽位迁移目标并等待各实例加载配置，此后新消息同时写入原分库和目标分库
+//  2. 将这些槽位中会话的历史消息从原分库复制到目标分库，已存在的消息跳过；
+//     复制与双写可能并发写入同一条消息，由目标分库的(消息ID, 产生时间)唯一键去重，迁移前须确认该索引已建立
+//  3. 切换槽位归属到目标分库并等待各实例加载配置，此后读写都走目标分库
+//  4. 重新获取原分库中属于这些槽位的会话(包括复制开始后才创建的会话)，补齐切换前双写失败或没有复制过的消息，
+//     然后删除原分库中的这些会话；任何一步失败都以非0退出
+#include <gflags/gflags.h>
+#include "mysql_message_shard.hpp"
+#include "mysql_partition.hpp"
+
+DEFINE_bool(run_mode, false, "程序的运行模式，false-调试，true-发布");
+DEFINE_string(log_file, "", "发布模式下，用于指定日志的输出文件");
+DEFINE_int32(log_level, 0, "发布模式下，用于指定日志输出等级");
+
+DEFINE_string(shard_config, "", "消息分库配置文件路径，shard_etcd_host不为空时为etcd中的键");
+DEFINE_string(shard_etcd_host, "", "保存消息分库配置的etcd地址，为空表示使用本地配置文件");
+DEFINE_int32(begin_slot, 0, "迁移的起始槽位");
+DEFINE_int32(end_slot, 0, "迁移的结束槽位(不包含)");
+DEFINE_string(to_shard, "", "迁移目标分库名称");
+DEFINE_int32(wait_sec, 30, "修改配置后等待各实例加载的时间，应大于存储服务的shard_reload_interval");
+DEFINE_int32(copy_batch, 1000, "每批复制的消息条数");
+
+using namespace lbk;
+
+// 获取原分库中属于迁移槽位的会话ID：会话ID与用户ID共用映射表，用户ID在消息表中查不到消息，不影响结果
+static bool slot_sessions(const ShardLayout &layout, const std::shared_ptr<odb::core::database> &db,
+                          std::vector<std::string> &ssids)
+{
+    try
+    {
+        odb::transaction trans(db->begin());
+        typedef odb::result<IdMap> result;
+        result r(db->query<IdMap>());
+        for (auto it = r.begin(); it != r.end(); it++)
+        {
+            size_t slot = layout.slot(it->ext_id());
+            if (slot >= (size_t)FLAGS_begin_slot && slot < (size_t)FLAGS_end_slot)
+                ssids.push_back(it->ext_id());
+        }
+        trans.commit();
+    }
+    catch (const std::exception &e)
+    {
+        LOG_ERROR("获取待迁移会话失败：{}", e.what());
+        return false;
+    }
+    return true;
+}
+
+// 获取全部原分库中属于迁移槽位的会话ID
+static bool all_sessions(const ShardLayout &layout,
+                         const std::unordered_map<std::string, std::shared_ptr<odb::core::database>> &dbs,
+                         std::unordered_map<std::string, std::vector<std::string>> &sources)
+{
+    for (auto &it : dbs)
+    {
+        if (it.first == FLAGS_to_shard)
+            continue;
+        if (slot_sessions(layout, it.second, sources[it.first]) == false)
+            return false;
+    }
+    return true;
+}
+
+// 按消息ID顺序分批复制一个会话的消息，跳过目标分库中已存在的消息
+static bool copy_session(MessageTable &src, MessageTable &dst, const std::string &ssid, size_t &copied)
+{
+    std::string last;
+    while (true)
+    {
+        auto msgs = src.after(ssid, last, FLAGS_copy_batch);
+        if (msgs.empty())
+            return true;
+        std::vector<std::string> mids;
+        for (auto &msg : msgs)
+            mids.push_back(msg.message_id());
+        std::unordered_set<std::string> exists;
+        if (dst.existing(ssid, mids, exists) == false)
+            return false;
+        for (auto &msg : msgs)
+        {
+            if (exists.count(msg.message_id()))
+                continue;
+            if (dst.insert(msg) == false)
+                return false;
+            ++copied;
+        }
+        if ((int)msgs.size() < FLAGS_copy_batch)
+            return true;
+        last = msgs.back().message_id();
+    }
+}
+
+static bool copy_all(const std::unordered_map<std::string, std::vector<std::string>> &sources,
+                     const std::unordered_map<std::string, std::shared_ptr<odb::core::database>> &dbs)
+{
+    MessageTable dst(dbs.at(FLAGS_to_shard));
+    for (auto &it : sources)
+    {
+        MessageTable src(dbs.at(it.first));
+        size_t copied = 0;
+        for (auto &ssid : it.second)
+        {
+            if (copy_session(src, dst, ssid, copied) == false)
+            {
+                LOG_ERROR("复制会话{}的消息失败！", ssid);
+                return false;
+            }
+        }
+        LOG_INFO("从分库{}复制{}个会话的{}条消息到分库{}", it.first, it.second.size(), copied, FLAGS_to_shard);
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    google::ParseCommandLineFlags(&argc, &argv, true);
+    lbk::init_logger(FLAGS_run_mode, FLAGS_log_file, FLAGS_log_level);
+
+    auto store = std::make_shared<ShardConfigStore>(FLAGS_shard_config, FLAGS_shard_etcd_host);
+    ShardLayout layout;
+    if (store->load(layout) == false)
+        return -1;
+    if (!layout.has_shard(FLAGS_to_shard) || FLAGS_begin_slot < 0 ||
+        FLAGS_end_slot > (int)layout.slots() || FLAGS_begin_slot >= FLAGS_end_slot)
+    {
+        LOG_ERROR("迁移参数错误：槽位[{}, {})，目标分库{}", FLAGS_begin_slot, FLAGS_end_slot, FLAGS_to_shard);
+        return -1;
+    }
+    // 1. 标记迁移目标，开始双写
+    std::unordered_map<std::string, std::shared_ptr<odb::core::database>> dbs;
+    dbs[FLAGS_to_shard] = layout.connect(FLAGS_to_shard);
+    bool unique = false;
+    if (MessagePartitionManager(dbs[FLAGS_to_shard]).message_id_unique(unique) == false)
+        return -1;
+    if (!unique)
+    {
+        LOG_ERROR("目标分库{}的消息表还没有建立消息ID唯一索引，等待存储服务完成分区维护后再迁移！", FLAGS_to_shard);
+        return -1;
+    }
+    for (int i = FLAGS_begin_slot; i < FLAGS_end_slot; ++i)
+    {
+        if (layout.owner(i) == FLAGS_to_shard)
+            continue;
+        layout.migrate_to(i, FLAGS_to_shard);
+        if (dbs.count(layout.owner(i)) == 0)
+            dbs[layout.owner(i)] = layout.connect(layout.owner(i));
+    }
+    layout.version(layout.version() + 1);
+    if (store->save(layout) == false)
+        return -1;
+    LOG_INFO("已标记槽位[{}, {})迁移到分库{}，等待各实例加载配置", FLAGS_begin_slot, FLAGS_end_slot, FLAGS_to_shard);
+    std::this_thread::sleep_for(std::chrono::seconds(FLAGS_wait_sec));
+
+    // 2. 复制历史消息
+    std::unordered_map<std::string, std::vector<std::string>> sources;
+    if (all_sessions(layout, dbs, sources) == false)
+        return -1;
+    if (copy_all(sources, dbs) == false)
+        return -1;
+
+    // 3. 切换归属
+    for (int i = FLAGS_begin_slot; i < FLAGS_end_slot; ++i)
+    {
+        layout.owner(i, FLAGS_to_shard);
+        layout.migrate_to(i, "");
+    }
+    layout.version(layout.version() + 1);
+    if (store->save(layout) == false)
+        return -1;
+    LOG_INFO("已切换槽位[{}, {})到分库{}，等待各实例加载配置", FLAGS_begin_slot, FLAGS_end_slot, FLAGS_to_shard);
+    std::this_thread::sleep_for(std::chrono::seconds(FLAGS_wait_sec));
+
+    // 4. 补齐后清理原分库：切换后原分库不再写入这些槽位，重新扫描一次即可拿到全部会话
+    sources.clear();
+    if (all_sessions(layout, dbs, sources) == false)
+        return -1;
+    if (copy_all(sources, dbs) == false)
+        return -1;
+    for (auto &it : sources)
+    {
+        MessageTable src(dbs.at(it.first));
+        for (auto &ssid : it.second)
+        {
+            if (src.remove(ssid) == false)
+            {
+                LOG_ERROR("删除原分库{}中会话{}的消息失败！槽位归属已切换，原分库中剩余的会话需要手动清理", it.first, ssid);
+                return -1;
+            }
+        }
+    }
+    LOG_INFO("槽位[{}, {})迁移完成", FLAGS_begin_slot, FLAGS_end_slot);
+    return 0;
+}
@@ -27,34 +27,42 @@ namespace lbk
         ChatSessionType chat_session_type() const { return _chat_session_type; }
         void chat_session_type(const ChatSessionType val) { _chat_session_type = val; }
 
+        unsigned long session_key() const { return _session_key; }
+        void session_key(const unsigned long val) { _session_key = val; }
+
     private:
         friend class odb::access;
 #pragma db id auto
         unsigned long _id;
 #pragma db type("varchar(64)") index unique
         std::string _chat_session_id;
+#pragma db index unique
+        unsigned long _session_key; // 会话ID在id_map中的整数键，用于联表
 #pragma db type("varchar(64)")
         std::string _chat_session_name;
 #pragma db type("tinyint")
         ChatSessionType _chat_session_type; // 1-单聊； 2-群聊
     };
 
-    // 这里条件必须是指定条件：  css::chat_session_type==1 && csm1.user_id=uid && csm2.user_id != csm1.user_id
-#pragma db view object(ChatSession = css)                                             \
-    object(ChatSessionMember = csm1 : css::_chat_session_id == csm1::_session_id)     \
-        object(ChatSessionMember = csm2 : css::_chat_session_id == csm2::_session_id) \
+    // 这里条件必须是指定条件：  css::chat_session_type==1 && csm1.user_key=ukey && csm2.user_key != csm1.user_key
+    // 联表条件使用整数键，避免在varchar(64)列上做两次连接
+#pragma db view object(ChatSession = css)                                           \
+    object(ChatSessionMember = csm1 : css::_session_key == csm1::_session_key)     \
+        object(ChatSessionMember = csm2 : css::_session_key == csm2::_session_key) \
             query((?))
     struct SingleChatSession
     {
 #pragma db column(css::_chat_session_id)
         std::string chat_session_id;
+#pragma db column(css::_session_key)
+        unsigned long session_key;
 #pragma db column(csm2::_user_id)
         std::string friend_id;
     };
 
-// 这里条件必须是指定条件：  css::chat_session_type==2 && csm.user_id=uid
-#pragma db view object(ChatSession = css)                                       \
-    object(ChatSessionMember = csm : css::_chat_session_id == csm::_session_id) \
+// 这里条件必须是指定条件：  css::chat_session_type==2 && csm.user_key=ukey
+#pragma db view object(ChatSession = css)                                     \
+    object(ChatSessionMember = csm : css::_session_key == csm::_session_key) \
         query((?))
     struct GroupChatSession
     {
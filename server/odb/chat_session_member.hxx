@@ -33,13 +33,35 @@ namespace lbk
             _user_id = uid;
         }
 
+        unsigned long session_key() const
+        {
+            return _session_key;
+        }
+        void session_key(const unsigned long key)
+        {
+            _session_key = key;
+        }
+
+        unsigned long user_key() const
+        {
+            return _user_key;
+        }
+        void user_key(const unsigned long key)
+        {
+            _user_key = key;
+        }
+
     private:
         friend class odb::access;
+#pragma db index("csm_user_session_i") members(_user_key, _session_key)
 #pragma db id auto
         unsigned long _id;
-#pragma db type("varchar(64)") index
+#pragma db type("varchar(64)")
         std::string _session_id;
 #pragma db type("varchar(64)")
         std::string _user_id;
+#pragma db index
+        unsigned long _session_key; // 会话ID的整数键
+        unsigned long _user_key;    // 用户ID的整数键
     };
 }
\ No newline at end of file
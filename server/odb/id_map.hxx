@@ -0,0 +1,30 @@
+// 外部字符串ID与内部整数键的映射表
+//  用户ID、会话ID对外(protobuf/ES)仍然使用字符串，
+//  在关联查询频繁的表中(relation/chat_session_member/message)只存储整数键，缩小索引并加速联表
+#pragma once
+#include <string>
+#include <odb/core.hxx>
+
+namespace lbk
+{
+#pragma db object table("id_map")
+    class IdMap
+    {
+    public:
+        IdMap() {}
+        IdMap(const std::string &ext_id) : _ext_id(ext_id) {}
+
+        unsigned long key() const { return _id; }
+
+        std::string ext_id() const { return _ext_id; }
+        void ext_id(const std::string &val) { _ext_id = val; }
+
+    private:
+        friend class odb::access;
+#pragma db id auto
+        unsigned long _id; // 内部整数键
+#pragma db type("varchar(64)") index unique
+        std::string _ext_id; // 外部字符串ID
+    };
+}
+// odb -d mysql --std c++11 --generate-query --generate-schema --profile boost/date-time id_map.hxx
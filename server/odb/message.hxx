@@ -10,10 +10,10 @@ namespace lbk
     class Message
     {
     public:
-        Message() {}
+        Message() : _seq(0) {}
         Message(const std::string &mid, const std::string &ssid, const std::string &uid,
                 const unsigned char mtype, const boost::posix_time::ptime &ctime)
-            : _message_id(mid), _session_id(ssid), _user_id(uid), _message_type(mtype), _create_time(ctime)
+            : _message_id(mid), _session_id(ssid), _user_id(uid), _seq(0), _message_type(mtype), _create_time(ctime)
         {
         }
         void message_id(const std::string &val) { _message_id = val; }
@@ -25,6 +25,12 @@ namespace lbk
         void user_id(const std::string &val) { _user_id = val; }
         std::string user_id() const { return _user_id; }
 
+        void session_key(const unsigned long val) { _session_key = val; }
+        unsigned long session_key() const { return _session_key; }
+
+        void seq(const unsigned long val) { _seq = val; }
+        unsigned long seq() const { return _seq; }
+
         void message_type(const unsigned char val) { _message_type = val; }
         unsigned char message_type() const { return _message_type; }
 
@@ -65,12 +71,21 @@ namespace lbk
 
     private:
         friend class odb::access;
+#pragma db index("message_session_time_i") members(_session_key, _create_time)
+#pragma db index("message_session_mid_i") members(_session_key, _message_id)
+#pragma db index("message_session_seq_i") members(_session_key, _seq)
+// 分区表的唯一索引必须包含分区列create_time，因此以(消息ID, 产生时间)作为唯一键，
+//  同一条消息重复写入(MQ重投、迁移时双写与复制并发)会被唯一索引拒绝
+#pragma db index("message_message_id_i") unique members(_message_id, _create_time)
 #pragma db id auto
         unsigned long _id;
-#pragma db type("varchar(64)") index unique
+#pragma db type("varchar(64)")
         std::string _message_id;
-#pragma db type("varchar(64)") index
-        std::string _session_id; // 所属会话ID
+#pragma db type("varchar(64)")
+        std::string _session_id;    // 所属会话ID
+        unsigned long _session_key; // 所属会话ID的整数键
+#pragma db default(0)
+        unsigned long _seq; // 会话内消息序号
 #pragma db type("varchar(64)")
         std::string _user_id;        // 发送者用户ID
         unsigned char _message_type; // 消息类型 0-文本；1-图片；2-文件；3-语音
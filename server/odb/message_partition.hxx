@@ -0,0 +1,37 @@
+// 消息表分区信息视图：直接查询 information_schema，用于存储服务管理按月分区
+#pragma once
+#include <string>
+#include <odb/core.hxx>
+
+namespace lbk
+{
+// 普通表只有一条分区名为空的记录，表不存在时没有记录
+#pragma db view query("SELECT IFNULL(PARTITION_NAME, ''), IFNULL(PARTITION_DESCRIPTION, ''), IFNULL(TABLE_ROWS, 0) " \
+                      "FROM information_schema.PARTITIONS "                                                       \
+                      "WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = 'message' "                              \
+                      "ORDER BY PARTITION_ORDINAL_POSITION")
+    struct MessagePartition
+    {
+        std::string name;        // 分区名称 p_history / pYYYYMM / p_max，普通表为空
+        std::string description; // 分区上界：UNIX_TIMESTAMP(create_time)的取值或MAXVALUE
+        unsigned long long rows; // 估算行数
+    };
+
+// 消息ID唯一索引包含的列数，(message_id, create_time)唯一索引为2，旧版本的普通索引为0
+#pragma db view query("SELECT COUNT(*) FROM information_schema.STATISTICS "                   \
+                      "WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = 'message' "         \
+                      "AND INDEX_NAME = 'message_message_id_i' AND NON_UNIQUE = 0")
+    struct MessageIdIndex
+    {
+        unsigned long long columns;
+    };
+
+// 分区维护的命名锁：按库名区分，多个存储实例中同一时间只有一个在维护同一个库的消息表
+//  不等待，获取失败(其他实例持有)返回0；锁随连接断开自动释放
+#pragma db view query("SELECT IFNULL(GET_LOCK(CONCAT('message_partition.', DATABASE()), 0), 0)")
+    struct PartitionLock
+    {
+        int acquired;
+    };
+}
+// odb -d mysql --std c++11 --generate-query --generate-schema --profile boost/date-time message_partition.hxx
@@ -18,13 +18,22 @@ namespace lbk
         std::string peer_id() const { return _peer_id; }
         void peer_id(const std::string &val) { _peer_id = val; }
 
+        unsigned long user_key() const { return _user_key; }
+        void user_key(const unsigned long val) { _user_key = val; }
+
+        unsigned long peer_key() const { return _peer_key; }
+        void peer_key(const unsigned long val) { _peer_key = val; }
+
     private:
         friend class odb::access;
+#pragma db index("relation_user_peer_i") members(_user_key, _peer_key)
 #pragma db id auto
         unsigned long _id;
-#pragma db type("varchar(64)") index
+#pragma db type("varchar(64)")
         std::string _user_id;
 #pragma db type("varchar(64)")
         std::string _peer_id;
+        unsigned long _user_key; // 用户ID的整数键
+        unsigned long _peer_key; // 好友ID的整数键
     };
 }
\ No newline at end of file
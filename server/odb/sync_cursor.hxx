@@ -0,0 +1,43 @@
+// 用户消息同步游标表映射对象
+//  记录每个用户在每个会话中已经收到的最后一条消息的会话内序号，断线重连后只同步游标之后的消息
+//  同步时跳过的序号空洞也记录在这里，迟到的消息落库后再补发
+#pragma once
+#include <string>
+#include <odb/core.hxx>
+
+namespace lbk
+{
+#pragma db object table("sync_cursor")
+    class SyncCursor
+    {
+    public:
+        SyncCursor() {}
+        SyncCursor(unsigned long ukey, unsigned long skey, unsigned long seq)
+            : _user_key(ukey), _session_key(skey), _seq(seq)
+        {
+        }
+        unsigned long user_key() const { return _user_key; }
+        void user_key(const unsigned long val) { _user_key = val; }
+
+        unsigned long session_key() const { return _session_key; }
+        void session_key(const unsigned long val) { _session_key = val; }
+
+        unsigned long seq() const { return _seq; }
+        void seq(const unsigned long val) { _seq = val; }
+
+        std::string holes() const { return _holes; }
+        void holes(const std::string &val) { _holes = val; }
+
+    private:
+        friend class odb::access;
+#pragma db index("sync_cursor_user_session_i") unique members(_user_key, _session_key)
+#pragma db id auto
+        unsigned long _id;
+        unsigned long _user_key;    // 用户ID的整数键
+        unsigned long _session_key; // 会话ID的整数键
+        unsigned long _seq; // 已收到的最后一条消息的会话内序号
+#pragma db type("varchar(2048)") default("")
+        std::string _holes; // 跳过的序号空洞，格式为 "序号:跳过时的unix时间" 以逗号分隔
+    };
+}
+// odb -d mysql --std c++11 --generate-query --generate-schema --profile boost/date-time sync_cursor.hxx
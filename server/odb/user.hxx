@@ -1,5 +1,6 @@
 #pragma once
 #include <string>
+#include <cstdint>
 #include <odb/core.hxx>
 #include <odb/nullable.hxx>
 
@@ -69,6 +70,9 @@ namespace lbk
             return std::string();
         }
 
+        void version(int64_t val) { _version = val; }
+        int64_t version() const { return _version; }
+
     private:
         friend class odb::access;
 #pragma db id auto
@@ -84,6 +88,8 @@ namespace lbk
         odb::nullable<std::string> _phone; // 用户手机号 - 不一定存在
 #pragma db type("varchar(64)")
         odb::nullable<std::string> _avatar_id; // 用户头像文件ID - 不一定存在
+#pragma db default(0)
+        int64_t _version = 0; // 行版本号，每次修改时递增，作为ES用户文档的外部版本号
     };
 }
 // odb -d mysql --std c++11 --generate-query --generate-schema --profile boost/date-time user.hxx
\ No newline at end of file
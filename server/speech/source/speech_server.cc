@@ -4,6 +4,8 @@
 DEFINE_bool(run_mode, false, "程序的运行模式，false-调试，true-发布");
 DEFINE_string(log_file, "", "发布模式下，用于指定日志的输出文件");
 DEFINE_int32(log_level, 0, "发布模式下，用于指定日志输出等级");
+DEFINE_int32(trace_ring_size, 10000, "内存中保留的最近追踪span数量，可通过/trace页面查看，0表示关闭请求追踪");
+DEFINE_string(trace_file, "", "追踪span的输出文件(每行一个json)，为空表示只保留在内存中");
 
 DEFINE_string(registry_host, "http://127.0.0.1:2379", "服务注册中心地址");
 DEFINE_string(base_service, "/service", "服务监控根目录");
@@ -21,6 +23,7 @@ int main(int argc, char *argv[])
 {
     google::ParseCommandLineFlags(&argc, &argv, true);
     lbk::init_logger(FLAGS_run_mode, FLAGS_log_file, FLAGS_log_level);
+    lbk::trace::Tracer::instance().init("speech_service", FLAGS_trace_ring_size, FLAGS_trace_file);
 
     lbk::SpeechServerBuilder ssb;
     ssb.make_asr_object(FLAGS_app_id, FLAGS_api_key, FLAGS_secret_key);
@@ -6,6 +6,7 @@
 #include "asr.hpp"     //语音识别模块封装
 #include "etcd.hpp"    //服务注册模块封装
 #include "logger.hpp"  //日志模块封装
+#include "trace_service.hpp" // 请求追踪
 #include "speech.pb.h" //protobuf代码框架
 
 namespace lbk
@@ -25,6 +26,7 @@ namespace lbk
         {
             LOG_DEBUG("收到语音转文字请求！");
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "SpeechService.SpeechRecognition");
             // 1. 取出请求中的语音数据
             // 2. 调用语音sdk模块进行语音识别，得到响应
             std::string err;
@@ -92,7 +94,7 @@ namespace lbk
         {
             if (!_asr_client)
             {
-                LOG_ERROR("还未初始化语音识别模块！");
+                LOG_FATAL("还未初始化语音识别模块！");
                 abort();
             }
             _rpc_server = std::make_shared<brpc::Server>();
@@ -100,7 +102,12 @@ namespace lbk
             int ret = _rpc_server->AddService(speech_service, brpc::ServiceOwnership::SERVER_OWNS_SERVICE);
             if (ret == -1)
             {
-                LOG_ERROR("添加Rpc服务失败！");
+                LOG_FATAL("添加Rpc服务失败！");
+                abort();
+            }
+            if (trace::add_service(*_rpc_server) == false)
+            {
+                LOG_FATAL("添加追踪查看服务失败！");
                 abort();
             }
             brpc::ServerOptions options;
@@ -109,7 +116,7 @@ namespace lbk
             ret = _rpc_server->Start(port, &options);
             if (ret == -1)
             {
-                LOG_ERROR("服务启动失败！");
+                LOG_FATAL("服务启动失败！");
                 abort();
             }
         }
@@ -117,17 +124,17 @@ namespace lbk
         {
             if (!_asr_client)
             {
-                LOG_ERROR("还未初始化语音识别模块！");
+                LOG_FATAL("还未初始化语音识别模块！");
                 abort();
             }
             if (!_reg_client)
             {
-                LOG_ERROR("还未初始化服务注册模块！");
+                LOG_FATAL("还未初始化服务注册模块！");
                 abort();
             }
             if (!_rpc_server)
             {
-                LOG_ERROR("还未初始化RPC服务器模块！");
+                LOG_FATAL("还未初始化RPC服务器模块！");
                 abort();
             }
             SpeechServer::ptr server = std::make_shared<SpeechServer>(
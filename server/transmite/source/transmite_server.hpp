@@ -1,9 +1,11 @@
 // 实现消息转发服务
+#pragma once
 #include <brpc/server.h>
 #include <butil/logging.h>
 
 #include "etcd.hpp"       //服务注册模块封装
 #include "logger.hpp"     //日志模块封装
+#include "trace_service.hpp" // 请求追踪
 #include "base.pb.h"      //protobuf代码框架
 #include "user.pb.h"      //protobuf代码框架
 #include "transmite.pb.h" //protobuf代码框架
@@ -11,6 +13,9 @@
 #include "rabbitmq.hpp"
 #include "mysql.hpp"
 #include "mysql_chat_session_member.hpp"
+#include "db_executor.hpp"
+#include "data_redis.hpp"
+#include "seq_allocator.hpp"
 #include "utils.hpp"
 
 namespace lbk
@@ -19,10 +24,12 @@ namespace lbk
     class TransmitServiceImpl : public lbk::MsgTransmitService
     {
     public:
-        TransmitServiceImpl(const std::shared_ptr<odb::core::database> &db, const std::string &exchange_name,
+        TransmitServiceImpl(const DBRouter::ptr &router, const std::string &exchange_name,
                             const std::string &routing_key, const MQClient::ptr &mq_client,
-                            const ServiceManager::ptr &mm_channels, const std::string &user_service_name)
-            : _mysql_session_member_table(std::make_shared<ChatSessionMemberTable>(db)),
+                            const ServiceManager::ptr &mm_channels, const std::string &user_service_name,
+                            const SeqAllocator::ptr &seq_allocator, const DBExecutor::ptr &db_executor)
+            : _mysql_session_member_table(std::make_shared<ChatSessionMemberTable>(router)), _db_executor(db_executor),
+              _seq_allocator(seq_allocator),
               _exchange_name(exchange_name), _routing_key(routing_key), _mq_client(mq_client),
               _mm_channels(mm_channels), _user_service_name(user_service_name)
         {
@@ -34,6 +41,7 @@ namespace lbk
         {
             LOG_DEBUG("收到消息转发请求！");
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "MsgTransmitService.GetTransmitTarget");
             response->set_request_id(request->request_id());
             // 定义一个错误处理函数，当出错时调用该函数
             auto err_response = [this, &response](const std::string &err_msg)
@@ -46,6 +54,8 @@ namespace lbk
             std::string uid = request->user_id();
             std::string chat_ssid = request->chat_session_id();
             MessageContent content = request->message();
+            // 会话成员查询与用户子服务调用互不依赖，先投递到数据库线程池，最后再取结果
+            auto target_future = _db_executor->async(_mysql_session_member_table, &ChatSessionMemberTable::members, chat_ssid);
             // 进行消息组织：发送者-用户子服务获取信息，所属会话，消息内容，产生时间，消息ID
             auto channel = _mm_channels->choose(_user_service_name);
             if (!channel)
@@ -59,15 +69,27 @@ namespace lbk
             req.set_user_id(uid);
             GetUserInfoRsp rsp;
             brpc::Controller cntl;
+            trace::Span call_span("UserService.GetUserInfo", "rpc");
+            call_span.inject(cntl);
             stub.GetUserInfo(&cntl, &req, &rsp, nullptr);
+            call_span.finish(!cntl.Failed());
             if (cntl.Failed() == true || rsp.success() == false)
             {
                 LOG_ERROR("{} - 用户子服务调用失败：{}！", request->request_id(), cntl.ErrorText());
                 return err_response("用户子服务调用失败!");
             }
 
+            // 分配会话内的消息序号，同一秒内的消息也能有确定的先后顺序
+            uint64_t seq = _seq_allocator->next(chat_ssid);
+            if (seq == 0)
+            {
+                LOG_ERROR("{} - 分配会话{}的消息序号失败！", request->request_id(), chat_ssid);
+                return err_response("分配消息序号失败!");
+            }
+
             MessageInfo message;
-            message.set_message_id(uuid());
+            message.set_message_id(sid()); // 按时间有序，可直接作为消息分页游标
+            message.set_seq(seq);
             message.set_chat_session_id(chat_ssid);
             message.set_timestamp(time(nullptr));
             message.mutable_sender()->CopyFrom(rsp.user_info());
@@ -80,7 +102,7 @@ namespace lbk
                 return err_response("持久化消息发布失败：!");
             }
             // 获取消息转发客户端用户列表
-            std::vector<std::string> target = _mysql_session_member_table->members(chat_ssid);
+            std::vector<std::string> target = target_future.get();
             // 组织响应
             response->set_success(true);
             response->mutable_message()->CopyFrom(message);
@@ -97,6 +119,9 @@ namespace lbk
 
         // 聊天会话成员表的操作句柄
         ChatSessionMemberTable::ptr _mysql_session_member_table;
+        DBExecutor::ptr _db_executor;
+        // 会话内消息序号分配
+        SeqAllocator::ptr _seq_allocator;
 
         // 消息队列客户端句柄
         std::string _exchange_name;
@@ -149,9 +174,31 @@ namespace lbk
                                const std::string &db,
                                const std::string &cset,
                                int port,
-                               int conn_pool_count)
+                               int conn_pool_count,
+                               const std::string &replicas = "",
+                               int max_lag_ms = 1000,
+                               int conn_pool_min = 0)
+        {
+            // 连接池：conn_pool_min小于最大数量时在两者之间按排队情况自适应伸缩，否则为固定大小
+            PoolOptions pool;
+            pool.max_size = conn_pool_count;
+            pool.min_size = conn_pool_min > 0 && conn_pool_min < conn_pool_count ? conn_pool_min : conn_pool_count;
+            _mysql_client = ODBFactory::create(user, password, host, db, cset, port, pool);
+            // 读写分离：replicas为逗号分隔的从库 host:port 列表，为空时所有读写都走主库
+            auto replica_list = ODBFactory::create_replicas(user, password, replicas, db, cset, pool);
+            _mysql_router = std::make_shared<DBRouter>(_mysql_client, replica_list, max_lag_ms);
+            _mysql_router->start(std::chrono::milliseconds(1000));
+        }
+        // 构造数据库异步执行线程池，threads为执行线程数量，max_pending为排队任务上限
+        void make_executor_object(size_t threads, size_t max_pending)
         {
-            _mysql_client = ODBFactory::create(user, password, host, db, cset, port, conn_pool_count);
+            _db_executor = std::make_shared<DBExecutor>(threads, max_pending);
+        }
+        // 构造redis客户端以及消息序号分配器
+        void make_redis_object(const std::string &host, int port, int db, bool keep_alive, size_t pool_size)
+        {
+            _redis_client = RedisClientFactory::create(host, port, db, keep_alive, pool_size);
+            _seq_allocator = std::make_shared<SeqAllocator>(_redis_client);
         }
         // 用于构造服务发现客户端&信道管理对象
         void make_discovery_object(const std::string &reg_host, const std::string &base_service_name, const std::string &user_service_name)
@@ -178,26 +225,42 @@ namespace lbk
         {
             if (!_mq_client)
             {
-                LOG_ERROR("还未初始化消息队列客户端模块！");
+                LOG_FATAL("还未初始化消息队列客户端模块！");
                 abort();
             }
             if (!_mm_channels)
             {
-                LOG_ERROR("还未初始化信道管理模块！");
+                LOG_FATAL("还未初始化信道管理模块！");
                 abort();
             }
             if (!_mysql_client)
             {
-                LOG_ERROR("还未初始化Mysql数据库模块！");
+                LOG_FATAL("还未初始化Mysql数据库模块！");
+                abort();
+            }
+            if (!_seq_allocator)
+            {
+                LOG_FATAL("还未初始化Redis消息序号分配模块！");
+                abort();
+            }
+            if (!_db_executor)
+            {
+                LOG_FATAL("还未初始化数据库异步执行模块！");
                 abort();
             }
             _rpc_server = std::make_shared<brpc::Server>();
             TransmitServiceImpl *transmite_service = new TransmitServiceImpl(
-                _mysql_client, _exchange_name, _routing_key, _mq_client, _mm_channels, _user_service_name);
+                _mysql_router, _exchange_name, _routing_key, _mq_client, _mm_channels, _user_service_name,
+                _seq_allocator, _db_executor);
             int ret = _rpc_server->AddService(transmite_service, brpc::ServiceOwnership::SERVER_OWNS_SERVICE);
             if (ret == -1)
             {
-                LOG_ERROR("添加Rpc服务失败！");
+                LOG_FATAL("添加Rpc服务失败！");
+                abort();
+            }
+            if (trace::add_service(*_rpc_server) == false)
+            {
+                LOG_FATAL("添加追踪查看服务失败！");
                 abort();
             }
             brpc::ServerOptions options;
@@ -206,7 +269,7 @@ namespace lbk
             ret = _rpc_server->Start(port, &options);
             if (ret == -1)
             {
-                LOG_ERROR("服务启动失败！");
+                LOG_FATAL("服务启动失败！");
                 abort();
             }
         }
@@ -214,17 +277,17 @@ namespace lbk
         {
             if (!_discover_client)
             {
-                LOG_ERROR("还未初始化服务发现模块！");
+                LOG_FATAL("还未初始化服务发现模块！");
                 abort();
             }
             if (!_registry_client)
             {
-                LOG_ERROR("还未初始化服务注册模块！");
+                LOG_FATAL("还未初始化服务注册模块！");
                 abort();
             }
             if (!_rpc_server)
             {
-                LOG_ERROR("还未初始化RPC服务器模块！");
+                LOG_FATAL("还未初始化RPC服务器模块！");
                 abort();
             }
             TransmiteServer::ptr server = std::make_shared<TransmiteServer>(
@@ -240,6 +303,12 @@ namespace lbk
 
         // mysql数据库客户端
         std::shared_ptr<odb::core::database> _mysql_client;
+        DBRouter::ptr _mysql_router;
+        DBExecutor::ptr _db_executor;
+
+        // redis客户端与消息序号分配器
+        std::shared_ptr<sw::redis::Redis> _redis_client;
+        SeqAllocator::ptr _seq_allocator;
 
         // 消息队列客户端句柄
         std::string _exchange_name;
@@ -8,12 +8,16 @@
 
 #include "etcd.hpp"    //服务注册模块封装
 #include "logger.hpp"  //日志模块封装
+#include "trace_service.hpp" // 请求追踪
 #include "utils.hpp"   // 基础工具接口
 #include "channel.hpp" // 信道管理模块封装
 #include "mysql.hpp"
 #include "mysql_user.hpp" // mysql数据管理客户端封装
+#include "db_executor.hpp" // 数据库异步执行线程池
 #include "data_es.hpp"    // es数据管理客户端封装
 #include "data_redis.hpp" // redis数据管理客户端封装
+#include "data_cache.hpp" // 用户信息多级缓存封装
+#include "rabbitmq.hpp"   // 用户资料变更广播
 
 #include "user.hxx"
 #include "user-odb.hxx"
@@ -28,16 +32,26 @@ namespace lbk
     class UserServiceImpl : public lbk::UserService
     {
     public:
-        UserServiceImpl(const std::shared_ptr<elasticlient::Client> &es_client,
-                        const std::shared_ptr<odb::core::database> &mysql_client,
+        UserServiceImpl(const ESClient::ptr &es_client,
+                        const ESBulkWriter::ptr &es_bulk,
+                        const DBRouter::ptr &mysql_router,
+                        const DBExecutor::ptr &db_executor,
                         const std::shared_ptr<sw::redis::Redis> &redis_client,
+                        const UserCache::ptr &user_cache,
                         const ServiceManager::ptr &mm_channels,
-                        const std::string &file_service_name)
-            : _es_user(std::make_shared<ESUser>(es_client)),
-              _mysql_user(std::make_shared<UserTable>(mysql_client)),
+                        const std::string &file_service_name,
+                        int session_ttl_sec = 0,
+                        const MQClient::ptr &mq_client = MQClient::ptr(),
+                        const std::string &user_exchange = "")
+            : _es_user(std::make_shared<ESUser>(es_client, es_bulk)),
+              _mysql_user(std::make_shared<UserTable>(mysql_router)),
+              _db_executor(db_executor),
+              _user_cache(user_cache),
               _redis_session(std::make_shared<Session>(redis_client)),
               _redis_status(std::make_shared<Status>(redis_client)),
-              _mm_channels(mm_channels), _file_service_name(file_service_name)
+              _session_ttl(session_ttl_sec),
+              _mm_channels(mm_channels), _file_service_name(file_service_name),
+              _mq_client(mq_client), _user_exchange(user_exchange)
         {
             // 创建好es客户端后立马创建索引，因为创建索引需要时间较长，如果后续立马查询可能因为索引没有创建好而查询不到
             _es_user->createIndex();
@@ -73,6 +87,7 @@ namespace lbk
         {
             LOG_DEBUG("收到用户注册请求！");
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "UserService.UserRegister");
             response->set_request_id(request->request_id());
             // 定义一个错误处理函数，当出错时调用该函数
             auto err_response = [this, &response](const std::string &err_msg)
@@ -98,23 +113,23 @@ namespace lbk
                 return err_response("密码格式不合法！");
             }
             // 4. 根据昵称在数据库进行判断是否昵称已存在
-            auto user = _mysql_user->select_by_nickname(nickname);
+            auto user = _db_executor->async(_mysql_user, &UserTable::select_by_nickname, nickname).get();
             if (user)
             {
                 LOG_ERROR("{} - 用户名被占用 - {}！", request->request_id(), nickname);
                 return err_response("用户名被占用!");
             }
             // 5. 向数据库新增数据
-            std::string uid = uuid();
+            std::string uid = sid();
             user = std::make_shared<User>(uid, nickname, password);
-            ret = _mysql_user->insert(user);
+            ret = _db_executor->async(_mysql_user, &UserTable::insert, user).get();
             if (ret == false)
             {
                 LOG_ERROR("{} - Mysql数据库新增数据失败！", request->request_id());
                 return err_response("Mysql数据库新增数据失败!");
             }
             // 6. 向 ES 服务器中新增用户信息
-            ret = _es_user->appendData(uid, "", nickname, "", ""); 
+            ret = _index_user(uid, "", nickname, "", "", user->version());
             if (ret == false)
             {
                 LOG_ERROR("{} - ES搜索引擎新增数据失败！", request->request_id());
@@ -130,6 +145,7 @@ namespace lbk
         {
             LOG_DEBUG("收到用户登录请求！");
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "UserService.UserLogin");
             response->set_request_id(request->request_id());
             // 定义一个错误处理函数，当出错时调用该函数
             auto err_response = [this, &response](const std::string &err_msg)
@@ -141,25 +157,21 @@ namespace lbk
             const std::string nickname = request->nickname();
             const std::string password = request->password();
             // 2. 通过昵称获取用户信息，进行密码是否一致的判断
-            auto user = _mysql_user->select_by_nickname(nickname);
+            auto user = _db_executor->async(_mysql_user, &UserTable::select_by_nickname, nickname).get();
             if (!user || password != user->password())
             {
                 LOG_ERROR("{} - 用户名或密码错误 - {}-{}！", request->request_id(), nickname, password);
                 return err_response("用户名或密码错误!");
             }
-            // 3. 根据 redis 中的登录标记信息是否存在判断用户是否已经登录
-            bool ret = _redis_status->exists(request->request_id());
-            if (ret)
+            // 3. 构造会话 ID，在 redis 中原子地检查登录标记并添加会话信息以及登录标记信息
+            std::string ssid = uuid();
+            bool ret = _redis_session->create(ssid, user->user_id(), _session_ttl);
+            if (ret == false)
             {
                 LOG_ERROR("{} - 用户已在其他地方登录 - {}！", request->request_id(), nickname);
                 return err_response("用户已在其他地方登录!");
             }
-            // 4. 构造会话 ID，生成会话键值对，向 redis 中添加会话信息以及登录标记信息
-            std::string ssid = uuid();
-            _redis_session->append(ssid, request->request_id());
-            // 5. 添加用户登录信息
-            _redis_status->append(request->request_id());
-            // 6. 组织响应，返回生成的会话 ID
+            // 4. 组织响应，返回生成的会话 ID
             response->set_success(true);
             response->set_login_session_id(ssid);
         }
@@ -192,6 +204,7 @@ namespace lbk
         {
             LOG_DEBUG("收到手机号注册请求！");
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "UserService.PhoneRegister");
             response->set_request_id(request->request_id());
             // 定义一个错误处理函数，当出错时调用该函数
             auto err_response = [this, &response](const std::string &err_msg)
@@ -210,23 +223,23 @@ namespace lbk
                 return err_response("手机号码格式错误!");
             }
             // 3. 通过数据库查询判断手机号是否已经注册过
-            auto user = _mysql_user->select_by_phone(phone_number);
+            auto user = _db_executor->async(_mysql_user, &UserTable::select_by_phone, phone_number).get();
             if (user)
             {
                 LOG_ERROR("{} - 该手机号已注册过用户 - {}！", request->request_id(), phone_number);
                 return err_response("该手机号已注册过用户!");
             }
             // 5. 向数据库新增用户信息
-            std::string uid = uuid();
+            std::string uid = sid();
             user = std::make_shared<User>(uid, phone_number, password, uid);
-            ret = _mysql_user->insert(user);
+            ret = _db_executor->async(_mysql_user, &UserTable::insert, user).get();
             if (ret == false)
             {
                 LOG_ERROR("{} - 向数据库添加用户信息失败 - {}！", request->request_id(), phone_number);
                 return err_response("向数据库添加用户信息失败!");
             }
             // 6. 向 ES 服务器中新增用户信息
-            ret = _es_user->appendData(uid, phone_number, uid, "", "");
+            ret = _index_user(uid, phone_number, uid, "", "", user->version());
             if (ret == false)
             {
                 LOG_ERROR("{} - ES搜索引擎新增数据失败！", request->request_id());
@@ -242,6 +255,7 @@ namespace lbk
         {
             LOG_DEBUG("收到手机号登录请求！");
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "UserService.PhoneLogin");
             response->set_request_id(request->request_id());
             // 定义一个错误处理函数，当出错时调用该函数
             auto err_response = [this, &response](const std::string &err_msg)
@@ -260,25 +274,21 @@ namespace lbk
                 return err_response("手机号码格式错误!");
             }
             // 3. 根据手机号从数据数据进行用户信息查询，判断用用户是否存在
-            auto user = _mysql_user->select_by_phone(phone_number);
+            auto user = _db_executor->async(_mysql_user, &UserTable::select_by_phone, phone_number).get();
             if (!user || password != user->password())
             {
                 LOG_ERROR("{} - 该手机号未注册用户或密码错误 - {}-{}！", request->request_id(), phone_number, password);
                 return err_response("该手机号未注册用户或密码错误!");
             }
-            // 4. 根据 redis 中的登录标记信息是否存在判断用户是否已经登录
-            ret = _redis_status->exists(request->request_id());
-            if (ret == true)
+            // 4. 构造会话 ID，在 redis 中原子地检查登录标记并添加会话信息以及登录标记信息
+            std::string ssid = uuid();
+            ret = _redis_session->create(ssid, user->user_id(), _session_ttl);
+            if (ret == false)
             {
                 LOG_ERROR("{} - 用户已在其他地方登录 - {}！", request->request_id(), phone_number);
                 return err_response("用户已在其他地方登录!");
             }
-            // 5. 构造会话 ID，生成会话键值对，向 redis 中添加会话信息以及登录标记信息
-            std::string ssid = uuid();
-            _redis_session->append(ssid, request->request_id());
-            // 6. 添加用户登录信息
-            _redis_status->append(request->request_id());
-            // 7. 组织响应，返回生成的会话 ID
+            // 5. 组织响应，返回生成的会话 ID
             response->set_success(true);
             response->set_login_session_id(ssid);
         }
@@ -290,6 +300,7 @@ namespace lbk
         {
             LOG_DEBUG("收到获取单个用户信息请求！");
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "UserService.GetUserInfo");
             response->set_request_id(request->request_id());
             // 定义一个错误处理函数，当出错时调用该函数
             auto err_response = [this, &response](const std::string &err_msg)
@@ -299,8 +310,8 @@ namespace lbk
             };
             // 1. 从请求中取出用户 ID
             std::string uid = request->user_id();
-            // 2. 通过用户 ID，从数据库中查询用户信息
-            auto user = _mysql_user->select_by_id(uid);
+            // 2. 通过用户 ID，从缓存/数据库中查询用户信息
+            auto user = _user_cache->select_by_id(uid);
             if (!user)
             {
                 LOG_ERROR("{} - 未找到用户信息 - {}！", request->request_id(), uid);
@@ -327,7 +338,10 @@ namespace lbk
                 req.set_request_id(request->request_id());
                 req.set_file_id(user->avatar_id());
                 brpc::Controller cntl;
+                trace::Span call_span("FileService.GetSingleFile", "rpc");
+                call_span.inject(cntl);
                 file_stub.GetSingleFile(&cntl, &req, &rsp, nullptr);
+                call_span.finish(!cntl.Failed());
                 if (cntl.Failed() || !rsp.success())
                 {
                     LOG_ERROR("{} - 文件子服务调用失败：{}！", request->request_id(), cntl.ErrorText());
@@ -345,6 +359,7 @@ namespace lbk
         {
             LOG_DEBUG("收到批量用户信息获取请求!");
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "UserService.GetMultiUserInfo");
             response->set_request_id(request->request_id());
             // 定义一个错误处理函数，当出错时调用该函数
             auto err_response = [this, &response](const std::string &err_msg)
@@ -352,17 +367,19 @@ namespace lbk
                 response->set_success(false);
                 response->set_errmsg(err_msg);
             };
-            // 1. 从请求中取出用户ID --- 列表
+            // 1. 从请求中取出用户ID --- 列表，重复的用户ID只保留一个
             std::vector<std::string> uid_list;
+            std::unordered_set<std::string> uid_set;
             for (int i = 0; i < request->users_id_size(); i++)
             {
-                uid_list.push_back(request->users_id(i));
+                if (uid_set.insert(request->users_id(i)).second)
+                    uid_list.push_back(request->users_id(i));
             }
-            // 2. 从数据库进行批量用户信息查询
-            auto users = _mysql_user->select_multi_users(uid_list);
-            if (users.size() != request->users_id_size())
+            // 2. 从缓存/数据库进行批量用户信息查询
+            auto users = _user_cache->select_multi_users(uid_list);
+            if (users.size() != uid_list.size())
             {
-                LOG_ERROR("{} - 从数据库查找的用户信息数量不一致 {}-{}！", request->request_id(), request->users_id_size(), users.size());
+                LOG_ERROR("{} - 从数据库查找的用户信息数量不一致 {}-{}！", request->request_id(), uid_list.size(), users.size());
                 return err_response("从数据库查找的用户信息数量不一致!");
             }
             // 3. 批量从文件管理子服务进行文件下载
@@ -382,7 +399,10 @@ namespace lbk
                     req.add_file_id_list(user.avatar_id());
             }
             brpc::Controller cntl;
+            trace::Span call_span("FileService.GetMultiFile", "rpc");
+            call_span.inject(cntl);
             file_stub.GetMultiFile(&cntl, &req, &rsp, nullptr);
+            call_span.finish(!cntl.Failed());
             if (cntl.Failed() || !rsp.success())
             {
                 LOG_ERROR("{} - 文件子服务调用失败：{}！", request->request_id(), cntl.ErrorText());
@@ -411,6 +431,7 @@ namespace lbk
         {
             LOG_DEBUG("收到用户头像设置请求！");
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "UserService.SetUserAvatar");
             response->set_request_id(request->request_id());
             // 定义一个错误处理函数，当出错时调用该函数
             auto err_response = [this, &response](const std::string &err_msg)
@@ -421,7 +442,7 @@ namespace lbk
             // 1. 从请求中取出用户 ID
             std::string uid = request->user_id();
             // 2. 从数据库通过用户 ID 进行用户信息查询，判断用户是否存在
-            auto user = _mysql_user->select_by_id(uid);
+            auto user = _db_executor->async(_mysql_user, &UserTable::select_by_id, uid).get();
             if (!user)
             {
                 LOG_ERROR("{} - 未找到用户信息 - {}！", request->request_id(), uid);
@@ -442,18 +463,30 @@ namespace lbk
             req.mutable_file_data()->set_file_size(request->avatar().size());
             req.mutable_file_data()->set_file_content(request->avatar());
             brpc::Controller cntl;
+            trace::Span call_span("FileService.PutSingleFile", "rpc");
+            call_span.inject(cntl);
             file_stub.PutSingleFile(&cntl, &req, &rsp, nullptr);
+            call_span.finish(!cntl.Failed());
             if (cntl.Failed() || !rsp.success())
             {
                 LOG_ERROR("{} - 文件子服务调用失败：{}！", request->request_id(), cntl.ErrorText());
                 return err_response("文件子服务调用失败!");
             }
-            // 4. 将返回的头像文件 ID 更新到数据库中
-            user->avatar_id(rsp.file_info().file_id());
-            _mysql_user->update(user);
+            // 4. 将返回的头像文件 ID 更新到数据库中，在主库上加锁读取最新数据后修改
+            std::string avatar_id = rsp.file_info().file_id();
+            user = _db_executor->submit([&]()
+                                        { return _mysql_user->modify(uid, [&avatar_id](User &u)
+                                                                     { u.avatar_id(avatar_id); }); })
+                       .get();
+            if (!user)
+            {
+                LOG_ERROR("{} - 更新数据库用户头像ID失败 ：{}！", request->request_id(), avatar_id);
+                return err_response("更新数据库用户头像ID失败!");
+            }
+            _user_cache->invalidate(uid);
             // 5. 更新 ES 服务器中用户信息
-            bool ret = _es_user->appendData(user->user_id(), user->phone(), user->nickname(),
-                                            user->description(), user->avatar_id());
+            bool ret = _index_user(user->user_id(), user->phone(), user->nickname(),
+                                   user->description(), user->avatar_id(), user->version());
             if (ret == false)
             {
                 LOG_ERROR("{} - 更新搜索引擎用户头像ID失败 ：{}！", request->request_id(), user->avatar_id());
@@ -469,6 +502,7 @@ namespace lbk
         {
             LOG_DEBUG("收到用户昵称设置请求！");
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "UserService.SetUserNickname");
             response->set_request_id(request->request_id());
             // 定义一个错误处理函数，当出错时调用该函数
             auto err_response = [this, &response](const std::string &err_msg)
@@ -486,30 +520,26 @@ namespace lbk
                 LOG_ERROR("{} - 用户名长度不合法！", request->request_id());
                 return err_response("用户名长度不合法！");
             }
-            // 3. 从数据库通过用户 ID 进行用户信息查询，判断用户是否存在
-            auto user = _mysql_user->select_by_id(uid);
+            // 3. 在主库上加锁读取用户信息，将新的昵称更新到数据库中
+            auto user = _db_executor->submit([&]()
+                                             { return _mysql_user->modify(uid, [&new_nickname](User &u)
+                                                                          { u.nickname(new_nickname); }); })
+                            .get();
             if (!user)
-            {
-                LOG_ERROR("{} - 未找到用户信息 - {}！", request->request_id(), uid);
-                return err_response("未找到用户信息!");
-            }
-            // 4. 将新的昵称更新到数据库中
-            user->nickname(new_nickname);
-            ret = _mysql_user->update(user);
-            if (ret == false)
             {
                 LOG_ERROR("{} - 更新数据库用户昵称失败 ：{}！", request->request_id(), new_nickname);
                 return err_response("更新数据库用户昵称失败!");
             }
-            // 5. 更新 ES 服务器中用户信息
-            ret = _es_user->appendData(user->user_id(), user->phone(), user->nickname(),
-                                       user->description(), user->avatar_id());
+            _user_cache->invalidate(uid);
+            // 4. 更新 ES 服务器中用户信息
+            ret = _index_user(user->user_id(), user->phone(), user->nickname(),
+                              user->description(), user->avatar_id(), user->version());
             if (ret == false)
             {
                 LOG_ERROR("{} - 更新搜索引擎用户昵称失败 ：{}！", request->request_id(), new_nickname);
                 return err_response("更新搜索引擎用户昵称失败!");
             }
-            // 6. 组织响应，返回更新成功与否
+            // 5. 组织响应，返回更新成功与否
             response->set_success(true);
         }
         virtual void SetUserDescription(::google::protobuf::RpcController *controller,
@@ -519,6 +549,7 @@ namespace lbk
         {
             LOG_DEBUG("收到用户签名设置请求！");
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "UserService.SetUserDescription");
             response->set_request_id(request->request_id());
             // 定义一个错误处理函数，当出错时调用该函数
             auto err_response = [this, &response](const std::string &err_msg)
@@ -529,30 +560,26 @@ namespace lbk
             // 1. 从请求中取出用户 ID 与新的签名
             std::string uid = request->user_id();
             std::string new_description = request->description();
-            // 2. 从数据库通过用户 ID 进行用户信息查询，判断用户是否存在
-            auto user = _mysql_user->select_by_id(uid);
+            // 2. 在主库上加锁读取用户信息，将新的签名更新到数据库中
+            auto user = _db_executor->submit([&]()
+                                             { return _mysql_user->modify(uid, [&new_description](User &u)
+                                                                          { u.description(new_description); }); })
+                            .get();
             if (!user)
-            {
-                LOG_ERROR("{} - 未找到用户信息 - {}！", request->request_id(), uid);
-                return err_response("未找到用户信息!");
-            }
-            // 3. 将新的昵称更新到数据库中
-            user->description(new_description);
-            bool ret = _mysql_user->update(user);
-            if (ret == false)
             {
                 LOG_ERROR("{} - 更新数据库用户签名失败 ：{}！", request->request_id(), new_description);
                 return err_response("更新数据库用户签名失败!");
             }
-            // 4. 更新 ES 服务器中用户信息
-            ret = _es_user->appendData(user->user_id(), user->phone(), user->nickname(),
-                                       user->description(), user->avatar_id());
+            _user_cache->invalidate(uid);
+            // 3. 更新 ES 服务器中用户信息
+            bool ret = _index_user(user->user_id(), user->phone(), user->nickname(),
+                                   user->description(), user->avatar_id(), user->version());
             if (ret == false)
             {
                 LOG_ERROR("{} - 更新搜索引擎用户签名失败 ：{}！", request->request_id(), new_description);
                 return err_response("更新搜索引擎用户签名失败!");
             }
-            // 5. 组织响应，返回更新成功与否
+            // 4. 组织响应，返回更新成功与否
             response->set_success(true);
         }
         virtual void SetUserPhoneNumber(::google::protobuf::RpcController *controller,
@@ -562,6 +589,7 @@ namespace lbk
         {
             LOG_DEBUG("收到用户手机号设置请求！");
             brpc::ClosureGuard rpc_guard(done);
+            trace::Span span(controller, request->request_id(), "UserService.SetUserPhoneNumber");
             response->set_request_id(request->request_id());
             // 定义一个错误处理函数，当出错时调用该函数
             auto err_response = [this, &response](const std::string &err_msg)
@@ -572,41 +600,62 @@ namespace lbk
             // 1. 从请求中取出用户 ID 与手机号
             std::string uid = request->user_id();
             std::string new_phone_number = request->phone_number();
-            // 2. 从数据库通过用户 ID 进行用户信息查询，判断用户是否存在
-            auto user = _mysql_user->select_by_id(uid);
+            // 2. 在主库上加锁读取用户信息，将新的手机号更新到数据库中
+            auto user = _db_executor->submit([&]()
+                                             { return _mysql_user->modify(uid, [&new_phone_number](User &u)
+                                                                          { u.phone(new_phone_number); }); })
+                            .get();
             if (!user)
-            {
-                LOG_ERROR("{} - 未找到用户信息 - {}！", request->request_id(), uid);
-                return err_response("未找到用户信息!");
-            }
-            // 4. 将新的手机号更新到数据库中
-            user->phone(new_phone_number);
-            bool ret = _mysql_user->update(user);
-            if (ret == false)
             {
                 LOG_ERROR("{} - 更新数据库用户手机号失败 ：{}！", request->request_id(), new_phone_number);
                 return err_response("更新数据库用户手机号失败!");
             }
-            // 5. 更新 ES 服务器中用户信息
-            ret = _es_user->appendData(user->user_id(), user->phone(), user->nickname(),
-                                       user->description(), user->avatar_id());
+            _user_cache->invalidate(uid);
+            // 3. 更新 ES 服务器中用户信息
+            bool ret = _index_user(user->user_id(), user->phone(), user->nickname(),
+                                   user->description(), user->avatar_id(), user->version());
             if (ret == false)
             {
                 LOG_ERROR("{} - 更新搜索引擎用户手机号失败 ：{}！", request->request_id(), new_phone_number);
                 return err_response("更新搜索引擎用户手机号失败!");
             }
-            // 6. 组织响应，返回更新成功与否
+            // 4. 组织响应，返回更新成功与否
             response->set_success(true);
         }
 
+    private:
+        // 用户资料写入ES，并广播给好友子服务；广播失败只记录日志，不影响本次请求
+        bool _index_user(const std::string &uid, const std::string &phone, const std::string &nickname,
+                         const std::string &description, const std::string &avatar_id, int64_t version)
+        {
+            if (_es_user->appendData(uid, phone, nickname, description, avatar_id, version) == false)
+                return false;
+            if (_mq_client)
+            {
+                UserInfo info;
+                info.set_user_id(uid);
+                info.set_phone(phone);
+                info.set_nickname(nickname);
+                if (_mq_client->publish(_user_exchange, info.SerializeAsString()) == false)
+                    LOG_WARN("用户资料变更广播失败：{}", uid);
+            }
+            return true;
+        }
+
     private:
         ESUser::ptr _es_user;
-        UserTable::ptr _mysql_user;
+        UserTable::ptr _mysql_user; // 修改用户信息时直接读写数据库
+        DBExecutor::ptr _db_executor; // 数据库读写投递到独立线程执行，不占用brpc的worker线程
+        UserCache::ptr _user_cache; // 用户信息展示类查询走缓存
         Session::ptr _redis_session;
         Status::ptr _redis_status;
+        std::chrono::seconds _session_ttl; // 登录会话的过期时间，0表示不过期
         // rpc调用文件存储子服务相关对象
         ServiceManager::ptr _mm_channels;
         std::string _file_service_name;
+        // 用户资料变更广播，好友子服务据此增量更新本地用户检索索引
+        MQClient::ptr _mq_client;
+        std::string _user_exchange;
     };
 
     // 使用建造者模式实现UserServer
@@ -619,7 +668,7 @@ namespace lbk
             const Registry::ptr &registry_client,
             const std::shared_ptr<odb::core::database> &mysql_client,
             const std::shared_ptr<sw::redis::Redis> &redis_client,
-            const std::shared_ptr<elasticlient::Client> &es_client,
+            const ESClient::ptr &es_client,
             const std::shared_ptr<brpc::Server> &rpc_server)
             : _discover_client(discover_client), _registry_client(_registry_client),
               _mysql_client(mysql_client), _redis_client(redis_client), _es_client(es_client),
@@ -637,17 +686,38 @@ namespace lbk
         Registry::ptr _registry_client;
         std::shared_ptr<odb::core::database> _mysql_client;
         std::shared_ptr<sw::redis::Redis> _redis_client;
-        std::shared_ptr<elasticlient::Client> _es_client;
+        ESClient::ptr _es_client;
         std::shared_ptr<brpc::Server> _rpc_server;
     };
 
     class UserServerBuilder
     {
     public:
-        // 构造es客户端对象
-        void make_es_object(const std::vector<std::string> &host_list)
+        // 构造es客户端对象，并检查/创建用户索引；按新映射重建索引使用es_reindex_tool离线执行
+        void make_es_object(const std::vector<std::string> &host_list,
+                            const ESIndexSettings &settings = ESIndexSettings())
         {
             _es_client = ESClientFactory::create(host_list);
+            if (!_es_client)
+            {
+                LOG_FATAL("初始化ES搜索引擎客户端失败！");
+                abort();
+            }
+            _es_settings = settings;
+            ESUser es(_es_client, ESBulkWriter::ptr(), settings);
+            bool ret = es.createIndex();
+            if (ret == false)
+                LOG_ERROR("用户索引初始化失败，检索功能可能不可用！");
+        }
+        // 构造ES批量写入器：max_docs/max_bytes/flush_interval_ms任一达到即发送一批，capacity为排队文档上限
+        void make_es_bulk_object(size_t max_docs, size_t max_bytes, int flush_interval_ms, size_t capacity)
+        {
+            if (!_es_client)
+            {
+                LOG_FATAL("还未初始化ES搜索引擎模块！");
+                abort();
+            }
+            _es_bulk = std::make_shared<ESBulkWriter>(_es_client, max_docs, max_bytes, flush_interval_ms, capacity);
         }
         // 构造mysql客户端对象
         void make_mysql_object(const std::string &user,
@@ -656,14 +726,52 @@ namespace lbk
                                const std::string &db,
                                const std::string &cset,
                                int port,
-                               int conn_pool_count)
+                               int conn_pool_count,
+                               const std::string &replicas = "",
+                               int max_lag_ms = 1000,
+                               int conn_pool_min = 0)
         {
-            _mysql_client = ODBFactory::create(user, password, host, db, cset, port, conn_pool_count);
+            // 连接池：conn_pool_min小于最大数量时在两者之间按排队情况自适应伸缩，否则为固定大小
+            PoolOptions pool;
+            pool.max_size = conn_pool_count;
+            pool.min_size = conn_pool_min > 0 && conn_pool_min < conn_pool_count ? conn_pool_min : conn_pool_count;
+            _mysql_client = ODBFactory::create(user, password, host, db, cset, port, pool);
+            // 读写分离：replicas为逗号分隔的从库 host:port 列表，为空时所有读写都走主库
+            auto replica_list = ODBFactory::create_replicas(user, password, replicas, db, cset, pool);
+            _mysql_router = std::make_shared<DBRouter>(_mysql_client, replica_list, max_lag_ms);
+            _mysql_router->start(std::chrono::milliseconds(1000));
+        }
+        // 构造数据库异步执行线程池，threads为执行线程数量，max_pending为排队任务上限
+        void make_executor_object(size_t threads, size_t max_pending)
+        {
+            _db_executor = std::make_shared<DBExecutor>(threads, max_pending);
         }
         // 构造redis客户端对象
-        void make_redis_object(const std::string &host, int port, int db, bool keep_alive)
+        void make_redis_object(const std::string &host, int port, int db, bool keep_alive,
+                               size_t pool_size = 1, int session_ttl_sec = 0)
         {
-            _redis_client = RedisClientFactory::create(host, port, db, keep_alive);
+            _redis_client = RedisClientFactory::create(host, port, db, keep_alive, pool_size);
+            _session_ttl_sec = session_ttl_sec;
+        }
+        // 构造用户信息缓存对象，依赖mysql与redis客户端
+        void make_cache_object(size_t local_capacity, int local_ttl_ms, int redis_ttl_sec)
+        {
+            if (!_mysql_client || !_redis_client)
+            {
+                LOG_FATAL("构造用户信息缓存前需要先初始化Mysql与Redis模块！");
+                abort();
+            }
+            _user_cache = std::make_shared<UserCache>(std::make_shared<UserTable>(_mysql_router), _redis_client,
+                                                      local_capacity, std::chrono::milliseconds(local_ttl_ms),
+                                                      std::chrono::seconds(redis_ttl_sec));
+        }
+        // 构造用户资料变更广播对象：声明fanout交换机，每个好友子服务实例各自绑定一个队列
+        void make_mq_object(const std::string &user, const std::string &password, const std::string &host,
+                            const std::string &exchange)
+        {
+            _user_exchange = exchange;
+            _mq_client = std::make_shared<MQClient>(user, password, host);
+            _mq_client->declareExchange(exchange, AMQP::ExchangeType::fanout);
         }
         // 用于构造服务发现客户端&信道管理对象
         void make_discovery_object(const std::string &reg_host, const std::string &base_service_name, const std::string &file_service_name)
@@ -689,30 +797,47 @@ namespace lbk
         {
             if (!_es_client)
             {
-                LOG_ERROR("还未初始化ES搜索引擎模块！");
+                LOG_FATAL("还未初始化ES搜索引擎模块！");
                 abort();
             }
             if (!_mysql_client)
             {
-                LOG_ERROR("还未初始化Mysql数据库模块！");
+                LOG_FATAL("还未初始化Mysql数据库模块！");
+                abort();
+            }
+            if (!_db_executor)
+            {
+                LOG_FATAL("还未初始化数据库异步执行模块！");
                 abort();
             }
             if (!_redis_client)
             {
-                LOG_ERROR("还未初始化Redis数据库模块！");
+                LOG_FATAL("还未初始化Redis数据库模块！");
+                abort();
+            }
+            if (!_user_cache)
+            {
+                LOG_FATAL("还未初始化用户信息缓存模块！");
                 abort();
             }
             if (!_mm_channels)
             {
-                LOG_ERROR("还未初始化信道管理模块！");
+                LOG_FATAL("还未初始化信道管理模块！");
                 abort();
             }
             _rpc_server = std::make_shared<brpc::Server>();
-            UserServiceImpl *user_service = new UserServiceImpl(_es_client, _mysql_client, _redis_client, _mm_channels, _file_service_name);
+            UserServiceImpl *user_service = new UserServiceImpl(_es_client, _es_bulk, _mysql_router, _db_executor, _redis_client, _user_cache,
+                                                            _mm_channels, _file_service_name, _session_ttl_sec,
+                                                            _mq_client, _user_exchange);
             int ret = _rpc_server->AddService(user_service, brpc::ServiceOwnership::SERVER_OWNS_SERVICE);
             if (ret == -1)
             {
-                LOG_ERROR("添加Rpc服务失败！");
+                LOG_FATAL("添加Rpc服务失败！");
+                abort();
+            }
+            if (trace::add_service(*_rpc_server) == false)
+            {
+                LOG_FATAL("添加追踪查看服务失败！");
                 abort();
             }
             brpc::ServerOptions options;
@@ -721,7 +846,7 @@ namespace lbk
             ret = _rpc_server->Start(port, &options);
             if (ret == -1)
             {
-                LOG_ERROR("服务启动失败！");
+                LOG_FATAL("服务启动失败！");
                 abort();
             }
         }
@@ -729,17 +854,17 @@ namespace lbk
         {
             if (!_discover_client)
             {
-                LOG_ERROR("还未初始化服务发现模块！");
+                LOG_FATAL("还未初始化服务发现模块！");
                 abort();
             }
             if (!_registry_client)
             {
-                LOG_ERROR("还未初始化服务注册模块！");
+                LOG_FATAL("还未初始化服务注册模块！");
                 abort();
             }
             if (!_rpc_server)
             {
-                LOG_ERROR("还未初始化RPC服务器模块！");
+                LOG_FATAL("还未初始化RPC服务器模块！");
                 abort();
             }
             UserServer::ptr server = std::make_shared<UserServer>(_discover_client, _registry_client,
@@ -754,8 +879,16 @@ namespace lbk
 
         Registry::ptr _registry_client;
         std::shared_ptr<odb::core::database> _mysql_client;
+        DBRouter::ptr _mysql_router;
+        DBExecutor::ptr _db_executor;
         std::shared_ptr<sw::redis::Redis> _redis_client;
-        std::shared_ptr<elasticlient::Client> _es_client;
+        ESClient::ptr _es_client;
+        ESBulkWriter::ptr _es_bulk;
+        ESIndexSettings _es_settings;
+        UserCache::ptr _user_cache;
+        int _session_ttl_sec = 0;
+        MQClient::ptr _mq_client;
+        std::string _user_exchange;
         std::shared_ptr<brpc::Server> _rpc_server;
     };
 }
\ No newline at end of file
@@ -16,8 +16,8 @@ int main(int argc, char *argv[])
     auto es_client = lbk::ESClientFactory::create({FLAGS_es_host});
     auto es_user = std::make_shared<lbk::ESUser>(es_client);
     es_user->createIndex();
-    es_user->appendData("用户ID1", "手机号1", "小猪佩奇", "这是一只小猪", "小猪头像1");
-    es_user->appendData("用户ID2", "手机号2", "小猪乔治", "这是一只小小猪", "小猪头像2");
+    es_user->appendData("用户ID1", "手机号1", "小猪佩奇", "这是一只小猪", "小猪头像1", 1);
+    es_user->appendData("用户ID2", "手机号2", "小猪乔治", "这是一只小小猪", "小猪头像2", 1);
     std::this_thread::sleep_for(std::chrono::seconds(2));
     auto res = es_user->search("小猪", {"用户ID1"});
     for (auto &u : res)
@@ -12,7 +12,8 @@ CREATE TABLE `user` (
   `description` TEXT NULL,
   `password` varchar(64) NULL,
   `phone` varchar(64) NULL,
-  `avatar_id` varchar(64) NULL)
+  `avatar_id` varchar(64) NULL,
+  `version` BIGINT NOT NULL DEFAULT 0)
  ENGINE=InnoDB;
 
 CREATE UNIQUE INDEX `user_id_i`
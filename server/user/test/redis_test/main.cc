@@ -38,6 +38,35 @@ void status_test(const std::shared_ptr<sw::redis::Redis> &client) {
     if (status.exists("用户ID1")) std::cout << "用户1在线！" << std::endl;
     if (status.exists("用户ID2")) std::cout << "用户2在线！" << std::endl;
     if (status.exists("用户ID3")) std::cout << "用户3在线！" << std::endl;
+
+    auto online = status.exists_many({"用户ID1", "用户ID2", "用户ID3"});
+    for (size_t i = 0; i < online.size(); i++)
+        std::cout << "批量查询 用户" << i + 1 << (online[i] ? "在线！" : "不在线！") << std::endl;
+    status.remove_many({"用户ID1", "用户ID3"});
+}
+
+void login_test(const std::shared_ptr<sw::redis::Redis> &client) {
+    lbk::Session ss(client);
+    if (ss.create("会话ID5", "用户ID5", std::chrono::seconds(2))) std::cout << "用户5登录成功！" << std::endl;
+    if (!ss.create("会话ID6", "用户ID5", std::chrono::seconds(2))) std::cout << "用户5重复登录被拒绝！" << std::endl;
+    auto uids = ss.uids({"会话ID5", "会话ID6"});
+    for (auto &it : uids) std::cout << it.first << " -> " << it.second << std::endl;
+    std::this_thread::sleep_for(std::chrono::seconds(3));
+    if (!ss.uid("会话ID5")) std::cout << "会话ID5已过期" << std::endl;
+}
+
+void presence_test(const std::shared_ptr<sw::redis::Redis> &client) {
+    lbk::Presence presence(client, std::chrono::seconds(2), 4);
+    presence.online("用户ID7", "网关1");
+    presence.online("用户ID8", "网关2");
+    presence.heartbeat({"用户ID7"}, "网关1");
+    auto res = presence.online_among({"用户ID7", "用户ID8", "用户ID9"});
+    for (auto &it : res) std::cout << it.first << " 在线于 " << it.second << std::endl;
+    std::cout << "在线人数：" << presence.online_count() << std::endl;
+    presence.offline("用户ID8");
+    std::this_thread::sleep_for(std::chrono::seconds(3));
+    if (!presence.is_online("用户ID7")) std::cout << "用户7心跳超时已下线" << std::endl;
+    std::cout << "清理过期在线索引：" << presence.sweep() << std::endl;
 }
 
 void code_test(const std::shared_ptr<sw::redis::Redis> &client) {
@@ -72,6 +101,8 @@ int main(int argc, char *argv[])
 
     session_test(client);
     status_test(client);
+    login_test(client);
+    presence_test(client);
     code_test(client);
     return 0;
 }
@@ -0,0 +1,81 @@
+#include "../../../common/utils.hpp"
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+DEFINE_bool(run_mode, false, "程序的运行模式，false-调试； true-发布；");
+DEFINE_string(log_file, "", "发布模式下，用于指定日志的输出文件");
+DEFINE_int32(log_level, 0, "发布模式下，用于指定日志输出等级");
+
+DEFINE_int32(threads, 8, "并发生成ID的线程数量");
+DEFINE_int32(count, 100000, "每个线程生成的ID数量");
+
+TEST(雪花ID测试, 多线程唯一且单线程内递增)
+{
+    std::mutex mutex;
+    std::unordered_set<uint64_t> ids;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < FLAGS_threads; i++)
+    {
+        threads.emplace_back([&]()
+                             {
+            std::vector<uint64_t> local;
+            uint64_t last = 0;
+            for (int j = 0; j < FLAGS_count; j++)
+            {
+                uint64_t id = lbk::Snowflake::next();
+                ASSERT_GT(id, last);
+                last = id;
+                local.push_back(id);
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            ids.insert(local.begin(), local.end()); });
+    }
+    for (auto &t : threads)
+        t.join();
+    ASSERT_EQ(ids.size(), (size_t)FLAGS_threads * FLAGS_count);
+}
+
+TEST(雪花ID测试, 时钟回拨)
+{
+    uint64_t now = lbk::Snowflake::timestamp_ms(lbk::Snowflake::next()) - lbk::Snowflake::EPOCH_MS + 1000;
+    uint64_t before = lbk::Snowflake::next(now);
+    // 时钟回拨10秒，生成的ID仍然递增
+    uint64_t last = before;
+    for (int i = 0; i < 10000; i++)
+    {
+        uint64_t id = lbk::Snowflake::next(now - 10000);
+        ASSERT_GT(id, last);
+        last = id;
+    }
+    // 时钟恢复后继续递增
+    ASSERT_GT(lbk::Snowflake::next(now + 1), last);
+}
+
+TEST(雪花ID测试, 编码解码)
+{
+    uint64_t id = lbk::Snowflake::next();
+    uint64_t ret = 0;
+    ASSERT_TRUE(lbk::Snowflake::decode(lbk::Snowflake::encode(id), ret));
+    ASSERT_EQ(id, ret);
+    ASSERT_LT(lbk::Snowflake::encode(id), lbk::Snowflake::encode(lbk::Snowflake::next()));
+}
+
+TEST(雪花ID测试, 未指定节点编号)
+{
+    ASSERT_DEATH(lbk::Snowflake::init(-1), "");
+    ASSERT_DEATH(lbk::Snowflake::init(lbk::Snowflake::MAX_NODE + 1), "");
+}
+
+int main(int argc, char *argv[])
+{
+    testing::InitGoogleTest(&argc, argv);
+    testing::FLAGS_gtest_death_test_style = "threadsafe";
+    google::ParseCommandLineFlags(&argc, &argv, true);
+    lbk::init_logger(FLAGS_run_mode, FLAGS_log_file, FLAGS_log_level);
+    lbk::Snowflake::init(1);
+    return RUN_ALL_TESTS();
+}